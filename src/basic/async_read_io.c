@@ -6,12 +6,21 @@
 
 #include <pthread.h>
 
+// Inputs are shared by all readers, each takes the next input when it
+// finishes one
+typedef struct
+{
+  const AsyncIOReadInput *tasks;
+  size_t num_tasks, next_task, num_running;
+} AsyncIOQueue;
+
 struct AsyncIOWorker
 {
   pthread_t thread;
   MsgPool *const pool;
-  AsyncIOReadInput task;
-  size_t *const num_running;
+  AsyncIOQueue *const queue;
+  const AsyncIOReadInput *task; // current input
+  uint64_t nreads; // reads passed from current input
 };
 
 
@@ -96,11 +105,11 @@ void asynciodata_pool_init(void *el, size_t idx, void *args)
 
 // No memory allocated for io worker
 static void async_io_worker_init(AsyncIOWorker *wrkr,
-                                 const AsyncIOReadInput *task,
-                                 MsgPool *pool, size_t *num_running)
+                                 MsgPool *pool, AsyncIOQueue *queue)
 {
   ctx_assert(pool->elsize == sizeof(AsyncIOData*));
-  AsyncIOWorker tmp = {.pool = pool, .task = *task, .num_running = num_running};
+  AsyncIOWorker tmp = {.pool = pool, .queue = queue, .task = NULL,
+                        .nreads = 0};
   memcpy(wrkr, &tmp, sizeof(AsyncIOWorker));
 }
 
@@ -119,7 +128,8 @@ static void add_to_pool(read_t *r1, read_t *r2,
 
   data->fq_offset1 = fq_offset1;
   data->fq_offset2 = fq_offset2;
-  data->ptr = wrkr->task.ptr;
+  data->ptr = wrkr->task->ptr;
+  data->readid = wrkr->nreads++;
 
   SWAP(data->r1, *r1);
 
@@ -134,41 +144,46 @@ static void* async_io_reader(void *ptr) __attribute__((noreturn));
 static void* async_io_reader(void *ptr)
 {
   AsyncIOWorker *wrkr = (AsyncIOWorker*)ptr;
-  AsyncIOReadInput *task = &wrkr->task;
+  AsyncIOQueue *queue = wrkr->queue;
+  const AsyncIOReadInput *task;
+  size_t i;
 
   read_t r1, r2;
   seq_read_alloc(&r1);
   seq_read_alloc(&r2);
 
-  if(task->interleaved)
+  // Take inputs off the queue until there are none left
+  while((i = __sync_fetch_and_add(&queue->next_task, 1)) < queue->num_tasks)
   {
-    seq_parse_interleaved_sf(task->file1, task->fq_offset,
-                             &r1, &r2, add_to_pool, wrkr);
-  } else {
-    seq_parse_pe_sf(task->file1, task->file2, task->fq_offset,
-                    &r1, &r2, add_to_pool, wrkr);
+    task = wrkr->task = &queue->tasks[i];
+    wrkr->nreads = 0;
+
+    if(task->interleaved)
+    {
+      seq_parse_interleaved_sf(task->file1, task->fq_offset,
+                               &r1, &r2, add_to_pool, wrkr);
+    } else {
+      seq_parse_pe_sf(task->file1, task->file2, task->fq_offset,
+                      &r1, &r2, add_to_pool, wrkr);
+    }
   }
 
   seq_read_dealloc(&r1);
   seq_read_dealloc(&r2);
 
   // Check if we are the last thread to finish, if so close the pool
-  size_t n = __sync_sub_and_fetch((volatile size_t*)wrkr->num_running, 1);
-
-  if(n == 0) {
-    msgpool_close(wrkr->pool);
-    ctx_free(wrkr->num_running);
-  }
+  size_t n = __sync_sub_and_fetch((volatile size_t*)&queue->num_running, 1);
+  if(n == 0) msgpool_close(wrkr->pool);
 
   pthread_exit(NULL);
 }
 
 // Start loading into a pool
-// returns an array of AsyncIOWorker of length len_files, each is a running
-// thread putting reading into the pool passed.
+// returns an array of `num_readers` AsyncIOWorkers, each is a running
+// thread putting reads into the pool passed. Readers take inputs in order.
 static AsyncIOWorker* asyncio_read_start(MsgPool *pool,
                                          const AsyncIOReadInput *tasks,
-                                         size_t num_tasks)
+                                         size_t num_tasks, size_t num_readers)
 {
   if(num_tasks == 0) return NULL;
 
@@ -177,24 +192,27 @@ static AsyncIOWorker* asyncio_read_start(MsgPool *pool,
 
   // Initiate all reads in the pool
   ctx_assert(pool->elsize == sizeof(AsyncIOData*));
+  ctx_assert(num_readers > 0 && num_readers <= num_tasks);
 
   // Create workers
-  AsyncIOWorker *workers = ctx_malloc(num_tasks * sizeof(AsyncIOWorker));
+  AsyncIOWorker *workers = ctx_malloc(num_readers * sizeof(AsyncIOWorker));
 
   // Keep a counter of how many threads are still running
   // last thread to finish closes the pool
-  size_t *num_running = ctx_malloc(sizeof(size_t));
-  *num_running = num_tasks;
+  AsyncIOQueue *queue = ctx_malloc(sizeof(AsyncIOQueue));
+  AsyncIOQueue tmpq = {.tasks = tasks, .num_tasks = num_tasks,
+                       .next_task = 0, .num_running = num_readers};
+  memcpy(queue, &tmpq, sizeof(AsyncIOQueue));
 
-  for(i = 0; i < num_tasks; i++)
-    async_io_worker_init(&workers[i], &tasks[i], pool, num_running);
+  for(i = 0; i < num_readers; i++)
+    async_io_worker_init(&workers[i], pool, queue);
 
   // Start threads
   pthread_attr_t thread_attr;
   pthread_attr_init(&thread_attr);
   pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_JOINABLE);
 
-  for(i = 0; i < num_tasks; i++) {
+  for(i = 0; i < num_readers; i++) {
     rc = pthread_create(&workers[i].thread, &thread_attr,
                         async_io_reader, (void*)&workers[i]);
     if(rc != 0) die("Creating thread failed: %s", strerror(rc));
@@ -223,27 +241,42 @@ static void asyncio_read_finish(AsyncIOWorker *workers, size_t num_workers)
   msgpool_wait_til_empty(pool);
   ctx_assert(pool->num_full == 0);
 
+  ctx_free(workers[0].queue);
   ctx_free(workers);
 }
 
-void asyncio_run_threads(MsgPool *pool,
-                         AsyncIOReadInput *asyncio_tasks, size_t num_inputs,
-                         void (*job)(void*),
-                         void *args, size_t num_readers, size_t elsize)
+void asyncio_run_queued(MsgPool *pool,
+                        AsyncIOReadInput *asyncio_tasks, size_t num_inputs,
+                        size_t max_io_threads,
+                        void (*job)(void*),
+                        void *args, size_t num_readers, size_t elsize)
 {
   if(!num_inputs) return;
   ctx_assert(num_readers > 0);
+  ctx_assert(max_io_threads > 0);
+
+  size_t num_io = MIN2(num_inputs, max_io_threads);
 
-  status("[asyncio] Inputs: %zu; Threads: %zu", num_inputs, num_readers);
+  status("[asyncio] Inputs: %zu; IO threads: %zu; Threads: %zu",
+         num_inputs, num_io, num_readers);
 
   // Start async io reading
   AsyncIOWorker *asyncio_workers;
-  asyncio_workers = asyncio_read_start(pool, asyncio_tasks, num_inputs);
+  asyncio_workers = asyncio_read_start(pool, asyncio_tasks, num_inputs, num_io);
 
   util_run_threads(args, num_readers, elsize, num_readers, job);
 
   // Finish with the async io (waits until queue is empty)
-  asyncio_read_finish(asyncio_workers, num_inputs);
+  asyncio_read_finish(asyncio_workers, num_io);
+}
+
+void asyncio_run_threads(MsgPool *pool,
+                         AsyncIOReadInput *asyncio_tasks, size_t num_inputs,
+                         void (*job)(void*),
+                         void *args, size_t num_readers, size_t elsize)
+{
+  asyncio_run_queued(pool, asyncio_tasks, num_inputs, num_inputs,
+                     job, args, num_readers, elsize);
 }
 
 // Guess numer of kmers
@@ -18,6 +18,7 @@ typedef struct
 {
   read_t r1, r2;
   void *ptr;
+  uint64_t readid; // index of read (pair) in its input, starting at 0
   uint8_t fq_offset1, fq_offset2;
 } AsyncIOData;
 
@@ -45,11 +46,23 @@ typedef struct AsyncIOWorker AsyncIOWorker;
 void asynciodata_pool_init(void *el, size_t idx, void *args);
 void asynciodata_pool_destroy(void *el, size_t idx, void *args);
 
+// Read all inputs at once (one IO thread per input) into `pool`, while running
+// `num_readers` threads of `job`
 void asyncio_run_threads(MsgPool *pool,
                          AsyncIOReadInput *asyncio_tasks, size_t num_inputs,
                          void (*job)(void*),
                          void *args, size_t num_readers, size_t elsize);
 
+// As asyncio_run_threads() but with at most `max_io_threads` IO threads.
+// Inputs are taken in order from a shared queue: an IO thread starts on the
+// next input as soon as it finishes one, so there is no barrier between inputs.
+// Each read carries its input's `ptr` in AsyncIOData.
+void asyncio_run_queued(MsgPool *pool,
+                        AsyncIOReadInput *asyncio_tasks, size_t num_inputs,
+                        size_t max_io_threads,
+                        void (*job)(void*),
+                        void *args, size_t num_readers, size_t elsize);
+
 // Guess numer of kmers
 size_t asyncio_input_nkmers(const AsyncIOReadInput *io);
 
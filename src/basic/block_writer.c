@@ -0,0 +1,389 @@
+#include "global.h"
+#include "block_writer.h"
+
+// Initial number of out-of-order records held in ordered mode
+#define BLOCK_WRITER_RING 4096
+
+struct BlockWriterBlock
+{
+  StrBuf data; // uncompressed
+  uint8_t *out; // compressed
+  size_t outlen, outcap;
+  uint64_t id;
+  bool ready; // ready to be written
+};
+
+// Compress a block as a single gzip member. Called without lock held.
+static void _block_compress(const BlockWriter *bw, BlockWriterBlock *blk)
+{
+  z_stream strm;
+  memset(&strm, 0, sizeof(strm));
+
+  // 15+16 => gzip header and footer
+  if(deflateInit2(&strm, bw->level, Z_DEFLATED, 15+16, 8,
+                  Z_DEFAULT_STRATEGY) != Z_OK) {
+    die("Cannot initialise zlib: %s", bw->path);
+  }
+
+  size_t bound = deflateBound(&strm, blk->data.len);
+  if(blk->outcap < bound) {
+    blk->outcap = bound;
+    blk->out = ctx_realloc(blk->out, blk->outcap);
+  }
+
+  strm.next_in = (Bytef*)blk->data.buff;
+  strm.avail_in = blk->data.len;
+  strm.next_out = blk->out;
+  strm.avail_out = blk->outcap;
+
+  if(deflate(&strm, Z_FINISH) != Z_STREAM_END)
+    die("Compression failed: %s", bw->path);
+
+  blk->outlen = strm.total_out;
+  deflateEnd(&strm);
+}
+
+//
+// Functions below are called with bw->lock held
+//
+
+// Wait until a block is free
+static BlockWriterBlock* _block_get_free(BlockWriter *bw)
+{
+  while(bw->nfree == 0) pthread_cond_wait(&bw->cond, &bw->lock);
+  BlockWriterBlock *blk = bw->free[--bw->nfree];
+  strbuf_reset(&blk->data);
+  blk->ready = false;
+  return blk;
+}
+
+// Queue a block to be written
+static void _block_queue_only(BlockWriter *bw, BlockWriterBlock *blk)
+{
+  blk->id = bw->next_id++;
+  blk->ready = !bw->gzip;
+  bw->queued[blk->id % bw->nblocks] = blk;
+  pthread_cond_broadcast(&bw->cond);
+}
+
+// If there are no helper threads, compress the next queued block now,
+// releasing the lock while we do so
+static void _block_compress_next(BlockWriter *bw)
+{
+  if(bw->gzip && bw->nthreads == 0 && bw->next_compress < bw->next_id) {
+    BlockWriterBlock *blk = bw->queued[bw->next_compress++ % bw->nblocks];
+    pthread_mutex_unlock(&bw->lock);
+    _block_compress(bw, blk);
+    pthread_mutex_lock(&bw->lock);
+    blk->ready = true;
+    pthread_cond_broadcast(&bw->cond);
+  }
+}
+
+// Queue a block to be written and compress it if there are no helper threads
+static void _block_queue(BlockWriter *bw, BlockWriterBlock *blk)
+{
+  _block_queue_only(bw, blk);
+  _block_compress_next(bw);
+}
+
+//
+// Threads
+//
+
+static void* _compress_thread(void *ptr)
+{
+  BlockWriter *bw = (BlockWriter*)ptr;
+  BlockWriterBlock *blk;
+
+  pthread_mutex_lock(&bw->lock);
+
+  while(1)
+  {
+    if(bw->next_compress < bw->next_id) {
+      blk = bw->queued[bw->next_compress++ % bw->nblocks];
+      pthread_mutex_unlock(&bw->lock);
+      _block_compress(bw, blk);
+      pthread_mutex_lock(&bw->lock);
+      blk->ready = true;
+      pthread_cond_broadcast(&bw->cond);
+    }
+    else if(bw->closing) break;
+    else pthread_cond_wait(&bw->cond, &bw->lock);
+  }
+
+  pthread_mutex_unlock(&bw->lock);
+  return NULL;
+}
+
+// Write blocks in the order they were queued
+static void* _writer_thread(void *ptr)
+{
+  BlockWriter *bw = (BlockWriter*)ptr;
+  BlockWriterBlock *blk = NULL;
+  const uint8_t *data;
+  size_t len;
+
+  pthread_mutex_lock(&bw->lock);
+
+  while(1)
+  {
+    if(bw->next_write < bw->next_id)
+      blk = bw->queued[bw->next_write % bw->nblocks];
+
+    if(bw->next_write < bw->next_id && blk->ready)
+    {
+      pthread_mutex_unlock(&bw->lock);
+
+      data = bw->gzip ? blk->out : (const uint8_t*)blk->data.buff;
+      len = bw->gzip ? blk->outlen : blk->data.len;
+      if(fwrite(data, 1, len, bw->fh) != len)
+        die("Cannot write to file: %s [%s]", bw->path, strerror(errno));
+
+      pthread_mutex_lock(&bw->lock);
+      bw->queued[bw->next_write % bw->nblocks] = NULL;
+      bw->free[bw->nfree++] = blk;
+      bw->next_write++;
+      pthread_cond_broadcast(&bw->cond);
+    }
+    else if(bw->closing && bw->next_write == bw->next_id) break;
+    else pthread_cond_wait(&bw->cond, &bw->lock);
+  }
+
+  pthread_mutex_unlock(&bw->lock);
+  return NULL;
+}
+
+void block_writer_open(BlockWriter *bw, FILE *fh, const char *path,
+                       bool gzip, bool ordered,
+                       size_t nproducers, size_t nthreads)
+{
+  size_t i;
+  int rc;
+
+  if(ordered) nproducers = 0;
+  if(!gzip) nthreads = 0;
+
+  // Each producer holds one block, each helper thread compresses one block
+  // while another waits to be written
+  size_t nblocks = nproducers + 2*nthreads + 4;
+
+  BlockWriter tmp = {.fh = fh, .path = path,
+                     .gzip = gzip, .ordered = ordered,
+                     .level = Z_DEFAULT_COMPRESSION,
+                     .nproducers = nproducers, .nthreads = nthreads,
+                     .nblocks = nblocks, .nfree = nblocks,
+                     .next_id = 0, .next_compress = 0, .next_write = 0,
+                     .ring = NULL, .ring_set = NULL, .ring_cap = 0,
+                     .next_seq = 0, .obuf = NULL, .oflushing = false,
+                     .closing = false};
+
+  memcpy(bw, &tmp, sizeof(BlockWriter));
+
+  bw->blocks = ctx_calloc(nblocks, sizeof(BlockWriterBlock));
+  bw->free = ctx_calloc(nblocks, sizeof(BlockWriterBlock*));
+  bw->queued = ctx_calloc(nblocks, sizeof(BlockWriterBlock*));
+  bw->bufs = ctx_calloc(nproducers+1, sizeof(BlockWriterBlock*));
+
+  for(i = 0; i < nblocks; i++) {
+    strbuf_alloc(&bw->blocks[i].data, 1024);
+    bw->free[i] = &bw->blocks[i];
+  }
+
+  if(pthread_mutex_init(&bw->lock, NULL) != 0) die("Mutex init failed");
+  if(pthread_cond_init(&bw->cond, NULL) != 0) die("Cond init failed");
+
+  pthread_mutex_lock(&bw->lock);
+  for(i = 0; i < nproducers; i++) bw->bufs[i] = _block_get_free(bw);
+  pthread_mutex_unlock(&bw->lock);
+
+  if(ordered) {
+    bw->ring_cap = BLOCK_WRITER_RING;
+    bw->ring = ctx_calloc(bw->ring_cap, sizeof(StrBuf));
+    bw->ring_set = ctx_calloc(bw->ring_cap, sizeof(uint8_t));
+    pthread_mutex_lock(&bw->lock);
+    bw->obuf = _block_get_free(bw);
+    pthread_mutex_unlock(&bw->lock);
+  }
+
+  // Start threads
+  bw->threads = ctx_calloc(nthreads+1, sizeof(pthread_t));
+
+  for(i = 0; i < nthreads; i++) {
+    rc = pthread_create(&bw->threads[i], NULL, _compress_thread, bw);
+    if(rc != 0) die("Creating thread failed: %s", strerror(rc));
+  }
+
+  rc = pthread_create(&bw->writer, NULL, _writer_thread, bw);
+  if(rc != 0) die("Creating thread failed: %s", strerror(rc));
+}
+
+void block_writer_close(BlockWriter *bw)
+{
+  size_t i;
+  int rc;
+
+  pthread_mutex_lock(&bw->lock);
+
+  for(i = 0; i < bw->nproducers; i++)
+    if(bw->bufs[i]->data.len > 0) _block_queue(bw, bw->bufs[i]);
+
+  if(bw->ordered) {
+    for(i = 0; i < bw->ring_cap; i++) ctx_assert(!bw->ring_set[i]);
+    if(bw->obuf->data.len > 0) _block_queue(bw, bw->obuf);
+  }
+
+  bw->closing = true;
+  pthread_cond_broadcast(&bw->cond);
+  pthread_mutex_unlock(&bw->lock);
+
+  for(i = 0; i < bw->nthreads; i++) {
+    rc = pthread_join(bw->threads[i], NULL);
+    if(rc != 0) die("Joining thread failed: %s", strerror(rc));
+  }
+
+  rc = pthread_join(bw->writer, NULL);
+  if(rc != 0) die("Joining thread failed: %s", strerror(rc));
+
+  pthread_mutex_destroy(&bw->lock);
+  pthread_cond_destroy(&bw->cond);
+
+  for(i = 0; i < bw->nblocks; i++) {
+    strbuf_dealloc(&bw->blocks[i].data);
+    ctx_free(bw->blocks[i].out);
+  }
+
+  for(i = 0; i < bw->ring_cap; i++)
+    if(bw->ring[i].buff != NULL) strbuf_dealloc(&bw->ring[i]);
+
+  ctx_free(bw->blocks);
+  ctx_free(bw->free);
+  ctx_free(bw->queued);
+  ctx_free(bw->bufs);
+  ctx_free(bw->threads);
+  ctx_free(bw->ring);
+  ctx_free(bw->ring_set);
+  memset(bw, 0, sizeof(BlockWriter));
+}
+
+bool block_writer_append(BlockWriter *bw, size_t id, const char *str, size_t len)
+{
+  ctx_assert(!bw->ordered);
+  ctx_assert(id < bw->nproducers);
+  StrBuf *buf = &bw->bufs[id]->data;
+  strbuf_append_strn(buf, str, len);
+  return (buf->len >= BLOCK_WRITER_SIZE);
+}
+
+void block_writer_flush(BlockWriter *bw, size_t id)
+{
+  ctx_assert(!bw->ordered);
+  ctx_assert(id < bw->nproducers);
+  if(bw->bufs[id]->data.len == 0) return;
+
+  pthread_mutex_lock(&bw->lock);
+  _block_queue(bw, bw->bufs[id]);
+  bw->bufs[id] = _block_get_free(bw);
+  pthread_mutex_unlock(&bw->lock);
+}
+
+void block_writer_queue(BlockWriter *bw, size_t id)
+{
+  ctx_assert(!bw->ordered);
+  ctx_assert(id < bw->nproducers);
+  if(bw->bufs[id]->data.len == 0) return;
+
+  pthread_mutex_lock(&bw->lock);
+  _block_queue_only(bw, bw->bufs[id]);
+  bw->bufs[id] = _block_get_free(bw);
+  pthread_mutex_unlock(&bw->lock);
+}
+
+void block_writer_compress(BlockWriter *bw)
+{
+  pthread_mutex_lock(&bw->lock);
+  _block_compress_next(bw);
+  pthread_mutex_unlock(&bw->lock);
+}
+
+void block_writer_write(BlockWriter *bw, size_t id, const char *str, size_t len)
+{
+  if(block_writer_append(bw, id, str, len)) block_writer_flush(bw, id);
+}
+
+//
+// Ordered mode
+//
+
+// Double the number of records we can hold out of order
+static void _ring_grow(BlockWriter *bw)
+{
+  size_t i, oldcap = bw->ring_cap, newcap = oldcap * 2;
+  StrBuf *ring = ctx_calloc(newcap, sizeof(StrBuf));
+  uint8_t *ring_set = ctx_calloc(newcap, sizeof(uint8_t));
+  uint64_t s;
+
+  for(i = 0; i < oldcap; i++) {
+    s = bw->next_seq + i;
+    ring[s % newcap] = bw->ring[s % oldcap];
+    ring_set[s % newcap] = bw->ring_set[s % oldcap];
+  }
+
+  ctx_free(bw->ring);
+  ctx_free(bw->ring_set);
+  bw->ring = ring;
+  bw->ring_set = ring_set;
+  bw->ring_cap = newcap;
+}
+
+// Append the next record in order to the shared block
+static void _ordered_append(BlockWriter *bw, const char *str, size_t len)
+{
+  strbuf_append_strn(&bw->obuf->data, str, len);
+  bw->next_seq++;
+
+  // Only one thread swaps out the full block. Records added by other threads
+  // while we wait for a free block are appended to the full block, in order.
+  if(bw->obuf->data.len >= BLOCK_WRITER_SIZE && !bw->oflushing) {
+    bw->oflushing = true;
+    BlockWriterBlock *full = bw->obuf, *blk = _block_get_free(bw);
+    bw->obuf = blk;
+    _block_queue(bw, full);
+    bw->oflushing = false;
+  }
+}
+
+void block_writer_write_seq(BlockWriter *bw, uint64_t seqn,
+                            const char *str, size_t len)
+{
+  ctx_assert(bw->ordered);
+
+  size_t idx;
+
+  pthread_mutex_lock(&bw->lock);
+  ctx_assert2(seqn >= bw->next_seq, "%zu < %zu",
+              (size_t)seqn, (size_t)bw->next_seq);
+
+  if(seqn == bw->next_seq)
+  {
+    _ordered_append(bw, str, len);
+
+    // Add any records that were waiting for this one
+    while(bw->ring_set[idx = bw->next_seq % bw->ring_cap]) {
+      bw->ring_set[idx] = 0;
+      _ordered_append(bw, bw->ring[idx].buff, bw->ring[idx].len);
+    }
+  }
+  else
+  {
+    while(seqn >= bw->next_seq + bw->ring_cap) _ring_grow(bw);
+    idx = seqn % bw->ring_cap;
+    ctx_assert(!bw->ring_set[idx]);
+    if(bw->ring[idx].buff == NULL) strbuf_alloc(&bw->ring[idx], len+1);
+    strbuf_reset(&bw->ring[idx]);
+    strbuf_append_strn(&bw->ring[idx], str, len);
+    bw->ring_set[idx] = 1;
+  }
+
+  pthread_mutex_unlock(&bw->lock);
+}
@@ -0,0 +1,84 @@
+#ifndef BLOCK_WRITER_H_
+#define BLOCK_WRITER_H_
+
+//
+// Multithreaded buffered output
+//
+// Each producer thread appends text to its own block. Full blocks are queued
+// with an increasing id, optionally compressed as independent gzip members,
+// then written out in id order by a writer thread. Concatenated gzip members
+// are a valid gzip file, so output can be read with zcat / gzread().
+//
+// Compression is done by `nthreads` helper threads, or if `nthreads` is zero,
+// by the producer that filled the block, outside of any lock.
+//
+// Ordered mode: records are passed with a sequence number (0,1,2,...) instead
+// of a producer id. Records are collected in sequence order into one shared
+// block, so output order matches input order. Every sequence number must be
+// passed exactly once (pass an empty record to skip one).
+//
+
+#define BLOCK_WRITER_SIZE (1<<20) // bytes per block before compression
+
+typedef struct BlockWriterBlock BlockWriterBlock;
+
+typedef struct
+{
+  FILE *fh;
+  const char *path;
+  bool gzip, ordered;
+  int level;
+
+  size_t nproducers, nthreads;
+  BlockWriterBlock *blocks; // pool of blocks
+  BlockWriterBlock **free, **queued, **bufs;
+  size_t nblocks, nfree;
+  uint64_t next_id, next_compress, next_write;
+
+  // ordered mode
+  StrBuf *ring;
+  uint8_t *ring_set;
+  size_t ring_cap;
+  uint64_t next_seq;
+  BlockWriterBlock *obuf;
+  bool oflushing; // a thread is swapping out a full obuf
+
+  bool closing;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  pthread_t writer, *threads;
+} BlockWriter;
+
+// `fh` is not closed by block_writer_close(). `path` is used for error messages
+// `nproducers` is the number of producer ids (0..nproducers-1) that will call
+// block_writer_write(); it is ignored in ordered mode
+void block_writer_open(BlockWriter *bw, FILE *fh, const char *path,
+                       bool gzip, bool ordered,
+                       size_t nproducers, size_t nthreads);
+
+// Write out all remaining data, stop threads and free memory
+void block_writer_close(BlockWriter *bw);
+
+// Unordered: append to producer `id`'s buffer, queued once full
+void block_writer_write(BlockWriter *bw, size_t id, const char *str, size_t len);
+
+// Unordered: append to producer `id`'s buffer without queuing it
+// Returns true if the buffer is full and should be passed to
+// block_writer_flush(). Use to keep blocks of paired files in step.
+bool block_writer_append(BlockWriter *bw, size_t id, const char *str, size_t len);
+
+// Queue producer `id`'s buffer now, even if not full
+void block_writer_flush(BlockWriter *bw, size_t id);
+
+// block_writer_flush() in two steps, so that a caller can queue blocks of
+// several writers under its own lock and compress them after releasing it.
+// block_writer_queue() does not compress; if nthreads is zero, follow it with
+// block_writer_compress(), which compresses the next queued block.
+void block_writer_queue(BlockWriter *bw, size_t id);
+void block_writer_compress(BlockWriter *bw);
+
+// Ordered: add record number `seqn`
+void block_writer_write_seq(BlockWriter *bw, uint64_t seqn,
+                            const char *str, size_t len);
+
+#endif /* BLOCK_WRITER_H_ */
@@ -0,0 +1,128 @@
+#include "global.h"
+#include "file_prefetch.h"
+
+#include <fcntl.h> // posix_fadvise()
+
+static void* fprefetch_reader(void *ptr)
+{
+  FilePrefetch *pf = (FilePrefetch*)ptr;
+  size_t idx, len;
+
+  while(1)
+  {
+    // Wait for a free buffer
+    pthread_mutex_lock(&pf->lock);
+    while(!pf->stop && pf->nfilled - pf->nused == FPREFETCH_NBUFS)
+      pthread_cond_wait(&pf->cond, &pf->lock);
+    bool stop = pf->stop;
+    pthread_mutex_unlock(&pf->lock);
+
+    if(stop) break;
+
+    // Read into buffer without holding the lock
+    idx = pf->nfilled % FPREFETCH_NBUFS;
+    len = MIN2(pf->bufsize, pf->remaining);
+    len = len ? fread(pf->bufs[idx], 1, len, pf->fh) : 0;
+    pf->remaining -= len;
+
+    pthread_mutex_lock(&pf->lock);
+    if(len == 0) {
+      pf->eof = true;
+      if(ferror(pf->fh)) pf->read_errno = errno ? errno : EIO;
+    }
+    else {
+      pf->lens[idx] = len;
+      pf->nfilled++;
+    }
+    pthread_cond_broadcast(&pf->cond);
+    pthread_mutex_unlock(&pf->lock);
+
+    if(len == 0) break;
+  }
+
+  pthread_exit(NULL);
+}
+
+void fprefetch_start(FilePrefetch *pf, FILE *fh, const char *path,
+                     size_t recsize, size_t limit)
+{
+  ctx_assert(recsize > 0 && recsize <= FPREFETCH_BUFSIZE);
+  size_t i;
+  int rc;
+
+  memset(pf, 0, sizeof(*pf));
+  pf->fh = fh;
+  pf->path = path;
+  pf->recsize = recsize;
+  pf->bufsize = (MIN2(FPREFETCH_BUFSIZE, limit) / recsize) * recsize;
+  pf->bufsize = MAX2(pf->bufsize, recsize);
+  pf->remaining = limit;
+
+  for(i = 0; i < FPREFETCH_NBUFS; i++)
+    pf->bufs[i] = ctx_malloc(pf->bufsize);
+
+  // Hint to the kernel that we're reading sequentially (fails on pipes)
+  posix_fadvise(fileno(fh), 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  if(pthread_mutex_init(&pf->lock, NULL) != 0) die("Mutex init failed");
+  if(pthread_cond_init(&pf->cond, NULL) != 0) die("Cond init failed");
+
+  rc = pthread_create(&pf->thread, NULL, fprefetch_reader, pf);
+  if(rc != 0) die("Creating thread failed: %s", strerror(rc));
+}
+
+size_t fprefetch_next(FilePrefetch *pf, const uint8_t **ptr)
+{
+  size_t idx, len;
+
+  pthread_mutex_lock(&pf->lock);
+
+  // Release the last slab we handed out
+  if(pf->holding) {
+    pf->nused++;
+    pf->holding = false;
+    pthread_cond_broadcast(&pf->cond);
+  }
+
+  while(pf->nfilled == pf->nused && !pf->eof)
+    pthread_cond_wait(&pf->cond, &pf->lock);
+
+  if(pf->nfilled == pf->nused) {
+    pthread_mutex_unlock(&pf->lock);
+    if(pf->read_errno) {
+      die("Error reading file: %s [path: %s]",
+          strerror(pf->read_errno), pf->path);
+    }
+    return 0;
+  }
+
+  idx = pf->nused % FPREFETCH_NBUFS;
+  len = pf->lens[idx];
+  pf->holding = true;
+  pthread_mutex_unlock(&pf->lock);
+
+  if(len % pf->recsize != 0) die("Unexpected end of file: %s", pf->path);
+
+  *ptr = pf->bufs[idx];
+  return len / pf->recsize;
+}
+
+void fprefetch_stop(FilePrefetch *pf)
+{
+  size_t i;
+  int rc;
+
+  pthread_mutex_lock(&pf->lock);
+  pf->stop = true;
+  pthread_cond_broadcast(&pf->cond);
+  pthread_mutex_unlock(&pf->lock);
+
+  rc = pthread_join(pf->thread, NULL);
+  if(rc != 0) die("Joining thread failed: %s", strerror(rc));
+
+  pthread_cond_destroy(&pf->cond);
+  pthread_mutex_destroy(&pf->lock);
+
+  for(i = 0; i < FPREFETCH_NBUFS; i++) ctx_free(pf->bufs[i]);
+  memset(pf, 0, sizeof(*pf));
+}
@@ -0,0 +1,63 @@
+#ifndef FILE_PREFETCH_H_
+#define FILE_PREFETCH_H_
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+//
+// Read fixed size records from a file in a background thread
+//
+// A ring of buffers is kept full by a reader thread whilst the caller
+// processes the records in the previous buffer. Each buffer (slab) holds a
+// whole number of records, so records can be used in place without copying.
+//
+// Example:
+//
+//   FilePrefetch pf;
+//   const uint8_t *rec;
+//   size_t i, n;
+//   fprefetch_start(&pf, fh, path, recsize, SIZE_MAX);
+//   while((n = fprefetch_next(&pf, &rec)) > 0)
+//     for(i = 0; i < n; i++, rec += recsize) { ... }
+//   fprefetch_stop(&pf);
+//
+
+// Number of buffers in the ring
+#define FPREFETCH_NBUFS 4
+// Size of each buffer (rounded down to a multiple of the record size)
+#define FPREFETCH_BUFSIZE (8UL<<20)
+
+typedef struct
+{
+  FILE *fh;
+  const char *path;
+  uint8_t *bufs[FPREFETCH_NBUFS];
+  size_t lens[FPREFETCH_NBUFS];
+  size_t bufsize, recsize;
+  size_t remaining; // bytes left to read
+  size_t nfilled, nused; // number of buffers filled / released
+  bool eof, holding, stop;
+  int read_errno;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} FilePrefetch;
+
+// Start reading records of `recsize` bytes from the current position in `fh`
+// Stops after `limit` bytes or at the end of the file (pass SIZE_MAX for no
+// limit). `path` is only used in error messages.
+void fprefetch_start(FilePrefetch *pf, FILE *fh, const char *path,
+                     size_t recsize, size_t limit);
+
+// Get the next slab of records. Previous slab is released and may no longer
+// be accessed. Returns number of records in slab, 0 when there are no more.
+// Calls die() if the file ends part way through a record.
+size_t fprefetch_next(FilePrefetch *pf, const uint8_t **ptr);
+
+// Stop reader thread and release memory. Can be called before all records
+// have been read, in which case the file position is undefined.
+void fprefetch_stop(FilePrefetch *pf);
+
+#endif /* FILE_PREFETCH_H_ */
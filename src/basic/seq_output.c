@@ -11,23 +11,39 @@ void seq_output_alloc(SeqOutput *out)
   strbuf_alloc(&out->path_se, 512);
   strbuf_alloc(&out->path_pe[0], 512);
   strbuf_alloc(&out->path_pe[1], 512);
-  out->gzout_se = out->gzout_pe[0] = out->gzout_pe[1] = NULL;
-  out->output_pe = false;
-  if(pthread_mutex_init(&out->lock_se, NULL) != 0) die("Mutex init failed");
+  out->fout_se = out->fout_pe[0] = out->fout_pe[1] = NULL;
+  out->output_pe = out->ordered = out->writing = false;
   if(pthread_mutex_init(&out->lock_pe, NULL) != 0) die("Mutex init failed");
 }
 
+// Flush buffered output and stop writer threads
+static void seq_output_stop(SeqOutput *out)
+{
+  if(!out->writing) return;
+  block_writer_close(&out->bw_se);
+  if(out->output_pe) {
+    block_writer_close(&out->bw_pe[0]);
+    block_writer_close(&out->bw_pe[1]);
+  }
+  out->writing = false;
+}
+
+static void seq_output_fclose(FILE *fh, const char *path)
+{
+  if(fclose(fh) != 0) warn("Error closing: %s [%s]", path, strerror(errno));
+}
+
 void seq_output_dealloc(SeqOutput *out)
 {
-  if(out->gzout_se) gzclose(out->gzout_se);
-  if(out->gzout_pe[0]) gzclose(out->gzout_pe[0]);
-  if(out->gzout_pe[1]) gzclose(out->gzout_pe[1]);
-  out->gzout_se = out->gzout_pe[0] = out->gzout_pe[1] = NULL;
+  seq_output_stop(out);
+  if(out->fout_se) seq_output_fclose(out->fout_se, out->path_se.buff);
+  if(out->fout_pe[0]) seq_output_fclose(out->fout_pe[0], out->path_pe[0].buff);
+  if(out->fout_pe[1]) seq_output_fclose(out->fout_pe[1], out->path_pe[1].buff);
+  out->fout_se = out->fout_pe[0] = out->fout_pe[1] = NULL;
   strbuf_dealloc(&out->path_se);
   strbuf_dealloc(&out->path_pe[0]);
   strbuf_dealloc(&out->path_pe[1]);
   out->output_pe = false;
-  pthread_mutex_destroy(&out->lock_se);
   pthread_mutex_destroy(&out->lock_pe);
 }
 
@@ -54,14 +70,16 @@ void seq_output_set_paths(SeqOutput *out, const char *base, bool pe)
 // Close and delete opened files
 void seq_output_delete(SeqOutput *out)
 {
-  #define test_and_delete(gz,pathbuf) do {                     \
-    if((gz) != NULL) { gzclose(gz); unlink((pathbuf)->buff); } \
+  seq_output_stop(out);
+
+  #define test_and_delete(fh,pathbuf) do {                     \
+    if((fh) != NULL) { fclose(fh); unlink((pathbuf)->buff); } \
   } while(0)
 
-  test_and_delete(out->gzout_se, &out->path_se);
-  test_and_delete(out->gzout_pe[0], &out->path_pe[0]);
-  test_and_delete(out->gzout_pe[1], &out->path_pe[1]);
-  out->gzout_se = out->gzout_pe[0] = out->gzout_pe[1] = NULL;
+  test_and_delete(out->fout_se, &out->path_se);
+  test_and_delete(out->fout_pe[0], &out->path_pe[0]);
+  test_and_delete(out->fout_pe[1], &out->path_pe[1]);
+  out->fout_se = out->fout_pe[0] = out->fout_pe[1] = NULL;
 
   #undef test_and_delete
 }
@@ -93,20 +111,20 @@ bool seq_output_files_exist_check(const SeqOutput *out)
 }
 
 // Returns true on success, false on error
-bool seq_output_open(SeqOutput *out)
+bool seq_output_open(SeqOutput *out, size_t nthreads, bool ordered)
 {
   size_t i;
 
-  out->gzout_se = gzopen(out->path_se.buff, "w");
-  if(out->gzout_se == NULL) {
+  out->fout_se = fopen(out->path_se.buff, "w");
+  if(out->fout_se == NULL) {
     warn("Cannot write to: %s", out->path_se.buff);
     return false;
   }
 
   if(out->output_pe) {
     for(i = 0; i < 2; i++) {
-      out->gzout_pe[i] = gzopen(out->path_pe[i].buff, "w");
-      if(out->gzout_pe[i] == NULL) {
+      out->fout_pe[i] = fopen(out->path_pe[i].buff, "w");
+      if(out->fout_pe[i] == NULL) {
         warn("Cannot write to: %s", out->path_pe[i].buff);
         seq_output_delete(out); // remove existing files
         return false;
@@ -114,5 +132,82 @@ bool seq_output_open(SeqOutput *out)
     }
   }
 
+  // Threads compress their own blocks, so no helper threads needed
+  block_writer_open(&out->bw_se, out->fout_se, out->path_se.buff,
+                    true, ordered, nthreads, 0);
+
+  if(out->output_pe) {
+    for(i = 0; i < 2; i++) {
+      block_writer_open(&out->bw_pe[i], out->fout_pe[i], out->path_pe[i].buff,
+                        true, ordered, nthreads, 0);
+    }
+  }
+
+  out->ordered = ordered;
+  out->writing = true;
   return true;
 }
+
+// In ordered mode every file gets every sequence number, with empty records
+// written to the files a read does not go to
+void seq_output_write_se(SeqOutput *out, size_t tid, uint64_t seqn,
+                         const StrBuf *buf)
+{
+  if(out->ordered) {
+    block_writer_write_seq(&out->bw_se, seqn, buf->buff, buf->len);
+    if(out->output_pe) {
+      block_writer_write_seq(&out->bw_pe[0], seqn, "", 0);
+      block_writer_write_seq(&out->bw_pe[1], seqn, "", 0);
+    }
+  }
+  else block_writer_write(&out->bw_se, tid, buf->buff, buf->len);
+}
+
+void seq_output_write_pe(SeqOutput *out, size_t tid, uint64_t seqn,
+                         const StrBuf *buf1, const StrBuf *buf2)
+{
+  ctx_assert(out->output_pe);
+
+  if(out->ordered) {
+    block_writer_write_seq(&out->bw_se, seqn, "", 0);
+    block_writer_write_seq(&out->bw_pe[0], seqn, buf1->buff, buf1->len);
+    block_writer_write_seq(&out->bw_pe[1], seqn, buf2->buff, buf2->len);
+  }
+  else {
+    // Mates must be in blocks with the same index in both files, so we queue
+    // both blocks together. Blocks are compressed once we release the lock.
+    BlockWriter *bw1 = &out->bw_pe[0], *bw2 = &out->bw_pe[1];
+    bool full1 = block_writer_append(bw1, tid, buf1->buff, buf1->len);
+    bool full2 = block_writer_append(bw2, tid, buf2->buff, buf2->len);
+    if(full1 || full2) {
+      pthread_mutex_lock(&out->lock_pe);
+      block_writer_queue(bw1, tid);
+      block_writer_queue(bw2, tid);
+      pthread_mutex_unlock(&out->lock_pe);
+      block_writer_compress(bw1);
+      block_writer_compress(bw2);
+    }
+  }
+}
+
+void seq_output_fasta(StrBuf *sbuf, const read_t *r)
+{
+  strbuf_append_char(sbuf, '>');
+  strbuf_append_strn(sbuf, r->name.b, r->name.end);
+  strbuf_append_char(sbuf, '\n');
+  strbuf_append_strn(sbuf, r->seq.b, r->seq.end);
+  strbuf_append_char(sbuf, '\n');
+}
+
+void seq_output_fastq(StrBuf *sbuf, const read_t *r)
+{
+  size_t i, qlen = MIN2(r->qual.end, r->seq.end);
+  strbuf_append_char(sbuf, '@');
+  strbuf_append_strn(sbuf, r->name.b, r->name.end);
+  strbuf_append_char(sbuf, '\n');
+  strbuf_append_strn(sbuf, r->seq.b, r->seq.end);
+  strbuf_append_str(sbuf, "\n+\n");
+  strbuf_append_strn(sbuf, r->qual.b, qlen);
+  for(i = qlen; i < r->seq.end; i++) strbuf_append_char(sbuf, '.');
+  strbuf_append_char(sbuf, '\n');
+}
@@ -1,6 +1,9 @@
 #ifndef SEQ_OUTPUT_H_
 #define SEQ_OUTPUT_H_
 
+#include "seq_file.h"
+#include "block_writer.h"
+
 //
 // FASTA output
 //
@@ -9,12 +12,18 @@
 //   <out>.1.fa.gz
 //   <out>.2.fa.gz
 //
+// Output is written through a BlockWriter per file: each thread fills its own
+// buffer which is compressed as a separate gzip member. If `ordered` is set,
+// reads are written in input order using their sequence number.
+//
 
 typedef struct {
   StrBuf path_se, path_pe[2];
-  gzFile gzout_se, gzout_pe[2];
-  pthread_mutex_t lock_se, lock_pe;
+  FILE *fout_se, *fout_pe[2];
+  BlockWriter bw_se, bw_pe[2];
+  pthread_mutex_t lock_pe; // keep blocks of paired files in step
   bool output_pe; // false => only one output file; true => three output files
+  bool ordered, writing;
 } SeqOutput;
 
 void seq_output_alloc(SeqOutput *out);
@@ -34,8 +43,24 @@ void seq_output_delete(SeqOutput *out);
 //  - false if no files already exist
 bool seq_output_files_exist_check(const SeqOutput *out);
 
+// `nthreads` is the number of threads that will write to the output, each
+// passing its own id (0..nthreads-1). If `ordered` is true, reads are written
+// in the order of their sequence number instead.
 // Returns true on success, false on error
 // If cannot open file, removes opened files
-bool seq_output_open(SeqOutput *out);
+bool seq_output_open(SeqOutput *out, size_t nthreads, bool ordered);
+
+// Write formatted reads from thread `tid`, with sequence number `seqn`.
+// In ordered mode every sequence number must be written exactly once.
+void seq_output_write_se(SeqOutput *out, size_t tid, uint64_t seqn,
+                         const StrBuf *buf);
+
+void seq_output_write_pe(SeqOutput *out, size_t tid, uint64_t seqn,
+                         const StrBuf *buf1, const StrBuf *buf2);
+
+// Append a read to a buffer as FASTA / FASTQ
+// Missing quality scores are printed as '.'
+void seq_output_fasta(StrBuf *sbuf, const read_t *r);
+void seq_output_fastq(StrBuf *sbuf, const read_t *r);
 
 #endif /* SEQ_OUTPUT_H_ */
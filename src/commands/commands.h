@@ -18,6 +18,9 @@ int ctx_clean(int argc, char **argv);
 int ctx_pjoin(int argc, char **argv);
 int ctx_supernodes(int argc, char **argv);
 int ctx_health_check(int argc, char **argv);
+int ctx_sort(int argc, char **argv);
+int ctx_index(int argc, char **argv);
+int ctx_unitigs(int argc, char **argv);
 
 int ctx_unique(CmdArgs *args);
 int ctx_place(CmdArgs *args);
@@ -48,5 +51,8 @@ extern const char correct_usage[];
 extern const char breakpoints_usage[];
 extern const char coverage_usage[];
 extern const char rmsubstr_usage[];
+extern const char sort_usage[];
+extern const char index_usage[];
+extern const char unitigs_usage[];
 
 #endif /* COMMANDS_H_ */
@@ -48,6 +48,8 @@ const char breakpoints_usage[] =
 "  -s, --seq <in>          Trusted input (can specify multiple times)\n"
 "  -r, --minref <N>        Require <N> kmers at ref breakpoint [default: "QUOTE_VALUE(DEFAULT_MIN_REF_NKMERS)"]\n"
 "  -R, --maxref <N>        Limit to <N> kmers at ref breakpoint [default: "QUOTE_VALUE(DEFAULT_MAX_REF_NKMERS)"]\n"
+"  -S, --sort              Sort calls by seed kmer, output is the same between\n"
+"                          runs regardless of number of threads\n"
 "\n";
 
 static struct option longopts[] =
@@ -64,6 +66,7 @@ static struct option longopts[] =
   {"seq",          required_argument, NULL, 's'},
   {"minref",       required_argument, NULL, 'r'},
   {"maxref",       required_argument, NULL, 'R'},
+  {"sort",         no_argument,       NULL, 'S'},
   {NULL, 0, NULL, 0}
 };
 
@@ -72,6 +75,7 @@ int ctx_breakpoints(int argc, char **argv)
   size_t num_of_threads = DEFAULT_NTHREADS;
   struct MemArgs memargs = MEM_ARGS_INIT;
   const char *output_file = NULL;
+  bool sort_calls = false;
   size_t min_ref_flank = DEFAULT_MIN_REF_NKMERS;
   size_t max_ref_flank = DEFAULT_MAX_REF_NKMERS;
   PathFileBuffer pfilebuf;
@@ -120,6 +124,7 @@ int ctx_breakpoints(int argc, char **argv)
           die("Cannot read --seq file %s", optarg);
         seq_file_ptr_buf_add(&sfilebuf, tmp_sfile);
         break;
+      case 'S': sort_calls = true; break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -218,7 +223,7 @@ int ctx_breakpoints(int argc, char **argv)
   // Open output file
   //
   if(output_file == NULL) output_file = "-";
-  gzFile gzout = futil_gzopen_output(output_file);
+  FILE *fout = futil_open_output(output_file);
 
   //
   // Set up memory
@@ -292,14 +297,14 @@ int ctx_breakpoints(int argc, char **argv)
 
   // Call breakpoints
   breakpoints_call(num_of_threads,
-                   gzout, output_file,
+                   fout, output_file, sort_calls,
                    rbuf.data, rbuf.len,
                    seq_paths, num_seq_paths,
                    min_ref_flank, max_ref_flank,
                    &db_graph);
 
   // Finished: do clean up
-  gzclose(gzout);
+  fclose(fout);
 
   for(i = 0; i < rbuf.len; i++) seq_read_dealloc(&rbuf.data[i]);
   readbuf_dealloc(&rbuf);
@@ -11,6 +11,9 @@
 #include "graph_walker.h"
 #include "bubble_caller.h"
 #include "path_file_reader.h"
+#include "graph_image.h"
+#include "unitig_index.h"
+#include "db_adjacency.h"
 
 // Long flanks help us map calls
 // increasing allele length can be costly
@@ -28,10 +31,15 @@ const char bubbles_usage[] =
 "  -n, --nkmers <kmers>    Number of hash table entries (e.g. 1G ~ 1 billion)\n"
 "  -t, --threads <T>       Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
 "  -p, --paths <in.ctp>    Load path file (can specify multiple times)\n"
+"  -J, --load-image <in>   Load graph from an image of <in.ctx> if possible\n"
+"  -U, --unitigs <in>      Use unitig index from `"CMD" unitigs` if it matches\n"
+"  -A, --adjacency         Cache neighbours of each kmer (faster, more memory)\n"
 //
 "  -H, --haploid <col>     Colour is haploid, can use repeatedly [e.g. ref colour]\n"
 "  -a, --max-allele <len>  Max bubble branch length in kmers [default: "QUOTE_VALUE(DEFAULT_MAX_ALLELE)"]\n"
 "  -f, --max-flank <len>   Max flank length in kmers [default: "QUOTE_VALUE(DEFAULT_MAX_FLANK)"]\n"
+"  -S, --sort              Sort calls by seed kmer, output is the same between\n"
+"                          runs regardless of number of threads\n"
 "\n"
 "  When loading path files with -p, use offset (e.g. 2:in.ctp) to specify\n"
 "  which colour to load the data into.\n"
@@ -46,10 +54,14 @@ static struct option longopts[] =
   {"nkmers",       required_argument, NULL, 'n'},
   {"threads",      required_argument, NULL, 't'},
   {"paths",        required_argument, NULL, 'p'},
+  {"load-image",   required_argument, NULL, 'J'},
+  {"unitigs",      required_argument, NULL, 'U'},
+  {"adjacency",    no_argument,       NULL, 'A'},
 // command specific
   {"haploid",      required_argument, NULL, 'H'},
   {"max-allele",   required_argument, NULL, 'a'},
   {"max-flank",    required_argument, NULL, 'f'},
+  {"sort",         no_argument,       NULL, 'S'},
   {NULL, 0, NULL, 0}
 };
 
@@ -60,8 +72,9 @@ int ctx_bubbles(int argc, char **argv)
 {
   size_t num_of_threads = 0;
   struct MemArgs memargs = MEM_ARGS_INIT;
-  const char *out_path = NULL;
+  const char *out_path = NULL, *image_path = NULL, *unitigs_path = NULL;
   size_t max_allele_len = 0, max_flank_len = 0;
+  bool sort_calls = false, use_adjacency = false;
 
   SizeBuffer haploidbuf;
   size_buf_alloc(&haploidbuf, 8);
@@ -96,6 +109,15 @@ int ctx_bubbles(int argc, char **argv)
         path_file_open(&tmp_pfile, optarg, true);
         pfile_buf_add(&pfilesbuf, tmp_pfile);
         break;
+      case 'J':
+        if(image_path != NULL) die("%s set twice", cmd);
+        image_path = optarg;
+        break;
+      case 'U':
+        if(unitigs_path != NULL) die("%s set twice", cmd);
+        unitigs_path = optarg;
+        break;
+      case 'A': use_adjacency = true; break;
       case 't':
         if(num_of_threads) die("%s set twice", cmd);
         num_of_threads = cmd_parse_arg_uint32_nonzero(cmd, optarg);
@@ -114,6 +136,7 @@ int ctx_bubbles(int argc, char **argv)
         if(max_flank_len) die("%s set twice", cmd);
         max_flank_len = cmd_parse_arg_uint32_nonzero(cmd, optarg);
         break;
+      case 'S': sort_calls = true; break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -172,11 +195,15 @@ int ctx_bubbles(int argc, char **argv)
   size_t bits_per_kmer, kmers_in_hash, graph_mem, path_mem, thread_mem;
   char thread_mem_str[100];
 
-  // edges(1bytes) + kmer_paths(8bytes) + in_colour(1bit/col) +
-  // visitedfw/rv(2bits/thread)
+  // edges(1bytes) + kmer_paths(8bytes) + in_colour(1bit/col)
+
+  bits_per_kmer = sizeof(Edges)*8 + sizeof(PathIndex)*8 + ncols;
 
-  bits_per_kmer = sizeof(Edges)*8 + sizeof(PathIndex)*8 +
-                  ncols + 2*num_of_threads;
+  if(unitigs_path != NULL) bits_per_kmer += UNITIG_INDEX_BYTES_PER_KMER*8;
+  if(use_adjacency) bits_per_kmer += db_adj_bytes_per_kmer(2)*8;
+
+  if(image_path != NULL) cmd_mem_args_set_image(&memargs, image_path);
+  if(unitigs_path != NULL) cmd_mem_args_set_unitigs(&memargs, unitigs_path);
 
   kmers_in_hash = cmd_get_kmers_in_hash2(memargs.mem_to_use,
                                          memargs.mem_to_use_set,
@@ -186,8 +213,8 @@ int ctx_bubbles(int argc, char **argv)
                                          ctx_max_kmers, ctx_sum_kmers,
                                          false, &graph_mem);
 
-  // Thread memory
-  thread_mem = roundup_bits2bytes(kmers_in_hash) * 2;
+  // Thread memory: RepeatWalker does not scale with the graph
+  thread_mem = rpt_walker_est_mem(kmers_in_hash, 22);
   bytes_to_str(thread_mem * num_of_threads, 1, thread_mem_str);
   status("[memory] (of which threads: %zu x %zu = %s)\n",
           num_of_threads, thread_mem, thread_mem_str);
@@ -203,7 +230,7 @@ int ctx_bubbles(int argc, char **argv)
   //
   // Open output file
   //
-  gzFile gzout = futil_gzopen_output(out_path);
+  FILE *fout = futil_open_output(out_path);
 
   // Allocate memory
   dBGraph db_graph;
@@ -231,8 +258,11 @@ int ctx_bubbles(int argc, char **argv)
                               .must_exist_in_edges = NULL,
                               .empty_colours = true};
 
+  bool image_loaded = (image_path != NULL &&
+                       graph_image_load(image_path, gfiles, num_gfiles, &db_graph));
+
   for(i = 0; i < num_gfiles; i++) {
-    graph_load(&gfiles[i], gprefs, &stats);
+    if(!image_loaded) graph_load(&gfiles[i], gprefs, &stats);
     graph_file_close(&gfiles[i]);
     gprefs.empty_colours = false;
   }
@@ -246,6 +276,18 @@ int ctx_bubbles(int argc, char **argv)
 
   for(i = 0; i < pfilesbuf.len; i++) path_file_close(&pfilesbuf.data[i]);
 
+  // Unitig index is only used if it was built from the same graph
+  UnitigIndex unitigs;
+  if(unitigs_path != NULL &&
+     unitig_index_load(&unitigs, unitigs_path, num_of_threads, &db_graph)) {
+    db_graph.unitigs = &unitigs;
+  }
+
+  // Graph does not change from here on
+  dBAdjacency adj;
+  if(use_adjacency && db_adj_build(&adj, num_of_threads, &db_graph))
+    db_graph.adj = &adj;
+
   // Now call variants
   BubbleCallingPrefs call_prefs = {.max_allele_len = max_allele_len,
                                    .max_flank_len = max_flank_len,
@@ -253,10 +295,13 @@ int ctx_bubbles(int argc, char **argv)
                                    .num_haploid = haploidbuf.len};
 
   invoke_bubble_caller(num_of_threads, call_prefs,
-                       gzout, out_path, &db_graph);
+                       fout, out_path, sort_calls, &db_graph);
 
   status("  saved to: %s\n", out_path);
-  gzclose(gzout);
+  fclose(fout);
+
+  if(db_graph.unitigs != NULL) unitig_index_dealloc(&unitigs);
+  if(db_graph.adj != NULL) db_adj_dealloc(&adj);
 
   db_graph_dealloc(&db_graph);
 
@@ -7,6 +7,7 @@
 #include "graph_format.h"
 #include "loading_stats.h"
 #include "build_graph.h"
+#include "graph_image.h"
 
 #include "seq_file.h"
 
@@ -33,6 +34,7 @@ const char build_usage[] =
 "  -f,--FR -F,--FF          Mate pair orientation [default: FR] (for --keep_pcr)\n"
 "    -r,--RF -R--RR\n"
 "  -g, --graph <in.ctx>     Load samples from a graph file (.ctx)\n"
+"  -I, --save-image <out>   Also save a graph image for fast reloading\n"
 "\n"
 "  Note: Argument must come before input file\n"
 "  PCR duplicate removal works by ignoring read (pairs) if (both) reads\n"
@@ -67,6 +69,7 @@ static struct option longopts[] =
   {"RF",           no_argument,       NULL, 'r'},
   {"RR",           no_argument,       NULL, 'R'},
   {"graph",        required_argument, NULL, 'g'},
+  {"save-image",   required_argument, NULL, 'I'},
   {NULL, 0, NULL, 0}
 };
 
@@ -85,7 +88,7 @@ SampleNameBuffer snamebuf;
 size_t num_of_threads = DEFAULT_NTHREADS;
 struct MemArgs memargs = MEM_ARGS_INIT;
 
-char *out_path = NULL;
+char *out_path = NULL, *image_path = NULL;
 size_t output_colours = 0, kmer_size = 0;
 
 static void add_task(BuildGraphTask *task)
@@ -167,6 +170,10 @@ static void parse_args(int argc, char **argv)
         gfile_buf_add(&gfilebuf, tmp_gfile);
         sample_named = false;
         break;
+      case 'I':
+        if(image_path != NULL) die("%s set twice", cmd);
+        image_path = optarg;
+        break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -184,6 +191,10 @@ static void parse_args(int argc, char **argv)
   out_path = argv[optind];
   status("Saving graph to: %s", out_path);
 
+  // Images record the graph file they mirror, so it must be a real file
+  if(image_path != NULL && strcmp(out_path,"-") == 0)
+    cmd_print_usage("Cannot save an image when writing the graph to stdout");
+
   if(snamebuf.len == 0) cmd_print_usage("No inputs given");
 
   if(pref_unused) cmd_print_usage("Arguments not given BEFORE sequence file");
@@ -282,6 +293,9 @@ int ctx_build(int argc, char **argv)
     if(!futil_is_file_writable(out_path)) die("Cannot write to file: %s", out_path);
   }
 
+  if(image_path != NULL && !futil_is_file_writable(image_path))
+    die("Cannot write to file: %s", image_path);
+
   status("Writing %zu colour graph to %s\n", output_colours, out_path_name);
 
   // Create db_graph
@@ -353,6 +367,8 @@ int ctx_build(int argc, char **argv)
   graph_file_save_mkhdr(out_path, &db_graph, CTX_GRAPH_FILEFORMAT, NULL,
                         0, output_colours);
 
+  if(image_path != NULL) graph_image_save(image_path, out_path, &db_graph);
+
   build_graph_task_buf_dealloc(&gtaskbuf);
   gfile_buf_dealloc(&gfilebuf);
   sample_name_buf_dealloc(&snamebuf);
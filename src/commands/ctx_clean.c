@@ -6,6 +6,8 @@
 #include "graph_info.h"
 #include "graph_format.h"
 #include "clean_graph.h"
+#include "clean_stream.h"
+#include "graph_image.h"
 #include "supernode.h" // for saving length histogram
 
 const char clean_usage[] =
@@ -20,6 +22,10 @@ const char clean_usage[] =
 "  -n, --nkmers <kmers>        Number of hash table entries (e.g. 1G ~ 1 billion)\n"
 "  -t, --threads <T>           Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
 "  -N, --ncols <N>             Number of graph colours to use\n"
+"  -I, --save-image <out>      Also save cleaned graph as an image for fast reloading\n"
+"  -J, --load-image <in>       Load graph from an image of <in.ctx> if possible\n"
+"  -M, --mmap                  Make a first cleaning pass over a sorted graph on\n"
+"                              disk, then only load kmers that pass it\n"
 "\n"
 "  Cleaning:\n"
 "  -T, --tips <L>              Clip tips shorter than <L> kmers\n"
@@ -44,6 +50,9 @@ static struct option longopts[] =
   {"memory",       required_argument, NULL, 'm'},
   {"nkmers",       required_argument, NULL, 'n'},
   {"threads",      required_argument, NULL, 't'},
+  {"save-image",   required_argument, NULL, 'I'},
+  {"load-image",   required_argument, NULL, 'J'},
+  {"mmap",         no_argument,       NULL, 'M'},
 // command specific
   {"tips",         required_argument, NULL, 'T'},
   {"supernodes",   optional_argument, NULL, 'S'},
@@ -61,12 +70,13 @@ int ctx_clean(int argc, char **argv)
   size_t num_of_threads = 0, use_ncols = 0;
   struct MemArgs memargs = MEM_ARGS_INIT;
   const char *out_ctx_path = NULL;
-  bool tip_cleaning = false, supernode_cleaning = false;
+  bool tip_cleaning = false, supernode_cleaning = false, use_mmap = false;
   size_t min_keep_tip = 0;
   Covg threshold = 0;
   double seq_depth = 0;
   const char *len_before_path = NULL, *len_after_path = NULL;
   const char *covg_before_path = NULL, *covg_after_path = NULL;
+  const char *save_image_path = NULL, *load_image_path = NULL;
 
   // Arg parsing
   char cmd[100];
@@ -93,6 +103,15 @@ int ctx_clean(int argc, char **argv)
         if(num_of_threads) die("%s set twice", cmd);
         num_of_threads = cmd_parse_arg_uint32_nonzero(cmd, optarg);
         break;
+      case 'I':
+        if(save_image_path) die("%s set twice", cmd);
+        save_image_path = optarg;
+        break;
+      case 'J':
+        if(load_image_path) die("%s set twice", cmd);
+        load_image_path = optarg;
+        break;
+      case 'M': use_mmap = true; break;
       case 'T':
         if(tip_cleaning) die("%s set twice", cmd);
         tip_cleaning = true;
@@ -169,6 +188,11 @@ int ctx_clean(int argc, char **argv)
   char **gfile_paths = argv + optind;
   size_t i, j, num_gfiles = (size_t)(argc - optind);
 
+  if(use_mmap && num_gfiles > 1)
+    cmd_print_usage("--mmap only takes one sorted graph (see `"CMD" sort`)");
+  if(use_mmap && (load_image_path || save_image_path))
+    cmd_print_usage("Cannot use --mmap with --load-image/--save-image");
+
   // Open graph files
   GraphFileReader *gfiles = ctx_calloc(num_gfiles, sizeof(GraphFileReader));
   size_t ncols, ctx_max_kmers = 0, ctx_sum_kmers = 0;
@@ -181,6 +205,12 @@ int ctx_clean(int argc, char **argv)
   // default to one colour for now
   if(use_ncols == 0) use_ncols = 1;
 
+  // Colours are merged into one when streaming
+  if(use_mmap && use_ncols > 1) {
+    warn("--mmap cleans with colours merged ('--ncols %zu' ignored)", use_ncols);
+    use_ncols = 1;
+  }
+
   // Flatten if we don't have to remember colours / output a graph
   if(!doing_cleaning)
   {
@@ -242,12 +272,79 @@ int ctx_clean(int argc, char **argv)
   if(len_after_path != NULL)
     status("%zu. Saving supernode length distribution to: %s", step++, len_after_path);
 
+  //
+  // Check output files are writable
+  //
+  if(out_ctx_path != NULL && strcmp(out_ctx_path,"-") != 0 &&
+     !futil_is_file_writable(out_ctx_path)) {
+    cmd_print_usage("Cannot write to output: %s", out_ctx_path);
+  }
+
+  if(covg_before_path && !futil_is_file_writable(covg_before_path))
+    die("Cannot write 'before' coverage histogram to: %s", covg_before_path);
+  if(covg_after_path && !futil_is_file_writable(covg_after_path))
+    die("Cannot write 'after' coverage histogram to: %s", covg_after_path);
+  if(len_before_path && !futil_is_file_writable(len_before_path))
+    die("Cannot write 'before' length histogram to: %s", len_before_path);
+  if(len_after_path && !futil_is_file_writable(len_after_path))
+    die("Cannot write 'after' length histogram to: %s", len_after_path);
+  if(save_image_path && !futil_is_file_writable(save_image_path))
+    die("Cannot write graph image to: %s", save_image_path);
+
+  //
+  // Streaming: first cleaning pass over the sorted graph on disk, which also
+  // writes the 'before' histograms. Only kmers that pass it are loaded.
+  //
+  GraphMmap gm;
+  CleanStream cs;
+  size_t stream_nkmers = 0, stream_mem = 0;
+
+  if(use_mmap)
+  {
+    Covg stream_thresh = 0;
+    if(supernode_cleaning)
+      stream_thresh = threshold > 0 ? threshold : CLEANING_THRESH_AUTO;
+
+    graph_mmap_open(&gm, gfile_paths[0]);
+
+    stream_mem = clean_stream_mem(gm.num_kmers,
+                                  stream_thresh == CLEANING_THRESH_AUTO);
+    cmd_print_mem(stream_mem, "first pass");
+    cmd_check_mem_limit(memargs.mem_to_use, stream_mem);
+
+    stream_thresh = clean_stream_prefilter(&cs, &gm, num_of_threads,
+                                           stream_thresh, seq_depth,
+                                           min_keep_tip,
+                                           covg_before_path, len_before_path);
+
+    if(supernode_cleaning) threshold = stream_thresh;
+    stream_nkmers = cs.num_kmers;
+    ctx_max_kmers = ctx_sum_kmers = MAX2(cs.num_kept, 1);
+
+    if(!doing_cleaning) {
+      // Histograms are all we need
+      clean_stream_dealloc(&cs);
+      graph_mmap_close(&gm);
+      for(i = 0; i < num_gfiles; i++) graph_file_close(&gfiles[i]);
+      ctx_free(gfiles);
+      return EXIT_SUCCESS;
+    }
+  }
+
   //
   // Decide memory usage
   //
   bool all_colours_loaded = (ncols <= use_ncols);
   bool use_mem_limit = (memargs.mem_to_use_set && num_gfiles > 1) || !ctx_max_kmers;
 
+  // Images hold all colours
+  if(!all_colours_loaded && (load_image_path || save_image_path)) {
+    warn("Not all colours fit in memory, ignoring --load-image/--save-image");
+    load_image_path = save_image_path = NULL;
+  }
+
+  if(load_image_path != NULL) cmd_mem_args_set_image(&memargs, load_image_path);
+
   size_t kmers_in_hash, extra_bits_per_kmer, graph_mem;
   size_t per_kmer_per_col_bits = (sizeof(Covg) + sizeof(Edges)) * 8;
   size_t pop_edges_per_kmer_bits = (!all_colours_loaded) * sizeof(Edges) * 8;
@@ -263,28 +360,19 @@ int ctx_clean(int argc, char **argv)
                                          use_mem_limit, &graph_mem);
 
   // Maximise the number of colours we load to fill the mem
-  size_t max_usencols = (memargs.mem_to_use*8 - pop_edges_per_kmer_bits * kmers_in_hash) /
-                        (per_kmer_per_col_bits * kmers_in_hash);
-  use_ncols = MIN2(max_usencols, ncols);
-
-  cmd_check_mem_limit(memargs.mem_to_use, graph_mem);
+  if(!use_mmap) {
+    size_t max_usencols = (memargs.mem_to_use*8 - pop_edges_per_kmer_bits * kmers_in_hash) /
+                          (per_kmer_per_col_bits * kmers_in_hash);
+    use_ncols = MIN2(max_usencols, ncols);
+  }
 
-  //
-  // Check output files are writable
-  //
-  if(out_ctx_path != NULL && strcmp(out_ctx_path,"-") != 0 &&
-     !futil_is_file_writable(out_ctx_path)) {
-    cmd_print_usage("Cannot write to output: %s", out_ctx_path);
+  // Bitsets from the first pass are held until kmers are loaded
+  if(use_mmap) {
+    stream_mem = clean_stream_kept_mem(gm.num_kmers);
+    cmd_print_mem(stream_mem, "first pass results");
   }
 
-  if(covg_before_path && !futil_is_file_writable(covg_before_path))
-    die("Cannot write 'before' coverage histogram to: %s", covg_before_path);
-  if(covg_after_path && !futil_is_file_writable(covg_after_path))
-    die("Cannot write 'after' coverage histogram to: %s", covg_after_path);
-  if(len_before_path && !futil_is_file_writable(len_before_path))
-    die("Cannot write 'before' length histogram to: %s", len_before_path);
-  if(len_after_path && !futil_is_file_writable(len_after_path))
-    die("Cannot write 'after' length histogram to: %s", len_after_path);
+  cmd_check_mem_limit(memargs.mem_to_use, graph_mem + stream_mem);
 
   // Create db_graph
   // Load as many colours as possible
@@ -321,7 +409,16 @@ int ctx_clean(int argc, char **argv)
     }
   }
 
-  if(ncols > use_ncols)
+  if(use_mmap) {
+    clean_stream_load(&cs, &db_graph);
+    clean_stream_dealloc(&cs);
+    graph_mmap_close(&gm);
+  }
+  else if(load_image_path != NULL &&
+          graph_image_load(load_image_path, gfiles, num_gfiles, &db_graph)) {
+    // Loaded graph from image; graph files only used for writing output
+  }
+  else if(ncols > use_ncols)
   {
     // Load into one colour
     size_t tmpinto; bool tmpflatten;
@@ -344,31 +441,39 @@ int ctx_clean(int argc, char **argv)
   ulong_to_str(db_graph.ht.num_kmers, num_kmers_str);
   status("Total kmers loaded: %s\n", num_kmers_str);
 
-  size_t initial_nkmers = db_graph.ht.num_kmers;
+  size_t initial_nkmers = use_mmap ? stream_nkmers : db_graph.ht.num_kmers;
   hash_table_print_stats(&db_graph.ht);
 
   uint8_t *visited = ctx_calloc(roundup_bits2bytes(db_graph.ht.capacity), 1);
-  uint8_t *keep = ctx_calloc(roundup_bits2bytes(db_graph.ht.capacity), 1);
-
-  if(threshold == 0 || covg_before_path || len_before_path) {
-    // Get coverage distribution and estimate cleaning threshold
-    size_t est_threshold = cleaning_get_threshold(num_of_threads, seq_depth,
-                                                  covg_before_path, len_before_path,
-                                                  visited, &db_graph);
-
-    // Use estimated threshold if threshold not set
-    if(threshold == 0) threshold = est_threshold;
-  }
+  uint8_t *flags = ctx_calloc(roundup_bits2bytes(db_graph.ht.capacity), 1);
 
   if(doing_cleaning) {
     // Clean graph of tips (if min_keep_tip > 0) and supernodes (if threshold > 0)
-    clean_graph(num_of_threads, threshold, min_keep_tip,
-                covg_after_path, len_after_path,
-                visited, keep, &db_graph);
+    // Histograms and the threshold estimate come from the same pass
+    Covg covg_thresh = 0;
+    if(supernode_cleaning)
+      covg_thresh = threshold > 0 ? threshold : CLEANING_THRESH_AUTO;
+
+    // If streaming, the threshold was set and 'before' histograms written by
+    // the first pass
+    covg_thresh = clean_graph(num_of_threads, covg_thresh, seq_depth,
+                              min_keep_tip,
+                              use_mmap ? NULL : covg_before_path,
+                              use_mmap ? NULL : len_before_path,
+                              covg_after_path, len_after_path,
+                              visited, flags, &db_graph);
+
+    if(supernode_cleaning) threshold = covg_thresh;
+  }
+  else {
+    // Just save supernode coverage and length distributions
+    cleaning_get_threshold(num_of_threads, seq_depth,
+                           covg_before_path, len_before_path,
+                           visited, &db_graph);
   }
 
   ctx_free(visited);
-  ctx_free(keep);
+  ctx_free(flags);
 
   if(doing_cleaning)
   {
@@ -425,6 +530,22 @@ int ctx_clean(int argc, char **argv)
       db_graph.col_edges = intersect_edges;
   }
 
+  if(save_image_path != NULL && use_ncols == ncols) {
+    // Image mirrors the cleaned graph we wrote, or the input if not cleaning
+    const char *image_ctx_path = NULL;
+    if(doing_cleaning) image_ctx_path = out_ctx_path;
+    else if(num_gfiles == 1 && gfiles[0].fltr.nofilter && !gfiles[0].fltr.flatten)
+      image_ctx_path = gfiles[0].fltr.file_path.buff;
+
+    if(image_ctx_path == NULL || strcmp(image_ctx_path,"-") == 0) {
+      warn("Graph is not the same as a single graph file, not saving image");
+    } else {
+      // Save with the cleaned sample info
+      for(i = 0; i < ncols; i++) graph_info_cpy(&db_graph.ginfo[i], &outhdr.ginfo[i]);
+      graph_image_save(save_image_path, image_ctx_path, &db_graph);
+    }
+  }
+
   ctx_check(db_graph.ht.num_kmers == hash_table_count_kmers(&db_graph.ht));
 
   graph_header_dealloc(&outhdr);
@@ -13,6 +13,10 @@
 #include "graph_walker.h"
 #include "repeat_walker.h"
 #include "seq_reader.h"
+#include "block_writer.h"
+#include "async_read_io.h"
+#include "unitig_index.h"
+#include "db_adjacency.h"
 
 #define DEFAULT_NCONTIGS 1000
 
@@ -28,7 +32,10 @@ const char contigs_usage[] =
 "  -o, --out <out.fa>   Print contigs in FASTA [default: don't print]\n"
 "  -e, --seed <in.fa>   Use seed kmers from a file. If longer than kmer-size, only\n"
 "                       use the first kmer found from each input sequence.\n"
-"  -R, --no-reseed      Do not use a seed kmer if it is used in a contig\n"
+"  -R, --no-reseed      Do not use a seed kmer if it is used in an earlier contig\n"
+"  -U, --unitigs <in>   Use unitig index from `"CMD" unitigs` if it matches\n"
+"  -A, --adjacency      Cache neighbours of each kmer (faster, more memory)\n"
+"  -t, --threads <T>    Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
 "\n";
 
 #define MAXPATH 5
@@ -42,11 +49,51 @@ typedef struct {
   size_t *lengths, *junctions;
   size_t min_len, max_len, min_junc, max_junc;
   double max_junc_density;
-  dBNodeBuffer nodes;
-  size_t nprint; // id of next contig printed
+  StrBuf seqbuf; // contig to print
+  size_t nprint; // number of contigs printed
   size_t num_reseed_abort, num_seed_not_found;
 } ContigData;
 
+// A contig that has been walked but not yet counted or printed
+typedef struct {
+  hkey_t seed; // HASH_NOT_FOUND if no seed kmer was found in the graph
+  dBNodeBuffer nodes; // empty if the walk was skipped
+  size_t njunc;
+  size_t grphwlk_steps[8];
+  uint8_t paths_held[2], paths_pickdup[2], paths_counter[2]; // per orientation
+} ContigWalk;
+
+// Shared between threads
+typedef struct
+{
+  const dBGraph *db_graph;
+  size_t colour;
+  BlockWriter *bw; // NULL if not printing
+  MsgPool *pool; // seed reads
+  size_t ncontigs; // number of contigs to pull out from random kmers
+  volatile size_t nclaimed, nrecords; // random contigs claimed, records printed
+
+  // --no-reseed: contigs are walked in parallel but accepted in record order.
+  // A seed is dropped if a contig with a lower record number used it, so the
+  // output does not depend on the number of threads or their timing.
+  uint8_t *visited; // kmers used in an accepted contig, only set under `lock`
+  pthread_mutex_t lock;
+  ContigWalk *ring; // walked contigs waiting for lower record numbers
+  uint8_t *ring_set;
+  size_t ring_cap, next_id;
+  volatile size_t nkept; // random contigs accepted
+} ContigsShared;
+
+typedef struct
+{
+  ContigData cd;
+  ContigWalk walk;
+  GraphWalker wlk;
+  RepeatWalker rptwlk;
+  unsigned int rand_state; // for rand_r()
+  ContigsShared *shared;
+} ContigsWorker;
+
 
 // Returns first kmer that is in the graph
 // Or HASH_NOT_FOUND if no kmers are in the graph
@@ -126,7 +173,7 @@ static inline void contig_data_alloc(ContigData *cd, size_t capacity)
                     .min_junc = SIZE_MAX, .max_junc = 0,
                     .max_junc_density = 0, .nprint = 0,
                     .num_reseed_abort = 0, .num_seed_not_found = 0};
-  db_node_buf_alloc(&tmp.nodes, 1024);
+  strbuf_alloc(&tmp.seqbuf, 1024);
   memcpy(cd, &tmp, sizeof(ContigData));
 }
 
@@ -143,27 +190,73 @@ static inline void contig_data_dealloc(ContigData *cd)
 {
   ctx_free(cd->lengths);
   ctx_free(cd->junctions);
-  db_node_buf_dealloc(&cd->nodes);
+  strbuf_dealloc(&cd->seqbuf);
 }
 
-static void pulldown_contig(hkey_t hkey, ContigData *cd,
-                            const dBGraph *db_graph, size_t colour,
-                            GraphWalker *wlk, RepeatWalker *rptwlk,
-                            uint8_t *visited, FILE *fout)
+// Add stats from another thread
+static void contig_data_merge(ContigData *cd, const ContigData *src)
 {
-  // Don't use a visited kmer as a seed node if --no-reseed passed
-  if(visited != NULL && bitset_get(visited, hkey)) {
-    cd->num_reseed_abort++;
-    if(fout != NULL) {
-      fprintf(fout, ">contig%zu\n\n", cd->nprint);
-      cd->nprint++;
-    }
-    return;
+  size_t i;
+  contig_data_ensure_capacity(cd, cd->ncontigs + src->ncontigs);
+  memcpy(cd->lengths + cd->ncontigs, src->lengths,
+         src->ncontigs * sizeof(size_t));
+  memcpy(cd->junctions + cd->ncontigs, src->junctions,
+         src->ncontigs * sizeof(size_t));
+  cd->ncontigs += src->ncontigs;
+  cd->total_len += src->total_len;
+  cd->total_junc += src->total_junc;
+
+  for(i = 0; i < 5; i++) cd->contigs_outdegree[i] += src->contigs_outdegree[i];
+  for(i = 0; i < MAXPATH; i++) {
+    cd->paths_held[i] += src->paths_held[i];
+    cd->paths_pickdup[i] += src->paths_pickdup[i];
+    cd->paths_counter[i] += src->paths_counter[i];
+  }
+  for(i = 0; i < 8; i++) cd->grphwlk_steps[i] += src->grphwlk_steps[i];
+
+  cd->min_len = MIN2(cd->min_len, src->min_len);
+  cd->max_len = MAX2(cd->max_len, src->max_len);
+  cd->min_junc = MIN2(cd->min_junc, src->min_junc);
+  cd->max_junc = MAX2(cd->max_junc, src->max_junc);
+  cd->max_junc_density = MAX2(cd->max_junc_density, src->max_junc_density);
+  cd->nprint += src->nprint;
+  cd->num_reseed_abort += src->num_reseed_abort;
+  cd->num_seed_not_found += src->num_seed_not_found;
+}
+
+// Print contig as FASTA, `num` may be zero
+// `id` is the output record number: contigs are written out in order of id
+static void contig_print(ContigData *cd, size_t id,
+                         const dBNode *nodes, size_t num,
+                         const dBGraph *db_graph, BlockWriter *bw)
+{
+  StrBuf *sbuf = &cd->seqbuf;
+  strbuf_reset(sbuf);
+  strbuf_sprintf(sbuf, ">contig%zu\n", id);
+  if(num > 0) {
+    strbuf_ensure_capacity(sbuf, sbuf->len + num + db_graph->kmer_size);
+    sbuf->len += db_nodes_to_str(nodes, num, db_graph, sbuf->buff + sbuf->len);
   }
+  strbuf_append_char(sbuf, '\n');
+  block_writer_write_seq(bw, id, sbuf->buff, sbuf->len);
+  cd->nprint++;
+}
 
-  dBNodeBuffer *nodes = &cd->nodes;
+// Walk out from `hkey` in both directions, filling wrkr->walk
+static void contig_walk(hkey_t hkey, ContigsWorker *wrkr)
+{
+  const ContigsShared *shared = wrkr->shared;
+  const dBGraph *db_graph = shared->db_graph;
+  const size_t colour = shared->colour;
+  ContigWalk *walk = &wrkr->walk;
+  GraphWalker *wlk = &wrkr->wlk;
+  RepeatWalker *rptwlk = &wrkr->rptwlk;
+  dBNodeBuffer *nodes = &walk->nodes;
   Orientation orient;
-  size_t njunc = 0, i;
+
+  walk->seed = hkey;
+  walk->njunc = 0;
+  memset(walk->grphwlk_steps, 0, sizeof(walk->grphwlk_steps));
 
   db_node_buf_reset(nodes);
   db_node_buf_safe_add(nodes, hkey, FORWARD);
@@ -181,39 +274,52 @@ static void pulldown_contig(hkey_t hkey, ContigData *cd,
     while(graph_walker_next(wlk) && rpt_walker_attempt_traverse(rptwlk, wlk))
     {
       db_node_buf_add(nodes, wlk->node);
-      cd->grphwlk_steps[wlk->last_step.status]++;
+      walk->grphwlk_steps[wlk->last_step.status]++;
     }
 
     // Grab some stats
-    njunc += wlk->fork_count;
-    cd->paths_held[MIN2(wlk->paths.len, MAXPATH-1)]++;
-    cd->paths_pickdup[MIN2(wlk->new_paths.len, MAXPATH-1)]++;
-    cd->paths_counter[MIN2(wlk->cntr_paths.len, MAXPATH-1)]++;
+    walk->njunc += wlk->fork_count;
+    walk->paths_held[orient] = MIN2(wlk->paths.len, MAXPATH-1);
+    walk->paths_pickdup[orient] = MIN2(wlk->new_paths.len, MAXPATH-1);
+    walk->paths_counter[orient] = MIN2(wlk->cntr_paths.len, MAXPATH-1);
 
     // Get failed status
-    cd->grphwlk_steps[wlk->last_step.status]++;
+    walk->grphwlk_steps[wlk->last_step.status]++;
     // nloop += rptwlk->nbloom_entries;
 
     graph_walker_finish(wlk);
-    rpt_walker_fast_clear(rptwlk, nodes->data, nodes->len);
+    rpt_walker_clear(rptwlk);
   }
+}
 
-  if(fout != NULL) {
-    fprintf(fout, ">contig%zu\n", cd->nprint);
-    db_nodes_print(nodes->data, nodes->len, db_graph, fout);
-    putc('\n', fout);
-    cd->nprint++;
+// Add a walked contig to the stats and print it
+static void contig_finish(ContigData *cd, size_t id, const ContigWalk *walk,
+                          const ContigsShared *shared)
+{
+  const dBGraph *db_graph = shared->db_graph;
+  const dBNodeBuffer *nodes = &walk->nodes;
+  size_t i;
+
+  if(walk->seed == HASH_NOT_FOUND) {
+    cd->num_seed_not_found++;
+    if(shared->bw != NULL) contig_print(cd, id, NULL, 0, db_graph, shared->bw);
+    return;
   }
 
-  // If --no-seed set, mark visited nodes are visited
-  // Don't use to seed another contig
-  if(visited != NULL) {
-    for(i = 0; i < nodes->len; i++)
-      bitset_set(visited, nodes->data[i].key);
+  if(shared->bw != NULL)
+    contig_print(cd, id, nodes->data, nodes->len, db_graph, shared->bw);
+
+  contig_data_ensure_capacity(cd, cd->ncontigs+1);
+
+  for(i = 0; i < 8; i++) cd->grphwlk_steps[i] += walk->grphwlk_steps[i];
+  for(i = 0; i < 2; i++) {
+    cd->paths_held[walk->paths_held[i]]++;
+    cd->paths_pickdup[walk->paths_pickdup[i]]++;
+    cd->paths_counter[walk->paths_counter[i]]++;
   }
 
   // Out degree
-  size_t len = nodes->len;
+  size_t len = nodes->len, njunc = walk->njunc;
   hkey_t firstnode = nodes->data[0].key;
   hkey_t firstorient = opposite_orientation(nodes->data[0].orient);
   hkey_t lastnode = nodes->data[len-1].key;
@@ -239,49 +345,197 @@ static void pulldown_contig(hkey_t hkey, ContigData *cd,
   cd->ncontigs++;
 }
 
-struct ParseSeeds {
-  ContigData *const cd;
-  const dBGraph *const db_graph;
-  const size_t colour;
-  GraphWalker *const wlk;
-  RepeatWalker *const rptwlk;
-  uint8_t *const visited;
-  FILE *const fout;
-};
+//
+// --no-reseed: accept walked contigs in record order
+//
 
-// Pull down a contig from the first node that is found in the graph
-static inline void parse_seed_read(const read_t *r, struct ParseSeeds *ps)
+static void contig_ring_alloc(ContigsShared *shared, size_t capacity)
+{
+  size_t i;
+  shared->ring = ctx_calloc(capacity, sizeof(ContigWalk));
+  shared->ring_set = ctx_calloc(capacity, sizeof(uint8_t));
+  shared->ring_cap = capacity;
+  shared->next_id = 0;
+  for(i = 0; i < capacity; i++) db_node_buf_alloc(&shared->ring[i].nodes, 256);
+  if(pthread_mutex_init(&shared->lock, NULL) != 0) die("Mutex init failed");
+}
+
+static void contig_ring_dealloc(ContigsShared *shared)
+{
+  size_t i;
+  for(i = 0; i < shared->ring_cap; i++) db_node_buf_dealloc(&shared->ring[i].nodes);
+  ctx_free(shared->ring);
+  ctx_free(shared->ring_set);
+  pthread_mutex_destroy(&shared->lock);
+}
+
+static void contig_ring_grow(ContigsShared *shared)
+{
+  size_t i, oldcap = shared->ring_cap, newcap = oldcap * 2;
+  ContigWalk *ring = ctx_calloc(newcap, sizeof(ContigWalk));
+  uint8_t *ring_set = ctx_calloc(newcap, sizeof(uint8_t));
+  size_t s;
+
+  for(i = 0; i < oldcap; i++) {
+    s = shared->next_id + i;
+    ring[s % newcap] = shared->ring[s % oldcap];
+    ring_set[s % newcap] = shared->ring_set[s % oldcap];
+  }
+
+  for(i = 0; i < newcap; i++)
+    if(ring[i].nodes.data == NULL) db_node_buf_alloc(&ring[i].nodes, 256);
+
+  ctx_free(shared->ring);
+  ctx_free(shared->ring_set);
+  shared->ring = ring;
+  shared->ring_set = ring_set;
+  shared->ring_cap = newcap;
+}
+
+// Accept or drop the contig with the next record number. Called with lock held
+static void contig_accept(ContigsWorker *wrkr, size_t id, const ContigWalk *walk)
 {
-  const dBGraph *db_graph = ps->db_graph;
+  ContigsShared *shared = wrkr->shared;
+  ContigData *cd = &wrkr->cd;
+  size_t i;
 
-  if(r == NULL) return;
-  hkey_t node = seq_reader_first_node(r, 0, 0, ps->colour, db_graph);
+  if(walk->seed != HASH_NOT_FOUND && bitset_get(shared->visited, walk->seed)) {
+    cd->num_reseed_abort++;
+    if(shared->bw != NULL)
+      contig_print(cd, id, NULL, 0, shared->db_graph, shared->bw);
+  }
+  else if(shared->pool == NULL && shared->nkept == shared->ncontigs) {
+    // Spare random attempt, started before we had enough contigs
+    if(shared->bw != NULL) block_writer_write_seq(shared->bw, id, "", 0);
+  }
+  else {
+    for(i = 0; i < walk->nodes.len; i++)
+      bitset_set(shared->visited, walk->nodes.data[i].key);
+    shared->nkept++;
+    contig_finish(cd, id, walk, shared);
+  }
+}
+
+// Queue wrkr->walk as record `id`, then accept any records that are now ready
+static void contig_submit(ContigsWorker *wrkr, size_t id)
+{
+  ContigsShared *shared = wrkr->shared;
+  ContigWalk tmp;
+  size_t idx;
 
-  if(node != HASH_NOT_FOUND) {
-    pulldown_contig(node, ps->cd, db_graph, ps->colour,
-                    ps->wlk, ps->rptwlk, ps->visited, ps->fout);
+  pthread_mutex_lock(&shared->lock);
+
+  if(id == shared->next_id)
+  {
+    contig_accept(wrkr, id, &wrkr->walk);
+    shared->next_id++;
+
+    // Accept any records that were waiting for this one
+    while(shared->ring_set[idx = shared->next_id % shared->ring_cap]) {
+      shared->ring_set[idx] = 0;
+      contig_accept(wrkr, shared->next_id, &shared->ring[idx]);
+      shared->next_id++;
+    }
   }
   else
   {
-    ps->cd->num_seed_not_found++;
+    while(id >= shared->next_id + shared->ring_cap) contig_ring_grow(shared);
+    idx = id % shared->ring_cap;
+    ctx_assert(!shared->ring_set[idx]);
+    // Swap buffers rather than copy the contig
+    tmp = shared->ring[idx];
+    shared->ring[idx] = wrkr->walk;
+    wrkr->walk = tmp;
+    shared->ring_set[idx] = 1;
+  }
 
-    if(ps->fout != NULL) {
-      fprintf(ps->fout, ">contig%zu\n\n", ps->cd->nprint);
-      ps->cd->nprint++;
-    }
+  pthread_mutex_unlock(&shared->lock);
+}
+
+// Pull down a contig from `hkey` as record `id`
+// `hkey` may be HASH_NOT_FOUND if the seed read had no kmers in the graph
+static void pulldown_contig(hkey_t hkey, size_t id, ContigsWorker *wrkr)
+{
+  ContigsShared *shared = wrkr->shared;
+
+  // With --no-reseed a seed that is already in an accepted contig is dropped
+  // whatever happens, so skip walking it. Only contigs with lower record
+  // numbers have been accepted, so this does not depend on timing.
+  if(hkey != HASH_NOT_FOUND &&
+     (shared->visited == NULL || !bitset_get(shared->visited, hkey))) {
+    contig_walk(hkey, wrkr);
+  } else {
+    wrkr->walk.seed = hkey;
+    db_node_buf_reset(&wrkr->walk.nodes);
+  }
+
+  if(shared->visited == NULL) contig_finish(&wrkr->cd, id, &wrkr->walk, shared);
+  else contig_submit(wrkr, id);
+}
+
+static void contigs_worker_alloc(ContigsWorker *wrkr, ContigsShared *shared)
+{
+  contig_data_alloc(&wrkr->cd, 1024);
+  db_node_buf_alloc(&wrkr->walk.nodes, 1024);
+  graph_walker_alloc(&wrkr->wlk);
+  rpt_walker_alloc(&wrkr->rptwlk, shared->db_graph->ht.capacity, 22); // 4MB
+  wrkr->shared = shared;
+}
+
+static void contigs_worker_dealloc(ContigsWorker *wrkr)
+{
+  contig_data_dealloc(&wrkr->cd);
+  db_node_buf_dealloc(&wrkr->walk.nodes);
+  rpt_walker_dealloc(&wrkr->rptwlk);
+  graph_walker_dealloc(&wrkr->wlk);
+}
+
+// Pull down contigs from random kmers until we have shared->ncontigs
+// Each attempt prints a record, even if it is dropped by --no-reseed
+static void contigs_rand_thread(void *arg)
+{
+  ContigsWorker *wrkr = (ContigsWorker*)arg;
+  ContigsShared *shared = wrkr->shared;
+  const dBGraph *db_graph = shared->db_graph;
+  hkey_t node;
+  size_t id;
+
+  // With --no-reseed we do not know how many attempts are needed, so keep
+  // going until enough have been accepted
+  while(shared->visited != NULL ?
+          shared->nkept < shared->ncontigs :
+          __sync_fetch_and_add(&shared->nclaimed, 1) < shared->ncontigs)
+  {
+    do { node = db_graph_rand_node(db_graph, &wrkr->rand_state); }
+    while(!db_node_has_col(db_graph, node, shared->colour));
+    id = __sync_fetch_and_add(&shared->nrecords, 1);
+    pulldown_contig(node, id, wrkr);
   }
 }
 
-static inline void parse_seed_reads(read_t *r1, read_t *r2,
-                                    uint8_t qoffset1, uint8_t qoffset2,
-                                    void *ptr)
+// Pull down a contig from the first node that is found in the graph
+static void parse_seed_read(const read_t *r, size_t id, ContigsWorker *wrkr)
 {
-  (void)qoffset1; (void)qoffset2;
+  const ContigsShared *shared = wrkr->shared;
+  hkey_t node = seq_reader_first_node(r, 0, 0, shared->colour, shared->db_graph);
+  pulldown_contig(node, id, wrkr);
+}
+
+// Seed reads are numbered in the order they are read, so contigs are printed
+// in the same order as their seeds
+static void contigs_seed_thread(void *arg)
+{
+  ContigsWorker *wrkr = (ContigsWorker*)arg;
+  MsgPool *pool = wrkr->shared->pool;
+  AsyncIOData *data;
+  int pos;
 
-  struct ParseSeeds *ps = (struct ParseSeeds*)ptr;
-  contig_data_ensure_capacity(ps->cd, ps->cd->ncontigs+2);
-  parse_seed_read(r1, ps);
-  parse_seed_read(r2, ps);
+  while((pos = msgpool_claim_read(pool)) != -1)
+  {
+    memcpy(&data, msgpool_get_ptr(pool, pos), sizeof(AsyncIOData*));
+    parse_seed_read(&data->r1, data->readid, wrkr);
+    msgpool_release(pool, pos, MPOOL_EMPTY);
+  }
 }
 
 
@@ -292,8 +546,9 @@ int ctx_contigs(CmdArgs *args)
   // Already checked there is at least 1 argument
 
   size_t i, n_rand_contigs = 0, colour = 0;
-  bool no_reseed = false;
+  bool no_reseed = false, use_adjacency = false;
   seq_file_t *seed_file = NULL;
+  const char *unitigs_path = NULL;
 
   while(argc > 0 && argv[0][0] == '-' && argv[0][1]) {
     if(!strcmp(argv[0],"--ncontigs") || !strcmp(argv[0],"-N")) {
@@ -326,6 +581,16 @@ int ctx_contigs(CmdArgs *args)
       no_reseed = true;
       argv++; argc--;
     }
+    else if(!strcmp(argv[0],"--unitigs") || !strcmp(argv[0], "-U")) {
+      if(argc == 1) cmd_print_usage("-U, --unitigs <in> requires an argument");
+      if(unitigs_path != NULL) cmd_print_usage("-U, --unitigs set twice");
+      unitigs_path = argv[1];
+      argv += 2; argc -= 2;
+    }
+    else if(!strcmp(argv[0],"--adjacency") || !strcmp(argv[0], "-A")) {
+      use_adjacency = true;
+      argv++; argc--;
+    }
     else cmd_print_usage("Unknown argument: %s", argv[0]);
   }
 
@@ -373,6 +638,17 @@ int ctx_contigs(CmdArgs *args)
   // 1 bit needed per kmer if we need to keep track of noreseed
   bits_per_kmer = sizeof(Edges)*8 + gfile.hdr.num_of_cols + sizeof(PathIndex)*8 +
                   no_reseed;
+  if(unitigs_path != NULL) bits_per_kmer += UNITIG_INDEX_BYTES_PER_KMER*8;
+  if(use_adjacency) bits_per_kmer += db_adj_bytes_per_kmer(2)*8;
+
+  // Unitig index can only be used with the hash table size it was built with
+  size_t unitigs_capacity = 0;
+  if(unitigs_path != NULL && !args->num_kmers_set &&
+     (unitigs_capacity = unitig_index_capacity(unitigs_path)) > 0) {
+    args->num_kmers = unitigs_capacity;
+    args->num_kmers_set = true;
+  }
+
   kmers_in_hash = cmd_get_kmers_in_hash(args, bits_per_kmer,
                                         gfile.num_of_kmers, gfile.num_of_kmers,
                                         false, &graph_mem);
@@ -390,6 +666,13 @@ int ctx_contigs(CmdArgs *args)
   // Output file if printing
   //
   FILE *fout = args->output_file_set ? futil_open_output(args->output_file) : NULL;
+  BlockWriter bwriter, *bw = NULL;
+
+  // Ordered so that output does not depend on the number of threads
+  if(fout != NULL) {
+    block_writer_open(&bwriter, fout, args->output_file, false, true, 1, 0);
+    bw = &bwriter;
+  }
 
   // Allocate
   dBGraph db_graph;
@@ -408,12 +691,6 @@ int ctx_contigs(CmdArgs *args)
   if(no_reseed)
     visited = ctx_calloc(roundup_bits2bytes(db_graph.ht.capacity), 1);
 
-  GraphWalker wlk;
-  graph_walker_alloc(&wlk);
-
-  RepeatWalker rptwlk;
-  rpt_walker_alloc(&rptwlk, db_graph.ht.capacity, 22); // 4MB
-
   // Load graph
   LoadingStats stats = LOAD_STATS_INIT_MACRO;
 
@@ -430,36 +707,80 @@ int ctx_contigs(CmdArgs *args)
   paths_format_merge(pfiles, num_pfiles, false, false,
                      args->max_work_threads, &db_graph);
 
-  status("Traversing graph in colour %zu...", colour);
+  // Unitig index is only used if it was built from the same graph
+  UnitigIndex unitigs;
+  if(unitigs_path != NULL &&
+     unitig_index_load(&unitigs, unitigs_path, args->max_work_threads,
+                       &db_graph)) {
+    db_graph.unitigs = &unitigs;
+  }
+
+  // Graph does not change from here on
+  dBAdjacency adj;
+  if(use_adjacency && db_adj_build(&adj, args->max_work_threads, &db_graph))
+    db_graph.adj = &adj;
 
-  hkey_t node;
-  ContigData cd;
+  const size_t num_threads = args->max_work_threads;
+  status("Traversing graph in colour %zu with %zu threads...",
+         colour, num_threads);
+
+  ContigsShared shared = {.db_graph = &db_graph, .colour = colour,
+                          .bw = bw, .pool = NULL,
+                          .ncontigs = n_rand_contigs,
+                          .nclaimed = 0, .nrecords = 0,
+                          .visited = visited, .nkept = 0};
+
+  if(no_reseed) contig_ring_alloc(&shared, 4*num_threads);
+
+  // rand() is not thread safe, so each thread has its own rand_r() state
+  unsigned int rand_base = (unsigned int)rand();
+
+  ContigsWorker *wrkrs = ctx_calloc(num_threads, sizeof(ContigsWorker));
+  for(i = 0; i < num_threads; i++) {
+    contigs_worker_alloc(&wrkrs[i], &shared);
+    wrkrs[i].rand_state = rand_base + i;
+  }
 
   if(seed_file == NULL)
   {
-    contig_data_alloc(&cd, n_rand_contigs);
-    while(cd.ncontigs < n_rand_contigs) {
-      do { node = db_graph_rand_node(&db_graph); }
-      while(!db_node_has_col(&db_graph, node, colour));
-      pulldown_contig(node, &cd, &db_graph, colour, &wlk, &rptwlk, visited, fout);
-    }
+    util_run_threads(wrkrs, num_threads, sizeof(ContigsWorker),
+                     num_threads, contigs_rand_thread);
   }
   else
   {
-    // Parse seed file
-    struct ParseSeeds ps = {.cd = &cd, .db_graph = &db_graph, .colour = colour,
-                            .wlk = &wlk, .rptwlk = &rptwlk, .visited = visited,
-                            .fout = fout};
-
-    contig_data_alloc(&cd, 1024);
-
-    read_t r1;
-    seq_read_alloc(&r1);
-    seq_parse_se_sf(seed_file, 0, &r1, parse_seed_reads, &ps);
-    seq_read_dealloc(&r1);
-    seq_close(seed_file);
+    // Read seeds in another thread
+    AsyncIOData *data = ctx_malloc(MSGPOOLSIZE * sizeof(AsyncIOData));
+    for(i = 0; i < MSGPOOLSIZE; i++) asynciodata_alloc(&data[i]);
+
+    MsgPool pool;
+    msgpool_alloc(&pool, MSGPOOLSIZE, sizeof(AsyncIOData*), USE_MSG_POOL);
+    msgpool_iterate(&pool, asynciodata_pool_init, data);
+    shared.pool = &pool;
+
+    AsyncIOReadInput seed_task = {.file1 = seed_file, .file2 = NULL,
+                                  .ptr = NULL, .fq_offset = 0,
+                                  .interleaved = false};
+
+    asyncio_run_threads(&pool, &seed_task, 1, contigs_seed_thread,
+                        wrkrs, num_threads, sizeof(ContigsWorker));
+
+    asyncio_task_close(&seed_task);
+    msgpool_dealloc(&pool);
+    for(i = 0; i < MSGPOOLSIZE; i++) asynciodata_dealloc(&data[i]);
+    ctx_free(data);
+  }
+
+  // Combine stats from all threads
+  ContigData cd;
+  contig_data_alloc(&cd, 1024);
+  for(i = 0; i < num_threads; i++) {
+    contig_data_merge(&cd, &wrkrs[i].cd);
+    contigs_worker_dealloc(&wrkrs[i]);
   }
+  ctx_free(wrkrs);
 
+  if(no_reseed) contig_ring_dealloc(&shared);
+  if(bw != NULL) block_writer_close(bw);
   if(fout != NULL && fout != stdout) fclose(fout);
 
   status("\n");
@@ -556,14 +877,13 @@ int ctx_contigs(CmdArgs *args)
 
   contig_data_dealloc(&cd);
 
-  rpt_walker_dealloc(&rptwlk);
-  graph_walker_dealloc(&wlk);
-
   ctx_free(visited);
 
   graph_file_close(&gfile);
   for(i = 0; i < num_pfiles; i++) path_file_close(&pfiles[i]);
 
+  if(db_graph.unitigs != NULL) unitig_index_dealloc(&unitigs);
+  if(db_graph.adj != NULL) db_adj_dealloc(&adj);
   db_graph_dealloc(&db_graph);
 
   return EXIT_SUCCESS;
@@ -8,6 +8,7 @@
 #include "graph_paths.h"
 #include "correct_reads.h"
 #include "read_thread_cmd.h"
+#include "db_adjacency.h"
 
 const char correct_usage[] =
 "usage: "CMD" correct [options] <input.ctx>\n"
@@ -19,6 +20,7 @@ const char correct_usage[] =
 "  -n, --nkmers <N>           Number of hash table entries (e.g. 1G ~ 1 billion)\n"
 "  -t, --threads <T>          Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
 "  -p, --paths <in.ctp>       Load path file (can specify multiple times)\n"
+"  -A, --adjacency            Cache neighbours of each kmer (faster, more memory)\n"
 // Non default:
 "  -c, --colour <in:out>         Correct reads from file (supports sam,bam,fq,*.gz\n"
 "  -1, --seq <in:out>         Correct reads from file (supports sam,bam,fq,*.gz\n"
@@ -39,9 +41,11 @@ const char correct_usage[] =
 // "  -M, --mp-gaps <out.csv>    Save size distribution of mate pair gaps bridged\n"
 //
 "  -g, --min-ins <ins>        Minimum insert size for --seq2 [default:0]\n"
+"  -O, --ordered              Print reads in the order they were read\n"
 "\n"
 " --seq outputs <out>.fa.gz, --seq2 outputs <out>.1.fa.gz, <out>.2.fa.gz\n"
-" --seq must come AFTER two/oneway options. Output may be slightly shuffled.\n"
+" --seq must come AFTER two/oneway options. Output may be slightly shuffled\n"
+" unless --ordered is passed.\n"
 "\n";
 
 static struct option longopts[] =
@@ -53,6 +57,7 @@ static struct option longopts[] =
   {"nkmers",       required_argument, NULL, 'n'},
   {"threads",      required_argument, NULL, 't'},
   {"paths",        required_argument, NULL, 'p'},
+  {"adjacency",    no_argument,       NULL, 'A'},
 // command specific
   {"seq",          required_argument, NULL, '1'},
   {"seq2",         required_argument, NULL, '2'},
@@ -73,6 +78,7 @@ static struct option longopts[] =
   {"colour",       required_argument, NULL, 'c'}, // allow --{col,color,colour}
   {"color",        required_argument, NULL, 'c'},
   {"col",          required_argument, NULL, 'c'},
+  {"ordered",      no_argument,       NULL, 'O'},
   // {"seq-gaps",     required_argument, NULL, 'S'},
   // {"mp-gaps",      required_argument, NULL, 'M'},
   {NULL, 0, NULL, 0}
@@ -111,6 +117,7 @@ int ctx_correct(int argc, char **argv)
 
   // 1 bit needed per kmer if we need to keep track of noreseed
   bits_per_kmer = sizeof(Edges)*8 + ctx_num_kmers + sizeof(uint64_t)*8;
+  if(args.use_adjacency) bits_per_kmer += db_adj_bytes_per_kmer(2)*8;
   kmers_in_hash = cmd_get_kmers_in_hash2(args.memargs.mem_to_use,
                                          args.memargs.mem_to_use_set,
                                          args.memargs.num_kmers,
@@ -152,7 +159,8 @@ int ctx_correct(int argc, char **argv)
   if(output_files_exist) die("Output files already exist");
 
   // Attempt to open all files
-  for(i = 0; i < inputs->len && seq_output_open(&outputs[i]); i++) {}
+  for(i = 0; i < inputs->len; i++)
+    if(!seq_output_open(&outputs[i], args.num_of_threads, args.ordered)) break;
 
   // Check if something went wrong - if so remove all output files
   if(i < inputs->len) {
@@ -195,6 +203,10 @@ int ctx_correct(int argc, char **argv)
   paths_format_merge(pfiles->data, pfiles->len, false, false,
                      args.num_of_threads, &db_graph);
 
+  dBAdjacency adj;
+  if(args.use_adjacency && db_adj_build(&adj, args.num_of_threads, &db_graph))
+    db_graph.adj = &adj;
+
   //
   // Run alignment
   //
@@ -208,6 +220,7 @@ int ctx_correct(int argc, char **argv)
 
   read_thread_args_dealloc(&args);
 
+  if(db_graph.adj != NULL) db_adj_dealloc(&adj);
   db_graph_dealloc(&db_graph);
 
   return EXIT_SUCCESS;
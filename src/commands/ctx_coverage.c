@@ -7,6 +7,8 @@
 #include "seq_reader.h"
 #include "graph_format.h"
 #include "graph_file_reader.h"
+#include "graph_mmap.h"
+#include "graph_index.h"
 
 const char coverage_usage[] =
 "usage: "CMD" coverage [options] <in.ctx> [in2.ctx ..]\n"
@@ -19,6 +21,10 @@ const char coverage_usage[] =
 "  -e, --edges          Print edges as well. Uses hex encoding [TGCA|TGCA].\n"
 "  -s, --seq <in>       Sequence file to get coverages for (can specify multiple times)\n"
 "  -o, --out <out.txt>  Save output [default: STDOUT]\n"
+"  -M, --mmap           Query sorted graphs on disk instead of loading them\n"
+"                       (see `"CMD" sort`)\n"
+"  -I, --index          Inputs are graph indexes (.ctxi) to query on disk\n"
+"                       (see `"CMD" index`)\n"
 "\n";
 
 static struct option longopts[] =
@@ -32,6 +38,8 @@ static struct option longopts[] =
   {"edges",        no_argument,       NULL, 'e'},
   {"seq",          required_argument, NULL, '1'},
   {"seq",          required_argument, NULL, 's'},
+  {"mmap",         no_argument,       NULL, 'M'},
+  {"index",        no_argument,       NULL, 'I'},
   {NULL, 0, NULL, 0}
 };
 
@@ -53,18 +61,76 @@ static inline void fetch_node_edges(const dBGraph *db_graph, dBNode node,
   }
 }
 
-static inline void print_read_covg(const dBGraph *db_graph, const read_t *r,
+// Add coverage and edges for a kmer from memory mapped graph files
+static inline void fetch_mmap_kmer(GraphMmap *gms, size_t num_gms,
+                                   BinaryKmer bkmer, bool print_edges,
+                                   Covg *covgs, Edges *edges)
+{
+  size_t i, j, col, fromcol;
+  GraphMmap *gm;
+  dBNode node;
+  Edges e;
+
+  for(i = 0; i < num_gms; i++) {
+    gm = &gms[i];
+    node = graph_mmap_find(gm, bkmer);
+    if(node.key != HASH_NOT_FOUND) {
+      for(j = 0; j < gm->file.fltr.ncols; j++) {
+        col = graph_file_intocol(&gm->file, j);
+        fromcol = graph_file_fromcol(&gm->file, j);
+        covgs[col] += graph_mmap_covg(gm, node.key, fromcol);
+        if(print_edges) {
+          e = graph_mmap_edges(gm, node.key, fromcol);
+          if(node.orient == REVERSE) e = (e>>4) | (e<<4);
+          edges[col] |= e;
+        }
+      }
+    }
+  }
+}
+
+// Add coverage and edges for a kmer from graph index files
+static inline void fetch_index_kmer(const GraphIndex *gis, size_t num_gis,
+                                    BinaryKmer bkmer, bool print_edges,
+                                    Covg *covgs, Edges *edges)
+{
+  size_t i, col;
+  dBNode node;
+  Edges e;
+
+  for(i = 0; i < num_gis; i++) {
+    node = graph_index_find(&gis[i], bkmer);
+    if(node.key != HASH_NOT_FOUND) {
+      for(col = 0; col < gis[i].num_of_cols; col++) {
+        covgs[col] = graph_index_covg(&gis[i], node.key, col);
+        if(print_edges) {
+          e = graph_index_edges(&gis[i], node.key, col);
+          edges[col] = node.orient == REVERSE ? (e>>4) | (e<<4) : e;
+        }
+      }
+    }
+    covgs += gis[i].num_of_cols;
+    if(print_edges) edges += gis[i].num_of_cols;
+  }
+}
+
+// If `gms` or `gis` is not NULL, kmers are looked up in memory mapped files or
+// indexes rather than in db_graph, which may then be NULL
+static inline void print_read_covg(const dBGraph *db_graph,
+                                   GraphMmap *gms, const GraphIndex *gis,
+                                   size_t num_files,
+                                   size_t kmer_size, size_t ncols,
+                                   bool print_edges, const read_t *r,
                                    CovgBuffer *covgbuf, EdgesBuffer *edgebuf,
                                    FILE *fout)
 {
   // Find nodes, set covgs
-  const size_t kmer_size = db_graph->kmer_size, ncols = db_graph->num_of_cols;
   size_t kmer_length = r->seq.end < kmer_size ? 0 : r->seq.end - kmer_size + 1;
 
   covg_buf_ensure_capacity(covgbuf, ncols * kmer_length);
   memset(covgbuf->data, 0, ncols * kmer_length * sizeof(Covg));
 
-  if(db_graph->col_edges) {
+  if(print_edges) {
     edges_buf_ensure_capacity(edgebuf, ncols * kmer_length);
     memset(edgebuf->data, 0, ncols * kmer_length * sizeof(Edges));
   }
@@ -88,12 +154,24 @@ static inline void print_read_covg(const dBGraph *db_graph, const read_t *r,
     {
       nuc = dna_char_to_nuc(r->seq.b[j]);
       bkmer = binary_kmer_left_shift_add(bkmer, kmer_size, nuc);
-      node = db_graph_find(db_graph, bkmer);
-      if(node.key != HASH_NOT_FOUND) {
-        covgs = &db_node_covg(db_graph, node.key, 0);
-        memcpy(covgbuf->data+i*ncols, covgs, ncols * sizeof(Covg));
-        if(db_graph->col_edges)
-          fetch_node_edges(db_graph, node, edgebuf->data+i*ncols);
+      if(gms != NULL) {
+        fetch_mmap_kmer(gms, num_files, bkmer, print_edges,
+                        covgbuf->data+i*ncols,
+                        print_edges ? edgebuf->data+i*ncols : NULL);
+      }
+      else if(gis != NULL) {
+        fetch_index_kmer(gis, num_files, bkmer, print_edges,
+                         covgbuf->data+i*ncols,
+                         print_edges ? edgebuf->data+i*ncols : NULL);
+      }
+      else {
+        node = db_graph_find(db_graph, bkmer);
+        if(node.key != HASH_NOT_FOUND) {
+          covgs = &db_node_covg(db_graph, node.key, 0);
+          memcpy(covgbuf->data+i*ncols, covgs, ncols * sizeof(Covg));
+          if(print_edges)
+            fetch_node_edges(db_graph, node, edgebuf->data+i*ncols);
+        }
       }
     }
   }
@@ -102,14 +180,14 @@ static inline void print_read_covg(const dBGraph *db_graph, const read_t *r,
   fprintf(fout, ">%s\n%s\n", r->name.b, r->seq.b);
   if(kmer_length == 0) {
     for(i = 0; i < ncols; i++) {
-      if(db_graph->col_edges) fputc('\n', fout);
+      if(print_edges) fputc('\n', fout);
       fputc('\n', fout);
     }
   }
   else {
     for(col = 0; col < ncols; col++)
     {
-      if(db_graph->col_edges) {
+      if(print_edges) {
         // Print edges
         edges_print(fout, edgebuf->data[col]);
         for(i = 1; i < kmer_length; i++) {
@@ -130,7 +208,7 @@ static inline void print_read_covg(const dBGraph *db_graph, const read_t *r,
 int ctx_coverage(int argc, char **argv)
 {
   struct MemArgs memargs = MEM_ARGS_INIT;
-  bool print_edges = false;
+  bool print_edges = false, use_mmap = false, use_index = false;
   const char *output_file = NULL;
   SeqFilePtrBuffer sfilebuf;
 
@@ -153,6 +231,8 @@ int ctx_coverage(int argc, char **argv)
       case 'm': cmd_mem_args_set_memory(&memargs, optarg); break;
       case 'n': cmd_mem_args_set_nkmers(&memargs, optarg); break;
       case 'e': print_edges = true; break;
+      case 'M': use_mmap = true; break;
+      case 'I': use_index = true; break;
       case 'o':
         if(output_file != NULL) cmd_print_usage("%s given twice", cmd);
         output_file = optarg;
@@ -173,6 +253,7 @@ int ctx_coverage(int argc, char **argv)
 
   if(sfilebuf.len == 0) cmd_print_usage("Require at least one --seq file");
   if(optind == argc) cmd_print_usage("Require input graph files (.ctx)");
+  if(use_mmap && use_index) cmd_print_usage("Cannot use --mmap with --index");
 
   //
   // Open graph files
@@ -180,28 +261,66 @@ int ctx_coverage(int argc, char **argv)
   char **graph_paths = argv + optind;
   size_t num_gfiles = argc - optind;
   ctx_assert(num_gfiles > 0);
-  GraphFileReader *gfiles = ctx_calloc(num_gfiles, sizeof(GraphFileReader));
-  size_t ncols, ctx_max_kmers = 0, ctx_sum_kmers = 0;
+  GraphFileReader *gfiles = NULL;
+  GraphIndex *gis = NULL;
+  size_t ncols = 0, kmer_size, ctx_max_kmers = 0, ctx_sum_kmers = 0;
+
+  if(use_index)
+  {
+    // Indexes are queried on disk, one colour per indexed colour
+    gis = ctx_calloc(num_gfiles, sizeof(GraphIndex));
+    for(i = 0; i < num_gfiles; i++) {
+      graph_index_open(&gis[i], graph_paths[i]);
+      if(gis[i].kmer_size != gis[0].kmer_size) {
+        cmd_print_usage("Kmer sizes don't match [%zu vs %zu]",
+                        gis[0].kmer_size, gis[i].kmer_size);
+      }
+      ncols += gis[i].num_of_cols;
+    }
+    kmer_size = gis[0].kmer_size;
+  }
+  else
+  {
+    gfiles = ctx_calloc(num_gfiles, sizeof(GraphFileReader));
+    ncols = graph_files_open(graph_paths, gfiles, num_gfiles,
+                             &ctx_max_kmers, &ctx_sum_kmers);
+    kmer_size = gfiles[0].hdr.kmer_size;
+  }
+
+  dBGraph db_graph;
+  GraphMmap *gms = NULL;
 
-  ncols = graph_files_open(graph_paths, gfiles, num_gfiles,
-                           &ctx_max_kmers, &ctx_sum_kmers);
+  if(use_mmap)
+  {
+    // Query files on disk, no hash table needed
+    gms = ctx_calloc(num_gfiles, sizeof(GraphMmap));
+    for(i = 0; i < num_gfiles; i++) {
+      graph_mmap_open(&gms[i], graph_paths[i]);
+      file_filter_update_intocol(&gms[i].file.fltr, gfiles[i].fltr.intocol);
+      graph_file_close(&gfiles[i]);
+    }
+    ctx_free(gfiles);
+  }
 
   //
   // Decide on memory
   //
-  size_t bits_per_kmer, kmers_in_hash, graph_mem;
+  size_t bits_per_kmer, kmers_in_hash = 0, graph_mem;
 
-  // kmer memory = Edges + paths + 1 bit per colour
-  bits_per_kmer = (sizeof(Covg) + print_edges*sizeof(Edges)) * 8 * ncols;
-  kmers_in_hash = cmd_get_kmers_in_hash2(memargs.mem_to_use,
-                                         memargs.mem_to_use_set,
-                                         memargs.num_kmers,
-                                         memargs.num_kmers_set,
-                                         bits_per_kmer,
-                                         ctx_max_kmers, ctx_sum_kmers,
-                                         memargs.mem_to_use_set, &graph_mem);
-
-  cmd_check_mem_limit(memargs.mem_to_use, graph_mem);
+  if(!use_mmap && !use_index)
+  {
+    // kmer memory = Edges + paths + 1 bit per colour
+    bits_per_kmer = (sizeof(Covg) + print_edges*sizeof(Edges)) * 8 * ncols;
+    kmers_in_hash = cmd_get_kmers_in_hash2(memargs.mem_to_use,
+                                           memargs.mem_to_use_set,
+                                           memargs.num_kmers,
+                                           memargs.num_kmers_set,
+                                           bits_per_kmer,
+                                           ctx_max_kmers, ctx_sum_kmers,
+                                           memargs.mem_to_use_set, &graph_mem);
+
+    cmd_check_mem_limit(memargs.mem_to_use, graph_mem);
+  }
 
   //
   // Open output file
@@ -215,35 +334,35 @@ int ctx_coverage(int argc, char **argv)
 
   if(fout == NULL) die("Cannot open output file: %s", output_file);
 
-  //
-  // Set up memory
-  //
-  size_t kmer_size = gfiles[0].hdr.kmer_size;
-
-  dBGraph db_graph;
-  db_graph_alloc(&db_graph, kmer_size, ncols, print_edges*ncols, kmers_in_hash);
-  db_graph.col_covgs = ctx_calloc(db_graph.ht.capacity*ncols, sizeof(Covg));
-
-  if(print_edges)
-    db_graph.col_edges = ctx_calloc(db_graph.ht.capacity*ncols, sizeof(Edges));
-
-  //
-  // Load graphs
-  //
-  LoadingStats stats = LOAD_STATS_INIT_MACRO;
-
-  GraphLoadingPrefs gprefs = {.db_graph = &db_graph,
-                              .boolean_covgs = false,
-                              .must_exist_in_graph = false,
-                              .empty_colours = true};
+  if(!use_mmap && !use_index)
+  {
+    //
+    // Set up memory
+    //
+    db_graph_alloc(&db_graph, kmer_size, ncols, print_edges*ncols, kmers_in_hash);
+    db_graph.col_covgs = ctx_calloc(db_graph.ht.capacity*ncols, sizeof(Covg));
+
+    if(print_edges)
+      db_graph.col_edges = ctx_calloc(db_graph.ht.capacity*ncols, sizeof(Edges));
+
+    //
+    // Load graphs
+    //
+    LoadingStats stats = LOAD_STATS_INIT_MACRO;
+
+    GraphLoadingPrefs gprefs = {.db_graph = &db_graph,
+                                .boolean_covgs = false,
+                                .must_exist_in_graph = false,
+                                .empty_colours = true};
+
+    for(i = 0; i < num_gfiles; i++) {
+      graph_load(&gfiles[i], gprefs, &stats);
+      graph_file_close(&gfiles[i]);
+    }
+    ctx_free(gfiles);
 
-  for(i = 0; i < num_gfiles; i++) {
-    graph_load(&gfiles[i], gprefs, &stats);
-    graph_file_close(&gfiles[i]);
+    hash_table_print_stats(&db_graph.ht);
   }
-  ctx_free(gfiles);
-
-  hash_table_print_stats(&db_graph.ht);
 
   //
   // Load sequence
@@ -259,7 +378,10 @@ int ctx_coverage(int argc, char **argv)
   // Deal with one read at a time
   for(i = 0; i < sfilebuf.len; i++) {
     while(seq_read(sfilebuf.data[i], &r) > 0) {
-      print_read_covg(&db_graph, &r, &covgbuf, &edgebuf, fout);
+      print_read_covg(use_mmap || use_index ? NULL : &db_graph,
+                      gms, gis, num_gfiles,
+                      kmer_size, ncols, print_edges, &r,
+                      &covgbuf, &edgebuf, fout);
     }
     seq_close(sfilebuf.data[i]);
   }
@@ -271,7 +393,16 @@ int ctx_coverage(int argc, char **argv)
   seq_file_ptr_buf_dealloc(&sfilebuf);
 
   fclose(fout);
-  db_graph_dealloc(&db_graph);
+
+  if(use_mmap) {
+    for(i = 0; i < num_gfiles; i++) graph_mmap_close(&gms[i]);
+    ctx_free(gms);
+  }
+  else if(use_index) {
+    for(i = 0; i < num_gfiles; i++) graph_index_close(&gis[i]);
+    ctx_free(gis);
+  }
+  else db_graph_dealloc(&db_graph);
 
   return EXIT_SUCCESS;
 }
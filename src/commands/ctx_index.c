@@ -0,0 +1,64 @@
+#include "global.h"
+#include "commands.h"
+#include "util.h"
+#include "file_util.h"
+#include "graph_index.h"
+
+const char index_usage[] =
+"usage: "CMD" index [options] <in.ctx>[:cols]\n"
+"\n"
+"  Build a static index of a graph that will not change. The index uses a\n"
+"  minimal perfect hash instead of storing kmers, and can be queried without\n"
+"  loading it (e.g. `"CMD" coverage --index`).\n"
+"\n"
+"  -h, --help             This help message\n"
+"  -o, --out <out.ctxi>   Save index to file [required]\n"
+"\n";
+
+static struct option longopts[] =
+{
+  {"help", no_argument,       NULL, 'h'},
+  {"out",  required_argument, NULL, 'o'},
+  {NULL, 0, NULL, 0}
+};
+
+int ctx_index(int argc, char **argv)
+{
+  const char *out_path = NULL;
+
+  // Arg parsing
+  char cmd[100], shortopts[100];
+  cmd_long_opts_to_short(longopts, shortopts, sizeof(shortopts));
+  int c;
+
+  while((c = getopt_long_only(argc, argv, shortopts, longopts, NULL)) != -1) {
+    cmd_get_longopt_str(longopts, c, cmd, sizeof(cmd));
+    switch(c) {
+      case 0: /* flag set */ break;
+      case 'h': cmd_print_usage(NULL); break;
+      case 'o':
+        if(out_path != NULL) cmd_print_usage("%s given twice", cmd);
+        out_path = optarg;
+        break;
+      case ':': /* BADARG */
+      case '?': /* BADCH getopt_long has already printed error */
+        die("`"CMD" index -h` for help. Bad option: %s", argv[optind-1]);
+      default: abort();
+    }
+  }
+
+  if(out_path == NULL) cmd_print_usage("--out <out.ctxi> required");
+  if(optind+1 != argc) cmd_print_usage("Require one input graph file (.ctx)");
+
+  if(!futil_is_file_writable(out_path))
+    cmd_print_usage("Cannot write to file: %s", out_path);
+
+  GraphFileReader gfile = INIT_GRAPH_READER;
+  graph_file_open(&gfile, argv[optind], true);
+
+  graph_index_build(&gfile, out_path);
+
+  graph_file_close(&gfile);
+
+  return EXIT_SUCCESS;
+}
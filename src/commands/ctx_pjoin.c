@@ -6,6 +6,7 @@
 #include "graph_format.h"
 #include "path_store.h"
 #include "path_format.h"
+#include "path_stream.h"
 
 const char pjoin_usage[] =
 "usage: "CMD" pjoin [options] <in1.ctp> [[offset:]in2.ctp[:0,2-4] ...]\n"
@@ -23,6 +24,11 @@ const char pjoin_usage[] =
 "  -f, --flatten          Dump into a single colour graph\n"
 "  -c, --outcols <C>      How many 'colours' should the output file have\n"
 "  -r, --noredundant      Remove redundant paths\n"
+"  -s, --sort             Write kmers in sorted order\n"
+"\n"
+"  If all input files are sorted (e.g. written with --sort), they are merged\n"
+"  in a single pass without loading paths into memory and -m is not needed.\n"
+"  The output is then also sorted.\n"
 "\n"
 "  Files can be specified with specific colours: samples.ctp:2,3\n"
 "  Offset specifies where to load the first colour: 3:samples.ctp\n"
@@ -42,6 +48,7 @@ static struct option longopts[] =
   {"flatten",      required_argument, NULL, 'f'},
   {"outcols",      required_argument, NULL, 'c'},
   {"noredundant",  required_argument, NULL, 'R'},
+  {"sort",         no_argument,       NULL, 's'},
   {NULL, 0, NULL, 0}
 };
 
@@ -49,7 +56,7 @@ int ctx_pjoin(int argc, char **argv)
 {
   size_t num_of_threads = 0;
   struct MemArgs memargs = MEM_ARGS_INIT;
-  bool overlap = false, flatten = false, noredundant = false;
+  bool overlap = false, flatten = false, noredundant = false, sort = false;
   size_t output_ncols = 0;
   char *graph_file = NULL;
   const char *out_ctp_path = NULL;
@@ -86,6 +93,7 @@ int ctx_pjoin(int argc, char **argv)
         output_ncols = cmd_parse_arg_uint32_nonzero(cmd, optarg);
         break;
       case 'R': if(noredundant) die("%s set twice", cmd); noredundant=true; break;
+      case 's': if(sort) die("%s set twice", cmd); sort=true; break;
       case ':': /* BADARG */
       case '?': /* BADCH getopt_long has already printed error */
         // cmd_print_usage(NULL);
@@ -150,6 +158,39 @@ int ctx_pjoin(int argc, char **argv)
                 output_ncols, total_cols);
   }
 
+  //
+  // Sorted inputs can be merged without loading them into memory
+  //
+  if(path_stream_files_compatible(pfiles, num_pfiles))
+  {
+    status("Input files are sorted, merging in a single pass");
+    if(graph_file != NULL) warn("Ignoring --graph: not needed to merge sorted files");
+
+    FILE *fout = fopen(out_ctp_path, "w");
+    if(fout == NULL) die("Cannot open output file: %s", out_ctp_path);
+    setvbuf(fout, NULL, _IOFBF, CTP_BUF_SIZE);
+
+    PathFileHeader pheader = INIT_PATH_FILE_HDR;
+    pheader.version = CTX_PATH_FILEFORMAT;
+    pheader.kmer_size = pfiles[0].hdr.kmer_size;
+    pheader.num_of_cols = (uint32_t)output_ncols;
+    paths_header_alloc(&pheader, output_ncols);
+
+    for(i = 0; i < num_pfiles; i++)
+      path_file_set_header_sample_names(&pfiles[i], &pheader);
+
+    path_stream_merge(pfiles, num_pfiles, noredundant, &pheader, fout);
+    fclose(fout);
+
+    status("Paths written to: %s\n", out_ctp_path);
+
+    paths_header_dealloc(&pheader);
+    for(i = 0; i < num_pfiles; i++) path_file_close(&pfiles[i]);
+    ctx_free(pfiles);
+
+    return EXIT_SUCCESS;
+  }
+
   // Open graph file to get number of kmers is passed
   uint64_t num_kmers = ctp_max_path_kmers;
   GraphFileReader gfile = INIT_GRAPH_READER;
@@ -245,8 +286,15 @@ int ctx_pjoin(int argc, char **argv)
   // Dump paths file
   setvbuf(fout, NULL, _IOFBF, CTP_BUF_SIZE);
   paths_header_update(&pheader, &db_graph.pstore);
-  paths_format_write_header(&pheader, fout);
-  paths_format_write_optimised_paths(&db_graph, fout);
+  if(sort) {
+    paths_header_set_sorted(&pheader);
+    paths_format_write_header(&pheader, fout);
+    paths_format_write_sorted_paths(&db_graph, fout);
+  }
+  else {
+    paths_format_write_header(&pheader, fout);
+    paths_format_write_optimised_paths(&db_graph, fout);
+  }
   fclose(fout);
 
   char pnum_str[100], pbytes_str[100], pkmers_str[100];
@@ -74,6 +74,8 @@ int ctx_pview(int argc, char **argv)
   printf("version: %u\n", phdr->version);
   printf("kmer size: %u\n", phdr->kmer_size);
   printf("colours: %u\n", phdr->num_of_cols);
+  if(phdr->version >= CTX_PATH_FILEFORMAT_FLAGS)
+    printf("sorted: %s\n", phdr->flags & PATH_FILE_SORTED ? "yes" : "no");
   printf("paths: %s\n", num_paths_str);
   printf("bytes: %s\n", path_bytes_str);
   printf("kmers starting paths: %s\n", kmers_with_paths_str);
@@ -117,7 +119,7 @@ int ctx_pview(int argc, char **argv)
   // Add kmers as reading
   bool add_kmers = true;
 
-  paths_format_load(&pfile, add_kmers, &db_graph);
+  paths_format_load(&pfile, add_kmers, 1, &db_graph);
 
   if(print_paths)
     db_graph_dump_paths_by_kmer(&db_graph);
@@ -10,6 +10,9 @@
 #include "binary_kmer.h"
 #include "seq_reader.h"
 #include "graph_format.h"
+#include "graph_mmap.h"
+#include "seq_output.h"
+#include "block_writer.h"
 
 const char reads_usage[] =
 "usage: "CMD" reads [options] <in.ctx>[:cols] [in2.ctx ...]\n"
@@ -18,24 +21,30 @@ const char reads_usage[] =
 "\n"
 "  -m, --memory <mem>          Memory to use\n"
 "  -n, --nkmers <kmers>        Number of hash table entries (e.g. 1G ~ 1 billion)\n"
+"  -t, --threads <T>           Threads used to compress output [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
 "  -f, --fasta                 Output as gzipped FASTA\n"
 "  -q, --fastq                 Output as gzipped FASTQ [default]\n"
 "  -v, --invert                Print reads/read pairs with no kmer in graph\n"
 "  -1, --seq <in> <O>          Writes output to <O>.fq.gz\n"
 "  -2, --seq2 <in1> <in2> <O>  Writes output to <O>.{1,2}.fq.gz\n"
 "  -i, --seqi <in> <O>         Writes output to <O>.{1,2}.fq.gz\n"
+"  -M, --mmap                  Query sorted graphs on disk instead of loading\n"
+"                              them (see `"CMD" sort`)\n"
 "\n"
 "  Can specify --seq/--seq2 multiple times.\n"
 "\n";
 
 typedef struct {
-  dBGraph *const db_graph;
+  dBGraph *const db_graph; // NULL if using memory mapped graphs
   LoadingStats *stats;
   char *in1, *in2;
-  gzFile out1, out2;
+  BlockWriter *out1, *out2;
+  StrBuf *sbuf;
   size_t num_of_reads_printed;
-  void (*print)(const read_t *r, gzFile gz, size_t linewrap);
+  void (*print)(StrBuf *sbuf, const read_t *r);
   bool invert;
+  GraphMmap *gms; // memory mapped graphs, used if db_graph is NULL
+  size_t num_gms, kmer_size;
 } AlignReadsData;
 
 static void get_out_path(char *path, size_t len, bool use_fq, int pe_num)
@@ -70,17 +79,40 @@ static void check_outfile_exists(char *outbase, bool is_pe, bool use_fq)
   }
 }
 
-static hkey_t find_node(BinaryKmer bkmer, const dBGraph *db_graph)
+// Kmer is in a memory mapped graph if it has coverage or edges in any of the
+// colours selected from the file (the same kmers graph_load() would load)
+static bool mmap_has_kmer(BinaryKmer bkey, const AlignReadsData *data)
 {
-  BinaryKmer bkey = bkmer_get_key(bkmer, db_graph->kmer_size);
-  return hash_table_find(&db_graph->ht, bkey);
+  size_t i, j, col;
+  const GraphMmap *gm;
+  hkey_t hkey;
+
+  for(i = 0; i < data->num_gms; i++) {
+    gm = &data->gms[i];
+    hkey = graph_mmap_find_key(&data->gms[i], bkey);
+    if(hkey != HASH_NOT_FOUND) {
+      for(j = 0; j < gm->file.fltr.ncols; j++) {
+        col = graph_file_fromcol(&gm->file, j);
+        if(graph_mmap_covg(gm, hkey, col) || graph_mmap_edges(gm, hkey, col))
+          return true;
+      }
+    }
+  }
+  return false;
 }
 
-static bool read_touches_graph(const read_t *r, const dBGraph *db_graph,
+static bool find_node(BinaryKmer bkmer, const AlignReadsData *data)
+{
+  BinaryKmer bkey = bkmer_get_key(bkmer, data->kmer_size);
+  if(data->db_graph == NULL) return mmap_has_kmer(bkey, data);
+  return hash_table_find(&data->db_graph->ht, bkey) != HASH_NOT_FOUND;
+}
+
+static bool read_touches_graph(const read_t *r, const AlignReadsData *data,
                                   LoadingStats *stats)
 {
   bool found = false;
-  size_t kmer_size = db_graph->kmer_size, num_contigs = 0, num_kmers_loaded = 0;
+  size_t kmer_size = data->kmer_size, num_contigs = 0, num_kmers_loaded = 0;
 
   if(r->seq.end >= kmer_size)
   {
@@ -96,14 +128,14 @@ static bool read_touches_graph(const read_t *r, const dBGraph *db_graph,
 
       bkmer = binary_kmer_from_str(r->seq.b + start, kmer_size);
       num_kmers_loaded++;
-      if(find_node(bkmer, db_graph) != HASH_NOT_FOUND) { found = true; break; }
+      if(find_node(bkmer, data)) { found = true; break; }
 
       for(i = start+kmer_size; i < end; i++)
       {
         nuc = dna_char_to_nuc(r->seq.b[i]);
         bkmer = binary_kmer_left_shift_add(bkmer, kmer_size, nuc);
         num_kmers_loaded++;
-        if(find_node(bkmer, db_graph) != HASH_NOT_FOUND) { found = true; break; }
+        if(find_node(bkmer, data)) { found = true; break; }
       }
     }
   }
@@ -118,29 +150,36 @@ static bool read_touches_graph(const read_t *r, const dBGraph *db_graph,
   return found;
 }
 
+static void print_read(const read_t *r, BlockWriter *bw,
+                       const AlignReadsData *data)
+{
+  strbuf_reset(data->sbuf);
+  data->print(data->sbuf, r);
+  block_writer_write(bw, 0, data->sbuf->buff, data->sbuf->len);
+}
+
 void filter_reads(read_t *r1, read_t *r2,
                   uint8_t qoffset1, uint8_t qoffset2, void *ptr)
 {
   (void)qoffset1; (void)qoffset2;
 
   AlignReadsData *data = (AlignReadsData*)ptr;
-  const dBGraph *db_graph = data->db_graph;
   LoadingStats *stats = data->stats;
 
-  bool touches_graph = read_touches_graph(r1, db_graph, stats) ||
-                          (r2 != NULL && read_touches_graph(r2, db_graph, stats));
+  bool touches_graph = read_touches_graph(r1, data, stats) ||
+                          (r2 != NULL && read_touches_graph(r2, data, stats));
 
   if(touches_graph != data->invert)
   {
     if(r2 != NULL) {
       // Print paired-end
-      gzFile out2 = data->out2 != NULL ? data->out2 : data->out1;
-      data->print(r1, data->out1, 0);
-      data->print(r2, out2, 0);
+      BlockWriter *out2 = data->out2 != NULL ? data->out2 : data->out1;
+      print_read(r1, data->out1, data);
+      print_read(r2, out2, data);
     }
     else {
       // Print single-ended
-      data->print(r1, data->out1, 0);
+      print_read(r1, data->out1, data);
     }
     data->num_of_reads_printed++;
   }
@@ -156,7 +195,7 @@ int ctx_reads(CmdArgs *args)
   // Check filelists are readable
   // Check output is writable
 
-  bool use_fq = false, use_fa = false, invert = false;
+  bool use_fq = false, use_fa = false, invert = false, use_mmap = false;
   seq_file_t **seqfiles = ctx_calloc(argc, sizeof(seq_file_t*));
   size_t num_sf = 0, sf = 0;
 
@@ -166,6 +205,7 @@ int ctx_reads(CmdArgs *args)
     if(!strcmp(argv[argi], "--fastq") || !strcmp(argv[argi],"-q")) use_fq = true;
     else if(!strcmp(argv[argi], "--fasta") || !strcmp(argv[argi],"-f")) use_fa = true;
     else if(!strcmp(argv[argi], "--invert") || !strcmp(argv[argi],"-v")) invert = true;
+    else if(!strcmp(argv[argi], "--mmap") || !strcmp(argv[argi],"-M")) use_mmap = true;
     else if(!strcmp(argv[argi], "--seq") || !strcmp(argv[argi],"-1"))
     {
       if(argi + 2 >= argc) cmd_print_usage("Missing arguments");
@@ -221,11 +261,13 @@ int ctx_reads(CmdArgs *args)
   //
   // Calculate memory use
   //
-  size_t kmers_in_hash, graph_mem;
+  size_t kmers_in_hash = 0, graph_mem;
 
-  kmers_in_hash = cmd_get_kmers_in_hash(args, 0, ctx_max_kmers, ctx_sum_kmers,
-                                        true, &graph_mem);
-  cmd_check_mem_limit(args->mem_to_use, graph_mem);
+  if(!use_mmap) {
+    kmers_in_hash = cmd_get_kmers_in_hash(args, 0, ctx_max_kmers, ctx_sum_kmers,
+                                          true, &graph_mem);
+    cmd_check_mem_limit(args->mem_to_use, graph_mem);
+  }
 
   //
   // Test output files
@@ -249,22 +291,35 @@ int ctx_reads(CmdArgs *args)
   //
   // Set up graph
   //
+  size_t kmer_size = gfiles[0].hdr.kmer_size;
   dBGraph db_graph;
-  db_graph_alloc(&db_graph, gfiles[0].hdr.kmer_size, 1, 0, kmers_in_hash);
-
-  // Load graphs
+  GraphMmap gms[use_mmap ? num_gfiles : 1];
   LoadingStats stats = LOAD_STATS_INIT_MACRO;
 
-  GraphLoadingPrefs gprefs = {.db_graph = &db_graph,
-                              .must_exist_in_graph = false,
-                              .empty_colours = true,
-                              .boolean_covgs = false};
-
-  for(i = 0; i < num_gfiles; i++) {
-    gfiles[i].fltr.flatten = true;
-    file_filter_update_intocol(&gfiles[i].fltr, 0);
-    graph_load(&gfiles[i], gprefs, &stats);
-    graph_file_close(&gfiles[i]);
+  if(use_mmap)
+  {
+    // Query files on disk, no hash table needed
+    for(i = 0; i < num_gfiles; i++) {
+      graph_file_close(&gfiles[i]);
+      graph_mmap_open(&gms[i], graph_paths[i]);
+    }
+  }
+  else
+  {
+    db_graph_alloc(&db_graph, kmer_size, 1, 0, kmers_in_hash);
+
+    // Load graphs
+    GraphLoadingPrefs gprefs = {.db_graph = &db_graph,
+                                .must_exist_in_graph = false,
+                                .empty_colours = true,
+                                .boolean_covgs = false};
+
+    for(i = 0; i < num_gfiles; i++) {
+      gfiles[i].fltr.flatten = true;
+      file_filter_update_intocol(&gfiles[i].fltr, 0);
+      graph_load(&gfiles[i], gprefs, &stats);
+      graph_file_close(&gfiles[i]);
+    }
   }
 
   status("Printing reads that do %stouch the graph\n", invert ? "not " : "");
@@ -275,6 +330,13 @@ int ctx_reads(CmdArgs *args)
   read_t r1, r2;
   size_t total_reads_printed = 0;
 
+  // Output is compressed by helper threads while we filter reads
+  size_t num_zthreads = args->max_work_threads;
+  BlockWriter bw1, bw2;
+  FILE *fout1, *fout2 = NULL;
+  StrBuf sbuf;
+  strbuf_alloc(&sbuf, 1024);
+
   if(seq_read_alloc(&r1) == NULL || seq_read_alloc(&r2) == NULL)
     die("Out of memory");
 
@@ -289,9 +351,11 @@ int ctx_reads(CmdArgs *args)
       char *in1 = NULL, *in2 = NULL, *out = NULL;
       size_t init_reads, reads_loaded;
 
-      AlignReadsData data = {&db_graph, &stats, in1, in2, NULL, NULL, 0,
-                             use_fq ? seq_gzprint_fastq : seq_gzprint_fasta,
-                             invert};
+      AlignReadsData data = {use_mmap ? NULL : &db_graph, &stats,
+                             in1, in2, NULL, NULL, &sbuf, 0,
+                             use_fq ? seq_output_fastq : seq_output_fasta,
+                             invert, gms, use_mmap ? num_gfiles : 0,
+                             kmer_size};
 
       if(is_se || is_interleaved) {
         in1 = argv[argi+1];
@@ -308,14 +372,20 @@ int ctx_reads(CmdArgs *args)
 
       memcpy(path1, out, pathlen);
       get_out_path(path1, pathlen, use_fq, is_pe ? 1 : 0);
-      if((data.out1 = gzopen(path1, "w")) == NULL)
+      if((fout1 = fopen(path1, "w")) == NULL)
         die("Cannot write to: %s", path1);
 
+      block_writer_open(&bw1, fout1, path1, true, false, 1, num_zthreads);
+      data.out1 = &bw1;
+
       if(is_pe || is_interleaved) {
         memcpy(path2, out, pathlen);
         get_out_path(path2, pathlen, use_fq, 2);
-        if((data.out2 = gzopen(path2, "w")) == NULL)
+        if((fout2 = fopen(path2, "w")) == NULL)
           die("Cannot write to: %s", path2);
+
+        block_writer_open(&bw2, fout2, path2, true, false, 1, num_zthreads);
+        data.out2 = &bw2;
       }
 
       init_reads = stats.num_se_reads + stats.num_pe_reads;
@@ -346,8 +416,13 @@ int ctx_reads(CmdArgs *args)
         sf++;
       }
 
-      gzclose(data.out1);
-      if(is_pe || is_interleaved) gzclose(data.out2);
+      block_writer_close(&bw1);
+      fclose(fout1);
+
+      if(is_pe || is_interleaved) {
+        block_writer_close(&bw2);
+        fclose(fout2);
+      }
 
       total_reads_printed += data.num_of_reads_printed;
       reads_loaded = stats.num_se_reads + stats.num_pe_reads - init_reads;
@@ -361,6 +436,7 @@ int ctx_reads(CmdArgs *args)
 
   seq_read_dealloc(&r1);
   seq_read_dealloc(&r2);
+  strbuf_dealloc(&sbuf);
 
   ctx_free(seqfiles);
 
@@ -368,7 +444,10 @@ int ctx_reads(CmdArgs *args)
 
   status("Total printed %zu / %zu reads\n", total_reads_printed, total_reads);
 
-  db_graph_dealloc(&db_graph);
+  if(use_mmap) {
+    for(i = 0; i < num_gfiles; i++) graph_mmap_close(&gms[i]);
+  }
+  else db_graph_dealloc(&db_graph);
 
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,54 @@
+#include "global.h"
+#include "commands.h"
+#include "util.h"
+#include "file_util.h"
+#include "graph_mmap.h"
+
+const char sort_usage[] =
+"usage: "CMD" sort [options] <in.ctx> [in2.ctx ...]\n"
+"\n"
+"  Sort the kmers in a graph file in place. Sorted graphs can be queried on\n"
+"  disk without loading them into memory (e.g. `"CMD" coverage --mmap`).\n"
+"\n"
+"  -h, --help   This help message\n"
+"\n";
+
+static struct option longopts[] =
+{
+  {"help", no_argument, NULL, 'h'},
+  {NULL, 0, NULL, 0}
+};
+
+int ctx_sort(int argc, char **argv)
+{
+  // Arg parsing
+  char shortopts[100];
+  cmd_long_opts_to_short(longopts, shortopts, sizeof(shortopts));
+  int c;
+
+  while((c = getopt_long_only(argc, argv, shortopts, longopts, NULL)) != -1) {
+    switch(c) {
+      case 0: /* flag set */ break;
+      case 'h': cmd_print_usage(NULL); break;
+      case ':': /* BADARG */
+      case '?': /* BADCH getopt_long has already printed error */
+        die("`"CMD" sort -h` for help. Bad option: %s", argv[optind-1]);
+      default: abort();
+    }
+  }
+
+  if(optind == argc) cmd_print_usage("Require input graph files (.ctx)");
+
+  int i;
+  for(i = optind; i < argc; i++) {
+    if(!futil_is_file_writable(argv[i]))
+      cmd_print_usage("Cannot write to file: %s", argv[i]);
+  }
+
+  for(i = optind; i < argc; i++)
+    graph_file_sort(argv[i]);
+
+  status("Done.");
+
+  return EXIT_SUCCESS;
+}
@@ -8,6 +8,7 @@
 #include "graph_format.h"
 #include "binary_kmer.h"
 #include "supernode.h"
+#include "block_writer.h"
 
 const char supernodes_usage[] =
 "usage: "CMD" supernodes [options] <in.ctx> [<in2.ctx> ...]\n"
@@ -138,66 +139,74 @@ static inline void dot_print_edges(hkey_t hkey, sndata_t *supernodes,
 
 struct SupernodePrinter
 {
-  FILE *fout;
-  pthread_mutex_t outlock;
+  BlockWriter bw;
+  StrBuf *bufs; // one per thread
   sndata_t *supernodes;
   size_t *supernode_idx;
   const int print_syntax;
   const dBGraph *db_graph;
 };
 
+// Each thread formats supernodes into its own buffer, no locking needed
 static void print_supernodes(const dBNodeBuffer *nbuf, size_t threadid, void *arg)
 {
-  (void)threadid;
   struct SupernodePrinter *prtr = (struct SupernodePrinter*)arg;
+  StrBuf *sbuf = &prtr->bufs[threadid];
+  const dBGraph *db_graph = prtr->db_graph;
 
-  supernode_normalise(nbuf->data, nbuf->len, prtr->db_graph);
+  supernode_normalise(nbuf->data, nbuf->len, db_graph);
 
   size_t idx = __sync_fetch_and_add((size_t volatile*)prtr->supernode_idx, 1);
-  FILE *fout = prtr->fout;
 
   if(prtr->print_syntax == PRINT_DOT)
     dot_store_ends(idx, nbuf, prtr->supernodes);
 
-  pthread_mutex_lock(&prtr->outlock);
+  strbuf_reset(sbuf);
 
-  if(prtr->print_syntax == PRINT_FASTA) {
-    fprintf(fout, ">supernode%zu\n", idx);
-    db_nodes_print(nbuf->data, nbuf->len, prtr->db_graph, fout);
-    fputc('\n', fout);
-  }
+  if(prtr->print_syntax == PRINT_FASTA)
+    strbuf_sprintf(sbuf, ">supernode%zu\n", idx);
   else {
     ctx_assert(prtr->print_syntax == PRINT_DOT);
-    fprintf(fout, "  node%zu [label=", idx);
-    db_nodes_print(nbuf->data, nbuf->len, prtr->db_graph, fout);
-    fputs("]\n", fout);
+    strbuf_sprintf(sbuf, "  node%zu [label=", idx);
   }
 
-  pthread_mutex_unlock(&prtr->outlock);
+  strbuf_ensure_capacity(sbuf, sbuf->len + nbuf->len + db_graph->kmer_size);
+  sbuf->len += db_nodes_to_str(nbuf->data, nbuf->len, db_graph,
+                               sbuf->buff + sbuf->len);
+
+  strbuf_append_str(sbuf, prtr->print_syntax == PRINT_FASTA ? "\n" : "]\n");
+  block_writer_write(&prtr->bw, threadid, sbuf->buff, sbuf->len);
 }
 
 // Returns number of supernodes printed
 static size_t print_all_supernodes(size_t nthreads, FILE *fout,
+                                   const char *out_path,
                                    int print_syntax, sndata_t *supernodes,
                                    uint8_t *visited, const dBGraph *db_graph)
 {
   ctx_assert(print_syntax == PRINT_FASTA || supernodes != NULL);
 
-  size_t next_snode_idx = 0;
-  struct SupernodePrinter printer = {.fout = fout,
-                                     .supernodes = supernodes,
+  size_t i, next_snode_idx = 0;
+  struct SupernodePrinter printer = {.supernodes = supernodes,
                                      .supernode_idx = &next_snode_idx,
                                      .print_syntax = print_syntax,
                                      .db_graph = db_graph};
 
-  if(pthread_mutex_init(&printer.outlock, NULL) != 0) die("Mutex init failed");
+  printer.bufs = ctx_calloc(nthreads, sizeof(StrBuf));
+  for(i = 0; i < nthreads; i++) strbuf_alloc(&printer.bufs[i], 1024);
+
+  block_writer_open(&printer.bw, fout, out_path, false, false, nthreads, 0);
   supernodes_iterate(nthreads, visited, db_graph, print_supernodes, &printer);
-  pthread_mutex_destroy(&printer.outlock);
+  block_writer_close(&printer.bw);
+
+  for(i = 0; i < nthreads; i++) strbuf_dealloc(&printer.bufs[i]);
+  ctx_free(printer.bufs);
 
   return next_snode_idx;
 }
 
-static size_t print_dot_syntax(size_t nthreads, FILE *fout,
+static size_t print_dot_syntax(size_t nthreads,
+                               FILE *fout, const char *out_path,
                                int print_syntax, bool dot_use_points,
                                uint8_t *visited, const dBGraph *db_graph)
 {
@@ -208,8 +217,9 @@ static size_t print_dot_syntax(size_t nthreads, FILE *fout,
 
   sndata_t *supernodes = ctx_calloc(db_graph->ht.capacity, sizeof(sndata_t));
 
-  size_t num_snodes = print_all_supernodes(nthreads, fout, print_syntax,
-                                           supernodes, visited, db_graph);
+  size_t num_snodes = print_all_supernodes(nthreads, fout, out_path,
+                                           print_syntax, supernodes,
+                                           visited, db_graph);
 
   // Now print edges
   fputc('\n', fout);
@@ -343,11 +353,13 @@ int ctx_supernodes(int argc, char **argv)
   // dump supernodes
   if(print_syntax == PRINT_FASTA) {
     num_snodes = print_all_supernodes(num_of_threads, fout,
+                                      futil_outpath_str(out_path),
                                       print_syntax, NULL,
                                       visited, &db_graph);
   }
   else {
     num_snodes = print_dot_syntax(num_of_threads, fout,
+                                  futil_outpath_str(out_path),
                                   print_syntax, dot_use_points,
                                   visited, &db_graph);
   }
@@ -10,6 +10,9 @@
 #include "generate_paths.h"
 #include "graph_paths.h"
 #include "read_thread_cmd.h"
+#include "db_adjacency.h"
+#include "graph_image.h"
+#include "path_spill.h"
 
 const char thread_usage[] =
 "usage: "CMD" thread [options] <in.ctx>\n"
@@ -18,16 +21,23 @@ const char thread_usage[] =
 "  have everyone in it and can be a pooled graph (with only 1 colour).  Samples\n"
 "  are loaded from <in.ctx> files one at a time.\n"
 "\n"
+"  If <in.ctx> has multiple colours, use --col <c> before sequence inputs to\n"
+"  thread them through colour <c>. Paths are saved to colour <c> of a single\n"
+"  multi-colour <out.ctp>.\n"
+"\n"
 "  -h, --help               This help message\n"
 "  -o, --out <out.ctp>      Save output file [required]\n"
 "  -m, --memory <mem>       Memory to use (e.g. 1M, 20GB)\n"
 "  -n, --nkmers <N>         Number of hash table entries (e.g. 1G ~ 1 billion)\n"
 "  -t, --threads <T>        Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
 "  -p, --paths <in.ctp>     Load path file (can specify multiple times)\n"
+"  -J, --load-image <in>    Load graph from an image of <in.ctx> if possible\n"
+"  -A, --adjacency          Cache neighbours of each kmer (faster, more memory)\n"
 // Non default:
 "  -1, --seq <in.fa>        Thread reads from file (supports sam,bam,fq,*.gz\n"
 "  -2, --seq2 <in1:in2>     Thread paired end sequences\n"
 "  -i, --seqi <in.bam>      Thread PE reads from a single file\n"
+"  -c, --col <c>            Thread following inputs through colour <c> [default: 0]\n"
 "  -f,--FR -F,--FF          Mate pair orientation [default: FR]\n"
 "    -r,--RF -R--RR\n"
 "  -w, --oneway             Use one-way gap filling (conservative)\n"
@@ -60,10 +70,13 @@ static struct option longopts[] =
   {"nkmers",       required_argument, NULL, 'n'},
   {"threads",      required_argument, NULL, 't'},
   {"paths",        required_argument, NULL, 'p'},
+  {"load-image",   required_argument, NULL, 'J'},
+  {"adjacency",    no_argument,       NULL, 'A'},
 // command specific
   {"seq",          required_argument, NULL, '1'},
   {"seq2",         required_argument, NULL, '2'},
   {"seqi",         required_argument, NULL, 'i'},
+  {"col",          required_argument, NULL, 'c'},
   {"FR",           no_argument,       NULL, 'f'},
   {"FF",           no_argument,       NULL, 'F'},
   {"RF",           no_argument,       NULL, 'r'},
@@ -98,6 +111,7 @@ int ctx_thread(int argc, char **argv)
   GraphFileReader *gfile = &args.gfile;
   PathFileBuffer *pfiles = &args.pfiles;
   CorrectAlnInputBuffer *inputs = &args.inputs;
+  size_t i, ncols = graph_file_usedcols(gfile);
 
   //
   // Decide on memory
@@ -106,10 +120,20 @@ int ctx_thread(int argc, char **argv)
 
   bits_per_kmer = sizeof(Edges)*8 +
                   sizeof(PathIndex)*8*(pfiles->len > 0 ? 2 : 1) +
-                  2*args.num_of_threads + // Have traversed
-                  1 + // node in colour
+                  ncols + // node in colour
                   1; // path store kmer lock
 
+  if(args.use_adjacency) bits_per_kmer += db_adj_bytes_per_kmer(2)*8;
+
+  // Paths are loaded before the graph, so we cannot use an image
+  if(args.load_image_path != NULL && pfiles->len > 0) {
+    warn("Cannot use --load-image with --paths, loading graph file");
+    args.load_image_path = NULL;
+  }
+
+  if(args.load_image_path != NULL)
+    cmd_mem_args_set_image(&args.memargs, args.load_image_path);
+
   // false -> don't use mem_to_use to decide how many kmers to store in hash
   // since we need some of that memory for storing paths
   kmers_in_hash = cmd_get_kmers_in_hash2(args.memargs.mem_to_use,
@@ -122,7 +146,7 @@ int ctx_thread(int argc, char **argv)
                                          false, &graph_mem);
 
   path_mem = path_files_mem_required(pfiles->data, pfiles->len, false, false,
-                                     args.path_max_usedcols, 0);
+                                     ncols, 0);
   path_mem = MAX2(args.memargs.mem_to_use - graph_mem, path_mem);
   cmd_print_mem(path_mem, "paths");
 
@@ -151,16 +175,16 @@ int ctx_thread(int argc, char **argv)
   //
   dBGraph db_graph;
   size_t kmer_size = gfile->hdr.kmer_size;
-  db_graph_alloc(&db_graph, kmer_size, 1, 1, kmers_in_hash);
+  db_graph_alloc(&db_graph, kmer_size, ncols, 1, kmers_in_hash);
   kmers_in_hash = db_graph.ht.capacity;
 
   // Edges
   db_graph.col_edges = ctx_calloc(kmers_in_hash, sizeof(Edges));
 
   // Path store
-  path_store_alloc(&db_graph.pstore, path_mem, true, kmers_in_hash, 1);
+  path_store_alloc(&db_graph.pstore, path_mem, true, kmers_in_hash, ncols);
 
-  // Keep counts in an extra byte per path
+  // Keep counts in an extra byte per path (shared by all colours)
   db_graph.pstore.extra_bytes = 1;
 
   // path kmer locks for multithreaded access
@@ -188,17 +212,20 @@ int ctx_thread(int argc, char **argv)
 
   // Set up paths header. This is for the output file we are creating
   PathFileHeader pheader = INIT_PATH_FILE_HDR_MACRO;
-  paths_header_alloc(&pheader, 1);
+  paths_header_alloc(&pheader, ncols);
 
-  pheader.num_of_cols = 1;
+  pheader.num_of_cols = ncols;
   pheader.kmer_size = kmer_size;
-  const char *sample_name = gfile->hdr.ginfo[gfile->fltr.cols[0]].sample_name.buff;
-  strbuf_set(&pheader.sample_names[0], sample_name);
+  for(i = 0; i < ncols; i++) {
+    const char *sample_name
+      = gfile->hdr.ginfo[graph_file_fromcol(gfile, i)].sample_name.buff;
+    strbuf_set(&pheader.sample_names[i], sample_name);
+  }
 
   // 2. reduce number of graph colours
-  db_graph_realloc(&db_graph, 1, 1);
+  db_graph_realloc(&db_graph, ncols, 1);
 
-  db_graph.node_in_cols = ctx_calloc(roundup_bits2bytes(kmers_in_hash), 1);
+  db_graph.node_in_cols = ctx_calloc(roundup_bits2bytes(kmers_in_hash)*ncols, 1);
 
   // Setup for loading graphs graph
   LoadingStats gstats;
@@ -211,24 +238,31 @@ int ctx_thread(int argc, char **argv)
                               .empty_colours = false}; // already loaded paths
 
   // Load graph, print stats, close file
-  graph_load(gfile, gprefs, &gstats);
+  if(args.load_image_path == NULL ||
+     !graph_image_load(args.load_image_path, gfile, 1, &db_graph)) {
+    graph_load(gfile, gprefs, &gstats);
+  }
   hash_table_print_stats_brief(&db_graph.ht);
   graph_file_close(gfile);
 
+  // Only paths are added from here on, the graph does not change
+  dBAdjacency adj;
+  if(args.use_adjacency && db_adj_build(&adj, args.num_of_threads, &db_graph))
+    db_graph.adj = &adj;
+
+  // Write paths to disk if we run out of memory
+  PathSpill spill;
+  path_spill_alloc(&spill, args.out_ctp_path, &db_graph);
+
   //
   // Start up the threads, do the work
   //
   GenPathWorker *workers;
-  workers = gen_paths_workers_alloc(args.num_of_threads, &db_graph, fout);
+  workers = gen_paths_workers_alloc(args.num_of_threads, &db_graph, &spill);
 
-  // Deal with a set of files at once
-  size_t start, end;
-  for(start = 0; start < inputs->len; start += args.num_of_threads)
-  {
-    // Can have different numbers of inputs vs threads
-    end = MIN2(inputs->len, start+args.num_of_threads);
-    generate_paths(inputs->data+start, end-start, workers, args.num_of_threads);
-  }
+  // All inputs go through one queue. All colours share the graph, path store
+  // and workers; each input threads into its own colour (crt_params.ctpcol)
+  generate_paths(inputs->data, inputs->len, workers, args.num_of_threads);
 
   // Output statistics
   LoadingStats stats = gen_paths_get_stats(workers);
@@ -289,10 +323,10 @@ int ctx_thread(int argc, char **argv)
   status("Estimate coverage to be %.2f [%zu / %zu], mean len: %.2f",
          covg, stats.num_kmers_loaded, (size_t)db_graph.ht.num_kmers, mean_klen);
 
+  // Set threshold if not given
+  uint8_t threshold = 0;
   if(args.clean_paths)
   {
-    // Set threshold if not given
-    uint8_t threshold;;
     if(args.clean_threshold == -1) {
       // DEV: calculate threshold
       threshold = 2;
@@ -300,24 +334,47 @@ int ctx_thread(int argc, char **argv)
       threshold = args.clean_threshold;
     }
 
-    if(threshold > 1)
-      graph_paths_clean(&db_graph, args.num_of_threads, threshold);
-    else
+    if(threshold < 2) {
       warn("Path cleaning threshold < 2 has no effect: %i", threshold);
+      threshold = 0;
+    }
+
+    // Path counts are not kept per colour
+    if(threshold > 0 && ncols > 1) {
+      warn("Cannot clean paths with multiple colours, skipping --clean");
+      threshold = 0;
+    }
   }
 
-  status("Saving paths to: %s", args.out_ctp_path);
+  if(spill.num_runs > 0)
+  {
+    // Paths have been written to disk, merge them into the output
+    status("Saving paths to: %s", args.out_ctp_path);
+    path_spill_write(&spill, &pheader, threshold, fout);
+  }
+  else
+  {
+    if(threshold > 0)
+      graph_paths_clean(&db_graph, args.num_of_threads, threshold);
+
+    // No need to de-fragment first: paths are written out as one contiguous
+    // list per kmer whatever their layout in memory
+    status("Saving paths to: %s", args.out_ctp_path);
+
+    // Update header and write
+    paths_header_update(&pheader, &db_graph.pstore);
+    paths_format_write_header(&pheader, fout);
+    paths_format_write_optimised_paths(&db_graph, fout);
+  }
 
-  // Update header and write
-  paths_header_update(&pheader, &db_graph.pstore);
-  paths_format_write_header(&pheader, fout);
-  paths_format_write_optimised_paths(&db_graph, fout);
   fclose(fout);
+  path_spill_dealloc(&spill);
 
   paths_header_dealloc(&pheader);
 
   read_thread_args_dealloc(&args);
 
+  if(db_graph.adj != NULL) db_adj_dealloc(&adj);
   db_graph_dealloc(&db_graph);
 
   return EXIT_SUCCESS;
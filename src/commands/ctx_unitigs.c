@@ -0,0 +1,158 @@
+#include "global.h"
+
+#include "commands.h"
+#include "util.h"
+#include "file_util.h"
+#include "db_graph.h"
+#include "graph_format.h"
+#include "unitig_index.h"
+
+const char unitigs_usage[] =
+"usage: "CMD" unitigs [options] <in.ctx> [in2.ctx ...]\n"
+"\n"
+"  Build an index of the unitigs (supernodes) in a graph: the kmers of each\n"
+"  unitig, its coverage in each colour and its neighbouring unitigs. Commands\n"
+"  that load the same graph files can reuse it with -U, --unitigs <in>; they\n"
+"  use the same hash table size (-n) so kmers do not need to be looked up.\n"
+"\n"
+"  -h, --help              This help message\n"
+"  -o, --out <out>         Save index [default: <in.ctx>.unitigs]\n"
+"  -m, --memory <mem>      Memory to use\n"
+"  -n, --nkmers <kmers>    Number of hash table entries (e.g. 1G ~ 1 billion)\n"
+"  -t, --threads <T>       Number of threads to use [default: "QUOTE_VALUE(DEFAULT_NTHREADS)"]\n"
+"\n";
+
+static struct option longopts[] =
+{
+// General options
+  {"help",         no_argument,       NULL, 'h'},
+  {"out",          required_argument, NULL, 'o'},
+  {"memory",       required_argument, NULL, 'm'},
+  {"nkmers",       required_argument, NULL, 'n'},
+  {"threads",      required_argument, NULL, 't'},
+  {NULL, 0, NULL, 0}
+};
+
+int ctx_unitigs(int argc, char **argv)
+{
+  size_t num_of_threads = 0;
+  struct MemArgs memargs = MEM_ARGS_INIT;
+  const char *out_path = NULL;
+
+  // Arg parsing
+  char cmd[100];
+  char shortopts[300];
+  cmd_long_opts_to_short(longopts, shortopts, sizeof(shortopts));
+  int c;
+
+  while((c = getopt_long_only(argc, argv, shortopts, longopts, NULL)) != -1) {
+    cmd_get_longopt_str(longopts, c, cmd, sizeof(cmd));
+    switch(c) {
+      case 0: /* flag set */ break;
+      case 'h': cmd_print_usage(NULL); break;
+      case 'o':
+        if(out_path != NULL) cmd_print_usage("%s given twice", cmd);
+        out_path = optarg;
+        break;
+      case 't':
+        if(num_of_threads) die("%s set twice", cmd);
+        num_of_threads = cmd_parse_arg_uint32_nonzero(cmd, optarg);
+        break;
+      case 'm': cmd_mem_args_set_memory(&memargs, optarg); break;
+      case 'n': cmd_mem_args_set_nkmers(&memargs, optarg); break;
+      case ':': /* BADARG */
+      case '?': /* BADCH getopt_long has already printed error */
+        die("`"CMD" unitigs -h` for help. Bad option: %s", argv[optind-1]);
+      default: abort();
+    }
+  }
+
+  // Defaults for unset values
+  if(num_of_threads == 0) num_of_threads = DEFAULT_NTHREADS;
+
+  if(optind >= argc) cmd_print_usage("Require input graph files (.ctx)");
+
+  //
+  // Open graph files
+  //
+  const size_t num_gfiles = argc - optind;
+  char **graph_paths = argv + optind;
+
+  GraphFileReader *gfiles = ctx_calloc(num_gfiles, sizeof(GraphFileReader));
+  size_t i, ncols, ctx_max_kmers = 0, ctx_sum_kmers = 0;
+
+  ncols = graph_files_open(graph_paths, gfiles, num_gfiles,
+                           &ctx_max_kmers, &ctx_sum_kmers);
+
+  // Default output is next to the first graph file
+  StrBuf default_out;
+  strbuf_alloc(&default_out, 256);
+  if(out_path == NULL) {
+    if(file_filter_isstdin(&gfiles[0].fltr))
+      cmd_print_usage("-o, --out <out> required when reading from STDIN");
+    strbuf_sprintf(&default_out, "%s.unitigs", gfiles[0].fltr.file_path.buff);
+    out_path = default_out.buff;
+  }
+
+  if(!futil_is_file_writable(out_path))
+    cmd_print_usage("Cannot write to file: %s", out_path);
+
+  //
+  // Decide on memory
+  //
+  size_t bits_per_kmer, kmers_in_hash, graph_mem;
+
+  // edges, covgs, unitig index, visited + claimed bits
+  bits_per_kmer = (sizeof(Edges) + sizeof(Covg)*ncols +
+                   UNITIG_INDEX_BYTES_PER_KMER) * 8 + 2;
+
+  kmers_in_hash = cmd_get_kmers_in_hash2(memargs.mem_to_use,
+                                         memargs.mem_to_use_set,
+                                         memargs.num_kmers,
+                                         memargs.num_kmers_set,
+                                         bits_per_kmer,
+                                         ctx_max_kmers, ctx_sum_kmers,
+                                         false, &graph_mem);
+
+  cmd_check_mem_limit(memargs.mem_to_use, graph_mem);
+
+  //
+  // Allocate memory
+  //
+  dBGraph db_graph;
+  db_graph_alloc(&db_graph, gfiles[0].hdr.kmer_size, ncols, 1, kmers_in_hash);
+  db_graph.col_edges = ctx_calloc(db_graph.ht.capacity, sizeof(Edges));
+  db_graph.col_covgs = ctx_calloc(db_graph.ht.capacity * ncols, sizeof(Covg));
+
+  //
+  // Load graphs
+  //
+  LoadingStats stats = LOAD_STATS_INIT_MACRO;
+
+  GraphLoadingPrefs gprefs = {.db_graph = &db_graph,
+                              .boolean_covgs = false,
+                              .must_exist_in_graph = false,
+                              .must_exist_in_edges = NULL,
+                              .empty_colours = true};
+
+  for(i = 0; i < num_gfiles; i++) {
+    graph_load(&gfiles[i], gprefs, &stats);
+    graph_file_close(&gfiles[i]);
+    gprefs.empty_colours = false;
+  }
+  ctx_free(gfiles);
+
+  hash_table_print_stats(&db_graph.ht);
+
+  status("Finding unitigs using %zu threads", num_of_threads);
+
+  UnitigIndex unitigs;
+  unitig_index_build(&unitigs, num_of_threads, &db_graph);
+  unitig_index_save(&unitigs, out_path, &db_graph);
+  unitig_index_dealloc(&unitigs);
+
+  strbuf_dealloc(&default_out);
+  db_graph_dealloc(&db_graph);
+
+  return EXIT_SUCCESS;
+}
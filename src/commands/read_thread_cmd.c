@@ -61,13 +61,23 @@ void read_thread_args_parse(struct ReadThreadCmdArgs *args,
         path_file_open(&tmp_pfile, optarg, true);
         pfile_buf_add(&args->pfiles, tmp_pfile);
         break;
+      case 'J':
+        if(args->load_image_path != NULL) die("%s set twice", cmd);
+        args->load_image_path = optarg;
+        break;
       case 't':
         if(args->num_of_threads != 0) die("%s set twice", cmd);
         args->num_of_threads = cmd_parse_arg_uint32_nonzero(cmd, optarg);
         break;
       case 'm': cmd_mem_args_set_memory(&args->memargs, optarg); break;
       case 'n': cmd_mem_args_set_nkmers(&args->memargs, optarg); break;
-      case 'c': args->colour = cmd_parse_arg_uint32(cmd, optarg); break;
+      case 'c':
+        if(correct_cmd) { args->colour = cmd_parse_arg_uint32(cmd, optarg); break; }
+        // thread: sample colour for following inputs
+        task.crt_params.ctxcol = task.crt_params.ctpcol
+          = cmd_parse_arg_uint32(cmd, optarg);
+        used = 0;
+        break;
       case '1':
       case '2':
       case 'i':
@@ -93,6 +103,8 @@ void read_thread_args_parse(struct ReadThreadCmdArgs *args,
       case 'S': args->dump_seq_sizes = optarg; dump_seq_n++; break;
       case 'M': args->dump_mp_sizes = optarg; dump_mp_n++; break;
       case 'u': args->use_new_paths = true; break;
+      case 'A': args->use_adjacency = true; break;
+      case 'O': args->ordered = true; break;
       case 'C':
         if(optarg == NULL || strcmp(optarg,"auto")) args->clean_threshold = -1;
         else if(parse_entire_int(optarg,&tmp_thresh) && tmp_thresh >= -1) {
@@ -139,8 +151,17 @@ void read_thread_args_parse(struct ReadThreadCmdArgs *args,
   GraphFileReader *gfile = &args->gfile;
   graph_file_open(gfile, graph_path, true);
   file_filter_update_intocol(&gfile->fltr, 0);
-  if(!correct_cmd && graph_file_usedcols(gfile) > 1)
-    die("Please specify a single colour e.g. %s:0", gfile->fltr.file_path.buff);
+  size_t graph_ncols = graph_file_usedcols(gfile);
+
+  if(!correct_cmd) {
+    for(i = 0; i < inputs->len; i++) {
+      if(inputs->data[i].crt_params.ctxcol >= graph_ncols) {
+        die("--col %zu is too large: graph only has %zu colour%s [%s]",
+            (size_t)inputs->data[i].crt_params.ctxcol, graph_ncols,
+            util_plural_str(graph_ncols), inputs->data[i].files.file1->path);
+      }
+    }
+  }
 
   //
   // Open path files
@@ -148,8 +169,10 @@ void read_thread_args_parse(struct ReadThreadCmdArgs *args,
   size_t path_max_usedcols = 0;
   for(i = 0; i < args->pfiles.len; i++) {
     // file_filter_update_intocol(&args->pfiles.data[i].fltr, 0);
-    if(!correct_cmd && path_file_usedcols(&args->pfiles.data[i]) > 1) {
-      die("Please specify a single colour e.g. %s:0",
+    // Path store only has as many colours as the graph
+    if(path_file_usedcols(&args->pfiles.data[i]) > graph_ncols) {
+      die("Path file has more colours than the graph (%zu > %zu): %s",
+          path_file_usedcols(&args->pfiles.data[i]), graph_ncols,
           args->pfiles.data[i].fltr.file_path.buff);
     }
     path_max_usedcols = MAX2(path_max_usedcols,
@@ -15,11 +15,13 @@ struct ReadThreadCmdArgs
 {
   size_t num_of_threads;
   struct MemArgs memargs;
-  char *graph_path, *out_ctp_path;
+  char *graph_path, *out_ctp_path, *load_image_path;
   bool use_new_paths, clean_paths;
+  bool use_adjacency; // cache neighbours of each kmer (db_adjacency.h)
   char *dump_seq_sizes, *dump_mp_sizes;
   int clean_threshold; // 0 => no cleaning, -1 => auto
-  size_t colour; // ctx_correct only
+  size_t colour; // ctx_correct only (ctx_thread sets inputs[].crt_params)
+  bool ordered; // ctx_correct only: keep reads in input order
 
   GraphFileReader gfile;
   PathFileBuffer pfiles;
@@ -33,12 +35,15 @@ struct ReadThreadCmdArgs
                                    .memargs = MEM_ARGS_INIT,           \
                                    .graph_path = NULL,                 \
                                    .out_ctp_path = NULL,               \
+                                   .load_image_path = NULL,            \
                                    .use_new_paths = false,             \
                                    .clean_paths = false,               \
+                                   .use_adjacency = false,             \
                                    .dump_seq_sizes = NULL,             \
                                    .dump_mp_sizes = NULL,              \
                                    .clean_threshold = 0,               \
                                    .colour = 0,                        \
+                                   .ordered = false,                   \
                                    .gfile = INIT_GRAPH_READER_MACRO,   \
                                    .pfiles = OBJBUF_INIT,              \
                                    .inputs = OBJBUF_INIT,              \
@@ -50,10 +55,10 @@ void read_thread_args_dealloc(struct ReadThreadCmdArgs *args);
 
 // If `correct_cmd` is true:
 //  - require --seq <in>:<out> instead of just --seq <in>
-//  - allow multiple colours to be loaded from one graph
+//  - --col <c> sets the colour to correct against
 // If `correct_cmd` is false:
 //  - do not take <out> argument with sequence files (e.g. --seq <in>)
-//  - do not allow a multicolour graph to be loaded
+//  - --col <c> sets the graph and path colour of following sequence inputs
 void read_thread_args_parse(struct ReadThreadCmdArgs *args,
                             int argc, char **argv,
                             const struct option *longopts, bool correct_cmd);
@@ -4,7 +4,8 @@
 #include "graph_info.h"
 #include "cmd.h" // define cmd_get_cmdline() and cmd_get_cwd()
 
-void caller_gzprint_ginfo(const GraphInfo *ginfo, size_t ncols, gzFile gzout)
+static void caller_print_ginfo(StrBuf *sbuf, const GraphInfo *ginfo,
+                               size_t ncols)
 {
   size_t col;
   StrBuf *sample_name = strbuf_new();
@@ -28,23 +29,25 @@ void caller_gzprint_ginfo(const GraphInfo *ginfo, size_t ncols, gzFile gzout)
       strbuf_set(sample_name, ginfo->sample_name.buff);
     }
 
-    gzprintf(gzout, "##colour=<ID=%s,name=\"%s\",colour=%i,"
-                    "meanreadlen=%zu,totalseqloaded=%zu,"
-                    "seqerror=%Lf,tipclipped=%s,removelowcovgsupernodes=%u,"
-                    "removelowcovgkmer=%u,cleanedagainstgraph=%s>\n",
-             sample_name->buff, ginfo->sample_name.buff, col,
-             (size_t)ginfo->mean_read_length, (size_t)ginfo->total_sequence,
-             ginfo->seq_err,
-             ec->cleaned_tips ? "yes" : "no", ec->clean_snodes_thresh,
-             ec->clean_kmers_thresh,
-             ec->intersection_name.buff);
+    strbuf_sprintf(sbuf, "##colour=<ID=%s,name=\"%s\",colour=%i,"
+                         "meanreadlen=%zu,totalseqloaded=%zu,"
+                         "seqerror=%Lf,tipclipped=%s,removelowcovgsupernodes=%u,"
+                         "removelowcovgkmer=%u,cleanedagainstgraph=%s>\n",
+                   sample_name->buff, ginfo->sample_name.buff, col,
+                   (size_t)ginfo->mean_read_length,
+                   (size_t)ginfo->total_sequence,
+                   ginfo->seq_err,
+                   ec->cleaned_tips ? "yes" : "no", ec->clean_snodes_thresh,
+                   ec->clean_kmers_thresh,
+                   ec->intersection_name.buff);
   }
 
   strbuf_free(sample_name);
 }
 
 // Print header with absolute path to a file
-void caller_gzprint_path_hdr(gzFile gzout, const char *name, const char *path)
+static void caller_print_path_hdr(StrBuf *sbuf, const char *name,
+                                  const char *path)
 {
   char absolute_path[PATH_MAX + 1];
 
@@ -53,25 +56,120 @@ void caller_gzprint_path_hdr(gzFile gzout, const char *name, const char *path)
   else
     path = absolute_path;
 
-  gzprintf(gzout, "##%s=%s\n", name, path);
+  strbuf_sprintf(sbuf, "##%s=%s\n", name, path);
 }
 
-void caller_gzprint_header(gzFile gzout, const char* out_file,
-                           const char *format_str, const dBGraph *db_graph)
+void caller_print_header(StrBuf *sbuf, const char* out_file,
+                         const char *format_str, const dBGraph *db_graph)
 {
   char datestr[9];
   time_t date = time(NULL);
   strftime(datestr, 9, "%Y%m%d", localtime(&date));
 
-  gzprintf(gzout, "##fileFormat=%s\n", format_str);
-  gzprintf(gzout, "##ctxCmd=\"%s\"\n", cmd_get_cmdline());
-  gzprintf(gzout, "##ctxCwd=%s\n", cmd_get_cwd());
-  gzprintf(gzout, "##ctxDate=%s\n", datestr);
-  gzprintf(gzout, "##ctxVersion=<version=%s,MAXK=%i>\n",
-           CTX_VERSION, MAX_KMER_SIZE);
-  gzprintf(gzout, "##ctxKmerSize=%u\n", db_graph->kmer_size);
-  caller_gzprint_path_hdr(gzout, "outPath", out_file);
-  gzprintf(gzout, "##ctxNumColoursUsedInCalling=%i\n", db_graph->num_of_cols);
-
-  caller_gzprint_ginfo(db_graph->ginfo, db_graph->num_of_cols, gzout);
+  strbuf_sprintf(sbuf, "##fileFormat=%s\n", format_str);
+  strbuf_sprintf(sbuf, "##ctxCmd=\"%s\"\n", cmd_get_cmdline());
+  strbuf_sprintf(sbuf, "##ctxCwd=%s\n", cmd_get_cwd());
+  strbuf_sprintf(sbuf, "##ctxDate=%s\n", datestr);
+  strbuf_sprintf(sbuf, "##ctxVersion=<version=%s,MAXK=%i>\n",
+                 CTX_VERSION, MAX_KMER_SIZE);
+  strbuf_sprintf(sbuf, "##ctxKmerSize=%u\n", db_graph->kmer_size);
+  caller_print_path_hdr(sbuf, "outPath", out_file);
+  strbuf_sprintf(sbuf, "##ctxNumColoursUsedInCalling=%i\n",
+                 db_graph->num_of_cols);
+
+  caller_print_ginfo(sbuf, db_graph->ginfo, db_graph->num_of_cols);
+}
+
+void caller_output_open(CallerOutput *out, FILE *fout, const char *path,
+                        const char *idprefix, size_t nthreads, bool sorted,
+                        const StrBuf *hdr)
+{
+  size_t i;
+
+  CallerOutput tmp = {.path = path, .idprefix = idprefix,
+                      .nthreads = nthreads, .sorted = sorted, .ncalls = 0,
+                      .tmp_fh = NULL, .tmp_ncalls = NULL};
+
+  memcpy(out, &tmp, sizeof(CallerOutput));
+
+  // Sorted: one producer (joining temp files), compress on helper threads
+  // Unsorted: each thread is a producer and compresses its own blocks
+  if(sorted) {
+    block_writer_open(&out->bw, fout, path, true, false, 1, nthreads);
+    out->tmp_fh = ctx_calloc(nthreads, sizeof(FILE*));
+    out->tmp_ncalls = ctx_calloc(nthreads, sizeof(size_t));
+    for(i = 0; i < nthreads; i++) {
+      if((out->tmp_fh[i] = tmpfile()) == NULL)
+        die("Cannot create temporary file [%s]", strerror(errno));
+    }
+  }
+  else {
+    block_writer_open(&out->bw, fout, path, true, false, nthreads, 0);
+  }
+
+  // Header goes in the first block
+  block_writer_write(&out->bw, 0, hdr->buff, hdr->len);
+  block_writer_flush(&out->bw, 0);
+}
+
+void caller_output_write(CallerOutput *out, size_t threadid,
+                         const StrBuf *sbuf)
+{
+  if(out->sorted) {
+    if(fwrite(sbuf->buff, 1, sbuf->len, out->tmp_fh[threadid]) != sbuf->len)
+      die("Cannot write to temporary file [%s]", strerror(errno));
+  }
+  else block_writer_write(&out->bw, threadid, sbuf->buff, sbuf->len);
+}
+
+// Copy a temporary file into the output, adding `offset` to call ids
+static void caller_output_join_tmp(CallerOutput *out, FILE *fh, size_t offset,
+                                   StrBuf *line, StrBuf *renum)
+{
+  const size_t plen = strlen(out->idprefix);
+  char *end;
+  size_t id;
+
+  if(fseek(fh, 0, SEEK_SET) != 0)
+    die("Cannot seek temporary file [%s]", strerror(errno));
+
+  while(strbuf_reset_readline(line, fh) > 0)
+  {
+    if(strncmp(line->buff, out->idprefix, plen) == 0) {
+      id = strtoul(line->buff+plen, &end, 10);
+      strbuf_reset(renum);
+      strbuf_sprintf(renum, "%s%zu", out->idprefix, offset+id);
+      strbuf_append_strn(renum, end, line->len - (end - line->buff));
+      block_writer_write(&out->bw, 0, renum->buff, renum->len);
+    }
+    else block_writer_write(&out->bw, 0, line->buff, line->len);
+  }
+
+  if(ferror(fh)) die("Cannot read temporary file [%s]", strerror(errno));
+}
+
+size_t caller_output_close(CallerOutput *out)
+{
+  size_t i, ncalls = out->ncalls;
+
+  if(out->sorted)
+  {
+    StrBuf line, renum;
+    strbuf_alloc(&line, 1024);
+    strbuf_alloc(&renum, 1024);
+
+    for(i = 0, ncalls = 0; i < out->nthreads; i++) {
+      caller_output_join_tmp(out, out->tmp_fh[i], ncalls, &line, &renum);
+      ncalls += out->tmp_ncalls[i];
+      fclose(out->tmp_fh[i]);
+    }
+
+    strbuf_dealloc(&line);
+    strbuf_dealloc(&renum);
+    ctx_free(out->tmp_fh);
+    ctx_free(out->tmp_ncalls);
+  }
+
+  block_writer_close(&out->bw);
+  return ncalls;
 }
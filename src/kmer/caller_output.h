@@ -2,8 +2,56 @@
 #define CALLER_OUTPUT_H_
 
 #include "db_graph.h"
+#include "block_writer.h"
 
-void caller_gzprint_header(gzFile gzout, const char* out_file,
-                           const char *format_str, const dBGraph *db_graph);
+//
+// Gzipped output shared by the bubble and breakpoint callers
+//
+// Each calling thread formats whole calls into its own buffer which is passed
+// to a BlockWriter and compressed by the calling thread as a gzip member - no
+// lock is held while printing or compressing.
+//
+// If `sorted` is set, output is reproducible between runs: each thread calls
+// a fixed range of the hash table in order, so writes its calls to a temporary
+// file, then files are concatenated in thread order giving calls sorted by
+// seed kmer. Call ids are local to a thread until then, and are renumbered as
+// files are joined, by matching lines that start with `idprefix` (e.g.
+// ">bubble."). Compression is then done by `nthreads` helper threads.
+//
+
+typedef struct
+{
+  BlockWriter bw;
+  const char *path, *idprefix;
+  size_t nthreads;
+  bool sorted;
+  size_t ncalls; // unsorted: shared counter
+  FILE **tmp_fh; // sorted: temporary file per thread
+  size_t *tmp_ncalls; // sorted: number of calls per thread
+} CallerOutput;
+
+// Header lines shared by all callers
+void caller_print_header(StrBuf *sbuf, const char* out_file,
+                         const char *format_str, const dBGraph *db_graph);
+
+// `fout` is not closed by caller_output_close()
+// `hdr` is written at the start of the file
+void caller_output_open(CallerOutput *out, FILE *fout, const char *path,
+                        const char *idprefix, size_t nthreads, bool sorted,
+                        const StrBuf *hdr);
+
+// Finish writing output, returns number of calls written
+size_t caller_output_close(CallerOutput *out);
+
+// Get id for a new call by thread `threadid`
+static inline size_t caller_output_callid(CallerOutput *out, size_t threadid)
+{
+  if(out->sorted) return out->tmp_ncalls[threadid]++;
+  return __sync_fetch_and_add((volatile size_t*)&out->ncalls, 1);
+}
+
+// Write one or more whole calls from thread `threadid`
+void caller_output_write(CallerOutput *out, size_t threadid,
+                         const StrBuf *sbuf);
 
 #endif /* CALLER_OUTPUT_H_ */
@@ -2,6 +2,8 @@
 #include "cmd_mem.h"
 #include "util.h"
 #include "hash_table.h" // for calculating mem usage
+#include "graph_image.h"
+#include "unitig_index.h"
 
 #include "misc/mem_size.h" // in libs/misc/
 
@@ -21,6 +23,24 @@ void cmd_mem_args_set_nkmers(struct MemArgs *mem, const char *arg)
   mem->num_kmers_set = true;
 }
 
+void cmd_mem_args_set_image(struct MemArgs *mem, const char *path)
+{
+  size_t capacity = graph_image_capacity(path);
+  if(capacity > 0 && !mem->num_kmers_set) {
+    mem->num_kmers = capacity;
+    mem->num_kmers_set = true;
+  }
+}
+
+void cmd_mem_args_set_unitigs(struct MemArgs *mem, const char *path)
+{
+  size_t capacity = unitig_index_capacity(path);
+  if(capacity > 0 && !mem->num_kmers_set) {
+    mem->num_kmers = capacity;
+    mem->num_kmers_set = true;
+  }
+}
+
 void cmd_print_mem(size_t mem_bytes, const char *name)
 {
   char mem_str[100];
@@ -17,6 +17,14 @@ struct MemArgs
 void cmd_mem_args_set_memory(struct MemArgs *mem, const char *arg);
 void cmd_mem_args_set_nkmers(struct MemArgs *mem, const char *arg);
 
+// Use a hash table big enough to load a graph image (--load-image), unless
+// -n <kmers> was given. Does nothing if the image cannot be loaded.
+void cmd_mem_args_set_image(struct MemArgs *mem, const char *path);
+
+// Use the hash table size a unitig index (-U, --unitigs) was built with,
+// unless -n <kmers> was given. Does nothing if the index cannot be read.
+void cmd_mem_args_set_unitigs(struct MemArgs *mem, const char *path);
+
 // If your command accepts -n <kmers> and -m <mem> this may be useful
 // extra_bits_per_kmer is additional memory per node, above hash table for
 // BinaryKmers
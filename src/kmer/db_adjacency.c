@@ -0,0 +1,131 @@
+#include "global.h"
+#include "db_adjacency.h"
+#include "util.h"
+
+typedef struct
+{
+  dBAdjacency *adj;
+  size_t start, end; // blocks
+  const dBGraph *db_graph;
+} dBAdjJob;
+
+static inline Edges db_adj_node_edges(hkey_t hkey, const dBGraph *db_graph)
+{
+  return db_graph_node_assigned(db_graph, hkey)
+           ? db_node_get_edges_union(db_graph, hkey) : 0;
+}
+
+// Count neighbours within each block
+static void db_adj_count_thread(void *arg)
+{
+  dBAdjJob *job = (dBAdjJob*)arg;
+  dBAdjacency *adj = job->adj;
+  size_t b, count, hkey, end;
+
+  for(b = job->start; b < job->end; b++) {
+    end = MIN2((b+1)*DB_ADJ_BLOCK, adj->capacity);
+    for(count = 0, hkey = b*DB_ADJ_BLOCK; hkey < end; hkey++) {
+      adj->offsets[hkey] = count;
+      count += __builtin_popcount(db_adj_node_edges(hkey, job->db_graph));
+    }
+    adj->blocks[b] = count;
+  }
+}
+
+static void db_adj_fill_thread(void *arg)
+{
+  dBAdjJob *job = (dBAdjJob*)arg;
+  dBAdjacency *adj = job->adj;
+  const dBGraph *db_graph = job->db_graph;
+  size_t hkey, end = MIN2(job->end*DB_ADJ_BLOCK, adj->capacity);
+  size_t i, n, idx;
+  Orientation orient;
+  BinaryKmer bkey;
+  Edges edges;
+  dBNode nodes[4];
+  Nucleotide nucs[4];
+  uint64_t v;
+
+  for(hkey = job->start*DB_ADJ_BLOCK; hkey < end; hkey++)
+  {
+    if(!(edges = db_adj_node_edges(hkey, db_graph))) continue;
+
+    bkey = db_node_get_bkmer(db_graph, hkey);
+    idx = adj->blocks[hkey / DB_ADJ_BLOCK] + adj->offsets[hkey];
+
+    for(orient = 0; orient < 2; orient++) {
+      n = db_graph_next_nodes(db_graph, bkey, orient, edges, nodes, nucs);
+      for(i = 0; i < n; i++, idx++) {
+        v = ((uint64_t)nodes[i].key << 1) | nodes[i].orient;
+        memcpy(adj->nodes + idx*DB_ADJ_NODE_BYTES, &v, DB_ADJ_NODE_BYTES);
+      }
+    }
+  }
+}
+
+static void db_adj_run(dBAdjacency *adj, size_t nthreads,
+                       const dBGraph *db_graph, void (*func)(void*))
+{
+  size_t i, nblocks = (adj->capacity + DB_ADJ_BLOCK - 1) / DB_ADJ_BLOCK;
+  dBAdjJob *jobs = ctx_calloc(nthreads, sizeof(dBAdjJob));
+
+  for(i = 0; i < nthreads; i++) {
+    jobs[i].adj = adj;
+    jobs[i].start = (nblocks * i) / nthreads;
+    jobs[i].end = (nblocks * (i+1)) / nthreads;
+    jobs[i].db_graph = db_graph;
+  }
+
+  util_run_threads(jobs, nthreads, sizeof(dBAdjJob), nthreads, func);
+  ctx_free(jobs);
+}
+
+bool db_adj_build(dBAdjacency *adj, size_t nthreads, const dBGraph *db_graph)
+{
+  size_t b, tmp, nblocks, capacity = db_graph->ht.capacity;
+  uint64_t sum = 0;
+  char mem_str[50];
+
+  memset(adj, 0, sizeof(dBAdjacency));
+
+  if(capacity >= DB_ADJ_MAX_CAPACITY) {
+    warn("Hash table too large for adjacency cache");
+    return false;
+  }
+
+  nblocks = (capacity + DB_ADJ_BLOCK - 1) / DB_ADJ_BLOCK;
+  adj->capacity = capacity;
+  adj->blocks = ctx_malloc(nblocks * sizeof(uint64_t));
+  adj->offsets = ctx_malloc(capacity * sizeof(uint16_t));
+
+  db_adj_run(adj, nthreads, db_graph, db_adj_count_thread);
+
+  // Cumulative sum of block counts
+  for(b = 0; b < nblocks; b++) {
+    tmp = adj->blocks[b];
+    adj->blocks[b] = sum;
+    sum += tmp;
+  }
+
+  adj->num_nodes = sum;
+  // Padding so that we can always read 8 bytes
+  adj->nodes = ctx_malloc(sum*DB_ADJ_NODE_BYTES + sizeof(uint64_t));
+  memset(adj->nodes + sum*DB_ADJ_NODE_BYTES, 0, sizeof(uint64_t));
+
+  db_adj_run(adj, nthreads, db_graph, db_adj_fill_thread);
+
+  bytes_to_str(nblocks*sizeof(uint64_t) + capacity*sizeof(uint16_t) +
+               sum*DB_ADJ_NODE_BYTES, 1, mem_str);
+  status("[adjacency] Cached %zu neighbours of %zu kmers [%s]",
+         (size_t)sum, (size_t)db_graph->ht.num_kmers, mem_str);
+
+  return true;
+}
+
+void db_adj_dealloc(dBAdjacency *adj)
+{
+  ctx_free(adj->blocks);
+  ctx_free(adj->offsets);
+  ctx_free(adj->nodes);
+  memset(adj, 0, sizeof(dBAdjacency));
+}
@@ -0,0 +1,82 @@
+#ifndef DB_ADJACENCY_H_
+#define DB_ADJACENCY_H_
+
+#include "db_graph.h"
+#include "db_node.h"
+
+//
+// Adjacency cache
+//
+// For each kmer, store the neighbours reached by each of its edges (merged
+// across colours), so that traversal can look them up without rebuilding and
+// hashing each neighbouring kmer. Only for graphs that do not change once the
+// cache is built. Attach with db_graph->adj.
+//
+// Neighbours are stored in hkey order, and for each kmer in order of edge bit
+// (forward A,C,G,T then reverse A,C,G,T). Each is 40 bits: hkey<<1 | orient,
+// where orient is the orientation we enter the neighbour in when walking out of
+// the kmer in the orientation of the edge.
+// The first neighbour of a kmer is found from a count per block of 64 hash
+// table entries plus a 16 bit offset within the block.
+//
+
+#define DB_ADJ_BLOCK 64
+#define DB_ADJ_NODE_BYTES 5
+#define DB_ADJ_MAX_CAPACITY (1UL<<39)
+
+typedef struct dBAdjacency
+{
+  size_t capacity, num_nodes;
+  uint64_t *blocks; // neighbours before each block of DB_ADJ_BLOCK kmers
+  uint16_t *offsets; // neighbours before kmer within its block
+  uint8_t *nodes; // DB_ADJ_NODE_BYTES per neighbour, plus padding
+} dBAdjacency;
+
+// Memory per kmer for a graph with `edges_per_kmer` edges per kmer on average.
+// Each edge is stored from both ends, so a simple path has 2 per kmer.
+#define db_adj_bytes_per_kmer(edges_per_kmer) \
+        (sizeof(uint16_t) + (edges_per_kmer)*DB_ADJ_NODE_BYTES + 1)
+
+// Returns false (and prints why) if the cache cannot be built for this graph
+bool db_adj_build(dBAdjacency *adj, size_t nthreads, const dBGraph *db_graph);
+void db_adj_dealloc(dBAdjacency *adj);
+
+static inline dBNode db_adj_get(const dBAdjacency *adj, size_t idx)
+{
+  uint64_t v = 0;
+  memcpy(&v, adj->nodes + idx*DB_ADJ_NODE_BYTES, sizeof(v));
+  v &= (1UL << (DB_ADJ_NODE_BYTES*8)) - 1;
+  return (dBNode){.key = v >> 1, .orient = v & 1};
+}
+
+// Same result as db_graph_next_nodes(), `union_edges` are all edges of
+// node.key and `edges` is the subset to follow.
+static inline uint8_t db_adj_next_nodes(const dBAdjacency *adj, dBNode node,
+                                        Edges union_edges, Edges edges,
+                                        dBNode nodes[4], Nucleotide fw_nucs[4])
+{
+  size_t idx = adj->blocks[node.key / DB_ADJ_BLOCK] + adj->offsets[node.key];
+  Edges all = edges_with_orientation(union_edges, node.orient);
+  uint8_t count = 0;
+  Nucleotide nuc;
+
+  // Reverse neighbours come after forward ones
+  if(node.orient == REVERSE)
+    idx += edges_get_outdegree(union_edges, FORWARD);
+
+  edges = edges_with_orientation(edges, node.orient);
+
+  for(nuc = 0; nuc < 4; nuc++) {
+    if(edges & (1U << nuc)) {
+      ctx_assert(all & (1U << nuc));
+      nodes[count] = db_adj_get(adj, idx);
+      fw_nucs[count] = nuc;
+      count++;
+    }
+    idx += (all >> nuc) & 1;
+  }
+
+  return count;
+}
+
+#endif /* DB_ADJACENCY_H_ */
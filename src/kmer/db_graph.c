@@ -3,6 +3,7 @@
 #include "binary_kmer.h"
 #include "db_graph.h"
 #include "db_node.h"
+#include "db_adjacency.h"
 #include "graph_info.h"
 #include "path_store.h"
 #include "packed_path.h"
@@ -30,7 +31,8 @@ void db_graph_alloc(dBGraph *db_graph, size_t kmer_size,
                  .col_edges = NULL,
                  .col_covgs = NULL,
                  .node_in_cols = NULL,
-                 .readstrt = NULL};
+                 .readstrt = NULL,
+                 .unitigs = NULL, .adj = NULL};
 
   ctx_assert(num_of_cols > 0);
   ctx_assert(capacity > 0);
@@ -74,7 +76,9 @@ void db_graph_realloc(dBGraph *graph, size_t num_of_cols, size_t num_edge_cols)
                  .col_covgs = graph->col_covgs,
                  .node_in_cols = graph->node_in_cols,
                  .pstore = graph->pstore,
-                 .readstrt = graph->readstrt};
+                 .readstrt = graph->readstrt,
+                 .unitigs = graph->unitigs,
+                 .adj = graph->adj};
 
   memcpy(graph, &tmp, sizeof(dBGraph));
   db_graph_status(graph);
@@ -239,6 +243,22 @@ uint8_t db_graph_next_nodes(const dBGraph *db_graph, const BinaryKmer node_bkey,
   return count;
 }
 
+uint8_t db_graph_next_nodes2(const dBGraph *db_graph, hkey_t hkey,
+                             const BinaryKmer node_bkey, Orientation orient,
+                             Edges edges,
+                             dBNode nodes[4], Nucleotide fw_nucs[4])
+{
+  if(db_graph->adj != NULL) {
+    dBNode node = {.key = hkey, .orient = orient};
+    return db_adj_next_nodes(db_graph->adj, node,
+                             db_node_get_edges_union(db_graph, hkey), edges,
+                             nodes, fw_nucs);
+  }
+
+  return db_graph_next_nodes(db_graph, node_bkey, orient, edges,
+                             nodes, fw_nucs);
+}
+
 // Check kmer size of a file
 // Used when loading graph and path files
 void db_graph_check_kmer_size(size_t kmer_size, const char *path)
@@ -455,8 +475,7 @@ void db_graph_dump_paths_by_kmer(const dBGraph *db_graph)
   printf("-----------------------\n\n");
 }
 
-// call seed_random() before any calls to this function please
-hkey_t db_graph_rand_node(const dBGraph *db_graph)
+hkey_t db_graph_rand_node(const dBGraph *db_graph, unsigned int *rand_state)
 {
   uint64_t capacity = db_graph->ht.capacity;
   BinaryKmer *table = db_graph->ht.table;
@@ -469,7 +488,7 @@ hkey_t db_graph_rand_node(const dBGraph *db_graph)
 
   while(1)
   {
-    hkey = (hkey_t)((rand() / (double)RAND_MAX) * capacity);
+    hkey = (hkey_t)((rand_r(rand_state) / (RAND_MAX+1.0)) * capacity);
     if(HASH_ENTRY_ASSIGNED(table[hkey])) return hkey;
   }
 }
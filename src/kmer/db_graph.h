@@ -10,6 +10,9 @@
 #include "graph_info.h"
 #include "path_store.h"
 
+struct UnitigIndex;
+struct dBAdjacency;
+
 //
 // Graph
 //
@@ -50,6 +53,12 @@ typedef struct
 
   // Loading reads, 2 bits per kmers
   uint8_t *readstrt;
+
+  // Index of unitigs, not owned by the graph (see unitig_index.h)
+  const struct UnitigIndex *unitigs;
+
+  // Neighbours of each kmer, not owned by the graph (see db_adjacency.h)
+  const struct dBAdjacency *adj;
 } dBGraph;
 
 #define db_graph_node_assigned(graph,hkey) HASH_ENTRY_ASSIGNED((graph)->ht.table[hkey])
@@ -111,6 +120,13 @@ uint8_t db_graph_next_nodes(const dBGraph *db_graph, const BinaryKmer node_bkey,
                             Orientation orient, Edges edges,
                             dBNode nodes[4], Nucleotide fw_nucs[4]);
 
+// As db_graph_next_nodes() but also given the node's hkey, so that neighbours
+// are read from the adjacency cache (db_graph->adj) if there is one
+uint8_t db_graph_next_nodes2(const dBGraph *db_graph, hkey_t hkey,
+                             const BinaryKmer node_bkey, Orientation orient,
+                             Edges edges,
+                             dBNode nodes[4], Nucleotide fw_nucs[4]);
+
 // Check kmer size of a file
 void db_graph_check_kmer_size(size_t kmer_size, const char *path);
 
@@ -131,8 +147,8 @@ void db_graph_add_all_edges(dBGraph *db_graph);
 void db_graph_dump_paths_by_kmer(const dBGraph *db_graph);
 
 // Get a random node from the graph
-// call seed_random() before any calls to this function please
-hkey_t db_graph_rand_node(const dBGraph *db_graph);
+// `rand_state` is passed to rand_r(), so each thread should have its own
+hkey_t db_graph_rand_node(const dBGraph *db_graph, unsigned int *rand_state);
 
 //
 // Printing
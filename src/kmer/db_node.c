@@ -47,8 +47,8 @@ Edges db_node_edges_in_col(dBNode node, size_t col, const dBGraph *db_graph)
   Nucleotide nucs[4];
   size_t i, n;
 
-  n = db_graph_next_nodes(db_graph, bkmer, node.orient,
-                          edges, nodes, nucs);
+  n = db_graph_next_nodes2(db_graph, node.key, bkmer, node.orient,
+                           edges, nodes, nucs);
 
   edges = 0;
   if(db_graph->node_in_cols != NULL) {
@@ -2,6 +2,7 @@
 #include "graph_cache.h"
 #include "binary_seq.h"
 #include "supernode.h"
+#include "unitig_index.h"
 
 #include "sort_r/sort_r.h"
 
@@ -43,6 +44,42 @@ uint32_t graph_cache_new_path(GraphCache *cache)
   return cache_path_buf_add(&cache->path_buf, path);
 }
 
+// Create a supernode from the unitig index, no hash table lookups needed
+static inline void _create_supernode_from_index(GraphCache *cache,
+                                                const Unitig *ut,
+                                                GCacheSnode *snode)
+{
+  const UnitigIndex *ui = cache->db_graph->unitigs;
+  size_t i, first_node_id = cache->node_buf.len;
+  dBNode prev_nodes[4] = {{0}}, next_nodes[4] = {{0}};
+
+  db_node_buf_append(&cache->node_buf, (dBNode*)unitig_index_nodes(ui, ut),
+                     ut->len);
+
+  for(i = 0; i < ut->num_prev; i++)
+    prev_nodes[i] = unitig_index_link_node(ui, ut->prev[i]);
+  for(i = 0; i < ut->num_next; i++)
+    next_nodes[i] = unitig_index_link_node(ui, ut->next[i]);
+
+  GCacheSnode tmp = {.first_node_id = first_node_id,
+                     .num_nodes = ut->len,
+                     .first_step = UINT32_MAX,
+                     .num_prev = ut->num_prev,
+                     .prev_bases = ut->prev_bases,
+                     .prev_nodes[0] = prev_nodes[0],
+                     .prev_nodes[1] = prev_nodes[1],
+                     .prev_nodes[2] = prev_nodes[2],
+                     .prev_nodes[3] = prev_nodes[3],
+                     .num_next = ut->num_next,
+                     .next_bases = ut->next_bases,
+                     .next_nodes[0] = next_nodes[0],
+                     .next_nodes[1] = next_nodes[1],
+                     .next_nodes[2] = next_nodes[2],
+                     .next_nodes[3] = next_nodes[3]};
+
+  memcpy(snode, &tmp, sizeof(GCacheSnode));
+}
+
 // Create a supernode starting at node/or.  Store in snode.
 // Ensure snode->nodes and snode->orients point to valid memory before passing
 // Returns 0 on failure, otherwise snode->num_of_nodes
@@ -50,8 +87,17 @@ static inline void _create_supernode(GraphCache *cache, dBNode node,
                                      GCacheSnode *snode)
 {
   const dBGraph *db_graph = cache->db_graph;
+  const UnitigIndex *ui = db_graph->unitigs;
   ctx_assert(db_graph->num_edge_cols == 1);
 
+  if(ui != NULL && unitig_index_is_start(ui, node)) {
+    const Unitig *ut = &ui->unitigs[ui->pos[node.key].uid];
+    if(ut->links_ok) {
+      _create_supernode_from_index(cache, ut, snode);
+      return;
+    }
+  }
+
   size_t first_node_id = cache->node_buf.len;
   db_node_buf_add(&cache->node_buf, node);
   supernode_extend(&cache->node_buf, 0, db_graph);
@@ -76,14 +122,14 @@ static inline void _create_supernode(GraphCache *cache, dBNode node,
   // prev nodes
   union_edges = db_node_get_edges_union(db_graph, first.key);
   bkmer0 = db_node_get_bkmer(db_graph, first.key);
-  num_prev = db_graph_next_nodes(db_graph, bkmer0, first.orient, union_edges,
-                                 prev_nodes, prev_bases);
+  num_prev = db_graph_next_nodes2(db_graph, first.key, bkmer0, first.orient,
+                                  union_edges, prev_nodes, prev_bases);
 
   // next nodes
   union_edges = db_node_get_edges_union(db_graph, last.key);
   bkmer1 = db_node_get_bkmer(db_graph, last.key);
-  num_next = db_graph_next_nodes(db_graph, bkmer1, last.orient, union_edges,
-                                 next_nodes, next_bases);
+  num_next = db_graph_next_nodes2(db_graph, last.key, bkmer1, last.orient,
+                                  union_edges, next_nodes, next_bases);
 
   uint8_t prev_packed = binary_seq_pack_byte(prev_bases);
   uint8_t next_packed = binary_seq_pack_byte(next_bases);
@@ -91,29 +91,6 @@ uint32_t graph_crawler_load_path_limit(GraphCache *cache, dBNode node,
 }
 
 
-void graph_crawler_reset_rpt_walker(RepeatWalker *rptwlk,
-                                    const GraphCache *cache, uint32_t pathid)
-{
-  rpt_walker_fast_clear(rptwlk, NULL, 0);
-
-  const GCachePath *path = graph_cache_path(cache, pathid);
-  const GCacheStep *step = graph_cache_step(cache, path->first_step), *endstep;
-  const GCacheSnode *snode;
-  const dBNode *node0, *node1;
-
-  // Loop over supernodes in the path
-  for(endstep = step + path->num_steps; step < endstep; step++)
-  {
-    // We don't care about orientation here
-    snode = graph_cache_snode(cache, step->supernode);
-    node0 = graph_cache_first_node(cache, snode);
-    node1 = graph_cache_last_node(cache, snode);
-    rpt_walker_fast_clear_single_node(rptwlk, *node0);
-    rpt_walker_fast_clear_single_node(rptwlk, *node1);
-  }
-}
-
-
 void graph_crawler_alloc(GraphCrawler *crawler, const dBGraph *db_graph)
 {
   ctx_assert(db_graph->node_in_cols != NULL);
@@ -209,7 +186,7 @@ void graph_crawler_fetch(GraphCrawler *crawler, dBNode node0,
       if(endfunc != NULL) endfunc(cache, pathid, arg);
 
       graph_walker_finish(wlk);
-      graph_crawler_reset_rpt_walker(rptwlk, cache, pathid);
+      rpt_walker_clear(rptwlk);
 
       unipaths[num_unicol_paths++] = (GCUniColPath){.colour = col,
                                                     .pathid = pathid};
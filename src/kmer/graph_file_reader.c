@@ -65,23 +65,12 @@ void graph_file_close(GraphFileReader *file)
   graph_header_dealloc(&file->hdr);
 }
 
-// Read a kmer from the file
-// returns true on success, false otherwise
-// prints warnings if dirty kmers in file
-bool graph_file_read(const GraphFileReader *file,
-                     BinaryKmer *bkmer, Covg *covgs, Edges *edges)
+static inline void graph_file_filter_cols(const FileFilter *fltr,
+                                          const Covg *kmercovgs,
+                                          const Edges *kmeredges,
+                                          Covg *covgs, Edges *edges)
 {
-  // status("Header colours: %u", file->hdr.num_of_cols);
-  Covg kmercovgs[file->hdr.num_of_cols];
-  Edges kmeredges[file->hdr.num_of_cols];
   size_t i;
-  const FileFilter *fltr = &file->fltr;
-
-  if(!graph_file_read_kmer(fltr->fh, &file->hdr, fltr->file_path.buff,
-                           bkmer, kmercovgs, kmeredges)) return false;
-
-  // covgs += file->intocol;
-  // edges += file->intocol;
 
   if(fltr->flatten) {
     covgs[0] = 0;
@@ -97,10 +86,59 @@ bool graph_file_read(const GraphFileReader *file,
       edges[i] = kmeredges[fltr->cols[i]];
     }
   }
+}
+
+// Read a kmer from the file
+// returns true on success, false otherwise
+// prints warnings if dirty kmers in file
+bool graph_file_read(const GraphFileReader *file,
+                     BinaryKmer *bkmer, Covg *covgs, Edges *edges)
+{
+  // status("Header colours: %u", file->hdr.num_of_cols);
+  Covg kmercovgs[file->hdr.num_of_cols];
+  Edges kmeredges[file->hdr.num_of_cols];
+  const FileFilter *fltr = &file->fltr;
+
+  if(!graph_file_read_kmer(fltr->fh, &file->hdr, fltr->file_path.buff,
+                           bkmer, kmercovgs, kmeredges)) return false;
+
+  // covgs += file->intocol;
+  // edges += file->intocol;
+
+  graph_file_filter_cols(fltr, kmercovgs, kmeredges, covgs, edges);
 
   return true;
 }
 
+// Bytes of kmer data left to read, SIZE_MAX if reading from a stream
+size_t graph_file_bytes_remaining(const GraphFileReader *file)
+{
+  if(file->fltr.file_size == -1) return SIZE_MAX;
+  return (size_t)(file->fltr.file_size - file->hdr_size);
+}
+
+// Decode a kmer record of graph_file_recsize() bytes, e.g. from a FilePrefetch
+// slab. Applies the file filter in the same way as graph_file_read()
+void graph_file_parse(const GraphFileReader *file, const uint8_t *rec,
+                      BinaryKmer *bkmer, Covg *covgs, Edges *edges)
+{
+  const GraphFileHeader *hdr = &file->hdr;
+  Covg kmercovgs[hdr->num_of_cols];
+  Edges kmeredges[hdr->num_of_cols];
+  size_t kbytes = hdr->num_of_bitfields * sizeof(uint64_t);
+  size_t cbytes = hdr->num_of_cols * sizeof(Covg);
+
+  // Records are not aligned
+  memcpy(bkmer->b, rec, kbytes);
+  memcpy(kmercovgs, rec + kbytes, cbytes);
+  memcpy(kmeredges, rec + kbytes + cbytes, hdr->num_of_cols * sizeof(Edges));
+
+  graph_file_check_kmer(hdr, file->fltr.file_path.buff,
+                        *bkmer, kmercovgs, kmeredges);
+
+  graph_file_filter_cols(&file->fltr, kmercovgs, kmeredges, covgs, edges);
+}
+
 // Returns true if one or more files passed loads data into colour
 bool graph_file_is_colour_loaded(size_t colour, const GraphFileReader *files,
                                  size_t num_files)
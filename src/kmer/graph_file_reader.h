@@ -72,6 +72,19 @@ void graph_file_close(GraphFileReader *file);
 bool graph_file_read(const GraphFileReader *file,
                         BinaryKmer *bkmer, Covg *covgs, Edges *edges);
 
+// Number of bytes used to store each kmer in the file
+#define graph_file_recsize(hdr) \
+        ((hdr)->num_of_bitfields * sizeof(uint64_t) + \
+         (hdr)->num_of_cols * (sizeof(Covg) + sizeof(Edges)))
+
+// Bytes of kmer data left to read, SIZE_MAX if reading from a stream
+size_t graph_file_bytes_remaining(const GraphFileReader *file);
+
+// Decode a kmer record of graph_file_recsize() bytes, e.g. from a FilePrefetch
+// slab. Applies the file filter in the same way as graph_file_read()
+void graph_file_parse(const GraphFileReader *file, const uint8_t *rec,
+                      BinaryKmer *bkmer, Covg *covgs, Edges *edges);
+
 // Returns true if one or more files passed loads data into colour
 bool graph_file_is_colour_loaded(size_t colour, const GraphFileReader *files,
                                     size_t num_files);
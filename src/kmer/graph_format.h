@@ -50,6 +50,11 @@ void graph_reader_merge_headers(GraphFileHeader *hdr,
 int graph_file_read_header(FILE *fh, GraphFileHeader *header,
                            bool fatal, const char *path);
 
+// Check a kmer read from a file, only print each warning once
+void graph_file_check_kmer(const GraphFileHeader *h, const char *path,
+                           BinaryKmer bkmer, const Covg *covgs,
+                           const Edges *edges);
+
 // Returns number of bytes read
 size_t graph_file_read_kmer(FILE *fh, const GraphFileHeader *h, const char *path,
                             BinaryKmer *bkmer, Covg *covgs, Edges *edges);
@@ -0,0 +1,356 @@
+#include "global.h"
+#include "graph_image.h"
+#include "graph_format.h"
+#include "db_node.h"
+#include "util.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef CITY_HASH
+  #define GIMAGE_HASH_FUNC 1
+#else
+  #define GIMAGE_HASH_FUNC 0
+#endif
+
+#define GIMAGE_PAD(x) (((x) + CTX_IMAGE_ALIGN-1) & ~(size_t)(CTX_IMAGE_ALIGN-1))
+
+// Byte offsets of each array in the file
+typedef struct
+{
+  size_t table, buckets, covgs, edges, in_cols, end;
+} GraphImageLayout;
+
+static void gimage_layout(const GraphImageHeader *hdr, size_t data_start,
+                          GraphImageLayout *lay)
+{
+  size_t cap = hdr->capacity, ncols = hdr->num_of_cols;
+  lay->table = GIMAGE_PAD(data_start);
+  lay->buckets = GIMAGE_PAD(lay->table + cap * sizeof(BinaryKmer));
+  lay->covgs = GIMAGE_PAD(lay->buckets + hdr->num_of_buckets * sizeof(uint8_t[2]));
+  lay->edges = GIMAGE_PAD(lay->covgs +
+                          (hdr->has_covgs ? cap * ncols * sizeof(Covg) : 0));
+  lay->in_cols = GIMAGE_PAD(lay->edges +
+                            (hdr->has_edges ? cap * hdr->num_edge_cols * sizeof(Edges) : 0));
+  lay->end = lay->in_cols +
+             (hdr->has_in_cols ? roundup_bits2bytes(cap) * ncols : 0);
+}
+
+static void gimage_write(FILE *fh, const void *ptr, size_t len, size_t *offset,
+                         size_t to, const char *path)
+{
+  static const char zeros[CTX_IMAGE_ALIGN] = {0};
+  ctx_assert(to >= *offset && to - *offset < CTX_IMAGE_ALIGN);
+  if(fwrite(zeros, 1, to - *offset, fh) != to - *offset ||
+     fwrite(ptr, 1, len, fh) != len) {
+    die("Cannot write file: %s [%s]", path, strerror(errno));
+  }
+  *offset = to + len;
+}
+
+// Get size and modification time of a file, returns false on error
+static bool gimage_file_stat(const char *path, uint64_t *size, uint64_t *mtime)
+{
+  struct stat st;
+  if(stat(path, &st) != 0) return false;
+  *size = (uint64_t)st.st_size;
+  *mtime = (uint64_t)st.st_mtime;
+  return true;
+}
+
+void graph_image_save(const char *path, const char *ctx_path,
+                      const dBGraph *db_graph)
+{
+  const HashTable *ht = &db_graph->ht;
+  const size_t ncols = db_graph->num_of_cols;
+  size_t i, offset;
+
+  GraphImageHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, CTX_IMAGE_MAGIC, sizeof(hdr.magic));
+  hdr.version = CTX_IMAGE_FILEFORMAT;
+  hdr.max_kmer_size = MAX_KMER_SIZE;
+  hdr.num_bkmer_words = NUM_BKMER_WORDS;
+  hdr.hash_func = GIMAGE_HASH_FUNC;
+  hdr.kmer_size = db_graph->kmer_size;
+  hdr.num_of_cols = ncols;
+  hdr.num_edge_cols = db_graph->num_edge_cols;
+  hdr.num_of_cols_used = db_graph->num_of_cols_used;
+  hdr.num_of_buckets = ht->num_of_buckets;
+  hdr.bucket_size = ht->bucket_size;
+  hdr.capacity = ht->capacity;
+  hdr.num_kmers = ht->num_kmers;
+  for(i = 0; i < REHASH_LIMIT; i++) hdr.collisions[i] = ht->collisions[i];
+  hdr.has_covgs = (db_graph->col_covgs != NULL);
+  hdr.has_edges = (db_graph->col_edges != NULL);
+  hdr.has_in_cols = (db_graph->node_in_cols != NULL);
+
+  if(!gimage_file_stat(ctx_path, &hdr.ctx_size, &hdr.ctx_mtime))
+    die("Cannot read graph file details: %s [%s]", ctx_path, strerror(errno));
+
+  // Sample names and cleaning info are stored in a graph file header
+  GraphFileHeader ghdr = {.version = CTX_GRAPH_FILEFORMAT,
+                          .kmer_size = (uint32_t)db_graph->kmer_size,
+                          .num_of_bitfields = NUM_BKMER_WORDS,
+                          .num_of_cols = (uint32_t)ncols,
+                          .ginfo = db_graph->ginfo,
+                          .capacity = ncols};
+
+  FILE *fh = fopen(path, "w");
+  if(fh == NULL) die("Cannot open file: %s [%s]", path, strerror(errno));
+
+  if(fwrite(&hdr, 1, sizeof(hdr), fh) != sizeof(hdr))
+    die("Cannot write file: %s [%s]", path, strerror(errno));
+  offset = sizeof(hdr) + graph_write_header(fh, &ghdr);
+
+  GraphImageLayout lay;
+  gimage_layout(&hdr, offset, &lay);
+
+  gimage_write(fh, ht->table, ht->capacity * sizeof(BinaryKmer),
+               &offset, lay.table, path);
+  gimage_write(fh, ht->buckets, ht->num_of_buckets * sizeof(uint8_t[2]),
+               &offset, lay.buckets, path);
+  if(hdr.has_covgs) {
+    gimage_write(fh, db_graph->col_covgs, ht->capacity * ncols * sizeof(Covg),
+                 &offset, lay.covgs, path);
+  }
+  if(hdr.has_edges) {
+    gimage_write(fh, db_graph->col_edges,
+                 ht->capacity * db_graph->num_edge_cols * sizeof(Edges),
+                 &offset, lay.edges, path);
+  }
+  if(hdr.has_in_cols) {
+    gimage_write(fh, db_graph->node_in_cols,
+                 roundup_bits2bytes(ht->capacity) * ncols,
+                 &offset, lay.in_cols, path);
+  }
+
+  gimage_write(fh, "", 0, &offset, lay.end, path);
+  if(fclose(fh) != 0) die("Cannot write file: %s [%s]", path, strerror(errno));
+
+  char num_kmers_str[50], mem_str[50];
+  ulong_to_str(ht->num_kmers, num_kmers_str);
+  bytes_to_str(lay.end, 1, mem_str);
+  status("[image] Saved %s kmers to %s [%s]", num_kmers_str, path, mem_str);
+}
+
+// Read image header and graph header, returns false if not a usable image
+static bool gimage_read_headers(FILE *fh, const char *path,
+                                GraphImageHeader *hdr, GraphFileHeader *ghdr)
+{
+  if(fread(hdr, 1, sizeof(*hdr), fh) != sizeof(*hdr) ||
+     memcmp(hdr->magic, CTX_IMAGE_MAGIC, sizeof(hdr->magic)) != 0) {
+    warn("Not a graph image: %s", path);
+    return false;
+  }
+  if(hdr->version != CTX_IMAGE_FILEFORMAT) {
+    warn("Graph image version not supported [%zu]: %s",
+         (size_t)hdr->version, path);
+    return false;
+  }
+  if(hdr->max_kmer_size != MAX_KMER_SIZE ||
+     hdr->num_bkmer_words != NUM_BKMER_WORDS ||
+     hdr->hash_func != GIMAGE_HASH_FUNC) {
+    warn("Graph image saved by a different build [MAXK=%zu]: %s",
+         (size_t)hdr->max_kmer_size, path);
+    return false;
+  }
+  if(hdr->bucket_size == 0 || hdr->bucket_size > MAX_BUCKET_SIZE ||
+     hdr->num_of_buckets == 0 ||
+     (hdr->num_of_buckets & (hdr->num_of_buckets-1)) != 0 ||
+     hdr->capacity != hdr->num_of_buckets * hdr->bucket_size) {
+    warn("Corrupt graph image: %s", path);
+    return false;
+  }
+  return (ghdr == NULL || graph_file_read_header(fh, ghdr, false, path) > 0);
+}
+
+size_t graph_image_capacity(const char *path)
+{
+  GraphImageHeader hdr;
+  FILE *fh = fopen(path, "r");
+  if(fh == NULL) {
+    warn("Cannot open file: %s [%s]", path, strerror(errno));
+    return 0;
+  }
+  bool success = gimage_read_headers(fh, path, &hdr, NULL);
+  fclose(fh);
+  return success ? hdr.capacity : 0;
+}
+
+static void gimage_set_in_cols(dBGraph *db_graph, const GraphImageHeader *hdr,
+                               const Covg *covgs, const Edges *edges)
+{
+  const size_t ncols = db_graph->num_of_cols;
+  hkey_t hkey;
+  size_t col;
+
+  for(hkey = 0; hkey < hdr->capacity; hkey++) {
+    if(!db_graph_node_assigned(db_graph, hkey)) continue;
+    for(col = 0; col < ncols; col++) {
+      if((covgs != NULL && covgs[hkey*ncols+col] > 0) ||
+         (edges != NULL && edges[hkey*ncols+col] != 0)) {
+        db_node_set_col(db_graph, hkey, col);
+      }
+    }
+  }
+}
+
+bool graph_image_load(const char *path, const GraphFileReader *gfiles,
+                      size_t num_gfiles, dBGraph *db_graph)
+{
+  GraphImageHeader hdr;
+  GraphFileHeader ghdr = INIT_GRAPH_FILE_HDR_MACRO;
+  GraphImageLayout lay;
+  struct stat st;
+  uint64_t ctx_size = 0, ctx_mtime = 0;
+  size_t i, j, data_start;
+  bool success;
+
+  FILE *fh = fopen(path, "r");
+  if(fh == NULL) {
+    warn("Cannot open file: %s [%s]", path, strerror(errno));
+    return false;
+  }
+
+  success = gimage_read_headers(fh, path, &hdr, &ghdr);
+  data_start = (size_t)ftell(fh);
+
+  if(success) {
+    const char *err = NULL;
+    gimage_layout(&hdr, data_start, &lay);
+
+    if(fstat(fileno(fh), &st) != 0 || (size_t)st.st_size != lay.end)
+      err = "file truncated";
+    else if(num_gfiles != 1)
+      err = "image is of a single graph file";
+    else if(!gfiles[0].fltr.nofilter || gfiles[0].fltr.flatten)
+      err = "colours selected from graph file";
+    else if(!gimage_file_stat(gfiles[0].fltr.file_path.buff,
+                              &ctx_size, &ctx_mtime) ||
+            ctx_size != hdr.ctx_size || ctx_mtime != hdr.ctx_mtime)
+      err = "graph file has changed";
+    else if(hdr.kmer_size != gfiles[0].hdr.kmer_size ||
+            hdr.num_kmers != gfiles[0].num_of_kmers)
+      err = "kmers differ from graph file";
+    else if(hdr.kmer_size != db_graph->kmer_size)
+      err = "different kmer size";
+    else if(hdr.num_of_cols != db_graph->num_of_cols ||
+            ghdr.num_of_cols != db_graph->num_of_cols)
+      err = "different number of colours";
+    else if(db_graph->ht.num_kmers > 0 || db_graph->num_of_cols_used > 0)
+      err = "graph is not empty";
+    else if(hdr.capacity > db_graph->ht.capacity)
+      err = "hash table too small";
+    else if(db_graph->col_covgs != NULL && !hdr.has_covgs)
+      err = "image has no coverage";
+    else if(db_graph->col_edges != NULL &&
+            (!hdr.has_edges || (hdr.num_edge_cols != db_graph->num_edge_cols &&
+                                db_graph->num_edge_cols != 1)))
+      err = "image has no edges for each colour";
+    else if(db_graph->node_in_cols != NULL && !hdr.has_in_cols &&
+            !hdr.has_covgs && !(hdr.has_edges && hdr.num_edge_cols == hdr.num_of_cols))
+      err = "cannot work out which colours each kmer is in";
+
+    if(err != NULL) {
+      warn("Cannot use graph image [%s]: %s", err, path);
+      success = false;
+    }
+  }
+
+  uint8_t *data = NULL;
+
+  if(success) {
+    data = mmap(NULL, lay.end, PROT_READ, MAP_SHARED, fileno(fh), 0);
+    if(data == MAP_FAILED) {
+      warn("Cannot memory map file: %s [%s]", path, strerror(errno));
+      success = false;
+    }
+  }
+
+  fclose(fh);
+
+  if(!success) {
+    graph_header_dealloc(&ghdr);
+    return false;
+  }
+
+  madvise(data, lay.end, MADV_SEQUENTIAL);
+
+  // Arrays are copied rather than used in place so that the graph can be
+  // modified and freed as usual
+
+  // Take on the bucket layout of the image
+  HashTable *ht = &db_graph->ht;
+  BinaryKmer *table = ctx_realloc(ht->table, hdr.capacity * sizeof(BinaryKmer));
+  uint8_t (*buckets)[2] = ctx_realloc(ht->buckets,
+                                      hdr.num_of_buckets * sizeof(uint8_t[2]));
+  memcpy(table, data+lay.table, hdr.capacity * sizeof(BinaryKmer));
+  memcpy(buckets, data+lay.buckets, hdr.num_of_buckets * sizeof(uint8_t[2]));
+
+  HashTable tmp = {
+    .table = table,
+    .num_of_buckets = hdr.num_of_buckets,
+    .hash_mask = (uint_fast32_t)(hdr.num_of_buckets - 1),
+    .bucket_size = (uint8_t)hdr.bucket_size,
+    .capacity = hdr.capacity,
+    .buckets = buckets,
+    .num_kmers = hdr.num_kmers,
+    .collisions = {0}};
+
+  for(i = 0; i < REHASH_LIMIT; i++) tmp.collisions[i] = hdr.collisions[i];
+  memcpy(ht, &tmp, sizeof(tmp));
+
+  if(db_graph->bktlocks != NULL) {
+    size_t nbytes = roundup_bits2bytes(hdr.num_of_buckets);
+    db_graph->bktlocks = ctx_realloc(db_graph->bktlocks, nbytes);
+    memset(db_graph->bktlocks, 0, nbytes);
+  }
+
+  const size_t ncols = db_graph->num_of_cols, cap = hdr.capacity;
+  const Covg *covgs = hdr.has_covgs ? (const Covg*)(data+lay.covgs) : NULL;
+  const Edges *edges = hdr.has_edges ? (const Edges*)(data+lay.edges) : NULL;
+
+  if(db_graph->col_covgs != NULL)
+    memcpy(db_graph->col_covgs, covgs, cap * ncols * sizeof(Covg));
+
+  if(db_graph->col_edges != NULL) {
+    if(hdr.num_edge_cols == db_graph->num_edge_cols) {
+      memcpy(db_graph->col_edges, edges,
+             cap * db_graph->num_edge_cols * sizeof(Edges));
+    }
+    else {
+      // Merge edges from all colours
+      for(i = 0; i < cap; i++) {
+        Edges e = 0;
+        for(j = 0; j < hdr.num_edge_cols; j++) e |= edges[i*hdr.num_edge_cols+j];
+        db_graph->col_edges[i] = e;
+      }
+    }
+  }
+
+  if(db_graph->node_in_cols != NULL) {
+    size_t nbytes = roundup_bits2bytes(cap) * ncols;
+    if(hdr.has_in_cols) memcpy(db_graph->node_in_cols, data+lay.in_cols, nbytes);
+    else {
+      memset(db_graph->node_in_cols, 0, nbytes);
+      gimage_set_in_cols(db_graph, &hdr, covgs,
+                         hdr.num_edge_cols == ncols ? edges : NULL);
+    }
+  }
+
+  if(munmap(data, lay.end) != 0) warn("munmap failed: %s", strerror(errno));
+
+  for(i = 0; i < ncols; i++) graph_info_merge(&db_graph->ginfo[i], &ghdr.ginfo[i]);
+  db_graph->num_of_cols_used = MAX2(db_graph->num_of_cols_used,
+                                    (size_t)hdr.num_of_cols_used);
+  graph_header_dealloc(&ghdr);
+
+  char num_kmers_str[50];
+  ulong_to_str(hdr.num_kmers, num_kmers_str);
+  status("[image] Loaded %s kmers from %s", num_kmers_str, path);
+
+  hash_table_print_stats(ht);
+  return true;
+}
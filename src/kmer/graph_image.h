@@ -0,0 +1,61 @@
+#ifndef GRAPH_IMAGE_H_
+#define GRAPH_IMAGE_H_
+
+#include "db_graph.h"
+#include "graph_file_reader.h"
+
+//
+// Raw graph images
+//
+// An image is a dump of a dBGraph's memory: the hash table (kmers and
+// buckets), col_covgs, col_edges, node_in_cols and sample info. Reloading an
+// image copies the arrays straight back without parsing or rehashing kmers,
+// which is much faster than loading a .ctx between pipeline stages.
+//
+// An image is saved alongside a .ctx file holding the same graph, and records
+// that file's size and modification time. Images are only valid for the same
+// build (MAXK, hash function) and only stand in for that unchanged .ctx file.
+// Loading checks both and returns false if the image cannot be used, so
+// callers should fall back to loading graph files. Paths are not saved.
+//
+// Layout: GraphImageHeader, graph file header (sample info), then each array
+// starting on a page boundary.
+//
+
+#define CTX_IMAGE_FILEFORMAT 2
+#define CTX_IMAGE_MAGIC "CTXIMAGE"
+#define CTX_IMAGE_ALIGN 4096
+
+typedef struct
+{
+  char magic[8];
+  uint64_t version, max_kmer_size, num_bkmer_words, hash_func;
+  uint64_t kmer_size, num_of_cols, num_edge_cols, num_of_cols_used;
+  uint64_t num_of_buckets, bucket_size, capacity, num_kmers;
+  uint64_t collisions[REHASH_LIMIT];
+  uint64_t has_covgs, has_edges, has_in_cols;
+  uint64_t ctx_size, ctx_mtime; // .ctx file this is an image of
+} GraphImageHeader;
+
+// Save graph to an image file, dies on error. `ctx_path` is the .ctx file
+// holding the same graph, which must already have been written.
+void graph_image_save(const char *path, const char *ctx_path,
+                      const dBGraph *db_graph);
+
+// Returns hash table capacity needed to load the image, or 0 if the file is
+// not an image that this build can load
+size_t graph_image_capacity(const char *path);
+
+// Load an image into an allocated but empty graph, in place of loading
+// `gfiles`. The image must be of the single graph file given, unchanged since
+// the image was saved, with all its colours loaded. The graph's hash table must
+// have at least graph_image_capacity() entries; it takes on the image's bucket
+// layout. Arrays allocated in db_graph (col_covgs, col_edges, node_in_cols)
+// are filled from the image: edges are merged if db_graph has one edge colour
+// and node_in_cols is computed if the image does not have it.
+// Returns false (and prints why) if the image cannot be used, in which case
+// db_graph is unchanged.
+bool graph_image_load(const char *path, const GraphFileReader *gfiles,
+                      size_t num_gfiles, dBGraph *db_graph);
+
+#endif /* GRAPH_IMAGE_H_ */
@@ -0,0 +1,253 @@
+#include "global.h"
+#include "graph_index.h"
+#include "graph_format.h"
+#include "file_prefetch.h"
+#include "util.h"
+
+#include "misc/twang.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define GINDEX_ALIGN(x) (((x) + 7) & ~(size_t)7)
+
+// Byte offsets of each section in the file
+typedef struct
+{
+  size_t bits, ranks, fallback, fps, covgs, edges, end;
+} GraphIndexLayout;
+
+static void gindex_layout(const GraphIndexHeader *hdr, GraphIndexLayout *lay)
+{
+  size_t n = hdr->num_kmers, ncols = hdr->num_of_cols;
+  lay->bits = GINDEX_ALIGN(sizeof(GraphIndexHeader));
+  lay->ranks = lay->bits + roundup_bits2words64(hdr->nbits) * sizeof(uint64_t);
+  lay->fallback = lay->ranks + (hdr->nbits/MPHF_RANK_BLOCK+1) * sizeof(uint64_t);
+  lay->fps = GINDEX_ALIGN(lay->fallback + hdr->nfallback * sizeof(BinaryKmer));
+  lay->covgs = GINDEX_ALIGN(lay->fps + n * sizeof(uint16_t));
+  lay->edges = GINDEX_ALIGN(lay->covgs + n * ncols * sizeof(Covg));
+  lay->end = lay->edges + n * ncols * sizeof(Edges);
+}
+
+static inline uint16_t gindex_fingerprint(BinaryKmer bkey)
+{
+  size_t i;
+  uint64_t h = 0x5bd1e995;
+  for(i = 0; i < NUM_BKMER_WORDS; i++) h = twang_mix64(h ^ bkey.b[i]);
+  return (uint16_t)(h >> 48);
+}
+
+static void gindex_prefetch(FilePrefetch *pf, GraphFileReader *file)
+{
+  FileFilter *fltr = &file->fltr;
+  if(fseek(fltr->fh, file->hdr_size, SEEK_SET) != 0)
+    die("fseek failed: %s", strerror(errno));
+  fprefetch_start(pf, fltr->fh, fltr->file_path.buff,
+                  graph_file_recsize(&file->hdr),
+                  graph_file_bytes_remaining(file));
+}
+
+void graph_index_build(GraphFileReader *file, const char *out_path)
+{
+  const char *in_path = file->fltr.file_path.buff;
+  const size_t kmer_size = file->hdr.kmer_size;
+  const size_t ncols = graph_file_outncols(file);
+  const size_t nkmers = file->num_of_kmers;
+  size_t i, r, nrecs, nread = 0;
+
+  if(file_filter_isstdin(&file->fltr))
+    die("Cannot build an index from STDIN, please pass a file");
+
+  FilePrefetch pf;
+  const uint8_t *rec;
+  BinaryKmer bkmer, *keys;
+  Covg covgs[ncols];
+  Edges edges[ncols];
+
+  // Load kmers
+  keys = ctx_malloc(MAX2(nkmers, 1) * sizeof(BinaryKmer));
+
+  gindex_prefetch(&pf, file);
+  while((nrecs = fprefetch_next(&pf, &rec)) > 0) {
+    for(r = 0; r < nrecs; r++, rec += graph_file_recsize(&file->hdr)) {
+      if(nread == nkmers) die("More kmers than expected: %s", in_path);
+      graph_file_parse(file, rec, &bkmer, covgs, edges);
+      keys[nread++] = bkmer_get_key(bkmer, kmer_size);
+    }
+  }
+  fprefetch_stop(&pf);
+
+  if(nread != nkmers) die("Fewer kmers than expected: %s", in_path);
+
+  status("[index] Building perfect hash of %zu kmers", nkmers);
+  KmerMphf mphf;
+  kmer_mphf_build(&mphf, keys, nkmers);
+  ctx_free(keys);
+
+  status("[index] %zu levels, %.2f bits per kmer, %zu kmers in fallback",
+         (size_t)mphf.nlevels,
+         nkmers ? (double)(kmer_mphf_nwords(&mphf) + kmer_mphf_nranks(&mphf)) *
+                  64.0 / nkmers : 0.0,
+         (size_t)mphf.nfallback);
+
+  // Set up header
+  GraphIndexHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, CTX_INDEX_MAGIC, sizeof(hdr.magic));
+  hdr.version = CTX_INDEX_FILEFORMAT;
+  hdr.kmer_size = kmer_size;
+  hdr.num_of_bitfields = NUM_BKMER_WORDS;
+  hdr.num_of_cols = ncols;
+  hdr.num_kmers = nkmers;
+  hdr.nbits = mphf.nbits;
+  hdr.nplaced = mphf.nplaced;
+  hdr.nfallback = mphf.nfallback;
+  hdr.nlevels = mphf.nlevels;
+  memcpy(hdr.level_start, mphf.level_start, sizeof(hdr.level_start));
+
+  GraphIndexLayout lay;
+  gindex_layout(&hdr, &lay);
+
+  // Create output file and map it
+  int fd = open(out_path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if(fd == -1) die("Cannot open file: %s [%s]", out_path, strerror(errno));
+  if(ftruncate(fd, (off_t)lay.end) != 0)
+    die("Cannot resize file: %s [%s]", out_path, strerror(errno));
+
+  uint8_t *data = mmap(NULL, lay.end, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(data == MAP_FAILED)
+    die("Cannot memory map file: %s [%s]", out_path, strerror(errno));
+
+  memcpy(data, &hdr, sizeof(hdr));
+  memcpy(data+lay.bits, mphf.bits, kmer_mphf_nwords(&mphf) * sizeof(uint64_t));
+  memcpy(data+lay.ranks, mphf.ranks, kmer_mphf_nranks(&mphf) * sizeof(uint64_t));
+  if(mphf.nfallback) {
+    memcpy(data+lay.fallback, mphf.fallback,
+           mphf.nfallback * sizeof(BinaryKmer));
+  }
+
+  // Fill in fingerprints, coverage and edges in MPHF order
+  uint16_t *fps = (uint16_t*)(data + lay.fps);
+  Covg *out_covgs = (Covg*)(data + lay.covgs);
+  Edges *out_edges = (Edges*)(data + lay.edges);
+  uint64_t pos;
+  BinaryKmer bkey;
+
+  gindex_prefetch(&pf, file);
+  while((nrecs = fprefetch_next(&pf, &rec)) > 0) {
+    for(r = 0; r < nrecs; r++, rec += graph_file_recsize(&file->hdr)) {
+      graph_file_parse(file, rec, &bkmer, covgs, edges);
+      bkey = bkmer_get_key(bkmer, kmer_size);
+      pos = kmer_mphf_lookup(&mphf, bkey);
+      ctx_assert(pos < nkmers);
+      fps[pos] = gindex_fingerprint(bkey);
+      // Edges are stored relative to the key
+      if(!binary_kmers_are_equal(bkmer, bkey))
+        for(i = 0; i < ncols; i++) edges[i] = (edges[i]>>4) | (edges[i]<<4);
+      for(i = 0; i < ncols; i++) {
+        out_covgs[i*nkmers+pos] = covgs[i];
+        out_edges[i*nkmers+pos] = edges[i];
+      }
+    }
+  }
+  fprefetch_stop(&pf);
+
+  kmer_mphf_dealloc(&mphf);
+
+  if(msync(data, lay.end, MS_SYNC) != 0)
+    die("Cannot write file: %s [%s]", out_path, strerror(errno));
+  munmap(data, lay.end);
+  close(fd);
+
+  char num_kmers_str[50], mem_str[50];
+  ulong_to_str(nkmers, num_kmers_str);
+  bytes_to_str(lay.end, 1, mem_str);
+  status("[index] Wrote %s kmers to %s [%s]", num_kmers_str, out_path, mem_str);
+}
+
+void graph_index_open(GraphIndex *gi, const char *path)
+{
+  GraphIndexHeader hdr;
+  GraphIndexLayout lay;
+  struct stat st;
+
+  memset(gi, 0, sizeof(*gi));
+
+  int fd = open(path, O_RDONLY);
+  if(fd == -1) die("Cannot open file: %s [%s]", path, strerror(errno));
+  if(fstat(fd, &st) != 0) die("Cannot stat file: %s [%s]", path, strerror(errno));
+
+  gi->data_len = (size_t)st.st_size;
+  if(gi->data_len < sizeof(hdr)) die("Not an index file: %s", path);
+
+  gi->data = mmap(NULL, gi->data_len, PROT_READ, MAP_SHARED, fd, 0);
+  if(gi->data == MAP_FAILED)
+    die("Cannot memory map file: %s [%s]", path, strerror(errno));
+  close(fd);
+
+  memcpy(&hdr, gi->data, sizeof(hdr));
+
+  if(memcmp(hdr.magic, CTX_INDEX_MAGIC, sizeof(hdr.magic)) != 0)
+    die("Not an index file: %s", path);
+  if(hdr.version != CTX_INDEX_FILEFORMAT)
+    die("Index file version not supported [%zu]: %s", (size_t)hdr.version, path);
+  if(hdr.num_of_bitfields != NUM_BKMER_WORDS) {
+    die("Index file has different kmer size [%zu bitfields; compiled for %i]: %s",
+        (size_t)hdr.num_of_bitfields, NUM_BKMER_WORDS, path);
+  }
+  if(hdr.nlevels > MPHF_MAX_LEVELS) die("Corrupt index file: %s", path);
+
+  db_graph_check_kmer_size(hdr.kmer_size, path);
+
+  gindex_layout(&hdr, &lay);
+  if(lay.end != gi->data_len) die("Truncated index file: %s", path);
+
+  gi->kmer_size = hdr.kmer_size;
+  gi->num_of_cols = hdr.num_of_cols;
+  gi->num_kmers = hdr.num_kmers;
+
+  KmerMphf *mphf = &gi->mphf;
+  mphf->nkeys = hdr.num_kmers;
+  mphf->nbits = hdr.nbits;
+  mphf->nplaced = hdr.nplaced;
+  mphf->nfallback = hdr.nfallback;
+  mphf->nlevels = hdr.nlevels;
+  memcpy(mphf->level_start, hdr.level_start, sizeof(hdr.level_start));
+  mphf->bits = (uint64_t*)(gi->data + lay.bits);
+  mphf->ranks = (uint64_t*)(gi->data + lay.ranks);
+  mphf->fallback = (BinaryKmer*)(gi->data + lay.fallback);
+  mphf->owned = false;
+
+  gi->fps = (const uint16_t*)(gi->data + lay.fps);
+  gi->covgs = (const Covg*)(gi->data + lay.covgs);
+  gi->edges = (const Edges*)(gi->data + lay.edges);
+
+  char num_kmers_str[50];
+  ulong_to_str(gi->num_kmers, num_kmers_str);
+  status("[index] Mapped %s kmers from %s", num_kmers_str, path);
+}
+
+void graph_index_close(GraphIndex *gi)
+{
+  if(gi->data != NULL && munmap(gi->data, gi->data_len) != 0)
+    warn("munmap failed: %s", strerror(errno));
+  kmer_mphf_dealloc(&gi->mphf);
+  memset(gi, 0, sizeof(*gi));
+}
+
+hkey_t graph_index_find_key(const GraphIndex *gi, BinaryKmer bkey)
+{
+  uint64_t pos = kmer_mphf_lookup(&gi->mphf, bkey);
+  if(pos >= gi->num_kmers || gi->fps[pos] != gindex_fingerprint(bkey))
+    return HASH_NOT_FOUND;
+  return (hkey_t)pos;
+}
+
+dBNode graph_index_find(const GraphIndex *gi, BinaryKmer bkmer)
+{
+  dBNode node;
+  BinaryKmer bkey = bkmer_get_key(bkmer, gi->kmer_size);
+  node.key = graph_index_find_key(gi, bkey);
+  node.orient = bkmer_get_orientation(bkmer, bkey);
+  return node;
+}
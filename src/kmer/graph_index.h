@@ -0,0 +1,61 @@
+#ifndef GRAPH_INDEX_H_
+#define GRAPH_INDEX_H_
+
+#include "graph_file_reader.h"
+#include "kmer_mphf.h"
+#include "db_node.h"
+
+//
+// Static graph index file (.ctxi)
+//
+// Built once from a graph file that will not change. Kmers are not stored;
+// instead a minimal perfect hash function (MPHF) maps each kmer to a slot and
+// a 16 bit fingerprint per slot rejects kmers not in the graph (false positive
+// rate 1/65536). Coverage and edges are stored one array per colour in slot
+// order. The file is memory mapped read-only when opened.
+//
+// Layout: header, MPHF bits, MPHF ranks, MPHF fallback kmers, fingerprints,
+// covgs[ncols][nkmers], edges[ncols][nkmers]. Each section is 8 byte aligned.
+//
+
+#define CTX_INDEX_FILEFORMAT 1
+#define CTX_INDEX_MAGIC "CTXINDEX"
+
+typedef struct
+{
+  char magic[8];
+  uint64_t version, kmer_size, num_of_bitfields, num_of_cols, num_kmers;
+  uint64_t nbits, nplaced, nfallback, nlevels;
+  uint64_t level_start[MPHF_MAX_LEVELS+1];
+} GraphIndexHeader;
+
+typedef struct
+{
+  KmerMphf mphf;
+  uint8_t *data;
+  size_t data_len;
+  size_t kmer_size, num_of_cols, num_kmers;
+  const uint16_t *fps; // fingerprints
+  const Covg *covgs;
+  const Edges *edges;
+} GraphIndex;
+
+// Build an index of the graph file and save it to out_path
+void graph_index_build(GraphFileReader *file, const char *out_path);
+
+// Maps index file, dies on error
+void graph_index_open(GraphIndex *gi, const char *path);
+void graph_index_close(GraphIndex *gi);
+
+// Returns HASH_NOT_FOUND if not in the index
+hkey_t graph_index_find_key(const GraphIndex *gi, BinaryKmer bkey);
+
+// Equivalent of db_graph_find(): orientation is relative to the kmer passed
+dBNode graph_index_find(const GraphIndex *gi, BinaryKmer bkmer);
+
+#define graph_index_covg(gi,hkey,col) \
+        ((gi)->covgs[(size_t)(col)*(gi)->num_kmers + (hkey)])
+#define graph_index_edges(gi,hkey,col) \
+        ((gi)->edges[(size_t)(col)*(gi)->num_kmers + (hkey)])
+
+#endif /* GRAPH_INDEX_H_ */
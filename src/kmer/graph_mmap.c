@@ -0,0 +1,209 @@
+#include "global.h"
+#include "graph_mmap.h"
+#include "graph_format.h"
+#include "util.h"
+
+#include <sys/mman.h>
+
+// Max bits used in prefix index: 2^20 entries = 8MB
+#define GMMAP_MAX_PREFIX_BITS 20
+// Aim for roughly this many records per prefix
+#define GMMAP_RECS_PER_PREFIX 64
+// Number of records sampled to check a file is sorted when opened
+#define GMMAP_SORT_SAMPLES 1024
+
+// Top `pbits` bits of a kmer
+static inline uint64_t gmmap_prefix(BinaryKmer bkmer, size_t kmer_size,
+                                    size_t pbits)
+{
+  const size_t topbits = BKMER_TOP_BITS(kmer_size);
+  uint64_t top = bkmer.b[0] << (64 - topbits);
+  #if NUM_BKMER_WORDS > 1
+    top |= bkmer.b[1] >> topbits;
+  #endif
+  return top >> (64 - pbits);
+}
+
+static inline int gmmap_kmer_cmp(const uint8_t *rec, BinaryKmer bkey)
+{
+  BinaryKmer bkmer;
+  memcpy(bkmer.b, rec, sizeof(BinaryKmer));
+  if(binary_kmers_are_equal(bkmer, bkey)) return 0;
+  return binary_kmer_less_than(bkmer, bkey) ? -1 : 1;
+}
+
+static void gmmap_check_sorted(const GraphMmap *gm)
+{
+  size_t i, idx, prev = 0, n = MIN2(gm->num_kmers, GMMAP_SORT_SAMPLES);
+  BinaryKmer prevkmer, bkmer;
+
+  for(i = 1; i < n; i++) {
+    idx = (gm->num_kmers - 1) * i / (n - 1);
+    prevkmer = graph_mmap_bkmer(gm, prev);
+    bkmer = graph_mmap_bkmer(gm, idx);
+    if(!binary_kmer_less_than(prevkmer, bkmer)) {
+      die("Graph file is not sorted, run `ctx sort` first: %s",
+          gm->file.fltr.file_path.buff);
+    }
+    prev = idx;
+  }
+}
+
+void graph_mmap_open(GraphMmap *gm, char *path)
+{
+  memset(gm, 0, sizeof(*gm));
+  gm->file = INIT_GRAPH_READER;
+  graph_file_open(&gm->file, path, true);
+
+  GraphFileReader *file = &gm->file;
+  const char *file_path = file->fltr.file_path.buff;
+
+  if(file_filter_isstdin(&file->fltr))
+    die("Cannot memory map STDIN, please pass a file");
+
+  if(file->hdr.num_of_bitfields != NUM_BKMER_WORDS) {
+    die("Graph file has different kmer size [%u bitfields; compiled for %i]: %s",
+        file->hdr.num_of_bitfields, NUM_BKMER_WORDS, file_path);
+  }
+
+  gm->kmer_size = file->hdr.kmer_size;
+  gm->num_of_cols = file->hdr.num_of_cols;
+  gm->recsize = graph_file_recsize(&file->hdr);
+  gm->num_kmers = file->num_of_kmers;
+  gm->data_len = (size_t)file->fltr.file_size;
+
+  if(gm->data_len > 0) {
+    gm->data = mmap(NULL, gm->data_len, PROT_READ, MAP_SHARED,
+                    fileno(file->fltr.fh), 0);
+    if(gm->data == MAP_FAILED)
+      die("Cannot memory map file: %s [%s]", file_path, strerror(errno));
+    madvise(gm->data, gm->data_len, MADV_RANDOM);
+  }
+
+  gm->kmers = gm->data + file->hdr_size;
+
+  // Pick prefix length from number of records
+  size_t nprefixes = MAX2(gm->num_kmers / GMMAP_RECS_PER_PREFIX, 1);
+  gm->pbits = MIN3((size_t)(64 - leading_zeros(nprefixes)),
+                   (size_t)GMMAP_MAX_PREFIX_BITS,
+                   gm->kmer_size * 2);
+  gm->pidx = ctx_calloc((1UL << gm->pbits) + 1, sizeof(gm->pidx[0]));
+
+  gmmap_check_sorted(gm);
+
+  char num_kmers_str[50];
+  ulong_to_str(gm->num_kmers, num_kmers_str);
+  status("[mmap] Mapped %s kmers from %s", num_kmers_str, file_path);
+}
+
+void graph_mmap_close(GraphMmap *gm)
+{
+  if(gm->data != NULL && munmap(gm->data, gm->data_len) != 0)
+    warn("munmap failed: %s", strerror(errno));
+  ctx_free(gm->pidx);
+  graph_file_close(&gm->file);
+  memset(gm, 0, sizeof(*gm));
+}
+
+// Index of first record with prefix >= p, computed on first use
+static size_t gmmap_prefix_start(GraphMmap *gm, uint64_t p)
+{
+  // Benign race: threads that compute the same entry store the same value
+  uint64_t v = *(volatile uint64_t*)&gm->pidx[p];
+  if(v) return v - 1;
+
+  size_t lo = 0, hi = gm->num_kmers, mid;
+
+  if(p == 0) lo = hi = 0;
+  else if(p >> gm->pbits) lo = hi;
+
+  while(lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if(gmmap_prefix(graph_mmap_bkmer(gm, mid), gm->kmer_size, gm->pbits) < p)
+      lo = mid + 1;
+    else hi = mid;
+  }
+
+  *(volatile uint64_t*)&gm->pidx[p] = lo + 1;
+  return lo;
+}
+
+hkey_t graph_mmap_find_key(GraphMmap *gm, BinaryKmer bkey)
+{
+  uint64_t p = gmmap_prefix(bkey, gm->kmer_size, gm->pbits);
+  size_t start = gmmap_prefix_start(gm, p);
+  size_t end = gmmap_prefix_start(gm, p+1);
+  size_t n = end - start, half;
+
+  if(n == 0) return HASH_NOT_FOUND;
+
+  // Branchless binary search: `base` ends on the last record <= bkey
+  const uint8_t *base = graph_mmap_rec(gm, start);
+  while(n > 1) {
+    half = n / 2;
+    base = gmmap_kmer_cmp(base + half * gm->recsize, bkey) <= 0
+             ? base + half * gm->recsize : base;
+    n -= half;
+  }
+
+  if(gmmap_kmer_cmp(base, bkey) != 0) return HASH_NOT_FOUND;
+  return (hkey_t)((size_t)(base - gm->kmers) / gm->recsize);
+}
+
+dBNode graph_mmap_find(GraphMmap *gm, BinaryKmer bkmer)
+{
+  dBNode node;
+  BinaryKmer bkey = bkmer_get_key(bkmer, gm->kmer_size);
+  node.key = graph_mmap_find_key(gm, bkey);
+  node.orient = bkmer_get_orientation(bkmer, bkey);
+  return node;
+}
+
+//
+// Sorting a graph file in place
+//
+
+static int gmmap_rec_cmp(const void *aa, const void *bb)
+{
+  BinaryKmer a, b;
+  memcpy(a.b, aa, sizeof(BinaryKmer));
+  memcpy(b.b, bb, sizeof(BinaryKmer));
+  if(binary_kmers_are_equal(a, b)) return 0;
+  return binary_kmer_less_than(a, b) ? -1 : 1;
+}
+
+void graph_file_sort(char *path)
+{
+  GraphFileReader file = INIT_GRAPH_READER;
+  graph_file_open2(&file, path, true, "r+");
+
+  const char *file_path = file.fltr.file_path.buff;
+  size_t len = (size_t)file.fltr.file_size, recsize;
+  uint8_t *data;
+
+  if(file_filter_isstdin(&file.fltr)) die("Cannot sort STDIN in place");
+
+  if(file.hdr.num_of_bitfields != NUM_BKMER_WORDS) {
+    die("Graph file has different kmer size [%u bitfields; compiled for %i]: %s",
+        file.hdr.num_of_bitfields, NUM_BKMER_WORDS, file_path);
+  }
+
+  recsize = graph_file_recsize(&file.hdr);
+
+  if(file.num_of_kmers > 1)
+  {
+    data = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                fileno(file.fltr.fh), 0);
+    if(data == MAP_FAILED)
+      die("Cannot memory map file: %s [%s]", file_path, strerror(errno));
+
+    status("[sort] Sorting %zu kmers in %s", file.num_of_kmers, file_path);
+    qsort(data + file.hdr_size, file.num_of_kmers, recsize, gmmap_rec_cmp);
+
+    if(msync(data, len, MS_SYNC) != 0)
+      die("Cannot write file: %s [%s]", file_path, strerror(errno));
+    munmap(data, len);
+  }
+
+  graph_file_close(&file);
+}
@@ -0,0 +1,73 @@
+#ifndef GRAPH_MMAP_H_
+#define GRAPH_MMAP_H_
+
+#include "graph_file_reader.h"
+#include "db_node.h"
+
+//
+// Read-only access to a sorted graph file (.ctx) without loading it
+//
+// The file is memory mapped and kmers are looked up with a binary search over
+// the records. Coverage and edges are read straight from the mapping. Since
+// the mapping is shared, concurrent jobs on the same file share the page cache.
+// A small prefix index (top bits of a kmer -> range of records) narrows each
+// search; entries are filled in lazily the first time a prefix is seen so
+// opening a file does not require a pass over it.
+//
+// Records must be sorted by kmer (see `ctx sort` / graph_file_sort()).
+// Record indices are used as hkey_t values in the dBNode returned.
+//
+
+typedef struct
+{
+  GraphFileReader file; // header info, file stays open whilst mapped
+  uint8_t *data; // whole file
+  size_t data_len;
+  const uint8_t *kmers; // first kmer record
+  size_t num_kmers, recsize, kmer_size, num_of_cols;
+  // prefix index: pidx[p] is 1 + index of the first record with prefix >= p,
+  // or 0 if not yet computed. Of length (1<<pbits)+1
+  uint64_t *pidx;
+  size_t pbits;
+} GraphMmap;
+
+// Maps file, dies on error
+void graph_mmap_open(GraphMmap *gm, char *path);
+void graph_mmap_close(GraphMmap *gm);
+
+// Thread safe. Returns HASH_NOT_FOUND if not in the file
+hkey_t graph_mmap_find_key(GraphMmap *gm, BinaryKmer bkey);
+
+// Equivalent of db_graph_find(): orientation is relative to the kmer passed
+dBNode graph_mmap_find(GraphMmap *gm, BinaryKmer bkmer);
+
+// Accessors by record index (as returned by graph_mmap_find)
+#define graph_mmap_rec(gm,hkey) ((gm)->kmers + (size_t)(hkey) * (gm)->recsize)
+
+static inline BinaryKmer graph_mmap_bkmer(const GraphMmap *gm, hkey_t hkey)
+{
+  BinaryKmer bkmer;
+  memcpy(bkmer.b, graph_mmap_rec(gm, hkey), sizeof(BinaryKmer));
+  return bkmer;
+}
+
+static inline Covg graph_mmap_covg(const GraphMmap *gm, hkey_t hkey,
+                                   size_t col)
+{
+  Covg covg;
+  memcpy(&covg, graph_mmap_rec(gm, hkey) + sizeof(BinaryKmer) +
+                col * sizeof(Covg), sizeof(Covg));
+  return covg;
+}
+
+static inline Edges graph_mmap_edges(const GraphMmap *gm, hkey_t hkey,
+                                     size_t col)
+{
+  return graph_mmap_rec(gm, hkey)[sizeof(BinaryKmer) +
+                                  gm->num_of_cols * sizeof(Covg) + col];
+}
+
+// Sort the kmer records of a graph file in place
+void graph_file_sort(char *path);
+
+#endif /* GRAPH_MMAP_H_ */
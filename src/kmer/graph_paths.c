@@ -89,7 +89,8 @@ void graphs_paths_compatible(const GraphFileReader *graphs, size_t num_graphs,
 // Returns address of path in PathStore by setting newidx
 bool graph_paths_find_or_add_mt(dBNode node, Colour ctpcol,
                                 const uint8_t *packed, size_t plen,
-                                PathStore *pstore, PathIndex *newidx)
+                                PathStore *pstore, PathStoreCounts *counts,
+                                PathIndex *newidx)
 {
   // path_nbytes is the number of bytes in <PackedSeq>
   size_t path_nbytes = (plen+3)/4;
@@ -101,6 +102,13 @@ bool graph_paths_find_or_add_mt(dBNode node, Colour ctpcol,
   // calling bitlock_yield_acquire instead of bitlock_acquire causes
   bitlock_yield_acquire(pstore->kmer_locks, node.key);
 
+  // Store is waiting to be flushed to disk
+  if(pstore->full) {
+    bitlock_release(pstore->kmer_locks, node.key);
+    *newidx = PATH_NULL;
+    return false;
+  }
+
   // const PathIndex next = pstore_get_pindex(pstore, node.key);
   const PathIndex next = *(volatile PathIndex*)&pstore->kmer_paths_write[node.key];
 
@@ -131,7 +139,7 @@ bool graph_paths_find_or_add_mt(dBNode node, Colour ctpcol,
       // Add colour to bitset
       colset = packedpath_get_colset(pstore->store+pindex);
       added = !bitset_get(colset, ctpcol);
-      if(added) __sync_add_and_fetch((volatile size_t*)&pstore->num_col_paths, 1);
+      counts->num_col_paths += added;
       bitset_set(colset, ctpcol);
     }
 
@@ -152,8 +160,15 @@ bool graph_paths_find_or_add_mt(dBNode node, Colour ctpcol,
 
   if(new_path + mem_bytes > pstore->end || pret == -1)
   {
-    // DEV: be better, pause threads, dump graph, clear memory
-    die("Out of path memory! [%s]", pret == -1 ? "PathHash" : "PathLinkedList");
+    if(!pstore->can_spill)
+      die("Out of path memory! [%s]", pret == -1 ? "PathHash" : "PathLinkedList");
+
+    // Mark store as full before releasing the lock, since we may have left
+    // an entry in the PathHash without a path. Caller must flush the store.
+    pstore->full = true;
+    bitlock_release(pstore->kmer_locks, node.key);
+    *newidx = PATH_NULL;
+    return false;
   }
 
   pindex = (uint64_t)(new_path - pstore->store);
@@ -185,14 +200,12 @@ bool graph_paths_find_or_add_mt(dBNode node, Colour ctpcol,
   pstore_set_pindex(pstore, node.key, pindex);
 
   // Update number of kmers with paths if this the first path for this kmer
-  if(next == PATH_NULL) {
-    __sync_add_and_fetch((volatile size_t*)&pstore->num_kmers_with_paths, 1);
-  }
+  counts->num_kmers_with_paths += (next == PATH_NULL);
 
   // Update number of paths
-  __sync_add_and_fetch((volatile size_t*)&pstore->num_of_paths, 1);
-  __sync_add_and_fetch((volatile size_t*)&pstore->num_col_paths, 1);
-  __sync_add_and_fetch((volatile size_t*)&pstore->num_of_bytes, out_bytes);
+  counts->num_of_paths++;
+  counts->num_col_paths++;
+  counts->num_of_bytes += out_bytes;
 
   // status("npaths: %zu nkmers: %zu", pstore->num_of_paths,
   //        pstore->num_kmers_with_paths);
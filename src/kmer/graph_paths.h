@@ -25,12 +25,6 @@ static inline void gp_dealloc(GraphPathPairing *gp) {
   gp->n = 0; gp->ctxcols = gp->ctpcols = NULL;
 }
 
-// De-fragment the linked list used by PathStore
-// Uses memory or disk to de-fragment the file
-// Warning: The PathStore must not be modified during the running of the
-//          function. That means it is NOT thread-safe.
-void graph_paths_defragment(dBGraph *db_graph, FILE* tmp_fh);
-
 // Similar to path_file_reader.c:path_file_load_check()
 // Check kmer size matches and sample names match
 void graphs_paths_compatible(const GraphFileReader *graphs, size_t num_graphs,
@@ -39,9 +33,14 @@ void graphs_paths_compatible(const GraphFileReader *graphs, size_t num_graphs,
 // Returns true if new to colour, false otherwise
 // packed points to <PathLen><PackedSeq>
 // Returns address of path in PathStore by setting newidx
+// If pstore->can_spill and the store is full, returns false with pstore->full
+// set and newidx set to PATH_NULL
+// Counters are updated in the caller's `counts`, not pstore, to avoid
+// contention between threads. Add them with path_store_add_counts().
 bool graph_paths_find_or_add_mt(dBNode node, Colour ctpcol,
                                 const uint8_t *packed, size_t plen,
-                                PathStore *pstore, PathIndex *newidx);
+                                PathStore *pstore, PathStoreCounts *counts,
+                                PathIndex *newidx);
 
 //
 // Update PathStore from PathSet which has had entries removed / reordered
@@ -3,6 +3,7 @@
 #include "graph_format.h"
 #include "util.h"
 #include "file_util.h"
+#include "file_prefetch.h"
 #include "db_graph.h"
 #include "db_node.h"
 #include "graph_info.h"
@@ -291,30 +292,22 @@ int graph_file_read_header(FILE *fh, GraphFileHeader *h,
 // Only print errors once
 bool greader_zero_covg_error = false, greader_missing_covg_error = false;
 
-size_t graph_file_read_kmer(FILE *fh, const GraphFileHeader *h, const char *path,
-                            BinaryKmer *bkmer, Covg *covgs, Edges *edges)
+// Check a kmer read from a file, only print each warning once
+void graph_file_check_kmer(const GraphFileHeader *h, const char *path,
+                           BinaryKmer bkmer, const Covg *covgs,
+                           const Edges *edges)
 {
-  size_t i, num_bytes_read;
+  size_t i;
   char kstr[MAX_KMER_SIZE+1];
 
-  num_bytes_read = fread(bkmer->b, 1, sizeof(uint64_t)*h->num_of_bitfields, fh);
-
-  if(num_bytes_read == 0) return 0;
-  if(num_bytes_read != sizeof(uint64_t)*h->num_of_bitfields)
-    die("Unexpected end of file: %s", path);
-
-  safe_fread(fh, covgs, h->num_of_cols * sizeof(uint32_t), "Coverages", path);
-  safe_fread(fh, edges, h->num_of_cols * sizeof(uint8_t), "Edges", path);
-  num_bytes_read += h->num_of_cols * (sizeof(uint32_t) + sizeof(uint8_t));
-
   // Check top word of each kmer
-  if(binary_kmer_oversized(*bkmer, h->kmer_size))
+  if(binary_kmer_oversized(bkmer, h->kmer_size))
     die("Oversized kmer in path [kmer: %u]: %s", h->kmer_size, path);
 
   // Check covg is not 0 for all colours
   for(i = 0; i < h->num_of_cols && covgs[i] == 0; i++) {}
   if(i == h->num_of_cols && !greader_zero_covg_error) {
-    binary_kmer_to_str(*bkmer, h->kmer_size, kstr);
+    binary_kmer_to_str(bkmer, h->kmer_size, kstr);
     warn("Kmer has zero covg in all colours [kmer: %s; path: %s]", kstr, path);
     greader_zero_covg_error = true;
   }
@@ -322,10 +315,28 @@ size_t graph_file_read_kmer(FILE *fh, const GraphFileHeader *h, const char *path
   // Check edges => coverage
   for(i = 0; i < h->num_of_cols && (!edges[i] || covgs[i]); i++) {}
   if(i < h->num_of_cols && !greader_missing_covg_error) {
-    binary_kmer_to_str(*bkmer, h->kmer_size, kstr);
+    binary_kmer_to_str(bkmer, h->kmer_size, kstr);
     warn("Kmer has edges but no coverage [kmer: %s; path: %s]", kstr, path);
     greader_missing_covg_error = true;
   }
+}
+
+size_t graph_file_read_kmer(FILE *fh, const GraphFileHeader *h, const char *path,
+                            BinaryKmer *bkmer, Covg *covgs, Edges *edges)
+{
+  size_t num_bytes_read;
+
+  num_bytes_read = fread(bkmer->b, 1, sizeof(uint64_t)*h->num_of_bitfields, fh);
+
+  if(num_bytes_read == 0) return 0;
+  if(num_bytes_read != sizeof(uint64_t)*h->num_of_bitfields)
+    die("Unexpected end of file: %s", path);
+
+  safe_fread(fh, covgs, h->num_of_cols * sizeof(uint32_t), "Coverages", path);
+  safe_fread(fh, edges, h->num_of_cols * sizeof(uint8_t), "Edges", path);
+  num_bytes_read += h->num_of_cols * (sizeof(uint32_t) + sizeof(uint8_t));
+
+  graph_file_check_kmer(h, path, *bkmer, covgs, edges);
 
   return num_bytes_read;
 }
@@ -415,72 +426,87 @@ size_t graph_load(GraphFileReader *file, const GraphLoadingPrefs prefs,
          (size_t)hdr->num_of_cols, util_plural_str(hdr->num_of_cols),
          fltr->file_path.buff);
 
-  for(nkmers_parsed = 0; graph_file_read(file, &bkmer, covgs, edges); nkmers_parsed++)
-  {
-    // If kmer has no covg or edges -> don't load
-    Covg keep_kmer = 0;
-    for(i = 0; i < load_ncols; i++) keep_kmer |= covgs[i] | edges[i];
-    if(keep_kmer == 0) continue;
+  // Read kmers in a background thread whilst we insert them
+  FilePrefetch pf;
+  const uint8_t *rec;
+  size_t r, nrecs, recsize = graph_file_recsize(hdr);
+  fprefetch_start(&pf, fltr->fh, fltr->file_path.buff, recsize,
+                  graph_file_bytes_remaining(file));
 
-    if(prefs.boolean_covgs)
-      for(i = 0; i < load_ncols; i++)
-        covgs[i] = covgs[i] > 0;
+  nkmers_parsed = 0;
+  while((nrecs = fprefetch_next(&pf, &rec)) > 0)
+  {
+    for(r = 0; r < nrecs; r++, rec += recsize, nkmers_parsed++)
+    {
+      graph_file_parse(file, rec, &bkmer, covgs, edges);
 
-    // Fetch node in the de bruijn graph
-    hkey_t node;
+      // If kmer has no covg or edges -> don't load
+      Covg keep_kmer = 0;
+      for(i = 0; i < load_ncols; i++) keep_kmer |= covgs[i] | edges[i];
+      if(keep_kmer == 0) continue;
 
-    if(prefs.must_exist_in_graph)
-    {
-      node = hash_table_find(&graph->ht, bkmer);
-      if(node == HASH_NOT_FOUND) continue;
+      if(prefs.boolean_covgs)
+        for(i = 0; i < load_ncols; i++)
+          covgs[i] = covgs[i] > 0;
 
-      // Edges union_edges = db_node_get_edges_union(graph, node);
-      Edges union_edges = prefs.must_exist_in_edges[node];
+      // Fetch node in the de bruijn graph
+      hkey_t node;
 
-      for(i = 0; i < load_ncols; i++) edges[i] &= union_edges;
-    }
-    else
-    {
-      bool found;
-      node = hash_table_find_or_insert(&graph->ht, bkmer, &found);
+      if(prefs.must_exist_in_graph)
+      {
+        node = hash_table_find(&graph->ht, bkmer);
+        if(node == HASH_NOT_FOUND) continue;
 
-      if(prefs.empty_colours && found)
-        die("Duplicate kmer loaded [cols:%zu:%zu]", fltr->intocol, load_ncols);
-    }
+        // Edges union_edges = db_node_get_edges_union(graph, node);
+        Edges union_edges = prefs.must_exist_in_edges[node];
 
-    // Set presence in colours
-    uint8_t has_col;
-    if(graph->node_in_cols != NULL) {
-      for(i = 0; i < load_ncols; i++) {
-        has_col = (covgs[i] > 0 || edges[i] != 0);
-        intocol = graph_file_intocol(file,i);
-        db_node_cpy_col(graph, node, intocol, has_col);
+        for(i = 0; i < load_ncols; i++) edges[i] &= union_edges;
       }
-    }
+      else
+      {
+        bool found;
+        node = hash_table_find_or_insert(&graph->ht, bkmer, &found);
 
-    if(graph->col_covgs != NULL) {
-      for(i = 0; i < load_ncols; i++)
-        db_node_add_col_covg(graph, node, graph_file_intocol(file,i), covgs[i]);
-    }
+        if(prefs.empty_colours && found)
+          die("Duplicate kmer loaded [cols:%zu:%zu]", fltr->intocol, load_ncols);
+      }
 
-    // Merge all edges into one colour
-    if(graph->col_edges != NULL)
-    {
-      Edges *col_edges = graph->col_edges + node * graph->num_edge_cols;
+      // Set presence in colours
+      uint8_t has_col;
+      if(graph->node_in_cols != NULL) {
+        for(i = 0; i < load_ncols; i++) {
+          has_col = (covgs[i] > 0 || edges[i] != 0);
+          intocol = graph_file_intocol(file,i);
+          db_node_cpy_col(graph, node, intocol, has_col);
+        }
+      }
 
-      if(graph->num_edge_cols == 1) {
+      if(graph->col_covgs != NULL) {
         for(i = 0; i < load_ncols; i++)
-          col_edges[0] |= edges[i];
+          db_node_add_col_covg(graph, node, graph_file_intocol(file,i), covgs[i]);
       }
-      else {
-        for(i = 0; i < load_ncols; i++)
-          col_edges[graph_file_intocol(file,i)] |= edges[i];
+
+      // Merge all edges into one colour
+      if(graph->col_edges != NULL)
+      {
+        Edges *col_edges = graph->col_edges + node * graph->num_edge_cols;
+
+        if(graph->num_edge_cols == 1) {
+          for(i = 0; i < load_ncols; i++)
+            col_edges[0] |= edges[i];
+        }
+        else {
+          for(i = 0; i < load_ncols; i++)
+            col_edges[graph_file_intocol(file,i)] |= edges[i];
+        }
       }
-    }
 
-    num_of_kmers_loaded++;
+      num_of_kmers_loaded++;
+    }
   }
 
+  fprefetch_stop(&pf);
+
   if(file->num_of_kmers && nkmers_parsed != file->num_of_kmers)
   {
     warn("More kmers in graph than expected [expected: %zu; actual: %zu; "
@@ -580,34 +606,48 @@ size_t graph_stream_filter(const char *out_ctx_path, const GraphFileReader *file
   memset(kmercovgs, 0, sizeof(Covg)*(num_usedcols));
   memset(kmeredges, 0, sizeof(Edges)*(num_usedcols));
 
-  while(graph_file_read(file, &bkmer, covgs, edges))
-  {
-    // Collapse down colours
-    Covg keep_kmer = 0;
-    for(i = 0; i < ncols; i++) keep_kmer |= covgs[i] | edges[i];
+  // Read kmers in a background thread whilst we filter and write them
+  FilePrefetch pf;
+  const uint8_t *rec;
+  size_t r, nrecs, recsize = graph_file_recsize(&file->hdr);
+  fprefetch_start(&pf, fltr->fh, fltr->file_path.buff, recsize,
+                  graph_file_bytes_remaining(file));
 
-    // If kmer has no covg or edges -> don't load
-    if(keep_kmer)
+  while((nrecs = fprefetch_next(&pf, &rec)) > 0)
+  {
+    for(r = 0; r < nrecs; r++, rec += recsize)
     {
-      if(only_load_if_in_graph)
+      graph_file_parse(file, rec, &bkmer, covgs, edges);
+
+      // Collapse down colours
+      Covg keep_kmer = 0;
+      for(i = 0; i < ncols; i++) keep_kmer |= covgs[i] | edges[i];
+
+      // If kmer has no covg or edges -> don't load
+      if(keep_kmer)
       {
-        hkey_t node = hash_table_find(&db_graph->ht, bkmer);
+        if(only_load_if_in_graph)
+        {
+          hkey_t node = hash_table_find(&db_graph->ht, bkmer);
 
-        if(node != HASH_NOT_FOUND) {
-          Edges union_edges = only_load_if_in_edges[node];
-          for(i = 0; i < ncols; i++) edges[i] &= union_edges;
+          if(node != HASH_NOT_FOUND) {
+            Edges union_edges = only_load_if_in_edges[node];
+            for(i = 0; i < ncols; i++) edges[i] &= union_edges;
+          }
+          else keep_kmer = 0;
         }
-        else keep_kmer = 0;
-      }
 
-      if(keep_kmer) {
-        graph_write_kmer(out, hdr->num_of_bitfields, hdr->num_of_cols,
-                         bkmer, kmercovgs, kmeredges);
-        nodes_dumped++;
+        if(keep_kmer) {
+          graph_write_kmer(out, hdr->num_of_bitfields, hdr->num_of_cols,
+                           bkmer, kmercovgs, kmeredges);
+          nodes_dumped++;
+        }
       }
     }
   }
 
+  fprefetch_stop(&pf);
+
   fflush(out);
   fclose(out);
 
@@ -648,6 +688,111 @@ size_t graph_stream_filter_mkhdr(const char *out_ctx_path, GraphFileReader *file
   return nodes_dumped;
 }
 
+//
+// Colour windows for graph_files_merge()
+//
+
+// Returns the first colour >= `col` that is loaded by any of the files
+// or SIZE_MAX if there are none
+static size_t merge_next_window_start(const GraphFileReader *files,
+                                      size_t num_files, size_t col)
+{
+  size_t i, strt = SIZE_MAX;
+  for(i = 0; i < num_files; i++) {
+    if(graph_file_usedcols(&files[i]) > col)
+      strt = MIN2(strt, MAX2(files[i].fltr.intocol, col));
+  }
+  return strt;
+}
+
+// Returns the last colour of a window starting at `firstcol` of at most `ncols`
+// colours. Window ends on the last colour of a file where possible, so that
+// files do not straddle two windows.
+static size_t merge_window_end(const GraphFileReader *files, size_t num_files,
+                               size_t firstcol, size_t ncols,
+                               size_t output_colours)
+{
+  if(firstcol >= output_colours) return SIZE_MAX;
+  size_t i, file_lastcol, lastcol = MIN2(firstcol+ncols, output_colours) - 1;
+  size_t best = SIZE_MAX;
+
+  for(i = 0; i < num_files; i++) {
+    file_lastcol = graph_file_usedcols(&files[i]) - 1;
+    if(file_lastcol >= firstcol && file_lastcol <= lastcol &&
+       (best == SIZE_MAX || file_lastcol > best)) {
+      best = file_lastcol;
+    }
+  }
+
+  return best == SIZE_MAX ? lastcol : best;
+}
+
+// Returns true if all colours loaded from `file` are in [firstcol, lastcol]
+static inline bool merge_file_in_window(const GraphFileReader *file,
+                                        size_t firstcol, size_t lastcol)
+{
+  return file->fltr.intocol >= firstcol &&
+         graph_file_usedcols(file) - 1 <= lastcol;
+}
+
+// Load only the kmers from a file, no coverage or edges
+static void merge_load_kmers(GraphFileReader *file, GraphLoadingPrefs prefs,
+                             LoadingStats *stats)
+{
+  dBGraph *db_graph = prefs.db_graph;
+  Covg *col_covgs = db_graph->col_covgs;
+  Edges *col_edges = db_graph->col_edges;
+  size_t tmpinto = file->fltr.intocol;
+  bool tmpflatten = file->fltr.flatten;
+
+  db_graph->col_covgs = NULL;
+  db_graph->col_edges = NULL;
+  file_filter_update_intocol(&file->fltr, 0);
+  file->fltr.flatten = true;
+
+  graph_load(file, prefs, stats);
+
+  file_filter_update_intocol(&file->fltr, tmpinto);
+  file->fltr.flatten = tmpflatten;
+  db_graph->col_covgs = col_covgs;
+  db_graph->col_edges = col_edges;
+}
+
+// Load colours from `file` that fall in the window starting at `firstcol`
+static void merge_load_window(GraphFileReader *file, size_t firstcol,
+                              GraphLoadingPrefs prefs, LoadingStats *stats)
+{
+  const dBGraph *db_graph = prefs.db_graph;
+
+  // Backup intocol, ncols, cols
+  size_t tmpinto = file->fltr.intocol, tmpncols = file->fltr.ncols;
+  size_t *tmpcols = file->fltr.cols;
+
+  // Modify file filter to only load limited colours
+  if(file->fltr.flatten)
+    file->fltr.intocol -= firstcol;
+  else {
+    if(file->fltr.intocol < firstcol) {
+      file->fltr.cols += firstcol - file->fltr.intocol;
+      file->fltr.ncols -= firstcol - file->fltr.intocol;
+      file_filter_update_intocol(&file->fltr, 0);
+    }
+    else file->fltr.intocol -= firstcol;
+
+    file->fltr.ncols = MIN2(db_graph->num_of_cols - file->fltr.intocol,
+                            file->fltr.ncols);
+  }
+
+  if(fseek(file->fltr.fh, file->hdr_size, SEEK_SET) != 0)
+    die("fseek failed: %s", strerror(errno));
+
+  graph_load(file, prefs, stats);
+
+  file_filter_update_intocol(&file->fltr, tmpinto);
+  file->fltr.cols = tmpcols;
+  file->fltr.ncols = tmpncols;
+}
+
 // `kmers_loaded`: means all kmers to dump have been loaded
 // `colours_loaded`: means all kmer data have been loaded
 // `only_load_if_in_edges`: Edges to mask edges with, 1 per hash table entry
@@ -731,18 +876,28 @@ size_t graph_files_merge(const char *out_ctx_path,
     setvbuf(fout, NULL, _IOFBF, CTX_BUF_SIZE);
     size_t header_size = graph_write_header(fout, hdr);
 
-    // Load all kmers into flat graph
+    // Colour windows are aligned to input file boundaries so that each input
+    // is only read once for its colours, unless it has more colours than we
+    // can hold in memory at once, in which case it is read once per window.
+    // Inputs that fit entirely in the first window are loaded with their
+    // colours whilst building the kmer set; all others are also read for
+    // their kmers in that first pass, so are read at least twice in total.
+    size_t firstcol, lastcol;
+    bool *colours_done = ctx_calloc(num_files, sizeof(bool));
+
+    firstcol = merge_next_window_start(files, num_files, 0);
+    lastcol = merge_window_end(files, num_files, firstcol,
+                               db_graph->num_of_cols, output_colours);
+
+    // Load all kmers
     if(!kmers_loaded)
     {
-      size_t tmpinto; bool tmpflatten;
-      for(i = 0; i < num_files; i++)
-      {
-        tmpinto = files[i].fltr.intocol; tmpflatten = files[i].fltr.flatten;
-        file_filter_update_intocol(&files[i].fltr, 0);
-        files[i].fltr.flatten = true;
-        graph_load(&files[i], prefs, &stats);
-        file_filter_update_intocol(&files[i].fltr, tmpinto);
-        files[i].fltr.flatten = tmpflatten;
+      for(i = 0; i < num_files; i++) {
+        if(merge_file_in_window(&files[i], firstcol, lastcol)) {
+          merge_load_window(&files[i], firstcol, prefs, &stats);
+          colours_done[i] = true;
+        }
+        else merge_load_kmers(&files[i], prefs, &stats);
       }
     }
 
@@ -752,75 +907,32 @@ size_t graph_files_merge(const char *out_ctx_path,
     graph_write_empty(db_graph, fout, output_colours);
 
     size_t num_kmer_cols = db_graph->ht.capacity * db_graph->num_of_cols;
-    size_t firstcol, lastcol, file_lastcol;
-
-    for(firstcol = 0; firstcol < output_colours; firstcol += db_graph->num_of_cols)
-    {
-      bool loaded = false;
-      lastcol = MIN2(firstcol + db_graph->num_of_cols - 1, output_colours-1);
+    size_t file_lastcol;
 
-      // Wipe colour coverages and edges
+    // Graph may hold colour data from before we were called
+    if(kmers_loaded) {
       memset(db_graph->col_edges, 0, num_kmer_cols * sizeof(Edges));
       memset(db_graph->col_covgs, 0, num_kmer_cols * sizeof(Covg));
+    }
 
-      // Check if any files cover this colour range
-      for(i = 0; i < num_files; i++) {
-        file_lastcol = graph_file_usedcols(&files[i]) - 1;
-        if(files[i].fltr.intocol <= lastcol && file_lastcol >= firstcol) break;
-      }
-
-      if(i == num_files) {
-        // No hits
-        size_t newstrt = SIZE_MAX;
-        for(i = 0; i < num_files; i++)
-          if(files[i].fltr.intocol > firstcol)
-            newstrt = MIN2(newstrt, files[i].fltr.intocol);
-        firstcol = newstrt;
-        lastcol = MIN2(firstcol + db_graph->num_of_cols - 1, output_colours-1);
-        ctx_assert(newstrt < SIZE_MAX);
-      }
+    while(firstcol < output_colours)
+    {
+      bool loaded = false;
 
       for(i = 0; i < num_files; i++)
       {
-        file_lastcol = graph_file_usedcols(&files[i]) - 1;
-        if(files[i].fltr.intocol <= lastcol && file_lastcol >= firstcol)
-        {
-          // Backup intocol, ncols, cols
-          size_t tmpinto = files[i].fltr.intocol, tmpncols = files[i].fltr.ncols;
-          size_t *tmpcols = files[i].fltr.cols;
-
-          // Modify file filter to only load limited colours
-          if(files[i].fltr.flatten)
-            files[i].fltr.intocol -= firstcol;
-          else {
-            if(files[i].fltr.intocol < firstcol) {
-              files[i].fltr.cols += firstcol - files[i].fltr.intocol;
-              files[i].fltr.ncols -= firstcol - files[i].fltr.intocol;
-              // files[i].fltr.intocol = 0;
-              file_filter_update_intocol(&files[i].fltr, 0);
-            }
-            else files[i].fltr.intocol -= firstcol;
-
-            files[i].fltr.ncols = MIN2(db_graph->num_of_cols-files[i].fltr.intocol,
-                                  files[i].fltr.ncols);
-          }
+        if(colours_done[i]) { loaded = true; continue; }
 
-          if(fseek(files[i].fltr.fh, files[i].hdr_size, SEEK_SET) != 0)
-            die("fseek failed: %s", strerror(errno));
-
-          graph_load(&files[i], prefs, &stats);
+        file_lastcol = graph_file_usedcols(&files[i]) - 1;
+        if(files[i].fltr.intocol <= lastcol && file_lastcol >= firstcol) {
+          merge_load_window(&files[i], firstcol, prefs, &stats);
           loaded = true;
-
-          // files[i].fltr.intocol = tmpinto;
-          file_filter_update_intocol(&files[i].fltr, tmpinto);
-          files[i].fltr.cols = tmpcols;
-          files[i].fltr.ncols = tmpncols;
         }
       }
 
       // if loaded, dump
       if(loaded) {
-        if(db_graph->num_of_cols == 1)
+        if(firstcol == lastcol)
           status("Dumping into colour %zu...\n", firstcol);
         else
           status("Dumping into colours %zu-%zu...\n", firstcol, lastcol);
@@ -831,8 +943,18 @@ size_t graph_files_merge(const char *out_ctx_path,
         graph_file_write_colours(db_graph, 0, firstcol, lastcol-firstcol+1,
                                  output_colours, fout);
       }
+
+      // Wipe colour coverages and edges
+      memset(db_graph->col_edges, 0, num_kmer_cols * sizeof(Edges));
+      memset(db_graph->col_covgs, 0, num_kmer_cols * sizeof(Covg));
+      memset(colours_done, 0, num_files * sizeof(bool));
+
+      firstcol = merge_next_window_start(files, num_files, lastcol+1);
+      lastcol = merge_window_end(files, num_files, firstcol,
+                                 db_graph->num_of_cols, output_colours);
     }
 
+    ctx_free(colours_done);
     fclose(fout);
 
     graph_write_status(db_graph->ht.num_kmers, output_colours,
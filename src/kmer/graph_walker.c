@@ -5,6 +5,7 @@
 #include "graph_walker.h"
 #include "packed_path.h"
 #include "binary_seq.h"
+#include "unitig_index.h"
 
 // hash functions
 #include "misc/jenkins.h"
@@ -168,9 +169,9 @@ static void _graph_walker_pickup_counter_paths(GraphWalker *wlk, Edges edges)
   if(wlk->db_graph->pstore.kmer_paths_read == NULL) return;
   if(edges_get_indegree(edges, wlk->node.orient) == 0) return;
 
-  num_prev_nodes = db_graph_next_nodes(db_graph, wlk->bkey,
-                                       !wlk->node.orient, edges,
-                                       prev_nodes, prev_bases);
+  num_prev_nodes = db_graph_next_nodes2(db_graph, wlk->node.key, wlk->bkey,
+                                        !wlk->node.orient, edges,
+                                        prev_nodes, prev_bases);
 
   // If we have the ability, slim down nodes by those in this colour
   if(db_graph->node_in_cols != NULL) {
@@ -660,8 +661,18 @@ bool graph_walker_next(GraphWalker *wlk)
   Nucleotide bases[4];
   size_t num_next;
 
-  num_next = db_graph_next_nodes(db_graph, wlk->bkey, wlk->node.orient, edges,
-                                 nodes, bases);
+  // Inside a unitig the next node comes from the index, without a lookup
+  if(db_graph->unitigs != NULL &&
+     unitig_index_next_node(db_graph->unitigs, wlk->node, &nodes[0]))
+  {
+    edges = edges_with_orientation(edges, wlk->node.orient);
+    num_next = (edges != 0);
+    bases[0] = __builtin_ctz(edges | 0x10);
+    return graph_walker_next_nodes(wlk, num_next, nodes, bases);
+  }
+
+  num_next = db_graph_next_nodes2(db_graph, wlk->node.key, wlk->bkey,
+                                  wlk->node.orient, edges, nodes, bases);
 
   return graph_walker_next_nodes(wlk, num_next, nodes, bases);
 }
@@ -847,8 +858,8 @@ bool graph_walker_agrees_contig(GraphWalker *wlk,
       n = 1;
     } else {
       // Need to look up possible next nodes
-      n = db_graph_next_nodes(wlk->db_graph, wlk->bkey, wlk->node.orient,
-                              edges, nodes, nucs);
+      n = db_graph_next_nodes2(wlk->db_graph, wlk->node.key, wlk->bkey,
+                               wlk->node.orient, edges, nodes, nucs);
     }
 
     // If we can't progress -> success
@@ -366,24 +366,30 @@ hkey_t hash_table_find_or_insert_mt(HashTable *htable, const BinaryKmer key,
   rehash_error_exit(htable);
 }
 
-// Safe to call on different entries at the same time
-// NOT safe to do find() whilst doing delete()
-void hash_table_delete(HashTable *const htable, hkey_t pos)
+// Does not update htable->num_kmers
+void hash_table_delete_nocount(HashTable *const htable, hkey_t pos)
 {
   uint64_t bucket = pos / htable->bucket_size;
 
   ctx_assert(pos != HASH_NOT_FOUND);
   ctx_assert(htable->buckets[bucket][HT_BITEMS] > 0);
-  ctx_assert(htable->num_kmers > 0);
   ctx_assert(HASH_ENTRY_ASSIGNED(htable->table[pos]));
 
   htable->table[pos] = unset_bkmer;
   __sync_fetch_and_sub((volatile uint8_t *)&htable->buckets[bucket][HT_BITEMS], 1);
-  __sync_fetch_and_sub((volatile uint64_t *)&htable->num_kmers, 1);
 
   ctx_assert(!HASH_ENTRY_ASSIGNED(htable->table[pos]));
 }
 
+// Safe to call on different entries at the same time
+// NOT safe to do find() whilst doing delete()
+void hash_table_delete(HashTable *const htable, hkey_t pos)
+{
+  ctx_assert(htable->num_kmers > 0);
+  hash_table_delete_nocount(htable, pos);
+  __sync_fetch_and_sub((volatile uint64_t *)&htable->num_kmers, 1);
+}
+
 void hash_table_print_stats_brief(const HashTable *const htable)
 {
   size_t nbytes, nkeybits;
@@ -60,6 +60,16 @@ void hash_table_alloc(HashTable *htable, uint64_t capacity);
 void hash_table_dealloc(HashTable *hash_table);
 
 hkey_t hash_table_find(const HashTable *const htable, const BinaryKmer bkmer);
+
+// Fetch the first bucket a kmer may be in into cache. Call on a batch of kmers
+// before looking them up.
+// Takes a pointer so the kmer is hashed in place rather than copied
+static inline void hash_table_prefetch(const HashTable *const htable,
+                                       const BinaryKmer *bkmer)
+{
+  uint_fast32_t h = binary_kmer_hash((*bkmer),0) & htable->hash_mask;
+  __builtin_prefetch(htable->table + (size_t)h * htable->bucket_size, 0, 1);
+}
 hkey_t hash_table_insert(HashTable *const htable, const BinaryKmer bkmer);
 hkey_t hash_table_find_or_insert(HashTable *htable, const BinaryKmer bkmer,
                                  bool *found);
@@ -72,6 +82,11 @@ hkey_t hash_table_find_or_insert_mt(HashTable *htable, const BinaryKmer key,
 // NOT safe to do find() whilst doing delete()
 void hash_table_delete(HashTable *const htable, hkey_t pos);
 
+// As hash_table_delete() but does not update htable->num_kmers. Threads count
+// the entries they delete and the caller subtracts the total once they are
+// done, instead of every delete contending on the counter.
+void hash_table_delete_nocount(HashTable *const htable, hkey_t pos);
+
 // Delete all entries from a hash table
 void hash_table_empty(HashTable *const htable);
 
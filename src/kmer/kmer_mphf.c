@@ -0,0 +1,137 @@
+#include "global.h"
+#include "kmer_mphf.h"
+#include "util.h"
+
+#include "misc/twang.h"
+
+static inline uint64_t mphf_hash(BinaryKmer bkey, uint64_t level)
+{
+  size_t i;
+  uint64_t h = twang_mix64(level + 1);
+  for(i = 0; i < NUM_BKMER_WORDS; i++) h = twang_mix64(h ^ bkey.b[i]);
+  return h;
+}
+
+// Bit used by key in a given level
+static inline uint64_t mphf_bit(const KmerMphf *mphf, BinaryKmer bkey,
+                                size_t level)
+{
+  uint64_t start = mphf->level_start[level];
+  uint64_t m = mphf->level_start[level+1] - start;
+  return start + mphf_hash(bkey, level) % m;
+}
+
+// Number of set bits before bit `pos`
+static inline uint64_t mphf_rank(const KmerMphf *mphf, uint64_t pos)
+{
+  uint64_t r = mphf->ranks[pos / MPHF_RANK_BLOCK];
+  size_t w = (pos / MPHF_RANK_BLOCK) * (MPHF_RANK_BLOCK/64), end = pos / 64;
+  for(; w < end; w++) r += __builtin_popcountll(mphf->bits[w]);
+  return r + __builtin_popcountll(mphf->bits[end] & ((1UL << (pos % 64)) - 1));
+}
+
+static int mphf_bkey_cmp(const void *aa, const void *bb)
+{
+  const BinaryKmer *a = (const BinaryKmer*)aa, *b = (const BinaryKmer*)bb;
+  if(binary_kmers_are_equal(*a, *b)) return 0;
+  return binary_kmer_less_than(*a, *b) ? -1 : 1;
+}
+
+void kmer_mphf_build(KmerMphf *mphf, BinaryKmer *keys, size_t n)
+{
+  size_t l, i, j, w, m, nwords, nrem = n;
+  uint64_t pos, *hits, *colls;
+
+  memset(mphf, 0, sizeof(*mphf));
+  mphf->nkeys = n;
+  mphf->owned = true;
+
+  for(l = 0; l < MPHF_MAX_LEVELS && nrem > 0; l++)
+  {
+    m = roundup_bits2words64(nrem * MPHF_GAMMA) * 64;
+    nwords = m / 64;
+    mphf->level_start[l+1] = mphf->level_start[l] + m;
+    mphf->nlevels = l+1;
+
+    hits = ctx_calloc(nwords, sizeof(uint64_t));
+    colls = ctx_calloc(nwords, sizeof(uint64_t));
+
+    // Mark bits hit more than once
+    for(i = 0; i < nrem; i++) {
+      pos = mphf_hash(keys[i], l) % m;
+      if(bitset_get(hits, pos)) bitset_set(colls, pos);
+      else bitset_set(hits, pos);
+    }
+
+    for(w = 0; w < nwords; w++) hits[w] &= ~colls[w];
+
+    // Keep keys that collided for the next level
+    for(i = j = 0; i < nrem; i++) {
+      pos = mphf_hash(keys[i], l) % m;
+      if(!bitset_get(hits, pos)) keys[j++] = keys[i];
+    }
+    nrem = j;
+
+    // Append level to bit array (levels are multiples of 64 bits)
+    w = mphf->level_start[l] / 64;
+    mphf->bits = ctx_realloc(mphf->bits, (w+nwords) * sizeof(uint64_t));
+    memcpy(mphf->bits + w, hits, nwords * sizeof(uint64_t));
+
+    ctx_free(hits);
+    ctx_free(colls);
+  }
+
+  mphf->nbits = mphf->level_start[mphf->nlevels];
+
+  // Ranks
+  size_t nranks = kmer_mphf_nranks(mphf);
+  nwords = kmer_mphf_nwords(mphf);
+  mphf->ranks = ctx_calloc(nranks, sizeof(uint64_t));
+
+  uint64_t nset = 0;
+  for(w = 0; w < nwords; w++) {
+    if(w % (MPHF_RANK_BLOCK/64) == 0) mphf->ranks[w / (MPHF_RANK_BLOCK/64)] = nset;
+    nset += __builtin_popcountll(mphf->bits[w]);
+  }
+  if(nwords % (MPHF_RANK_BLOCK/64) == 0) mphf->ranks[nranks-1] = nset;
+
+  mphf->nplaced = nset;
+  ctx_assert2(nset + nrem == n, "%zu + %zu != %zu", (size_t)nset, nrem, n);
+
+  // Remaining keys go in a sorted array
+  mphf->nfallback = nrem;
+  if(nrem > 0) {
+    mphf->fallback = ctx_malloc(nrem * sizeof(BinaryKmer));
+    memcpy(mphf->fallback, keys, nrem * sizeof(BinaryKmer));
+    qsort(mphf->fallback, nrem, sizeof(BinaryKmer), mphf_bkey_cmp);
+  }
+}
+
+void kmer_mphf_dealloc(KmerMphf *mphf)
+{
+  if(mphf->owned) {
+    ctx_free(mphf->bits);
+    ctx_free(mphf->ranks);
+    ctx_free(mphf->fallback);
+  }
+  memset(mphf, 0, sizeof(*mphf));
+}
+
+uint64_t kmer_mphf_lookup(const KmerMphf *mphf, BinaryKmer bkey)
+{
+  size_t l;
+  uint64_t pos;
+
+  for(l = 0; l < mphf->nlevels; l++) {
+    pos = mphf_bit(mphf, bkey, l);
+    if(bitset_get(mphf->bits, pos)) return mphf_rank(mphf, pos);
+  }
+
+  if(mphf->nfallback > 0) {
+    const BinaryKmer *bk = bsearch(&bkey, mphf->fallback, mphf->nfallback,
+                                   sizeof(BinaryKmer), mphf_bkey_cmp);
+    if(bk != NULL) return mphf->nplaced + (uint64_t)(bk - mphf->fallback);
+  }
+
+  return HASH_NOT_FOUND;
+}
@@ -0,0 +1,50 @@
+#ifndef KMER_MPHF_H_
+#define KMER_MPHF_H_
+
+#include "binary_kmer.h"
+#include "hash_table.h"
+#include "bit_array/bit_macros.h"
+
+//
+// Minimal perfect hash function over a static set of kmers
+//
+// Maps each of n keys to a unique value in [0,n). Keys are hashed into a bit
+// array at each level; keys that do not collide with another key are placed
+// and the rest move on to the next (smaller) level. A key's value is the
+// number of placed keys before its bit (rank). Uses ~3.7 bits per key.
+// Keys still unplaced after the last level are kept in a small sorted array.
+//
+// Looking up a kmer that was not in the set returns an arbitrary value, so
+// the caller must check membership (e.g. with a fingerprint).
+//
+
+#define MPHF_MAX_LEVELS 32
+// Bits per key at each level
+#define MPHF_GAMMA 2
+// Store number of set bits before every block of this many bits
+#define MPHF_RANK_BLOCK 512
+
+typedef struct
+{
+  uint64_t nkeys, nbits, nplaced, nfallback;
+  uint64_t nlevels;
+  uint64_t level_start[MPHF_MAX_LEVELS+1]; // bit offset of each level
+  uint64_t *bits; // roundup_bits2words64(nbits) words
+  uint64_t *ranks; // set bits before each block
+  BinaryKmer *fallback; // sorted keys not placed in any level
+  bool owned; // if true, arrays are freed by kmer_mphf_dealloc
+} KmerMphf;
+
+// Number of words in arrays
+#define kmer_mphf_nwords(m) roundup_bits2words64((m)->nbits)
+#define kmer_mphf_nranks(m) ((m)->nbits / MPHF_RANK_BLOCK + 1)
+
+// Build an MPHF for `n` distinct keys. `keys` is reordered.
+void kmer_mphf_build(KmerMphf *mphf, BinaryKmer *keys, size_t n);
+void kmer_mphf_dealloc(KmerMphf *mphf);
+
+// Returns value in [0,n) for keys in the set, HASH_NOT_FOUND or an arbitrary
+// value in [0,n) otherwise
+uint64_t kmer_mphf_lookup(const KmerMphf *mphf, BinaryKmer bkey);
+
+#endif /* KMER_MPHF_H_ */
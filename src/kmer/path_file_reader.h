@@ -9,6 +9,7 @@
 typedef struct
 {
   uint32_t version, kmer_size, num_of_cols;
+  uint32_t flags; // only in version >= 2 files, see path_format.h
   uint64_t num_of_paths, num_path_bytes, num_kmers_with_paths;
   StrBuf *sample_names;
   size_t capacity; // how many sample_names have been malloc'd
@@ -23,7 +24,7 @@ typedef struct
 
 #define INIT_PATH_FILE_HDR_MACRO {                \
   .version = CTX_PATH_FILEFORMAT,                 \
-  .kmer_size = 0, .num_of_paths = 0,              \
+  .kmer_size = 0, .flags = 0, .num_of_paths = 0,  \
   .num_path_bytes = 0, .num_kmers_with_paths = 0, \
   .sample_names = NULL, .capacity = 0}
 
@@ -6,12 +6,18 @@
 #include "path_store.h"
 #include "util.h"
 #include "file_util.h"
+#include "file_prefetch.h"
 #include "path_set.h"
 #include "graph_paths.h"
+#include "sort_r/sort_r.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 // Format:
 // -- Header --
 // "PATHS"<uint32_t:version><uint32_t:kmersize><uint32_t:num_of_cols>
+// [<uint32_t:flags> if version >= 2]
 // <uint64_t:num_of_paths><uint64_t:num_path_bytes><uint64_t:num_kmers_with_paths>
 // -- Colours --
 // <uint32_t:sname_len><uint8_t x sname_len:sample_name> x num_of_cols
@@ -68,6 +74,13 @@ int paths_file_read_header(FILE *fh, PathFileHeader *h,
   SAFE_READ(fh, &h->version, sizeof(uint32_t), "version", path, fatal);
   SAFE_READ(fh, &h->kmer_size, sizeof(uint32_t), "kmer_size", path, fatal);
   SAFE_READ(fh, &h->num_of_cols, sizeof(uint32_t), "num_of_cols", path, fatal);
+
+  h->flags = 0;
+  if(h->version >= CTX_PATH_FILEFORMAT_FLAGS) {
+    SAFE_READ(fh, &h->flags, sizeof(uint32_t), "flags", path, fatal);
+    bytes_read += sizeof(uint32_t);
+  }
+
   SAFE_READ(fh, &h->num_of_paths, sizeof(uint64_t), "num_of_paths", path, fatal);
   SAFE_READ(fh, &h->num_path_bytes, sizeof(uint64_t),
             "num_path_bytes", path, fatal);
@@ -96,7 +109,7 @@ int paths_file_read_header(FILE *fh, PathFileHeader *h,
   }
 
   // Checks
-  if(h->version < 1 || h->version > 1) {
+  if(h->version < 1 || h->version > CTX_PATH_FILEFORMAT_FLAGS) {
     if(!fatal) return -1;
     die("file version not supported [version: %u; path: %s]", h->version, path);
   }
@@ -250,9 +263,139 @@ static void path_files_update_empty_sample_names(const PathFileReader *files,
   }
 }
 
+// Each kmer in the file has a BinaryKmer followed by an index into path bytes
+#define PATH_KMER_RECSIZE (sizeof(BinaryKmer) + sizeof(PathIndex))
+
+// Start reading kmer records in a background thread
+// File must point to the first kmer
+static inline void paths_kmers_prefetch(FilePrefetch *pf, PathFileReader *file)
+{
+  size_t nbytes = file->hdr.num_kmers_with_paths * PATH_KMER_RECSIZE;
+  fprefetch_start(pf, file->fltr.fh, file->fltr.file_path.buff,
+                  PATH_KMER_RECSIZE, nbytes);
+}
+
+// Path data smaller than this is read rather than memory mapped
+#define PATHS_MMAP_MIN_BYTES (1UL<<20)
+// Number of kmers to prefetch hash table buckets for, before looking them up
+#define PATHS_KMER_BATCH 16
+
+// Decode a kmer record, find or insert its node in the graph
+static inline hkey_t paths_parse_kmer(const uint8_t *rec,
+                                      const PathFileHeader *hdr,
+                                      const char *path,
+                                      bool insert_missing_kmers,
+                                      dBGraph *db_graph, PathIndex *pindex)
+{
+  BinaryKmer bkmer;
+  hkey_t hkey;
+  bool found;
+
+  memcpy(bkmer.b, rec, sizeof(BinaryKmer));
+  memcpy(pindex, rec + sizeof(BinaryKmer), sizeof(PathIndex));
+
+  if(insert_missing_kmers) {
+    hkey = hash_table_find_or_insert(&db_graph->ht, bkmer, &found);
+  }
+  else if((hkey = hash_table_find(&db_graph->ht, bkmer)) == HASH_NOT_FOUND) {
+    char kmer_str[MAX_KMER_SIZE+1];
+    binary_kmer_to_str(bkmer, db_graph->kmer_size, kmer_str);
+    die("Node missing: %s [path: %s]", kmer_str, path);
+  }
+
+  if(*pindex > hdr->num_path_bytes) {
+    die("Path index out of bounds [%zu > %zu]",
+        (size_t)*pindex, (size_t)hdr->num_path_bytes);
+  }
+
+  return hkey;
+}
+
+typedef struct
+{
+  const uint8_t *data; // kmer records
+  size_t start, end; // records to load
+  const PathFileHeader *hdr;
+  const char *path;
+  dBGraph *db_graph;
+} PathKmerLoader;
+
+static void paths_load_kmers_thread(void *arg)
+{
+  const PathKmerLoader *ldr = (const PathKmerLoader*)arg;
+  dBGraph *db_graph = ldr->db_graph;
+  const uint8_t *rec, *ptr, *batch_end;
+  const uint8_t *end = ldr->data + ldr->end * PATH_KMER_RECSIZE;
+  BinaryKmer bkmer;
+  PathIndex pindex;
+  hkey_t hkey;
+
+  for(rec = ldr->data + ldr->start * PATH_KMER_RECSIZE; rec < end; )
+  {
+    batch_end = rec + PATHS_KMER_BATCH * PATH_KMER_RECSIZE;
+    if(batch_end > end) batch_end = end;
+
+    for(ptr = rec; ptr < batch_end; ptr += PATH_KMER_RECSIZE) {
+      memcpy(bkmer.b, ptr, sizeof(BinaryKmer));
+      hash_table_prefetch(&db_graph->ht, &bkmer);
+    }
+
+    for(; rec < batch_end; rec += PATH_KMER_RECSIZE) {
+      hkey = paths_parse_kmer(rec, ldr->hdr, ldr->path, false,
+                              db_graph, &pindex);
+      pstore_set_pindex(&db_graph->pstore, hkey, pindex);
+    }
+  }
+}
+
+// Map kmer records and look them up using multiple threads
+// Kmers must already be in the graph. File must point to the first kmer.
+// Returns false if the file cannot be mapped
+static bool paths_load_kmers_mt(PathFileReader *file, size_t nthreads,
+                                dBGraph *db_graph)
+{
+  FILE *fh = file->fltr.fh;
+  const char *path = file->fltr.file_path.buff;
+  size_t i, nkmers = file->hdr.num_kmers_with_paths;
+  size_t nbytes = nkmers * PATH_KMER_RECSIZE;
+  off_t offset = ftello(fh);
+  struct stat st;
+
+  if(offset < 0 || fstat(fileno(fh), &st) != 0) return false;
+  if(offset + (off_t)nbytes > st.st_size) die("Unexpected end of file: %s", path);
+
+  size_t skip = (size_t)offset % (size_t)sysconf(_SC_PAGESIZE);
+  uint8_t *data = mmap(NULL, skip + nbytes, PROT_READ, MAP_SHARED,
+                       fileno(fh), offset - (off_t)skip);
+  if(data == MAP_FAILED) return false;
+  madvise(data, skip + nbytes, MADV_SEQUENTIAL);
+
+  PathKmerLoader *ldrs = ctx_calloc(nthreads, sizeof(PathKmerLoader));
+  for(i = 0; i < nthreads; i++) {
+    ldrs[i] = (PathKmerLoader){.data = data + skip,
+                               .start = (nkmers * i) / nthreads,
+                               .end = (nkmers * (i+1)) / nthreads,
+                               .hdr = &file->hdr, .path = path,
+                               .db_graph = db_graph};
+  }
+
+  util_run_threads(ldrs, nthreads, sizeof(ldrs[0]),
+                   nthreads, paths_load_kmers_thread);
+
+  ctx_free(ldrs);
+  munmap(data, skip + nbytes);
+
+  if(fseeko(fh, offset + (off_t)nbytes, SEEK_SET) != 0)
+    die("fseek failed: %s [%s]", path, strerror(errno));
+
+  return true;
+}
+
 // if insert is true, insert missing kmers into the graph
+// Path data is memory mapped if possible. If we are not inserting kmers, up to
+// `nthreads` threads are used to look up kmers.
 void paths_format_load(PathFileReader *file, bool insert_missing_kmers,
-                       dBGraph *db_graph)
+                       size_t nthreads, dBGraph *db_graph)
 {
   const PathFileHeader *hdr = &file->hdr;
   FileFilter *fltr = &file->fltr;
@@ -275,41 +418,58 @@ void paths_format_load(PathFileReader *file, bool insert_missing_kmers,
   // Print some output
   paths_loading_print_status(file);
 
-  size_t i;
-  BinaryKmer bkmer;
+  size_t r, nrecs;
+  const uint8_t *rec;
+  FilePrefetch pf;
   hkey_t hkey;
-  bool found;
   PathIndex pindex;
 
+  bool use_mmap = !file_filter_isstdin(fltr);
+  off_t offset;
+
   // Load paths
   ctx_assert((ptrdiff_t)hdr->num_path_bytes <= pstore->end - pstore->store);
-  safe_fread(fh, pstore->store, hdr->num_path_bytes, "pstore->store", path);
+
+  if(use_mmap && hdr->num_path_bytes >= PATHS_MMAP_MIN_BYTES &&
+     (offset = ftello(fh)) >= 0 &&
+     path_store_mmap(pstore, fileno(fh), offset, hdr->num_path_bytes))
+  {
+    if(fseeko(fh, offset + (off_t)hdr->num_path_bytes, SEEK_SET) != 0)
+      die("fseek failed: %s [%s]", path, strerror(errno));
+  }
+  else {
+    safe_fread(fh, pstore->store, hdr->num_path_bytes, "pstore->store", path);
+  }
+
   pstore->next = pstore->store + hdr->num_path_bytes;
   pstore->num_of_paths = hdr->num_of_paths;
   pstore->num_kmers_with_paths = hdr->num_kmers_with_paths;
   pstore->num_of_bytes = hdr->num_path_bytes;
 
   // Load kmer pointers to paths
-  for(i = 0; i < hdr->num_kmers_with_paths; i++)
+  if(use_mmap && !insert_missing_kmers && nthreads > 1 &&
+     paths_load_kmers_mt(file, nthreads, db_graph))
   {
-    safe_fread(fh, bkmer.b, sizeof(BinaryKmer), "bkmer", path);
-
-    if(insert_missing_kmers) {
-      hkey = hash_table_find_or_insert(&db_graph->ht, bkmer, &found);
-    }
-    else if((hkey = hash_table_find(&db_graph->ht, bkmer)) == HASH_NOT_FOUND) {
-      char kmer_str[MAX_KMER_SIZE+1];
-      binary_kmer_to_str(bkmer, db_graph->kmer_size, kmer_str);
-      die("Node missing: %s [path: %s]", kmer_str, path);
+    // done
+  }
+  else
+  {
+    paths_kmers_prefetch(&pf, file);
+    size_t nkmers = 0;
+
+    while((nrecs = fprefetch_next(&pf, &rec)) > 0) {
+      for(r = 0; r < nrecs; r++, rec += PATH_KMER_RECSIZE) {
+        hkey = paths_parse_kmer(rec, hdr, path, insert_missing_kmers,
+                                db_graph, &pindex);
+        pstore_set_pindex(pstore, hkey, pindex);
+      }
+      nkmers += nrecs;
     }
 
-    safe_fread(fh, &pindex, sizeof(uint64_t), "kmer_index", path);
-    if(pindex > hdr->num_path_bytes) {
-      die("Path index out of bounds [%zu > %zu]",
-          (size_t)pindex, (size_t)hdr->num_path_bytes);
-    }
+    fprefetch_stop(&pf);
 
-    pstore_set_pindex(pstore, hkey, pindex);
+    if(nkmers != hdr->num_kmers_with_paths)
+      die("Unexpected end of file: %s", path);
   }
 
   // Test that this is the end of the file
@@ -321,7 +481,7 @@ void paths_format_load(PathFileReader *file, bool insert_missing_kmers,
 void paths_load_colour(PathFileReader *pfile,
                        bool insert_missing_kmers,
                        size_t colour_idx, size_t intocol,
-                       dBGraph *db_graph)
+                       size_t nthreads, dBGraph *db_graph)
 {
   ctx_assert(colour_idx < pfile->fltr.ncols);
   ctx_assert(intocol < db_graph->num_of_cols);
@@ -336,7 +496,7 @@ void paths_load_colour(PathFileReader *pfile,
   file_filter_update_intocol(&pfile->fltr, intocol);
 
   // Load paths
-  paths_format_load(pfile, insert_missing_kmers, db_graph);
+  paths_format_load(pfile, insert_missing_kmers, nthreads, db_graph);
 
   // Restore values
   pfile->fltr = tmp;
@@ -417,11 +577,11 @@ void paths_format_merge(PathFileReader *files, size_t num_files,
   PathFileHeader *hdr;
   FILE *fh;
   const char *path;
-  BinaryKmer bkey;
   hkey_t hkey;
   PathIndex tmpindex;
-  bool found;
-  size_t i, k, first_file = 0;
+  FilePrefetch pf;
+  const uint8_t *rec;
+  size_t i, r, nrecs, nkmers, first_file = 0;
 
   // Update sample names of the graph
   path_files_update_empty_sample_names(files, num_files, db_graph);
@@ -443,13 +603,15 @@ void paths_format_merge(PathFileReader *files, size_t num_files,
     // Currently no paths loaded
     if(!rmv_redundant)
     {
-      paths_format_load(&files[first_file], insert_missing_kmers, db_graph);
+      paths_format_load(&files[first_file], insert_missing_kmers,
+                        thread_limit, db_graph);
       first_file++;
     }
     else if(num_files == 1)
     {
       // Load whole file and remove duplicates
-      paths_format_load(&files[first_file], insert_missing_kmers, db_graph);
+      paths_format_load(&files[first_file], insert_missing_kmers,
+                        thread_limit, db_graph);
 
       // Slim paths store
       graph_paths_clean(db_graph, thread_limit, 0);
@@ -480,31 +642,29 @@ void paths_format_merge(PathFileReader *files, size_t num_files,
     safe_fread(fh, pstore->tmpstore, hdr->num_path_bytes, "paths->store", path);
 
     // Load kmer pointers to paths
-    for(k = 0; k < hdr->num_kmers_with_paths; k++)
-    {
-      safe_fread(fh, bkey.b, sizeof(BinaryKmer), "bkey", path);
+    // Kmers are read in a background thread whilst we merge paths
+    paths_kmers_prefetch(&pf, &files[i]);
+    nkmers = 0;
 
-      if(insert_missing_kmers) {
-        hkey = hash_table_find_or_insert(&db_graph->ht, bkey, &found);
-      }
-      else if((hkey = hash_table_find(&db_graph->ht, bkey)) == HASH_NOT_FOUND)
+    while((nrecs = fprefetch_next(&pf, &rec)) > 0)
+    {
+      for(r = 0; r < nrecs; r++, rec += PATH_KMER_RECSIZE)
       {
-        char kmer_str[MAX_KMER_SIZE+1];
-        binary_kmer_to_str(bkey, db_graph->kmer_size, kmer_str);
-        die("Node missing: %s [path: %s]", kmer_str, path);
-      }
+        hkey = paths_parse_kmer(rec, hdr, path, insert_missing_kmers,
+                                db_graph, &tmpindex);
 
-      safe_fread(fh, &tmpindex, sizeof(uint64_t), "kmer_index", path);
-      if(tmpindex > hdr->num_path_bytes) {
-        die("Path index out of bounds [%zu > %zu]",
-            (size_t)tmpindex, (size_t)hdr->num_path_bytes);
+        // Merge into currently loaded paths
+        load_linkedlist(hkey, tmpindex, &files[i],
+                        &pset0, &pset1, rmv_redundant, pstore);
       }
-
-      // Merge into currently loaded paths
-      load_linkedlist(hkey, tmpindex, &files[i],
-                      &pset0, &pset1, rmv_redundant, pstore);
+      nkmers += nrecs;
     }
 
+    fprefetch_stop(&pf);
+
+    if(nkmers != hdr->num_kmers_with_paths)
+      die("Unexpected end of file: %s", path);
+
     // Test that this is the end of the file
     uint8_t end;
     if(fread(&end, 1, 1, fh) != 0)
@@ -527,15 +687,18 @@ void paths_format_merge(PathFileReader *files, size_t num_files,
 // returns number of bytes written
 size_t paths_format_write_header_core(const PathFileHeader *header, FILE *fout)
 {
+  const bool has_flags = (header->version >= CTX_PATH_FILEFORMAT_FLAGS);
+
   size_t mem = fwrite("PATHS", 1, 5, fout) +
                fwrite(&header->version, 1, sizeof(uint32_t), fout) +
                fwrite(&header->kmer_size, 1, sizeof(uint32_t), fout) +
                fwrite(&header->num_of_cols, 1, sizeof(uint32_t), fout) +
+               (has_flags ? fwrite(&header->flags, 1, sizeof(uint32_t), fout) : 0) +
                fwrite(&header->num_of_paths, 1, sizeof(uint64_t), fout) +
                fwrite(&header->num_path_bytes, 1, sizeof(uint64_t), fout) +
                fwrite(&header->num_kmers_with_paths, 1, sizeof(uint64_t), fout);
 
-  const size_t expmem = 5 + sizeof(uint32_t)*3 + sizeof(uint64_t)*3;
+  const size_t expmem = 5 + sizeof(uint32_t)*(3+has_flags) + sizeof(uint64_t)*3;
   if(mem != expmem) die("Couldn't write header core");
   return mem;
 }
@@ -629,11 +792,104 @@ static inline void write_kmer_path_indices(hkey_t hkey, const dBGraph *db_graph,
   }
 }
 
+void paths_format_write_kmer_indices(const dBGraph *db_graph, FILE *fout)
+{
+  ctx_assert(db_graph->pstore.kmer_paths_read != NULL);
+  HASH_ITERATE(&db_graph->ht, write_kmer_path_indices, db_graph, fout);
+}
+
 // Corrupts paths so they cannot be used elsewhere
 // unless you reload the optimised paths from fout
 void paths_format_write_optimised_paths(dBGraph *db_graph, FILE *fout)
 {
   ctx_assert(db_graph->pstore.kmer_paths_read != NULL);
   paths_format_write_optimised_paths_only(db_graph, fout);
-  HASH_ITERATE(&db_graph->ht, write_kmer_path_indices, db_graph, fout);
+  paths_format_write_kmer_indices(db_graph, fout);
+}
+
+// Write paths in a set as one linked list, returns number of bytes written
+// If `counts`, each path is followed by its count (see path_spill.h)
+size_t paths_format_write_set(const PathSet *set, PathIndex poffset,
+                              bool counts, size_t *ncolpaths, FILE *fout)
+{
+  size_t i, j, nbytes, mem, written = 0;
+  const uint8_t *colset;
+  const PathEntry *entry;
+  PathIndex next;
+  PathLen lenword;
+
+  for(i = 0; i < set->members.len; i++)
+  {
+    entry = &set->members.data[i];
+    nbytes = (entry->plen+3)/4;
+    mem = packedpath_mem2(set->cbytes, nbytes);
+    next = (i+1 < set->members.len ? poffset + written + mem + counts : PATH_NULL);
+    lenword = packedpath_combine_lenorient(entry->plen, entry->orient);
+    colset = path_set_colset(entry,set);
+
+    if(fwrite(&next, 1, sizeof(PathIndex), fout) +
+       fwrite(colset, 1, set->cbytes, fout) +
+       fwrite(&lenword, 1, sizeof(PathLen), fout) +
+       fwrite(path_set_seq(entry,set), 1, nbytes, fout) +
+       (counts ? fwrite(&entry->count, 1, 1, fout) : 0) != mem + counts)
+    {
+      die("Couldn't write to file [%s]", strerror(errno));
+    }
+
+    written += mem + counts;
+    for(j = 0; j < set->cbytes; j++) *ncolpaths += __builtin_popcount(colset[j]);
+  }
+
+  return written;
+}
+
+//
+// Sorted path files
+//
+
+void paths_header_set_sorted(PathFileHeader *header)
+{
+  header->version = MAX2(header->version, CTX_PATH_FILEFORMAT_FLAGS);
+  header->flags |= PATH_FILE_SORTED;
+}
+
+static inline void _add_kmer_with_paths(hkey_t hkey, const PathStore *pstore,
+                                        hkey_t **ptr)
+{
+  if(pstore_get_pindex(pstore, hkey) != PATH_NULL) *((*ptr)++) = hkey;
+}
+
+static int _hkey_bkmer_cmp(const void *aa, const void *bb, void *arg)
+{
+  const dBGraph *db_graph = (const dBGraph*)arg;
+  BinaryKmer a = db_node_get_bkmer(db_graph, *(const hkey_t*)aa);
+  BinaryKmer b = db_node_get_bkmer(db_graph, *(const hkey_t*)bb);
+  if(binary_kmers_are_equal(a, b)) return 0;
+  return binary_kmer_less_than(a, b) ? -1 : 1;
+}
+
+// Write paths and kmer indices with kmers in sorted order. Header should have
+// been written with PATH_FILE_SORTED set (see paths_header_set_sorted()).
+// Corrupts paths in the same way as paths_format_write_optimised_paths()
+void paths_format_write_sorted_paths(dBGraph *db_graph, FILE *fout)
+{
+  const PathStore *pstore = &db_graph->pstore;
+  ctx_assert(pstore->kmer_paths_read != NULL);
+
+  size_t i, nkmers = pstore->num_kmers_with_paths;
+  hkey_t *hkeys = ctx_malloc(nkmers * sizeof(hkey_t)), *ptr = hkeys;
+
+  HASH_ITERATE(&db_graph->ht, _add_kmer_with_paths, pstore, &ptr);
+  ctx_assert((size_t)(ptr - hkeys) == nkmers);
+
+  status("[PathFormat] Sorting %zu kmers with paths", nkmers);
+  sort_r(hkeys, nkmers, sizeof(hkey_t), _hkey_bkmer_cmp, db_graph);
+
+  PathIndex poffset = 0;
+  for(i = 0; i < nkmers; i++)
+    write_optimised_paths(hkeys[i], &poffset, db_graph, fout);
+  for(i = 0; i < nkmers; i++)
+    write_kmer_path_indices(hkeys[i], db_graph, fout);
+
+  ctx_free(hkeys);
 }
@@ -4,15 +4,24 @@
 #include "cortex_types.h"
 #include "path_file_reader.h"
 #include "path_store.h"
+#include "path_set.h"
 #include "db_graph.h"
 #include "db_node.h"
 
 // path file format version
 #define CTX_PATH_FILEFORMAT 1
+// version with flags field, only used if flags are set
+#define CTX_PATH_FILEFORMAT_FLAGS 2
+
+// Header flags
+// Kmers are in sorted order (by binary kmer) and each kmer's paths are
+// contiguous, in the same order as the kmers
+#define PATH_FILE_SORTED 1
 
 // Path File Format:
 // -- Header --
 // "PATHS"<uint32_t:version><uint32_t:kmersize><uint32_t:num_of_cols>
+// [<uint32_t:flags> if version >= 2]
 // <uint64_t:num_of_paths><uint64_t:num_path_bytes><uint64_t:num_kmers_with_paths>
 // -- Colours --
 // <uint32_t:sname_len><uint8_t x sname_len:sample_name> x num_of_cols
@@ -41,8 +50,10 @@ size_t path_files_mem_required(const PathFileReader *files, size_t num_files,
                                size_t num_pcols, size_t extra_bytes);
 
 // if insert is true, insert missing kmers into the graph
+// Path data is memory mapped if possible. If we are not inserting kmers, up to
+// `nthreads` threads are used to look up kmers.
 void paths_format_load(PathFileReader *file, bool insert_missing_kmers,
-                       dBGraph *db_graph);
+                       size_t nthreads, dBGraph *db_graph);
 
 // Only load a given colour
 // colour_idx is the index of an already specified colour
@@ -50,7 +61,7 @@ void paths_format_load(PathFileReader *file, bool insert_missing_kmers,
 void paths_load_colour(PathFileReader *pfile,
                        bool insert_missing_kmers,
                        size_t colour_idx, size_t intocol,
-                       dBGraph *db_graph);
+                       size_t nthreads, dBGraph *db_graph);
 
 // Load 1 or more path files; can be called consecutively
 // if `rmv_redundant` is true we remove non-informative paths
@@ -70,6 +81,25 @@ size_t paths_format_write_header_core(const PathFileHeader *header, FILE *fout);
 size_t paths_format_write_header(const PathFileHeader *header, FILE *fout);
 
 void paths_format_write_optimised_paths_only(dBGraph *db_graph, FILE *fout);
+// Write <bkmer><pindex> for each kmer with paths, after the paths
+void paths_format_write_kmer_indices(const dBGraph *db_graph, FILE *fout);
 void paths_format_write_optimised_paths(dBGraph *db_graph, FILE *fout);
 
+// Write paths in a set as one linked list starting at offset `poffset` in the
+// path data. Returns number of bytes written. Adds number of colours set
+// over all paths to *ncolpaths. If `counts`, each path is followed by its count
+// (see path_spill.h)
+size_t paths_format_write_set(const PathSet *set, PathIndex poffset,
+                              bool counts, size_t *ncolpaths, FILE *fout);
+
+// Write paths and kmer indices with kmers in sorted order. Header should have
+// been written with PATH_FILE_SORTED set (see paths_header_set_sorted()).
+// Corrupts paths in the same way as paths_format_write_optimised_paths()
+void paths_format_write_sorted_paths(dBGraph *db_graph, FILE *fout);
+
+// Mark header as being for a sorted file
+void paths_header_set_sorted(PathFileHeader *header);
+
+#define paths_file_is_sorted(rdr) (((rdr)->hdr.flags & PATH_FILE_SORTED) != 0)
+
 #endif /* PATH_FORMAT_H_ */
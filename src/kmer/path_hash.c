@@ -3,7 +3,11 @@
 #include "util.h"
 #include "misc/city.h"
 
-// Entry is [hkey:5][pindex:5] = 10 bytes
+#ifdef __SSE2__
+  #include <emmintrin.h>
+#endif
+
+// Entry is [hkey:5][pindex:5] = 10 bytes, plus a 2 byte fingerprint
 
 // We compare with REHASH_LIMIT(16)*bucket_size(<255) = 4080
 // so we need 12 bits to have 2^12 = 4096 possibilities
@@ -11,17 +15,21 @@
 // (1-(1/(2^12)))^4080 = 0.369 = 37% of entries would have zero collisions
 // (1-(1/(2^16)))^4080 = 0.939 = 94% of entries would have zero collisions
 
+#define PHASH_FPRINT_STRIDE(bktsize) (((size_t)(bktsize)+7) & ~(size_t)7)
+
 void path_hash_alloc(PathHash *phash, size_t mem_in_bytes)
 {
-  size_t cap_entries; uint64_t num_bkts = 0; uint8_t bkt_size = 0;
+  size_t cap_entries, fstride; uint64_t num_bkts = 0; uint8_t bkt_size = 0;
 
   // Decide on hash table capacity based on how much memory we can use
-  cap_entries = mem_in_bytes / sizeof(KPEntry);
+  cap_entries = mem_in_bytes / (sizeof(KPEntry) + sizeof(PathHashFprint));
   hash_table_cap(cap_entries, &num_bkts, &bkt_size);
   cap_entries = num_bkts * bkt_size;
+  fstride = PHASH_FPRINT_STRIDE(bkt_size);
 
-  size_t bktlocks_mem = roundup_bits2bytes(num_bkts);
-  size_t mem = cap_entries*sizeof(KPEntry) + bktlocks_mem;
+  size_t mem = cap_entries*sizeof(KPEntry) +
+               num_bkts*fstride*sizeof(PathHashFprint) +
+               num_bkts*sizeof(uint8_t);
 
   char num_bkts_str[100], bkt_size_str[100], cap_str[100], mem_str[100];
   ulong_to_str(num_bkts, num_bkts_str);
@@ -32,24 +40,26 @@ void path_hash_alloc(PathHash *phash, size_t mem_in_bytes)
   status("[PathHash]  number of buckets: %s, bucket size: %s", num_bkts_str, bkt_size_str);
 
   KPEntry *table = ctx_malloc(cap_entries * sizeof(KPEntry));
-  uint8_t *bktlocks = ctx_calloc(bktlocks_mem, sizeof(uint8_t));
   uint8_t *bucket_nitems = ctx_calloc(num_bkts, sizeof(uint8_t));
+  PathHashFprint *fprints = ctx_calloc(num_bkts * fstride, sizeof(PathHashFprint));
 
   ctx_assert(num_bkts * bkt_size == cap_entries);
   ctx_assert(cap_entries > 0);
   ctx_assert(sizeof(KPEntry) == 10);
+  ctx_assert(((size_t)fprints & 15) == 0);
 
   // Table all set to 1 to indicate empty
   memset(table, 0xff, cap_entries * sizeof(KPEntry));
 
   PathHash tmp = {.table = table,
+                  .fprints = fprints,
                   .num_of_buckets = num_bkts,
                   .bucket_size = bkt_size,
+                  .fprint_stride = fstride,
                   .capacity = cap_entries,
                   .mask = num_bkts - 1,
                   .num_entries = 0,
-                  .bucket_nitems = bucket_nitems,
-                  .bktlocks = bktlocks};
+                  .bucket_nitems = bucket_nitems};
 
   memcpy(phash, &tmp, sizeof(PathHash));
 }
@@ -57,7 +67,7 @@ void path_hash_alloc(PathHash *phash, size_t mem_in_bytes)
 void path_hash_dealloc(PathHash *phash)
 {
   ctx_free(phash->bucket_nitems);
-  ctx_free(phash->bktlocks);
+  ctx_free(phash->fprints);
   ctx_free(phash->table);
   memset(phash, 0, sizeof(PathHash));
 }
@@ -65,85 +75,119 @@ void path_hash_dealloc(PathHash *phash)
 void path_hash_reset(PathHash *phash)
 {
   phash->num_entries = 0;
-  memset(phash->table, 0, phash->capacity * sizeof(KPEntry));
+  memset(phash->table, 0xff, phash->capacity * sizeof(KPEntry));
+  memset(phash->bucket_nitems, 0, phash->num_of_buckets * sizeof(uint8_t));
+  memset(phash->fprints, 0, phash->num_of_buckets * phash->fprint_stride *
+                            sizeof(PathHashFprint));
 }
 
-static inline bool _phash_entries_match(KPEntry entry,
-                                        hkey_t hkey, PathLen plen,
-                                        const uint8_t *seq,
+// packed is <PathLen><PackedSeq> of `mem` bytes. Length and orientation must
+// match as well as sequence, since different paths can share the same bytes
+static inline bool _phash_entries_match(KPEntry entry, hkey_t hkey,
+                                        const uint8_t *packed, size_t mem,
                                         const uint8_t *pstore, size_t colbytes)
 {
-  ctx_assert(entry.hkey != PATH_HASH_UNSET);
-  ctx_assert(entry.pindex != PATH_HASH_UNSET);
-  const uint8_t *seq2 = packedpath_seq(pstore+entry.pindex, colbytes);
-  return (hkey == entry.hkey && memcmp(seq, seq2, (plen+3)/4) == 0);
+  // Slot may have been claimed by another thread but not written yet
+  // (hkey unset) or written without pindex being set yet. Neither can be for
+  // this kmer, since the caller holds the lock on it.
+  if(hkey != entry.hkey || entry.pindex == PATH_HASH_UNSET) return false;
+  const uint8_t *packed2 = pstore+entry.pindex+sizeof(PathIndex)+colbytes;
+  return (memcmp(packed, packed2, mem) == 0);
 }
 
-// Use a bucket lock to find or add an entry
-// Returns:
-//   1  inserted
-//   0  found
-//  -1  not found and not inserted
-static inline int _find_or_add_in_bucket(PathHash *restrict phash, uint64_t hash,
-                                         hkey_t hkey, PathLen plen,
-                                         const uint8_t *restrict seq,
-                                         const uint8_t *restrict pstore,
-                                         size_t colbytes,
-                                         size_t *restrict pos)
+// Search entries [i,n) of a bucket for a match. Only entries whose
+// fingerprint matches are compared against the PathStore.
+// Returns index in bucket or -1 if not found
+static inline int _find_in_bucket(const KPEntry *bkt,
+                                  const PathHashFprint *fprints,
+                                  PathHashFprint fprint,
+                                  size_t i, size_t n,
+                                  hkey_t hkey, size_t mem,
+                                  const uint8_t *restrict packed,
+                                  const uint8_t *restrict pstore,
+                                  size_t colbytes)
 {
-  bitlock_yield_acquire(phash->bktlocks, hash);
-
-  KPEntry *entry = phash->table + hash * phash->bucket_size;
-  const KPEntry *end = entry + phash->bucket_size;
+#ifdef __SSE2__
+  // Compare 8 fingerprints at a time, rows are 16 byte aligned and padded
+  const __m128i key = _mm_set1_epi16((short)fprint);
+  size_t j, b;
+  unsigned int bits;
 
-  for(; entry < end; entry++)
+  for(b = i & ~(size_t)7; b < n; b += 8)
   {
-    if(!PATH_HASH_ENTRY_ASSIGNED(*entry))
-    {
-      *entry = (KPEntry){.hkey = hkey, .pindex = PATH_HASH_UNSET};
-      *pos = entry - phash->table;
-      __sync_fetch_and_add((volatile uint8_t *)&phash->bucket_nitems[hash], 1);
-      bitlock_release(phash->bktlocks, hash);
-      return 1;
+    __m128i fps = _mm_load_si128((const __m128i*)(fprints + b));
+    bits = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi16(fps, key));
+
+    // Two bits per 16 bit lane, keep one per lane
+    bits &= 0x5555;
+
+    while(bits) {
+      j = b + (size_t)__builtin_ctz(bits)/2;
+      bits &= bits - 1;
+      if(j >= i && j < n &&
+         _phash_entries_match(bkt[j], hkey, packed, mem, pstore, colbytes)) {
+        return (int)j;
+      }
     }
-    else if(_phash_entries_match(*entry, hkey, plen, seq, pstore, colbytes))
-    {
-      *pos = entry - phash->table;
-      bitlock_release(phash->bktlocks, hash);
-      return 0;
+  }
+#else
+  for(; i < n; i++) {
+    if(fprints[i] == fprint &&
+       _phash_entries_match(bkt[i], hkey, packed, mem, pstore, colbytes)) {
+      return (int)i;
     }
   }
-
-  bitlock_release(phash->bktlocks, hash);
+#endif
 
   return -1;
 }
 
-// Lock free search bucket for match.
-// We can traverse a full bucket without acquiring the lock first because
-// items are added but never removed from the hash. This allows us to remove
-// the use of locks and improve performance.
+// Lock free find or add in a bucket.
+// Entries are added but never removed, so we can search the first
+// bucket_nitems entries without a lock. A slot is claimed by incrementing
+// bucket_nitems with compare-and-swap; if another thread beats us to it, we
+// search the entries it added and try again with the next slot.
 // Returns:
+//   1  inserted
 //   0  found
-//  -1  not found
-static inline int _find_in_bucket(PathHash *restrict phash, uint64_t hash,
-                                  hkey_t hkey, PathLen plen,
-                                  const uint8_t *restrict seq,
-                                  const uint8_t *restrict pstore,
-                                  size_t colbytes,
-                                  size_t *restrict pos)
+//  -1  not found and not inserted (bucket full)
+static inline int _find_or_add_in_bucket(PathHash *restrict phash, uint64_t hash,
+                                         PathHashFprint fprint,
+                                         hkey_t hkey, size_t mem,
+                                         const uint8_t *restrict packed,
+                                         const uint8_t *restrict pstore,
+                                         size_t colbytes,
+                                         size_t *restrict pos)
 {
-  const KPEntry *entry = phash->table + hash * phash->bucket_size;
-  const KPEntry *end = entry + phash->bucket_size;
+  volatile uint8_t *nitems = (volatile uint8_t *)&phash->bucket_nitems[hash];
+  KPEntry *bkt = phash->table + hash * phash->bucket_size;
+  PathHashFprint *fprints = phash->fprints + hash * phash->fprint_stride;
+  size_t i = 0, n = *nitems;
+  int j;
+
+  while(1)
+  {
+    j = _find_in_bucket(bkt, fprints, fprint, i, n,
+                        hkey, mem, packed, pstore, colbytes);
 
-  for(; entry < end; entry++) {
-    if(_phash_entries_match(*entry, hkey, plen, seq, pstore, colbytes)) {
-      *pos = entry - phash->table;
+    if(j >= 0) {
+      *pos = bkt + j - phash->table;
       return 0;
     }
-  }
 
-  return -1;
+    if(n == phash->bucket_size) return -1;
+
+    if(__sync_bool_compare_and_swap(nitems, (uint8_t)n, (uint8_t)(n+1))) {
+      // Slot n is ours
+      fprints[n] = fprint;
+      bkt[n] = (KPEntry){.hkey = hkey, .pindex = PATH_HASH_UNSET};
+      *pos = bkt + n - phash->table;
+      return 1;
+    }
+
+    i = n;
+    n = *nitems;
+  }
 }
 
 // You must acquire the lock on the kmer before adding
@@ -153,7 +197,7 @@ static inline int _find_in_bucket(PathHash *restrict phash, uint64_t hash,
 //   1  inserted
 //   0  found
 //  -1  out of memory
-// Thread Safe: uses bucket level locks
+// Thread Safe: lock free, slots are claimed with compare-and-swap
 int path_hash_find_or_insert_mt(PathHash *restrict phash, hkey_t hkey,
                                 const uint8_t *restrict packed,
                                 const uint8_t *restrict pstore,
@@ -164,7 +208,6 @@ int path_hash_find_or_insert_mt(PathHash *restrict phash, hkey_t hkey,
   ctx_assert(hkey < PATH_HASH_UNSET);
 
   const uint64_t mask = phash->mask;
-  const uint8_t *seq = packed+sizeof(PathLen);
   PathLen plen;
 
   memcpy(&plen, packed, sizeof(PathLen));
@@ -172,23 +215,20 @@ int path_hash_find_or_insert_mt(PathHash *restrict phash, hkey_t hkey,
 
   size_t i, path_bytes = (plen+3)/4, mem = sizeof(PathLen) + path_bytes;
   uint64_t hash = hkey;
+  PathHashFprint fprint = 0;
   int ret;
 
   for(i = 0; i < REHASH_LIMIT; i++)
   {
     hash = CityHash64WithSeeds((const char*)packed, mem, hash, i);
-    hash &= mask;
 
-    uint8_t bucket_fill = *(volatile uint8_t *)&phash->bucket_nitems[hash];
+    // Fingerprint from top bits of the first hash, buckets use the low bits
+    if(i == 0) fprint = (PathHashFprint)(hash >> 48);
 
-    if(bucket_fill < phash->bucket_size) {
-      ret = _find_or_add_in_bucket(phash, hash, hkey, plen, seq,
-                                   pstore, colbytes, pos);
-    }
-    else {
-      ret = _find_in_bucket(phash, hash, hkey, plen, seq,
-                            pstore, colbytes, pos);
-    }
+    hash &= mask;
+
+    ret = _find_or_add_in_bucket(phash, hash, fprint, hkey, mem, packed,
+                                 pstore, colbytes, pos);
 
     if(ret >= 0) return ret;
   }
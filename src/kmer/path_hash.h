@@ -4,7 +4,9 @@
 #include "packed_path.h"
 #include "hash_table.h"
 
-#define PATH_HASH_EMPTY {.table = NULL, .num_of_buckets = 0, .bucket_size = 0, \
+#define PATH_HASH_EMPTY {.table = NULL, .fprints = NULL,                       \
+                         .num_of_buckets = 0, .bucket_size = 0,                \
+                         .fprint_stride = 0,                                   \
                          .capacity = 0, .mask = 0, .num_entries = 0}
 
 #define PATH_HASH_UNSET (0xffffffffff)
@@ -21,14 +23,22 @@ struct KPEntryStruct
 
 typedef struct KPEntryStruct KPEntry;
 
+// Each entry also has a 16 bit fingerprint of its kmer and sequence, stored
+// apart from the entries so a bucket's fingerprints can be compared eight at a
+// time. Rows of fingerprints are padded to a multiple of 8 (16 bytes), so each
+// row is 16 byte aligned. Only entries with a matching fingerprint are
+// compared against the PathStore.
+typedef uint16_t PathHashFprint;
+
 typedef struct
 {
   KPEntry *const table;
+  PathHashFprint *const fprints; // fprint_stride per bucket
   const size_t num_of_buckets; // needs to store maximum of 1<<32
   const uint8_t bucket_size; // max value 255
+  const size_t fprint_stride; // bucket_size rounded up to a multiple of 8
   const uint64_t capacity, mask; // num_of_buckets * bucket_size
-  uint8_t *const bucket_nitems; // number of items in each bucket
-  uint8_t *const bktlocks; // always cast to volatile
+  uint8_t *const bucket_nitems; // number of items in each bucket, CAS to add
   size_t num_entries;
 } PathHash;
 
@@ -43,7 +53,7 @@ void path_hash_reset(PathHash *phash);
 //   1  inserted
 //   0  found
 //  -1  out of memory
-// Thread Safe: uses bucket level locks
+// Thread Safe: lock free, slots are claimed with compare-and-swap
 int path_hash_find_or_insert_mt(PathHash *restrict phash, hkey_t hkey,
                                 const uint8_t *restrict packed,
                                 const uint8_t *restrict pstore, size_t colbytes,
@@ -11,6 +11,9 @@ void path_set_alloc(PathSet *set)
 {
   bytebuf_alloc(&set->seqs, 512);
   pentrybuf_alloc(&set->members, 512);
+  pentrybuf_alloc(&set->tmp, 512);
+  psrangebuf_alloc(&set->ranges, 64);
+  bytebuf_alloc(&set->tmpcols, 512);
   path_set_reset(set);
 }
 
@@ -18,6 +21,9 @@ void path_set_dealloc(PathSet *set)
 {
   bytebuf_dealloc(&set->seqs);
   pentrybuf_dealloc(&set->members);
+  pentrybuf_dealloc(&set->tmp);
+  psrangebuf_dealloc(&set->ranges);
+  bytebuf_dealloc(&set->tmpcols);
 }
 
 // Sort in orientation (FORWARD, then REVERSE)
@@ -28,6 +34,7 @@ void path_set_dealloc(PathSet *set)
 //   b
 //   bc
 //   bcd
+// Then by pindex
 static int _path_entry_cmp(const void *aa, const void *bb, void *ptr)
 {
   const PathEntry *a = (const PathEntry*)aa, *b = (const PathEntry*)bb;
@@ -37,14 +44,105 @@ static int _path_entry_cmp(const void *aa, const void *bb, void *ptr)
   ret = binary_seqs_cmp(path_set_seq(a,set), a->plen,
                         path_set_seq(b,set), b->plen);
   if(ret != 0) return ret;
-  return a->pindex - b->pindex;
+  return (a->pindex > b->pindex) - (a->pindex < b->pindex);
 }
 
+// Ranges smaller than this are insertion sorted
+#define PATH_SET_RADIX_MIN 16
+
+static inline void _path_entries_isort(PathEntry *list, size_t n,
+                                       PathSet *set)
+{
+  size_t i, j;
+  PathEntry tmp;
+  for(i = 1; i < n; i++) {
+    tmp = list[i];
+    for(j = i; j > 0 && _path_entry_cmp(&list[j-1], &tmp, set) > 0; j--)
+      list[j] = list[j-1];
+    list[j] = tmp;
+  }
+}
+
+// Radix key at a given depth: 0 if the path has ended, otherwise 1+base
+static inline size_t _path_entry_radix(const PathEntry *entry,
+                                       const PathSet *set, size_t depth)
+{
+  return entry->plen <= depth ? 0
+                              : 1 + binary_seq_get(path_set_seq(entry,set), depth);
+}
+
+static inline void _push_sort_range(PathSet *set, size_t start, size_t end,
+                                    size_t depth)
+{
+  PathSortRange range = {.start = start, .end = end, .depth = depth};
+  psrangebuf_add(&set->ranges, range);
+}
+
+// MSD radix sort on packed bases. Entries are first split by orientation,
+// then ranges of entries are bucketed by the base at `depth`. Paths that end
+// at `depth` go first (prefixes sort before the paths that extend them) and
+// are identical, so are ordered by pindex. Uses an explicit stack of ranges
+// rather than recursion, since paths can be long.
 void path_set_sort(PathSet *set)
 {
-  // Sort paths
-  sort_r(set->members.data, set->members.len, sizeof(PathEntry),
-         _path_entry_cmp, set);
+  const size_t n = set->members.len;
+  PathEntry *list = set->members.data, *tmp;
+  size_t i, k, nfw, len, counts[5], offsets[5];
+  PathSortRange range;
+
+  pentrybuf_ensure_capacity(&set->tmp, n);
+  psrangebuf_reset(&set->ranges);
+  tmp = set->tmp.data;
+
+  // Split by orientation
+  for(i = nfw = 0; i < n; i++) nfw += (list[i].orient == FORWARD);
+  for(i = 0, offsets[0] = 0, offsets[1] = nfw; i < n; i++)
+    tmp[offsets[list[i].orient == FORWARD ? 0 : 1]++] = list[i];
+  memcpy(list, tmp, n * sizeof(PathEntry));
+
+  if(nfw > 1) _push_sort_range(set, 0, nfw, 0);
+  if(n-nfw > 1) _push_sort_range(set, nfw, n, 0);
+
+  while(set->ranges.len > 0)
+  {
+    range = set->ranges.data[--set->ranges.len];
+    len = range.end - range.start;
+
+    if(len < PATH_SET_RADIX_MIN) {
+      _path_entries_isort(list+range.start, len, set);
+      continue;
+    }
+
+    memset(counts, 0, sizeof(counts));
+    for(i = range.start; i < range.end; i++)
+      counts[_path_entry_radix(&list[i], set, range.depth)]++;
+
+    // All share the next base: move on to the following base without copying
+    for(k = 1; k < 5 && counts[k] < len; k++) {}
+    if(k < 5) {
+      range.depth++;
+      psrangebuf_add(&set->ranges, range);
+      continue;
+    }
+
+    for(k = 0, offsets[0] = range.start; k < 4; k++)
+      offsets[k+1] = offsets[k] + counts[k];
+
+    for(i = range.start; i < range.end; i++)
+      tmp[offsets[_path_entry_radix(&list[i], set, range.depth)]++] = list[i];
+
+    memcpy(list+range.start, tmp+range.start, len * sizeof(PathEntry));
+
+    // Paths that end here are identical, sort by pindex
+    if(counts[0] < PATH_SET_RADIX_MIN)
+      _path_entries_isort(list+range.start, counts[0], set);
+    else
+      sort_r(list+range.start, counts[0], sizeof(PathEntry), _path_entry_cmp, set);
+
+    for(k = 1, i = range.start + counts[0]; k < 5; i += counts[k++])
+      if(counts[k] > 1) _push_sort_range(set, i, i+counts[k], range.depth+1);
+  }
+
   set->sorted = true;
 }
 
@@ -136,72 +234,81 @@ void path_set_load(PathSet *set, size_t cbytes,
   set->sorted = false;
 }
 
+// Returns true if path `a` is a prefix of, or equal to, path `b`
+static inline bool _path_entry_is_prefix(const PathEntry *a, const PathEntry *b,
+                                         const PathSet *set)
+{
+  return (a->orient == b->orient && a->plen <= b->plen &&
+          binary_seqs_cmp(path_set_seq(a,set), a->plen,
+                          path_set_seq(b,set), a->plen) == 0);
+}
+
+// Pop the top path off the slim stack. `cols` holds the colours of paths that
+// extend each path on the stack. Those colours are removed from the path and
+// passed on to its parent (the path below it on the stack).
+static inline void _path_set_slim_pop(PathSet *set, size_t *top)
+{
+  const size_t cbytes = set->cbytes;
+  size_t i = --(*top);
+  uint8_t *cset = path_set_colset(&set->tmp.data[i], set);
+  uint8_t *cols = set->tmpcols.data + i*cbytes;
+
+  if(i > 0) {
+    packedpath_colsets_or(cols-cbytes, cols, cbytes);
+    packedpath_colsets_or(cols-cbytes, cset, cbytes);
+  }
+
+  packedpath_colset_rm_intersect(cset, cols, cbytes);
+}
+
 // Remove redundant entries such as duplicates, substrings and
 // paths with no colours
 // {T,TT,TT} -> {TT}
 // {A,C,CG,CGC} -> {A,CGC}
+//
+// In sorted order a path comes after all of its prefixes, so we keep a stack
+// of the paths that are prefixes of the current path and make a single pass.
+// Entries on the stack share colour sets with set->members, so colours
+// removed from them are removed from the set.
 void path_set_slim(PathSet *set)
 {
-  const size_t num_members = set->members.len;
+  const size_t num_members = set->members.len, cbytes = set->cbytes;
   if(num_members == 0) return;
 
   if(!set->sorted) path_set_sort(set);
 
-  size_t i, j;
-  bool potential_empty_sets = false;
-  PathEntry *members = set->members.data;
-  PathLen min_plen;
-  uint8_t *cset_i, *cset_j; // colour sets
-  const uint8_t *seq_i, *seq_j;
+  PathEntry *members = set->members.data, *stack;
+  size_t i, j, top = 0;
+  uint8_t *cset_i;
 
-  // Work backwards to remove colours from subsumed paths
-  for(i = num_members-1; i > 0; i--)
-  {
-    seq_i = path_set_seq(&members[i],set);
-    cset_i = path_set_colset(&members[i],set);
+  pentrybuf_ensure_capacity(&set->tmp, num_members);
+  bytebuf_ensure_capacity(&set->tmpcols, num_members * cbytes);
+  stack = set->tmp.data;
 
-    // If sample has no colours skip it
-    if(packedpath_is_colset_zero(cset_i, set->cbytes)) {
-      potential_empty_sets = true;
+  for(i = 0; i < num_members; i++)
+  {
+    while(top > 0 && !_path_entry_is_prefix(&stack[top-1], &members[i], set))
+      _path_set_slim_pop(set, &top);
+
+    if(top > 0 && stack[top-1].plen == members[i].plen) {
+      // paths match, steal colours, zero it
+      packedpath_cpy_zero_colsets(path_set_colset(&members[i],set),
+                                  path_set_colset(&stack[top-1],set), cbytes);
+      stack[top-1] = members[i];
     }
     else {
-      // work backwards over paths as j as they match
-      for(j = i-1; j != SIZE_MAX && members[j].plen <= members[i].plen; j--)
-      {
-        min_plen = MIN2(members[i].plen, members[j].plen);
-
-        seq_j = path_set_seq(&members[j],set);
-        cset_j = path_set_colset(&members[j],set);
-
-        if(binary_seqs_cmp(seq_i, min_plen, seq_j, min_plen) != 0)
-          break;
-
-        if(members[i].plen == members[j].plen) {
-          // paths i,j match, steal colours, zero it
-          packedpath_cpy_zero_colsets(cset_i, cset_j, set->cbytes);
-        }
-        else {
-          // path j is substring of i, remove colours from j that are in i
-          packedpath_colset_rm_intersect(cset_j, cset_i, set->cbytes);
-        }
-
-        potential_empty_sets = true;
-      }
+      stack[top] = members[i];
+      memset(set->tmpcols.data + top*cbytes, 0, cbytes);
+      top++;
     }
   }
 
-  // We haven't checked the first path entry
-  if(!potential_empty_sets) {
-    cset_i = path_set_colset(&members[0],set);
-    potential_empty_sets = packedpath_is_colset_zero(cset_i, set->cbytes);
-  }
-
-  if(!potential_empty_sets) return;
+  while(top > 0) _path_set_slim_pop(set, &top);
 
   // loop over entries and remove empty ones
   for(i = j = 0; i < num_members; i++) {
     cset_i = path_set_colset(&members[i],set);
-    if(!packedpath_is_colset_zero(cset_i, set->cbytes)) {
+    if(!packedpath_is_colset_zero(cset_i, cbytes)) {
       members[j++] = members[i];
     }
   }
@@ -209,6 +316,36 @@ void path_set_slim(PathSet *set)
   set->members.len = j;
 }
 
+// Merge entries with the same orientation and sequence, OR-ing their colour
+// sets and summing counts. Does not remove substrings.
+// {T,TT,TT} -> {T,TT}
+void path_set_merge_dups(PathSet *set)
+{
+  const size_t num_members = set->members.len;
+  if(num_members == 0) return;
+
+  if(!set->sorted) path_set_sort(set);
+
+  size_t i, j;
+  PathEntry *members = set->members.data;
+
+  for(i = 0, j = 1; j < num_members; j++)
+  {
+    if(members[i].orient == members[j].orient &&
+       members[i].plen == members[j].plen &&
+       binary_seqs_cmp(path_set_seq(&members[i],set), members[i].plen,
+                       path_set_seq(&members[j],set), members[j].plen) == 0)
+    {
+      packedpath_colsets_or(path_set_colset(&members[i],set),
+                            path_set_colset(&members[j],set), set->cbytes);
+      members[i].count = MIN2(255, (size_t)members[i].count + members[j].count);
+    }
+    else members[++i] = members[j];
+  }
+
+  set->members.len = i+1;
+}
+
 // Updates entry0
 static inline void _update_store(const PathEntry *entry0, const PathSet *set0,
                                  const PathEntry *entry1, const PathSet *set1,
@@ -21,12 +21,25 @@ create_objbuf(pentrybuf, PathEntryBuffer, PathEntry);
   #define BYTE_BUFFER_DEFINED
 #endif
 
+// Range of entries left to sort, all sharing their first `depth` bases
+typedef struct
+{
+  size_t start, end, depth;
+} PathSortRange;
+
+create_objbuf(psrangebuf, PathSortRangeBuffer, PathSortRange);
+
 typedef struct
 {
   size_t cbytes; // number of bytes in colourset
   ByteBuffer seqs;
   PathEntryBuffer members;
   bool sorted;
+  // Scratch space for sorting and slimming. Kept between calls so that a set
+  // reused for many kmers (one per thread) stops allocating once warmed up.
+  PathEntryBuffer tmp;
+  PathSortRangeBuffer ranges;
+  ByteBuffer tmpcols;
 } PathSet;
 
 #define path_set_seq(entry,set) ((set)->seqs.data + (entry)->seq)
@@ -49,7 +62,8 @@ void path_set_load(PathSet *set, size_t cbytes,
                    const uint8_t *store, PathIndex pindex,
                    const FileFilter *fltr);
 
-// Sort path set
+// Sort path set by orientation, sequence then pindex (see path_set.c)
+// Uses an MSD radix sort on the packed bases
 void path_set_sort(PathSet *set);
 
 // Remove redundant entries such as duplicates, substrings and
@@ -58,6 +72,11 @@ void path_set_sort(PathSet *set);
 // {A,C,CG,CGC} -> {A,CGC}
 void path_set_slim(PathSet *set);
 
+// Merge entries with the same orientation and sequence, OR-ing their colour
+// sets and summing counts. Does not remove substrings.
+// {T,TT,TT} -> {T,TT}
+void path_set_merge_dups(PathSet *set);
+
 // Remove entries from set that are in the filter set
 // if `rmsubstr` then also remove substring matches
 // Note: does not remove duplicates from `set`,
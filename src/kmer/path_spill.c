@@ -0,0 +1,390 @@
+#include "global.h"
+#include "path_spill.h"
+#include "path_set.h"
+#include "file_util.h"
+#include "util.h"
+
+#include <unistd.h> // unlink
+#include <sched.h> // sched_yield
+
+#define SPILL_RUN_END UINT64_MAX
+
+// Maximum number of open run files, before they are merged into one
+#define PATH_SPILL_MAX_RUNS 64
+
+void path_spill_alloc(PathSpill *spill, const char *out_path, dBGraph *db_graph)
+{
+  PathStore *pstore = &db_graph->pstore;
+  ctx_assert2(pstore->extra_bytes == 1, "PathStore doesn't hold counts");
+  ctx_assert(pstore->kmer_paths_write != NULL);
+
+  memset(spill, 0, sizeof(PathSpill));
+  spill->db_graph = db_graph;
+  if(pthread_mutex_init(&spill->lock, NULL) != 0) die("pthread_mutex init failed");
+
+  strbuf_alloc(&spill->dir, 1024);
+  if(strcmp(out_path,"-") == 0) strbuf_set(&spill->dir, "./");
+  else futil_get_strbuf_of_dir_path(out_path, &spill->dir);
+
+  spill->runs = ctx_malloc(PATH_SPILL_MAX_RUNS * sizeof(FILE*));
+
+  spill->base_bytes = (size_t)(pstore->next - pstore->store);
+  spill->base_paths = pstore->num_of_paths;
+  spill->base_kmers = pstore->num_kmers_with_paths;
+  spill->base_col_paths = pstore->num_col_paths;
+  spill->base_num_bytes = pstore->num_of_bytes;
+
+  // If new paths are used whilst threading, we need to restore loaded paths
+  // to the index. Otherwise loaded paths are only written to the first run.
+  if(pstore->kmer_paths_read == pstore->kmer_paths_write &&
+     pstore->num_of_paths > 0)
+  {
+    size_t mem = db_graph->ht.capacity * sizeof(PathIndex);
+    spill->base_index = ctx_malloc(mem);
+    memcpy(spill->base_index, pstore->kmer_paths_write, mem);
+  }
+
+  pstore->can_spill = true;
+}
+
+void path_spill_dealloc(PathSpill *spill)
+{
+  size_t i;
+  for(i = 0; i < spill->num_runs; i++) fclose(spill->runs[i]);
+  ctx_free(spill->runs);
+  ctx_free(spill->base_index);
+  ctx_free(spill->threads);
+  strbuf_dealloc(&spill->dir);
+  pthread_mutex_destroy(&spill->lock);
+  spill->db_graph->pstore.can_spill = false;
+  memset(spill, 0, sizeof(PathSpill));
+}
+
+// Create an unlinked temporary file
+static FILE* path_spill_new_run(PathSpill *spill)
+{
+  StrBuf path;
+  strbuf_alloc(&path, spill->dir.len + 100);
+  strbuf_sprintf(&path, "%sctp_run.XXXXXX", spill->dir.buff);
+
+  int fd = mkstemp(path.buff);
+  if(fd == -1) die("Cannot create temporary file: %s [%s]", path.buff, strerror(errno));
+  FILE *fh = fdopen(fd, "w+");
+  if(fh == NULL) die("Cannot open temporary file: %s [%s]", path.buff, strerror(errno));
+  unlink(path.buff); // Immediately unlink to hide temp file
+  setvbuf(fh, NULL, _IOFBF, CTX_BUF_SIZE);
+
+  strbuf_dealloc(&path);
+  return fh;
+}
+
+// Write paths of a kmer to a run, skipping paths loaded before threading
+// (those with pindex < skip)
+static inline void _spill_write_kmer(hkey_t hkey, const PathStore *pstore,
+                                     PathIndex skip, ByteBuffer *buf,
+                                     FILE *fh)
+{
+  PathIndex pindex = pstore->kmer_paths_write[hkey];
+  const uint8_t *path;
+  uint8_t *out;
+  size_t mem, last = SIZE_MAX;
+
+  bytebuf_reset(buf);
+
+  for(; pindex != PATH_NULL; pindex = packedpath_get_prev(path))
+  {
+    path = pstore->store + pindex;
+    if(pindex < skip) continue;
+
+    mem = packedpath_mem(path, pstore->colset_bytes) + pstore->extra_bytes;
+    bytebuf_ensure_capacity(buf, buf->len + mem);
+    out = buf->data + buf->len;
+    memcpy(out, path, mem);
+
+    if(last != SIZE_MAX) packedpath_set_prev(buf->data+last, buf->len);
+    last = buf->len;
+    buf->len += mem;
+  }
+
+  if(last == SIZE_MAX) return;
+  packedpath_set_prev(buf->data+last, PATH_NULL);
+
+  uint64_t hdr[2] = {hkey, buf->len};
+  if(fwrite(hdr, 1, sizeof(hdr), fh) != sizeof(hdr) ||
+     fwrite(buf->data, 1, buf->len, fh) != buf->len)
+  {
+    die("Cannot write to temporary file [%s]", strerror(errno));
+  }
+}
+
+static void path_spill_compact(PathSpill *spill);
+
+// Write current paths to a new run file
+static void path_spill_write_run(PathSpill *spill)
+{
+  dBGraph *db_graph = spill->db_graph;
+  const PathStore *pstore = &db_graph->pstore;
+
+  // Loaded paths are only written to the first run
+  PathIndex skip = spill->num_runs > 0 ? spill->base_bytes : 0;
+
+  char paths_str[50], mem_str[50];
+  ulong_to_str(pstore->num_of_paths, paths_str);
+  bytes_to_str(pstore->num_of_bytes, 1, mem_str);
+  status("[PathSpill] Writing %s paths [%s] to disk [run %zu]",
+         paths_str, mem_str, spill->num_runs);
+
+  if(spill->num_runs == PATH_SPILL_MAX_RUNS) path_spill_compact(spill);
+
+  FILE *fh = path_spill_new_run(spill);
+  spill->runs[spill->num_runs++] = fh;
+
+  ByteBuffer buf;
+  bytebuf_alloc(&buf, 1024);
+  HASH_ITERATE(&db_graph->ht, _spill_write_kmer, pstore, skip, &buf, fh);
+  bytebuf_dealloc(&buf);
+
+  if(fflush(fh) != 0) die("Cannot write to temporary file [%s]", strerror(errno));
+}
+
+// Return the store to its state before threading reads
+static void path_spill_reset(PathSpill *spill)
+{
+  dBGraph *db_graph = spill->db_graph;
+  PathStore *pstore = &db_graph->pstore;
+  size_t mem = db_graph->ht.capacity * sizeof(PathIndex);
+
+  if(spill->base_index != NULL) {
+    memcpy(pstore->kmer_paths_write, spill->base_index, mem);
+    pstore->num_of_paths = spill->base_paths;
+    pstore->num_kmers_with_paths = spill->base_kmers;
+    pstore->num_col_paths = spill->base_col_paths;
+    pstore->num_of_bytes = spill->base_num_bytes;
+  } else {
+    memset(pstore->kmer_paths_write, 0xff, mem);
+    pstore->num_of_paths = pstore->num_kmers_with_paths = 0;
+    pstore->num_col_paths = pstore->num_of_bytes = 0;
+  }
+
+  pstore->next = pstore->store + spill->base_bytes;
+  path_hash_reset(&pstore->phash);
+
+  __sync_synchronize();
+  pstore->full = false;
+}
+
+size_t path_spill_add_thread(PathSpill *spill, PathStoreCounts *counts)
+{
+  size_t n = spill->num_threads + 1;
+  ctx_assert(sizeof(PathSpillThread) == 64);
+  spill->threads = ctx_realloc(spill->threads, n * sizeof(PathSpillThread));
+  memset(&spill->threads[n-1], 0, sizeof(PathSpillThread));
+  spill->threads[n-1].counts = counts;
+  spill->num_threads = n;
+  return n-1;
+}
+
+static void path_spill_flush(PathSpill *spill)
+{
+  PathStore *pstore = &spill->db_graph->pstore;
+  size_t i;
+
+  pthread_mutex_lock(&spill->lock);
+  // Another thread may have flushed whilst we waited for the lock
+  if(pstore->full) {
+    // Wait for reads in progress, they cannot add paths to a full store
+    __sync_synchronize();
+    for(i = 0; i < spill->num_threads; i++)
+      while(spill->threads[i].busy) sched_yield();
+    __sync_synchronize();
+
+    // No thread is threading a read, so their counts are up to date
+    for(i = 0; i < spill->num_threads; i++)
+      path_store_add_counts(pstore, spill->threads[i].counts);
+    path_spill_write_run(spill);
+    path_spill_reset(spill);
+  }
+  pthread_mutex_unlock(&spill->lock);
+}
+
+void path_spill_read_start(PathSpill *spill, size_t thread)
+{
+  PathSpillThread *thd = &spill->threads[thread];
+
+  while(1) {
+    // Set busy before checking the store, so a flush cannot start unseen
+    thd->busy = true;
+    __sync_synchronize();
+    if(!spill->db_graph->pstore.full) return;
+    thd->busy = false;
+    path_spill_flush(spill);
+  }
+}
+
+void path_spill_read_end(PathSpill *spill, size_t thread, bool flush)
+{
+  // Paths and counts from this read must be visible before a flush starts
+  __sync_synchronize();
+  spill->threads[thread].busy = false;
+  if(flush) path_spill_flush(spill);
+}
+
+//
+// Merge runs
+//
+
+// Read hkey and size of next record, sets hkey to SPILL_RUN_END at the end
+static inline void _run_next(FILE *fh, uint64_t *hkey, uint64_t *nbytes)
+{
+  uint64_t hdr[2];
+  size_t n = fread(hdr, 1, sizeof(hdr), fh);
+  if(n == 0) { *hkey = SPILL_RUN_END; *nbytes = 0; return; }
+  if(n != sizeof(hdr)) die("Corrupt temporary file");
+  *hkey = hdr[0];
+  *nbytes = hdr[1];
+}
+
+// Load paths from a record into the set, with counts
+static inline void _run_load(FILE *fh, uint64_t nbytes, size_t cbytes,
+                             ByteBuffer *buf, PathSet *set)
+{
+  size_t i = set->members.len;
+  const uint8_t *path;
+  PathEntry *entry;
+
+  bytebuf_ensure_capacity(buf, nbytes);
+  if(fread(buf->data, 1, nbytes, fh) != nbytes) die("Corrupt temporary file");
+
+  path_set_load(set, cbytes, buf->data, 0, NULL);
+
+  for(; i < set->members.len; i++) {
+    entry = &set->members.data[i];
+    path = buf->data + entry->pindex;
+    entry->count = *(path + packedpath_mem(path, cbytes));
+  }
+}
+
+// Merge all runs into `fout`. If `pstore` is NULL, output is a new run,
+// otherwise output is paths in .ctp format and pstore's kmer index and counts
+// are updated to match.
+static void _spill_merge(PathSpill *spill, uint8_t threshold,
+                         PathStore *pstore, FILE *fout)
+{
+  const size_t nruns = spill->num_runs;
+  const size_t cbytes = spill->db_graph->pstore.colset_bytes;
+  size_t i;
+
+  uint64_t *hkeys = ctx_malloc(nruns * sizeof(uint64_t));
+  uint64_t *nbytes = ctx_malloc(nruns * sizeof(uint64_t));
+  uint64_t hkey, rec[2];
+
+  for(i = 0; i < nruns; i++) {
+    if(fseek(spill->runs[i], 0, SEEK_SET) != 0)
+      die("Cannot seek temporary file [%s]", strerror(errno));
+    _run_next(spill->runs[i], &hkeys[i], &nbytes[i]);
+  }
+
+  // Kmer index now holds offsets of merged paths
+  if(pstore != NULL) {
+    memset(pstore->kmer_paths_write, 0xff,
+           spill->db_graph->ht.capacity * sizeof(PathIndex));
+  }
+
+  PathSet set;
+  ByteBuffer buf;
+  path_set_alloc(&set);
+  bytebuf_alloc(&buf, 1024);
+
+  PathIndex poffset = 0;
+  size_t npaths = 0, ncolpaths = 0, nkmers = 0;
+
+  while(1)
+  {
+    for(hkey = SPILL_RUN_END, i = 0; i < nruns; i++) hkey = MIN2(hkey, hkeys[i]);
+    if(hkey == SPILL_RUN_END) break;
+
+    path_set_reset(&set);
+    for(i = 0; i < nruns; i++) {
+      if(hkeys[i] == hkey) {
+        _run_load(spill->runs[i], nbytes[i], cbytes, &buf, &set);
+        _run_next(spill->runs[i], &hkeys[i], &nbytes[i]);
+      }
+    }
+
+    path_set_merge_dups(&set);
+
+    if(threshold > 0) {
+      path_set_threshold(&set, threshold, 0, NULL);
+      path_set_slim(&set);
+    }
+
+    if(set.members.len == 0) continue;
+
+    if(pstore != NULL) {
+      pstore_set_pindex(pstore, hkey, poffset);
+      poffset += paths_format_write_set(&set, poffset, false, &ncolpaths, fout);
+    } else {
+      rec[0] = hkey;
+      rec[1] = path_set_get_bytes_sum(&set) + set.members.len;
+      if(fwrite(rec, 1, sizeof(rec), fout) != sizeof(rec))
+        die("Cannot write to temporary file [%s]", strerror(errno));
+      paths_format_write_set(&set, 0, true, &ncolpaths, fout);
+    }
+
+    npaths += set.members.len;
+    nkmers++;
+  }
+
+  path_set_dealloc(&set);
+  bytebuf_dealloc(&buf);
+  ctx_free(hkeys);
+  ctx_free(nbytes);
+
+  if(pstore != NULL) {
+    pstore->num_of_paths = npaths;
+    pstore->num_col_paths = ncolpaths;
+    pstore->num_of_bytes = poffset;
+    pstore->num_kmers_with_paths = nkmers;
+  }
+}
+
+// Merge runs into one, to limit the number of open files
+static void path_spill_compact(PathSpill *spill)
+{
+  size_t i;
+  status("[PathSpill] Merging %zu runs on disk", spill->num_runs);
+
+  FILE *fh = path_spill_new_run(spill);
+  _spill_merge(spill, 0, NULL, fh);
+  if(fflush(fh) != 0) die("Cannot write to temporary file [%s]", strerror(errno));
+
+  for(i = 0; i < spill->num_runs; i++) fclose(spill->runs[i]);
+  spill->runs[0] = fh;
+  spill->num_runs = 1;
+}
+
+void path_spill_write(PathSpill *spill, PathFileHeader *hdr,
+                      uint8_t threshold, FILE *fout)
+{
+  dBGraph *db_graph = spill->db_graph;
+  PathStore *pstore = &db_graph->pstore;
+
+  ctx_assert(pstore->kmer_paths_read == pstore->kmer_paths_write);
+
+  // Remaining paths become the last run
+  path_spill_write_run(spill);
+
+  status("[PathSpill] Merging %zu runs", spill->num_runs);
+
+  // Merged paths are written to a temporary file since the header goes first
+  FILE *tmp_fh = path_spill_new_run(spill);
+  _spill_merge(spill, threshold, pstore, tmp_fh);
+
+  path_store_print_status(pstore);
+
+  // Write header, paths then kmer indices
+  paths_header_update(hdr, pstore);
+  paths_format_write_header(hdr, fout);
+  futil_merge_tmp_files(&tmp_fh, 1, fout);
+  paths_format_write_kmer_indices(db_graph, fout);
+}
@@ -0,0 +1,80 @@
+#ifndef PATH_SPILL_H_
+#define PATH_SPILL_H_
+
+#include <pthread.h>
+#include "db_graph.h"
+#include "path_format.h"
+
+//
+// Spill paths to disk when the PathStore fills up whilst threading reads
+//
+// With pstore->can_spill set, graph_paths_find_or_add_mt() marks the store as
+// full instead of dying. Each worker sets its own `busy` flag whilst threading
+// a read, so no lock is shared between reads. Once the store is full, a worker
+// takes `lock`, waits for reads in progress to finish (they cannot add to a
+// full store), writes the paths to a run file on disk and resets
+// the store to the state it was in before threading began (i.e. paths loaded
+// with -p are kept). Reads that were rejected by a full store are redone,
+// skipping paths from the read that were stored before the flush.
+//
+// Run files are temporary (unlinked), one record per kmer in hash table order:
+//   <hkey:uint64_t><nbytes:uint64_t><paths:nbytes>
+// Paths are in PathStore layout followed by a count byte, with prev indices
+// relative to the start of the record. At the end the runs are merged into a
+// single .ctp, with duplicate paths having colour sets OR'd and counts summed.
+//
+
+// A thread threading reads, padded so each is on its own cache line
+typedef struct
+{
+  volatile bool busy; // threading a read
+  PathStoreCounts *counts; // paths added, not yet added to the PathStore
+  uint8_t padding[48];
+} PathSpillThread;
+
+typedef struct
+{
+  dBGraph *db_graph;
+  pthread_mutex_t lock; // held whilst flushing
+  StrBuf dir; // where to create run files
+  FILE **runs;
+  size_t num_runs;
+
+  // State to reset the store to after each flush
+  size_t base_bytes; // paths in the store before threading
+  size_t base_paths, base_kmers, base_col_paths, base_num_bytes;
+  PathIndex *base_index; // NULL if kmer index should be emptied
+
+  // Threads threading reads, their counts are summed into the store on each
+  // flush
+  PathSpillThread *threads;
+  size_t num_threads;
+} PathSpill;
+
+// Call after loading any existing paths, before threading reads.
+// Run files are created in the same directory as `out_path` ("-" for STDOUT
+// uses the current directory).
+void path_spill_alloc(PathSpill *spill, const char *out_path, dBGraph *db_graph);
+void path_spill_dealloc(PathSpill *spill);
+
+// Register a thread before threads start, returns its id. `counts` are the
+// thread's counts of paths added (see path_store_add_counts()). They are added
+// to the store before each flush, so threads do not need to update the store's
+// counters after every read. Threads should still add their counts to the
+// store once they finish.
+size_t path_spill_add_thread(PathSpill *spill, PathStoreCounts *counts);
+
+// Call before threading a read, flushes the store first if it is full
+void path_spill_read_start(PathSpill *spill, size_t thread);
+
+// Call after threading a read. If `flush` is true (read was rejected by a full
+// store), flushes the store to disk. The read should then be redone.
+void path_spill_read_end(PathSpill *spill, size_t thread, bool flush);
+
+// Write all paths to fout (header and paths), merging with any runs on disk.
+// If threshold > 0, paths are cleaned as graph_paths_clean() would.
+// Call after path_store_combine_updated_paths(). Store cannot be used after.
+void path_spill_write(PathSpill *spill, PathFileHeader *hdr,
+                      uint8_t threshold, FILE *fout);
+
+#endif /* PATH_SPILL_H_ */
@@ -5,6 +5,8 @@
 #include "dna.h"
 #include "binary_seq.h"
 
+#include <sys/mman.h>
+
 // {[1:uint64_t prev][N:uint8_t col_bitfield][1:uint16_t len][M:uint8_t data]}..
 // prev = PATH_NULL if not set
 
@@ -47,6 +49,8 @@ void path_store_alloc(PathStore *ps, size_t mem, bool use_path_hash,
                          .kmer_paths_read = kmer_paths,
                          .kmer_paths_write = kmer_paths,
                          .kmer_locks = NULL,
+                         .can_spill = false, .full = false,
+                         .mmap_base = NULL, .mmap_len = 0,
                          .phash = PATH_HASH_EMPTY};
 
   if(use_path_hash)
@@ -92,12 +96,50 @@ void path_store_dealloc(PathStore *ps)
 {
   if(ps->kmer_paths_write != ps->kmer_paths_read) ctx_free(ps->kmer_paths_write);
   ctx_free(ps->kmer_paths_read);
-  ctx_free(ps->store);
+  if(ps->mmap_base != NULL) {
+    if(munmap(ps->mmap_base, ps->mmap_len) != 0)
+      warn("munmap failed: %s", strerror(errno));
+  }
+  else ctx_free(ps->store);
   ctx_free(ps->kmer_locks);
   path_hash_dealloc(&ps->phash);
   memset(ps, 0, sizeof(PathStore));
 }
 
+bool path_store_mmap(PathStore *ps, int fd, off_t offset, size_t nbytes)
+{
+  ctx_assert(ps->next == ps->store && ps->tmpstore == NULL);
+  ctx_assert(nbytes > 0 && (ptrdiff_t)nbytes <= ps->end - ps->store);
+
+  // Mappings must start on a page boundary
+  size_t pagesize = (size_t)sysconf(_SC_PAGESIZE);
+  size_t skip = (size_t)offset % pagesize;
+  size_t store_mem = (size_t)(ps->end - ps->store);
+  size_t len = skip + store_mem + PSTORE_PADDING;
+  uint8_t *base, *data;
+
+  // Reserve the whole block, then map the file over the start of it
+  base = mmap(NULL, len, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(base == MAP_FAILED) return false;
+
+  data = mmap(base, skip + nbytes, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_FIXED, fd, offset - (off_t)skip);
+  if(data == MAP_FAILED) {
+    munmap(base, len);
+    return false;
+  }
+
+  if(ps->mmap_base != NULL) munmap(ps->mmap_base, ps->mmap_len);
+  else ctx_free(ps->store);
+
+  ps->mmap_base = base;
+  ps->mmap_len = len;
+  ps->store = ps->next = base + skip;
+  ps->end = ps->store + store_mem;
+  return true;
+}
+
 void path_store_reset(PathStore *ps, size_t nkmers_in_hash)
 {
   if(ps->kmer_paths_read != NULL)
@@ -109,10 +151,21 @@ void path_store_reset(PathStore *ps, size_t nkmers_in_hash)
   ps->num_kmers_with_paths = 0;
   ps->num_col_paths = 0;
   ps->next = ps->store;
+  ps->full = false;
   if(ps->phash.table != NULL) path_hash_reset(&ps->phash);
   // done do anything to tmpstore, kmer_locks
 }
 
+void path_store_add_counts(PathStore *ps, PathStoreCounts *counts)
+{
+  __sync_add_and_fetch((volatile size_t*)&ps->num_of_paths, counts->num_of_paths);
+  __sync_add_and_fetch((volatile size_t*)&ps->num_kmers_with_paths,
+                       counts->num_kmers_with_paths);
+  __sync_add_and_fetch((volatile size_t*)&ps->num_col_paths, counts->num_col_paths);
+  __sync_add_and_fetch((volatile size_t*)&ps->num_of_bytes, counts->num_of_bytes);
+  memset(counts, 0, sizeof(*counts));
+}
+
 // Find a path
 // returns PATH_NULL if not found, otherwise index
 // path_nbytes is length in bytes of bases = (num bases + 3)/4
@@ -43,9 +43,25 @@ typedef struct
   // Multithreaded writing
   uint8_t *kmer_locks;
 
+  // If can_spill, running out of memory whilst adding paths sets `full`
+  // instead of dying. The store must then be flushed (see path_spill.h)
+  bool can_spill;
+  volatile bool full;
+
+  // If not NULL, the store block is memory mapped (see path_store_mmap())
+  uint8_t *mmap_base;
+  size_t mmap_len;
+
   PathHash phash;
 } PathStore;
 
+// Counters for paths added by one thread, added to the PathStore with
+// path_store_add_counts() rather than updating shared counters for every path
+typedef struct
+{
+  size_t num_of_paths, num_kmers_with_paths, num_col_paths, num_of_bytes;
+} PathStoreCounts;
+
 //
 // Pointer to linked list for each kmer
 //
@@ -69,8 +85,18 @@ void path_store_alloc(PathStore *ps, size_t mem, bool use_path_hash,
 // Release memory
 void path_store_dealloc(PathStore *paths);
 
+// Replace the store with a private memory mapping of `nbytes` of path data
+// read from `fd` at `offset`, followed by the rest of the store memory.
+// Path data is read from disk as it is accessed; pages are copied if written.
+// Store must be empty. Returns false if the file could not be mapped.
+bool path_store_mmap(PathStore *ps, int fd, off_t offset, size_t nbytes);
+
 void path_store_reset(PathStore *paths, size_t nkmers_in_hash);
 
+// Add counts to the PathStore counters and zero them
+// Thread Safe: counters are updated atomically
+void path_store_add_counts(PathStore *ps, PathStoreCounts *counts);
+
 // Set up temporary memory for merging PathStores
 void path_store_setup_tmp(PathStore *ps, size_t tmp_mem);
 
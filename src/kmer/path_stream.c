@@ -0,0 +1,238 @@
+#include "global.h"
+#include "path_stream.h"
+#include "path_format.h"
+#include "path_set.h"
+#include "binary_kmer.h"
+#include "file_util.h"
+#include "util.h"
+
+#define PATH_KMER_RECSIZE (sizeof(BinaryKmer) + sizeof(PathIndex))
+
+typedef struct
+{
+  const PathFileReader *file;
+  const char *path;
+  FILE *pfh, *kfh; // paths, kmers
+  size_t cbytes; // bytes in colour set in the file
+  uint64_t kmers_left;
+  PathIndex poffset; // offset of next path to be read
+  BinaryKmer bkmer; // current kmer
+  PathIndex pindex; // index of current kmer's paths
+  bool done;
+} PathStreamInput;
+
+bool path_stream_files_compatible(const PathFileReader *files, size_t num_files)
+{
+  size_t i;
+  for(i = 0; i < num_files; i++) {
+    if(!paths_file_is_sorted(&files[i]) || file_filter_isstdin(&files[i].fltr))
+      return false;
+  }
+  return true;
+}
+
+static void _input_next_kmer(PathStreamInput *in)
+{
+  BinaryKmer prev = in->bkmer;
+  bool first = (in->poffset == 0);
+
+  if(in->kmers_left == 0) { in->done = true; return; }
+
+  safe_fread(in->kfh, in->bkmer.b, sizeof(BinaryKmer), "bkmer", in->path);
+  safe_fread(in->kfh, &in->pindex, sizeof(PathIndex), "kmer pindex", in->path);
+  in->kmers_left--;
+
+  if(!first && !binary_kmer_less_than(prev, in->bkmer))
+    die("Path file is not sorted [kmers out of order]: %s", in->path);
+}
+
+static void _input_open(PathStreamInput *in, const PathFileReader *file)
+{
+  const PathFileHeader *hdr = &file->hdr;
+  const char *path = file->fltr.file_path.buff;
+  off_t kmers_offset = file->hdr_size + (off_t)hdr->num_path_bytes;
+
+  PathStreamInput tmp = {.file = file, .path = path,
+                         .pfh = file->fltr.fh, .kfh = NULL,
+                         .cbytes = roundup_bits2bytes(hdr->num_of_cols),
+                         .kmers_left = hdr->num_kmers_with_paths,
+                         .poffset = 0, .pindex = PATH_NULL, .done = false};
+
+  memset(&tmp.bkmer, 0, sizeof(BinaryKmer));
+
+  if(fseeko(tmp.pfh, file->hdr_size, SEEK_SET) != 0)
+    die("fseek failed: %s [%s]", path, strerror(errno));
+
+  if((tmp.kfh = fopen(path, "r")) == NULL)
+    die("Cannot open file: %s [%s]", path, strerror(errno));
+  setvbuf(tmp.kfh, NULL, _IOFBF, CTP_BUF_SIZE);
+
+  if(fseeko(tmp.kfh, kmers_offset, SEEK_SET) != 0)
+    die("fseek failed: %s [%s]", path, strerror(errno));
+
+  memcpy(in, &tmp, sizeof(PathStreamInput));
+  _input_next_kmer(in);
+}
+
+static void _input_close(PathStreamInput *in)
+{
+  fclose(in->kfh);
+}
+
+// Load paths for the current kmer into the set, applying the colour filter.
+// Then move on to the next kmer
+static void _input_load_paths(PathStreamInput *in, PathSet *set)
+{
+  const FileFilter *fltr = &in->file->fltr;
+  uint8_t colset[in->cbytes];
+  PathIndex prev;
+  PathLen lenword, plen;
+  size_t i, nbytes;
+
+  if(in->pindex != in->poffset)
+    die("Path file is not sorted [paths out of order]: %s", in->path);
+
+  do
+  {
+    safe_fread(in->pfh, &prev, sizeof(PathIndex), "prev", in->path);
+    safe_fread(in->pfh, colset, in->cbytes, "colset", in->path);
+    safe_fread(in->pfh, &lenword, sizeof(PathLen), "path length", in->path);
+
+    plen = packedpath_len(lenword);
+    nbytes = (plen+3)/4;
+    bytebuf_ensure_capacity(&set->seqs, set->seqs.len + set->cbytes + nbytes);
+
+    PathEntry entry = {.seq = set->seqs.len + set->cbytes,
+                       .pindex = set->members.len,
+                       .orient = packedpath_or(lenword), .plen = plen,
+                       .count = 0};
+
+    uint8_t *set_colset = path_set_colset(&entry, set);
+    memset(set_colset, 0, set->cbytes);
+    for(i = 0; i < fltr->ncols; i++) {
+      if(bitset_get(colset, file_filter_fromcol(fltr, i)))
+        bitset_set(set_colset, file_filter_intocol(fltr, i));
+    }
+
+    safe_fread(in->pfh, path_set_seq(&entry, set), nbytes, "path seq", in->path);
+    set->seqs.len += set->cbytes + nbytes;
+    pentrybuf_add(&set->members, entry);
+
+    in->poffset += packedpath_mem2(in->cbytes, nbytes);
+
+    if(prev != PATH_NULL && prev != in->poffset)
+      die("Path file is not sorted [paths not contiguous]: %s", in->path);
+  }
+  while(prev != PATH_NULL);
+
+  _input_next_kmer(in);
+}
+
+// Remove paths that have no colours (e.g. from colour filtering)
+static void _remove_empty_paths(PathSet *set)
+{
+  size_t i, j;
+  for(i = j = 0; i < set->members.len; i++) {
+    const PathEntry *entry = &set->members.data[i];
+    if(!packedpath_is_colset_zero(path_set_colset(entry, set), set->cbytes))
+      set->members.data[j++] = *entry;
+  }
+  set->members.len = j;
+}
+
+void path_stream_merge(PathFileReader *files, size_t num_files,
+                       bool rmv_redundant, PathFileHeader *hdr, FILE *fout)
+{
+  ctx_assert(path_stream_files_compatible(files, num_files));
+
+  size_t i, cbytes = roundup_bits2bytes(hdr->num_of_cols);
+  PathStreamInput *inputs = ctx_calloc(num_files, sizeof(PathStreamInput));
+
+  for(i = 0; i < num_files; i++) _input_open(&inputs[i], &files[i]);
+
+  status("[PathStream] Merging %zu sorted path files", num_files);
+
+  // Write header now, counts are updated at the end
+  paths_header_set_sorted(hdr);
+  hdr->num_of_paths = hdr->num_path_bytes = hdr->num_kmers_with_paths = 0;
+  paths_format_write_header(hdr, fout);
+
+  // Kmer index is written to a temporary file since it follows the paths
+  FILE *kmers_fh = tmpfile();
+  if(kmers_fh == NULL) die("Cannot create temporary file [%s]", strerror(errno));
+
+  PathSet set;
+  path_set_alloc(&set);
+
+  PathIndex poffset = 0;
+  size_t npaths = 0, nkmers = 0, ncolpaths = 0;
+  BinaryKmer bkmer;
+  bool found;
+
+  while(1)
+  {
+    // Find smallest kmer
+    for(i = 0, found = false; i < num_files; i++) {
+      if(!inputs[i].done &&
+         (!found || binary_kmer_less_than(inputs[i].bkmer, bkmer))) {
+        bkmer = inputs[i].bkmer;
+        found = true;
+      }
+    }
+
+    if(!found) break;
+
+    // Load paths from all files with this kmer
+    path_set_reset(&set);
+    set.cbytes = cbytes;
+
+    for(i = 0; i < num_files; i++) {
+      if(!inputs[i].done && binary_kmers_are_equal(inputs[i].bkmer, bkmer))
+        _input_load_paths(&inputs[i], &set);
+    }
+
+    _remove_empty_paths(&set);
+    if(rmv_redundant) path_set_slim(&set);
+    else path_set_merge_dups(&set);
+
+    if(set.members.len == 0) continue;
+
+    // Write paths and kmer index entry
+    if(fwrite(bkmer.b, 1, sizeof(BinaryKmer), kmers_fh) +
+       fwrite(&poffset, 1, sizeof(PathIndex), kmers_fh) != PATH_KMER_RECSIZE)
+    {
+      die("Cannot write to temporary file [%s]", strerror(errno));
+    }
+
+    poffset += paths_format_write_set(&set, poffset, false, &ncolpaths, fout);
+    npaths += set.members.len;
+    nkmers++;
+  }
+
+  path_set_dealloc(&set);
+
+  for(i = 0; i < num_files; i++) _input_close(&inputs[i]);
+  ctx_free(inputs);
+
+  futil_merge_tmp_files(&kmers_fh, 1, fout);
+
+  // Update header counts
+  hdr->num_of_paths = npaths;
+  hdr->num_path_bytes = poffset;
+  hdr->num_kmers_with_paths = nkmers;
+
+  if(fflush(fout) != 0 || fseek(fout, 0, SEEK_SET) != 0)
+    die("Cannot seek output file [%s]", strerror(errno));
+
+  paths_format_write_header_core(hdr, fout);
+
+  if(fseek(fout, 0, SEEK_END) != 0)
+    die("Cannot seek output file [%s]", strerror(errno));
+
+  char npaths_str[50], nkmers_str[50], nbytes_str[50];
+  ulong_to_str(npaths, npaths_str);
+  ulong_to_str(nkmers, nkmers_str);
+  bytes_to_str(poffset, 1, nbytes_str);
+  status("[PathStream] Wrote %s paths [%s] for %s kmers",
+         npaths_str, nbytes_str, nkmers_str);
+}
@@ -0,0 +1,31 @@
+#ifndef PATH_STREAM_H_
+#define PATH_STREAM_H_
+
+#include "path_file_reader.h"
+
+//
+// Streaming merge of sorted path files
+//
+// Path files written with PATH_FILE_SORTED have kmers in sorted order with
+// each kmer's paths stored contiguously in the same order. They can be merged
+// in one pass without loading them into a PathStore: we step through the kmer
+// index of every file, and for the smallest kmer load its paths from each file
+// that has it, merge them and write them out. Memory used is bounded by the
+// paths of a single kmer.
+//
+// Paths are read from each file's FileFilter handle (after the header), kmers
+// from a second handle opened on the same file, so inputs cannot be STDIN.
+//
+
+// Returns true if all files are sorted and can be streamed
+bool path_stream_files_compatible(const PathFileReader *files, size_t num_files);
+
+// Merge files into fout, which must be seekable. The header is written with
+// PATH_FILE_SORTED set and its counts are filled in once all paths are written.
+// `hdr` must have sample names and number of colours set. Colour filters of
+// the input files are applied. Duplicate paths have their colours OR'd, and if
+// `rmv_redundant` is true, redundant paths are removed (path_set_slim()).
+void path_stream_merge(PathFileReader *files, size_t num_files,
+                       bool rmv_redundant, PathFileHeader *hdr, FILE *fout);
+
+#endif /* PATH_STREAM_H_ */
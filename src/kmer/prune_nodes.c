@@ -5,9 +5,12 @@
 #include "db_graph.h"
 #include "db_node.h"
 
-// Remove a node from the graph, do not edit any edges / adjacent nodes
-// Threadsafe
-void prune_node_without_edges_mt(dBGraph *db_graph, hkey_t hkey)
+// Number of nodes whose neighbours are looked up together
+#define PRUNE_BATCH 32
+
+// Remove a node's data and hash table entry, without updating the number of
+// kmers in the hash table
+static inline void prune_node_data(dBGraph *db_graph, hkey_t hkey)
 {
   ctx_assert(hkey != HASH_NOT_FOUND);
   Colour col;
@@ -22,96 +25,194 @@ void prune_node_without_edges_mt(dBGraph *db_graph, hkey_t hkey)
     for(col = 0; col < db_graph->num_of_cols; col++)
       db_node_del_col_mt(db_graph, hkey, col);
 
-  hash_table_delete(&db_graph->ht, hkey);
+  hash_table_delete_nocount(&db_graph->ht, hkey);
+}
+
+// Remove a node from the graph, do not edit any edges / adjacent nodes
+// Threadsafe
+void prune_node_without_edges_mt(dBGraph *db_graph, hkey_t hkey)
+{
+  ctx_assert(db_graph->ht.num_kmers > 0);
+  prune_node_data(db_graph, hkey);
+  __sync_fetch_and_sub((volatile uint64_t *)&db_graph->ht.num_kmers, 1);
+}
+
+// Threadsafe, but db_graph->ht.num_kmers must be reduced by the caller
+void prune_node_without_edges_nocount(dBGraph *db_graph, hkey_t hkey)
+{
+  prune_node_data(db_graph, hkey);
 }
 
-// For all flagged nodes, trim edges to non-flagged nodes
-// After calling this function on all nodes, call:
-// prune_nodes_lacking_flag_no_edges
-static inline
-void prune_edges_to_nodes_lacking_flag(hkey_t hkey, const uint8_t *flags,
-                                       dBGraph *db_graph)
+// A kmer next to a node, see db_graph_next_node()
+typedef struct
 {
-  Edges keep_edges = 0x0;
+  BinaryKmer bkmer, bkey;
+  Nucleotide nuc;
+  Orientation orient;
+} PruneNext;
+
+// Get the kmers next to a node along `edges` and prefetch their hash table
+// buckets, so that they can then be looked up without waiting on each in turn.
+// Returns the number of kmers (up to 8)
+static inline size_t prune_next_kmers(const dBGraph *db_graph, BinaryKmer bkey,
+                                      Edges edges, PruneNext next[8])
+{
+  const size_t kmer_size = db_graph->kmer_size;
   Orientation orient;
   Nucleotide nuc;
-  dBNode next_node;
-  BinaryKmer bkmer;
-  size_t col;
+  size_t i, n = 0;
+
+  for(orient = 0; orient < 2; orient++) {
+    for(nuc = 0; nuc < 4; nuc++) {
+      if(edges_has_edge(edges, nuc, orient)) {
+        if(orient == FORWARD)
+          next[n].bkmer = binary_kmer_left_shift_add(bkey, kmer_size, nuc);
+        else
+          next[n].bkmer = binary_kmer_right_shift_add(bkey, kmer_size,
+                                                      dna_nuc_complement(nuc));
+        next[n].bkey = bkmer_get_key(next[n].bkmer, kmer_size);
+        next[n].nuc = nuc;
+        next[n].orient = orient;
+        n++;
+      }
+    }
+  }
+
+  for(i = 0; i < n; i++) hash_table_prefetch(&db_graph->ht, &next[i].bkey);
+
+  return n;
+}
 
-  if(bitset_get(flags, hkey))
+//
+// Removing nodes lacking a flag is done in two passes over the hash table,
+// each split between threads:
+// 1. Flagged nodes drop edges to nodes without the flag. The neighbours of a
+//    batch of nodes are prefetched together, then looked up.
+// 2. Nodes without the flag are removed. Threads count the nodes they remove
+//    and the hash table count is updated once at the end.
+//
+
+typedef struct
+{
+  hkey_t hkey;
+  Edges edges;
+  size_t next_start, next_len; // neighbours in PruneBatch.next
+} PruneBatchNode;
+
+typedef struct
+{
+  PruneBatchNode nodes[PRUNE_BATCH];
+  PruneNext next[PRUNE_BATCH*8];
+  size_t num_nodes, num_next;
+} PruneBatch;
+
+// Look up neighbours of nodes in the batch, and trim edges to those lacking
+// the flag
+static void prune_batch_trim(PruneBatch *batch, const uint8_t *flags,
+                             dBGraph *db_graph)
+{
+  const PruneBatchNode *node;
+  const PruneNext *next;
+  Edges keep_edges;
+  hkey_t next_key;
+  size_t i, j, col;
+
+  for(i = 0; i < batch->num_nodes; i++)
   {
-    // Check edges
-    bkmer = db_node_get_bkmer(db_graph, hkey);
-    keep_edges = db_node_get_edges_union(db_graph, hkey);
-
-    for(orient = 0; orient < 2; orient++)
-    {
-      for(nuc = 0; nuc < 4; nuc++)
-      {
-        if(edges_has_edge(keep_edges, nuc, orient))
-        {
-          next_node = db_graph_next_node(db_graph, bkmer, nuc, orient);
-
-          if(!bitset_get(flags, next_node.key))
-          {
-            // Next node fails filter - remove edge
-            keep_edges = edges_del_edge(keep_edges, nuc, orient);
-          }
-        }
+    node = &batch->nodes[i];
+    keep_edges = node->edges;
+
+    for(j = 0; j < node->next_len; j++) {
+      next = &batch->next[node->next_start+j];
+      next_key = hash_table_find(&db_graph->ht, next->bkey);
+
+      if(next_key == HASH_NOT_FOUND || !bitset_get(flags, next_key)) {
+        // Next node fails filter - remove edge
+        keep_edges = edges_del_edge(keep_edges, next->nuc, next->orient);
       }
     }
+
+    if(keep_edges != node->edges) {
+      for(col = 0; col < db_graph->num_edge_cols; col++)
+        db_node_edges(db_graph, node->hkey, col) &= keep_edges;
+    }
   }
 
-  for(col = 0; col < db_graph->num_edge_cols; col++)
-    db_node_edges(db_graph, hkey, col) &= keep_edges;
+  batch->num_nodes = batch->num_next = 0;
 }
 
-static inline
-void prune_nodes_lacking_flag_no_edges(hkey_t hkey, const uint8_t *flags,
-                                       dBGraph *db_graph)
+static inline void prune_batch_add(hkey_t hkey, const uint8_t *flags,
+                                   PruneBatch *batch, dBGraph *db_graph)
 {
-  if(!bitset_get(flags, hkey))
-    prune_node_without_edges_mt(db_graph, hkey);
+  if(!bitset_get(flags, hkey)) return;
+
+  Edges edges = db_node_get_edges_union(db_graph, hkey);
+  if(edges == 0) return;
+
+  PruneBatchNode *node = &batch->nodes[batch->num_nodes++];
+  node->hkey = hkey;
+  node->edges = edges;
+  node->next_start = batch->num_next;
+  node->next_len = prune_next_kmers(db_graph, db_node_get_bkmer(db_graph, hkey),
+                                    edges, batch->next + batch->num_next);
+  batch->num_next += node->next_len;
+
+  if(batch->num_nodes == PRUNE_BATCH)
+    prune_batch_trim(batch, flags, db_graph);
 }
 
+static inline void prune_node_lacking_flag(hkey_t hkey, const uint8_t *flags,
+                                           dBGraph *db_graph, size_t *count)
+{
+  if(!bitset_get(flags, hkey)) {
+    prune_node_data(db_graph, hkey);
+    (*count)++;
+  }
+}
 
 typedef struct {
   size_t threadid, nthreads;
   const uint8_t *keep_flags;
   dBGraph *db_graph;
+  size_t num_removed;
 } GraphCleaner;
 
 static void worker_prune_node_edges(void *arg)
 {
-  GraphCleaner cl = *(GraphCleaner*)arg;
+  GraphCleaner *cl = (GraphCleaner*)arg;
+  PruneBatch *batch = ctx_malloc(sizeof(PruneBatch));
+  batch->num_nodes = batch->num_next = 0;
+
+  HASH_ITERATE_PART(&cl->db_graph->ht, cl->threadid, cl->nthreads,
+                    prune_batch_add, cl->keep_flags, batch, cl->db_graph);
 
-  // printf("== Edges == Thread %zu / %zu\n", cl.threadid, cl.nthreads);
-  HASH_ITERATE_PART(&cl.db_graph->ht, cl.threadid, cl.nthreads,
-                    prune_edges_to_nodes_lacking_flag,
-                    cl.keep_flags, cl.db_graph);
+  prune_batch_trim(batch, cl->keep_flags, cl->db_graph);
+  ctx_free(batch);
 }
 
 static void worker_prune_nodes(void *arg)
 {
-  GraphCleaner cl = *(GraphCleaner*)arg;
+  GraphCleaner *cl = (GraphCleaner*)arg;
+  size_t count = 0;
 
-  // printf("== Nodes == Thread %zu / %zu\n", cl.threadid, cl.nthreads);
-  HASH_ITERATE_PART(&cl.db_graph->ht, cl.threadid, cl.nthreads,
-                    prune_nodes_lacking_flag_no_edges,
-                    cl.keep_flags, cl.db_graph);
+  HASH_ITERATE_PART(&cl->db_graph->ht, cl->threadid, cl->nthreads,
+                    prune_node_lacking_flag,
+                    cl->keep_flags, cl->db_graph, &count);
+
+  cl->num_removed = count;
 }
 
 // Remove all nodes that do not have a given flag
 void prune_nodes_lacking_flag(size_t num_threads, const uint8_t *flags,
                               dBGraph *db_graph)
 {
-  size_t i;
+  size_t i, num_removed = 0;
   GraphCleaner *cleaners = ctx_calloc(num_threads, sizeof(GraphCleaner));
 
   for(i = 0; i < num_threads; i++) {
     cleaners[i] = (GraphCleaner){.threadid = i, .nthreads = num_threads,
-                                 .keep_flags = flags, .db_graph = db_graph};
+                                 .keep_flags = flags, .db_graph = db_graph,
+                                 .num_removed = 0};
   }
 
   // Trim edges from valid nodes
@@ -124,50 +225,75 @@ void prune_nodes_lacking_flag(size_t num_threads, const uint8_t *flags,
   util_run_threads(cleaners, num_threads, sizeof(GraphCleaner),
                    num_threads, worker_prune_nodes);
 
+  for(i = 0; i < num_threads; i++) num_removed += cleaners[i].num_removed;
+  ctx_assert(num_removed <= db_graph->ht.num_kmers);
+  db_graph->ht.num_kmers -= num_removed;
+
   ctx_free(cleaners);
 }
 
+// Remove edges from node `hkey` to nodes that have a flag set
+// Threadsafe as long as no other thread is removing different edges from `hkey`
+void prune_edges_to_flagged_nodes(dBGraph *db_graph, hkey_t hkey,
+                                  const uint8_t *flags)
+{
+  Edges edges = db_node_get_edges_union(db_graph, hkey), keep_edges = edges;
+  BinaryKmer bkmer = db_node_get_bkmer(db_graph, hkey);
+  PruneNext next[8];
+  dBNode next_node;
+  size_t i, n, col;
+
+  n = prune_next_kmers(db_graph, bkmer, edges, next);
+
+  for(i = 0; i < n; i++) {
+    next_node.key = hash_table_find(&db_graph->ht, next[i].bkey);
+    ctx_assert(next_node.key != HASH_NOT_FOUND);
+    if(bitset_get(flags, next_node.key))
+      keep_edges = edges_del_edge(keep_edges, next[i].nuc, next[i].orient);
+  }
+
+  if(keep_edges != edges) {
+    for(col = 0; col < db_graph->num_edge_cols; col++)
+      db_node_edges(db_graph, hkey, col) &= keep_edges;
+  }
+}
+
 // Remove all edges in the graph that connect to the given node
 static void prune_connecting_edges(dBGraph *db_graph, hkey_t hkey)
 {
   Edges uedges = db_node_get_edges_union(db_graph, hkey);
   BinaryKmer bkmer = db_node_get_bkmer(db_graph, hkey);
+  PruneNext next[8];
   dBNode next_node;
-  Orientation or;
-  Nucleotide nuc, lost_nuc;
+  Nucleotide lost_nuc[2];
   Edges remove_edge_mask;
-  size_t col;
+  size_t i, n, col;
 
-  for(or = 0; or < 2; or++)
-  {
-    // Remove edge from: next_node:!next_or -> hkey:!or
-    // when working backwards, or = !or, next_or = !next_or
-    // so this is actually if(or == REVERSE)
+  // Remove edge from: next_node:!next_or -> hkey:!or
+  // when working backwards, or = !or, next_or = !next_or
+  // so this is actually if(or == REVERSE)
+  lost_nuc[FORWARD] = binary_kmer_first_nuc(bkmer, db_graph->kmer_size);
+  lost_nuc[FORWARD] = dna_nuc_complement(lost_nuc[FORWARD]);
+  lost_nuc[REVERSE] = binary_kmer_last_nuc(bkmer);
 
-    if(or == FORWARD) {
-      lost_nuc = binary_kmer_first_nuc(bkmer, db_graph->kmer_size);
-      lost_nuc = dna_nuc_complement(lost_nuc);
-    }
-    else lost_nuc = binary_kmer_last_nuc(bkmer);
-
-    for(nuc = 0; nuc < 4; nuc++)
-    {
-      if(edges_has_edge(uedges, nuc, or))
-      {
-        next_node = db_graph_next_node(db_graph, bkmer, nuc, or);
-        remove_edge_mask = nuc_orient_to_edge(lost_nuc,
-                                              rev_orient(next_node.orient));
-
-        // Sanity test
-        ctx_assert(next_node.key != HASH_NOT_FOUND);
-        ctx_check(next_node.key == hkey ||
-          (db_node_get_edges_union(db_graph, next_node.key) & remove_edge_mask)
-            == remove_edge_mask);
-
-        for(col = 0; col < db_graph->num_edge_cols; col++)
-          db_node_edges(db_graph, next_node.key, col) &= ~remove_edge_mask;
-      }
-    }
+  n = prune_next_kmers(db_graph, bkmer, uedges, next);
+
+  for(i = 0; i < n; i++)
+  {
+    next_node.key = hash_table_find(&db_graph->ht, next[i].bkey);
+    next_node.orient = bkmer_get_orientation(next[i].bkmer, next[i].bkey);
+    next_node.orient ^= next[i].orient;
+    remove_edge_mask = nuc_orient_to_edge(lost_nuc[next[i].orient],
+                                          rev_orient(next_node.orient));
+
+    // Sanity test
+    ctx_assert(next_node.key != HASH_NOT_FOUND);
+    ctx_check(next_node.key == hkey ||
+      (db_node_get_edges_union(db_graph, next_node.key) & remove_edge_mask)
+        == remove_edge_mask);
+
+    for(col = 0; col < db_graph->num_edge_cols; col++)
+      db_node_edges(db_graph, next_node.key, col) &= ~remove_edge_mask;
   }
 }
 
@@ -186,8 +312,12 @@ void prune_supernode(dBNode *nodes, size_t len, dBGraph *db_graph)
   prune_connecting_edges(db_graph, nodes[0].key);
   if(len > 1) prune_connecting_edges(db_graph, nodes[len-1].key);
 
+  ctx_assert(db_graph->ht.num_kmers >= len);
+
   for(i = 0; i < len; i++)
-    prune_node_without_edges_mt(db_graph, nodes[i].key);
+    prune_node_data(db_graph, nodes[i].key);
+
+  __sync_fetch_and_sub((volatile uint64_t *)&db_graph->ht.num_kmers, len);
 }
 
 // Remove nodes that are in the hash table but not assigned any colours
@@ -11,6 +11,11 @@
 // Threadsafe
 void prune_node_without_edges_mt(dBGraph *db_graph, hkey_t hkey);
 
+// As prune_node_without_edges_mt() but db_graph->ht.num_kmers is not updated.
+// When removing many nodes from several threads, count the nodes removed and
+// subtract the total once all threads are done.
+void prune_node_without_edges_nocount(dBGraph *db_graph, hkey_t hkey);
+
 void prune_node(dBGraph *db_graph, hkey_t node);
 
 // Supernode pruning used by ctx_clean
@@ -21,6 +26,11 @@ void prune_supernode(dBNode *nodes, size_t len, dBGraph *db_graph);
 void prune_nodes_lacking_flag(size_t num_threads, const uint8_t *flags,
                               dBGraph *db_graph);
 
+// Remove edges from node `hkey` to nodes that have a flag set
+// Threadsafe as long as no other thread is removing different edges from `hkey`
+void prune_edges_to_flagged_nodes(dBGraph *db_graph, hkey_t hkey,
+                                  const uint8_t *flags);
+
 // Currently unused
 // remove nodes if not in any colour
 // i.e. db_node_has_col(graph,node,colour) == false for all colours
@@ -0,0 +1,96 @@
+#include "global.h"
+#include "repeat_walker.h"
+
+static inline size_t rpt_walker_bitset_words(const RepeatWalker *rpt)
+{
+  return roundup_bits2words64(rpt->hash_capacity*2);
+}
+
+void rpt_walker_alloc(RepeatWalker *rpt, size_t hash_capacity, size_t nbits)
+{
+  ctx_assert(nbits > 0 && nbits < 32);
+  size_t repeat_words = roundup_bits2words64(1UL<<nbits);
+  RepeatWalker tmp = {.set = ctx_calloc(RPT_WALKER_SET_MIN,
+                                        sizeof(RptWalkerEntry)),
+                      .set_nbits = __builtin_ctzl(RPT_WALKER_SET_MIN),
+                      .set_len = 0, .epoch = 1, .visited = NULL,
+                      .bloom = ctx_calloc(repeat_words, sizeof(uint64_t)),
+                      .hash_capacity = hash_capacity,
+                      .bloom_nbits = nbits, .mask = bitmask(nbits,uint32_t),
+                      .nbloom_entries = 0};
+  memcpy(rpt, &tmp, sizeof(RepeatWalker));
+}
+
+void rpt_walker_dealloc(RepeatWalker *rpt)
+{
+  ctx_free(rpt->set);
+  ctx_free(rpt->visited);
+  ctx_free(rpt->bloom);
+  memset(rpt, 0, sizeof(RepeatWalker));
+}
+
+void rpt_walker_clear(RepeatWalker *rpt)
+{
+  if(rpt->visited != NULL) {
+    ctx_free(rpt->visited);
+    rpt->visited = NULL;
+  }
+
+  // Entries from old epochs are empty slots. Wipe them before epoch wraps.
+  if(++rpt->epoch == 0) {
+    memset(rpt->set, 0, sizeof(RptWalkerEntry) << rpt->set_nbits);
+    rpt->epoch = 1;
+  }
+  rpt->set_len = 0;
+
+  if(rpt->nbloom_entries) {
+    memset(rpt->bloom, 0, roundup_bits2words64(1UL<<rpt->bloom_nbits) *
+                          sizeof(uint64_t));
+    rpt->nbloom_entries = 0;
+  }
+}
+
+// Set is full: double its size, or switch to a bitset if it would be bigger
+// than one. Returns true if node was already visited
+bool rpt_walker_set_add_slow(RepeatWalker *rpt, dBNode node)
+{
+  size_t i, j, mask, nslots = 1UL << rpt->set_nbits;
+  size_t bitset_words = rpt_walker_bitset_words(rpt);
+  RptWalkerEntry *set = rpt->set, *new_set;
+
+  if(2 * nslots * sizeof(RptWalkerEntry) > bitset_words * sizeof(uint64_t))
+  {
+    // Copy nodes into a bitset and shrink the set back down
+    rpt->visited = ctx_calloc(bitset_words, sizeof(uint64_t));
+    for(i = 0; i < nslots; i++)
+      if(set[i].epoch == rpt->epoch) bitset_set(rpt->visited, set[i].node);
+
+    rpt->set = ctx_realloc(set, RPT_WALKER_SET_MIN * sizeof(RptWalkerEntry));
+    memset(rpt->set, 0, RPT_WALKER_SET_MIN * sizeof(RptWalkerEntry));
+    rpt->set_nbits = __builtin_ctzl(RPT_WALKER_SET_MIN);
+    rpt->set_len = 0;
+    rpt->epoch = 1;
+  }
+  else
+  {
+    // Rehash entries from this epoch into a set twice the size
+    new_set = ctx_calloc(2*nslots, sizeof(RptWalkerEntry));
+    mask = 2*nslots - 1;
+
+    for(i = 0; i < nslots; i++) {
+      if(set[i].epoch == rpt->epoch) {
+        j = rpt_walker_set_hash(set[i].node, rpt->set_nbits+1);
+        while(new_set[j].epoch) j = (j+1) & mask;
+        new_set[j].node = set[i].node;
+        new_set[j].epoch = 1;
+      }
+    }
+
+    ctx_free(set);
+    rpt->set = new_set;
+    rpt->set_nbits++;
+    rpt->epoch = 1;
+  }
+
+  return rpt_walker_visit(rpt, node);
+}
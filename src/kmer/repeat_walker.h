@@ -4,14 +4,74 @@
 #include "graph_walker.h"
 #include "db_node.h"
 
+//
+// RepeatWalker stops a GraphWalker going round a loop forever. The first time
+// we visit a node we carry on. On later visits we only carry on if the walker
+// is in a state (node + paths) not seen before, using a bloom filter.
+//
+// Visited nodes are kept in a small hash set rather than a bitset over the
+// whole hash table, so that each thread does not need graph sized memory.
+// Entries are stamped with an epoch: clearing only increments the epoch. If a
+// walk gets so long that the set would use more memory than a bitset, we
+// switch to a bitset (2 bits per kmer) until the walker is next cleared.
+//
+
+#define RPT_WALKER_SET_MIN 256 // initial number of slots in visited set
+
+typedef struct
+{
+  uint64_t node; // 2*hkey+orient
+  uint32_t epoch; // slot is set if equal to RepeatWalker.epoch
+} RptWalkerEntry;
+
 typedef struct
 {
-  uint64_t *const visited, *const bloom;
-  const size_t bloom_nbits, mem_bytes;
-  const uint32_t mask;
+  RptWalkerEntry *set;
+  size_t set_nbits, set_len; // 2^set_nbits slots, set_len set in this epoch
+  uint32_t epoch;
+  uint64_t *visited; // bitset used instead of set if non-NULL
+  uint64_t *bloom;
+  size_t hash_capacity, bloom_nbits;
+  uint32_t mask;
   size_t nbloom_entries;
 } RepeatWalker;
 
+// Add node to the visited set, slow path when the set is full
+// Returns true if node was already visited
+bool rpt_walker_set_add_slow(RepeatWalker *rpt, dBNode node);
+
+static inline size_t rpt_walker_set_hash(uint64_t node, size_t nbits)
+{
+  return (size_t)((node * 0x9E3779B97F4A7C15UL) >> (64 - nbits));
+}
+
+// Returns true if node was already visited, otherwise marks it as visited
+static inline bool rpt_walker_visit(RepeatWalker *rpt, dBNode node)
+{
+  if(rpt->visited != NULL) {
+    if(db_node_has_traversed(rpt->visited, node)) return true;
+    db_node_set_traversed(rpt->visited, node);
+    return false;
+  }
+
+  // Keep load factor below 1/2
+  if(2*(rpt->set_len+1) > (1UL << rpt->set_nbits))
+    return rpt_walker_set_add_slow(rpt, node);
+
+  uint64_t key = ((uint64_t)node.key << 1) | node.orient;
+  size_t mask = (1UL << rpt->set_nbits) - 1;
+  size_t i = rpt_walker_set_hash(key, rpt->set_nbits);
+  RptWalkerEntry *set = rpt->set;
+
+  for(; set[i].epoch == rpt->epoch; i = (i+1) & mask)
+    if(set[i].node == key) return true;
+
+  set[i].node = key;
+  set[i].epoch = rpt->epoch;
+  rpt->set_len++;
+  return false;
+}
+
 // GraphWalker wlk is proposing node and orient as next move
 // We determine if it is safe to make the traversal without getting stuck in
 // a loop/cycle in the graph
@@ -21,8 +81,7 @@ static inline bool rpt_walker_attempt_traverse(RepeatWalker *rpt,
   uint64_t h[3], hash64;
   bool collision;
 
-  if(!db_node_has_traversed(rpt->visited, wlk->node)) {
-    db_node_set_traversed(rpt->visited, wlk->node);
+  if(!rpt_walker_visit(rpt, wlk->node)) {
     return true;
   }
   else {
@@ -48,52 +107,21 @@ static inline bool rpt_walker_attempt_traverse(RepeatWalker *rpt,
   }
 }
 
+// Memory used by a RepeatWalker between walks. A very long walk may use up to
+// 2 bits per kmer more until it is cleared.
 static inline size_t rpt_walker_est_mem(size_t hash_capacity, size_t nbits)
 {
-  size_t visited_words = roundup_bits2words64(hash_capacity*2);
-  size_t repeat_words = roundup_bits2words64(1UL<<nbits);
-  return (visited_words+repeat_words) * sizeof(uint64_t);
-}
-
-static inline void rpt_walker_alloc(RepeatWalker *rpt,
-                                    size_t hash_capacity, size_t nbits)
-{
-  ctx_assert(nbits > 0 && nbits < 32);
-  size_t visited_words = roundup_bits2words64(hash_capacity*2);
+  (void)hash_capacity;
   size_t repeat_words = roundup_bits2words64(1UL<<nbits);
-  size_t nbytes = (visited_words + repeat_words) * sizeof(uint64_t);
-  uint64_t *mem = ctx_calloc(visited_words+repeat_words, sizeof(uint64_t));
-  uint32_t mask = bitmask(nbits,uint32_t);
-  RepeatWalker tmp = {.visited = mem, .bloom = mem+visited_words,
-                      .bloom_nbits = nbits, .mem_bytes = nbytes, .mask = mask,
-                      .nbloom_entries = 0};
-  memcpy(rpt, &tmp, sizeof(RepeatWalker));
+  return repeat_words * sizeof(uint64_t) +
+         RPT_WALKER_SET_MIN * sizeof(RptWalkerEntry);
 }
 
-static inline void rpt_walker_dealloc(RepeatWalker *rpt)
-{
-  ctx_free(rpt->visited);
-}
+void rpt_walker_alloc(RepeatWalker *rpt, size_t hash_capacity, size_t nbits);
+void rpt_walker_dealloc(RepeatWalker *rpt);
 
-static inline void rpt_walker_clear(RepeatWalker *rpt)
-{
-  memset(rpt->visited, 0, rpt->mem_bytes);
-  rpt->nbloom_entries = 0;
-}
-
-static inline void rpt_walker_fast_clear(RepeatWalker *rpt,
-                                         const dBNode *nodes, size_t n)
-{
-  size_t i, bmem = roundup_bits2words64(1UL<<rpt->bloom_nbits)*sizeof(uint64_t);
-  for(i = 0; i < n; i++) db_node_fast_clear_traversed(rpt->visited, nodes[i].key);
-  if(rpt->nbloom_entries) memset(rpt->bloom, 0, bmem);
-  rpt->nbloom_entries = 0;
-}
-
-static inline void rpt_walker_fast_clear_single_node(RepeatWalker *rpt,
-                                                     const dBNode node)
-{
-  db_node_fast_clear_traversed(rpt->visited, node.key);
-}
+// Forget all visited nodes. O(1) unless the bloom filter was used or the walk
+// was long enough to need a bitset.
+void rpt_walker_clear(RepeatWalker *rpt);
 
 #endif /* REPEAT_WALKER_H_ */
@@ -5,6 +5,8 @@
 #include "db_graph.h"
 #include "db_node.h"
 #include "supernode.h"
+#include "unitig_index.h"
+#include "db_adjacency.h"
 
 static bool supernode_is_closed_cycle(const dBNode *nlist, size_t len,
                                          BinaryKmer bkmer0, BinaryKmer bkmer1,
@@ -91,16 +93,23 @@ bool supernode_extend(dBNodeBuffer *nbuf, size_t limit,
   ctx_assert(nbuf->len > 0);
 
   const size_t kmer_size = db_graph->kmer_size;
+  const dBAdjacency *adj = db_graph->adj;
   dBNode node0 = nbuf->data[0], node1 = nbuf->data[nbuf->len-1], node = node1;
 
   BinaryKmer bkmer = db_node_oriented_bkmer(db_graph, node);
   Edges edges = db_node_get_edges_union(db_graph, node.key);
-  Nucleotide nuc;
+  Nucleotide nuc, nucs[4];
+  dBNode next[4];
 
   while(edges_has_precisely_one_edge(edges, node.orient, &nuc))
   {
-    bkmer = binary_kmer_left_shift_add(bkmer, kmer_size, nuc);
-    node = db_graph_find(db_graph, bkmer);
+    if(adj != NULL) {
+      db_adj_next_nodes(adj, node, edges, edges, next, nucs);
+      node = next[0];
+    } else {
+      bkmer = binary_kmer_left_shift_add(bkmer, kmer_size, nuc);
+      node = db_graph_find(db_graph, bkmer);
+    }
     edges = db_node_get_edges_union(db_graph, node.key);
 
     ctx_assert(node.key != HASH_NOT_FOUND);
@@ -124,6 +133,13 @@ bool supernode_extend(dBNodeBuffer *nbuf, size_t limit,
 
 void supernode_find(hkey_t hkey, dBNodeBuffer *nbuf, const dBGraph *db_graph)
 {
+  if(db_graph->unitigs != NULL) {
+    const UnitigIndex *ui = db_graph->unitigs;
+    const Unitig *ut = &ui->unitigs[ui->pos[hkey].uid];
+    db_node_buf_append(nbuf, (dBNode*)unitig_index_nodes(ui, ut), ut->len);
+    return;
+  }
+
   dBNode first = {.key = hkey, .orient = REVERSE};
   size_t offset = nbuf->len;
   db_node_buf_add(nbuf, first);
@@ -22,6 +22,7 @@ bool supernode_extend(dBNodeBuffer *nbuf, size_t limit,
 
 // Reallocates array if needs to resize
 // returns length of supernode (always >=1)
+// If the graph has a unitig index, the supernode is copied from it (normalised)
 void supernode_find(hkey_t node, dBNodeBuffer *nbuf, const dBGraph *db_graph);
 
 // Count number of read starts using coverage data
@@ -0,0 +1,586 @@
+#include "global.h"
+#include "unitig_index.h"
+#include "supernode.h"
+#include "binary_seq.h"
+#include "util.h"
+
+#include <sys/stat.h>
+
+#include "objbuf_macro.h"
+create_objbuf(unitig_buf, UnitigBuffer, Unitig);
+
+#define UNITIG_MAX_ID (UINT32_MAX-1)
+
+// Bytes used to save a Unitig (see unitig_pack())
+#define UNITIG_RECORD_BYTES (8+4+5+4*8+4*8)
+// Records read or written at a time
+#define UNITIG_IO_RECS 4096
+
+// Nodes are saved as <key:63><orient:1>
+#define unitig_node_word(node) (((uint64_t)(node).key << 1) | (node).orient)
+
+static inline size_t unitig_file_size(size_t num_unitigs, size_t num_of_cols,
+                                      size_t num_kmers)
+{
+  return sizeof(UnitigFileHeader) + num_unitigs * UNITIG_RECORD_BYTES +
+         num_unitigs * num_of_cols * sizeof(uint64_t) +
+         num_kmers * sizeof(uint64_t);
+}
+
+//
+// Checksum
+//
+
+// 64 bit finaliser from MurmurHash3
+static inline uint64_t unitig_mix64(uint64_t h)
+{
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// Only hash words used by kmer_size, so that the checksum does not depend on
+// MAX_KMER_SIZE. Each kmer is hashed with its position in the hash table, so
+// that a matching checksum means nodes can be loaded without lookups.
+static inline void unitig_hash_kmer(hkey_t hkey, const dBGraph *db_graph,
+                                    size_t nwords, uint64_t *sum)
+{
+  BinaryKmer bkey = db_node_get_bkmer(db_graph, hkey);
+  uint64_t h = ((uint64_t)hkey << 8) | db_node_get_edges_union(db_graph, hkey);
+  size_t i;
+  for(i = NUM_BKMER_WORDS - nwords; i < NUM_BKMER_WORDS; i++)
+    h = unitig_mix64(h ^ bkey.b[i]);
+  *sum += h;
+}
+
+typedef struct
+{
+  size_t threadid, nthreads;
+  uint64_t sum;
+  const dBGraph *db_graph;
+} UnitigChecksum;
+
+static void unitig_checksum_thread(void *arg)
+{
+  UnitigChecksum *job = (UnitigChecksum*)arg;
+  const dBGraph *db_graph = job->db_graph;
+  size_t nwords = (db_graph->kmer_size*2+63)/64;
+  HASH_ITERATE_PART(&db_graph->ht, job->threadid, job->nthreads,
+                    unitig_hash_kmer, db_graph, nwords, &job->sum);
+}
+
+uint64_t unitig_index_checksum(size_t nthreads, const dBGraph *db_graph)
+{
+  size_t i;
+  uint64_t sum = 0;
+  UnitigChecksum *jobs = ctx_calloc(nthreads, sizeof(UnitigChecksum));
+
+  for(i = 0; i < nthreads; i++) {
+    jobs[i].threadid = i;
+    jobs[i].nthreads = nthreads;
+    jobs[i].db_graph = db_graph;
+  }
+
+  util_run_threads(jobs, nthreads, sizeof(UnitigChecksum),
+                   nthreads, unitig_checksum_thread);
+
+  for(i = 0; i < nthreads; i++) sum += jobs[i].sum;
+  ctx_free(jobs);
+  return sum;
+}
+
+//
+// Links and coverage, once all unitigs have ids
+//
+
+typedef struct
+{
+  UnitigIndex *ui;
+  size_t start, end; // unitig ids
+  bool success;
+  const dBGraph *db_graph;
+} UnitigJob;
+
+static void unitig_jobs_init(UnitigJob *jobs, size_t njobs, UnitigIndex *ui,
+                             const dBGraph *db_graph)
+{
+  size_t i;
+  for(i = 0; i < njobs; i++) {
+    jobs[i].ui = ui;
+    jobs[i].start = (ui->num_unitigs * i) / njobs;
+    jobs[i].end = (ui->num_unitigs * (i+1)) / njobs;
+    jobs[i].success = true;
+    jobs[i].db_graph = db_graph;
+  }
+}
+
+// Returns number of links and whether each neighbour is the first node of its
+// unitig in the direction we reach it
+static uint8_t unitig_get_links(const UnitigIndex *ui, dBNode node,
+                                uint64_t links[4], uint8_t *packed_bases,
+                                bool *links_ok, const dBGraph *db_graph)
+{
+  BinaryKmer bkey = db_node_get_bkmer(db_graph, node.key);
+  Edges edges = db_node_get_edges_union(db_graph, node.key);
+  dBNode next_nodes[4];
+  Nucleotide next_bases[4] = {0};
+  uint8_t i, n;
+  UnitigPos pos;
+  Orientation orient;
+
+  n = db_graph_next_nodes(db_graph, bkey, node.orient, edges,
+                          next_nodes, next_bases);
+
+  for(i = 0; i < n; i++) {
+    pos = ui->pos[next_nodes[i].key];
+    orient = ui->nodes[ui->unitigs[pos.uid].first + pos.offset].orient;
+    links[i] = unitig_link(pos.uid, orient == next_nodes[i].orient ? FORWARD
+                                                                  : REVERSE);
+    *links_ok &= db_nodes_are_equal(unitig_index_link_node(ui, links[i]),
+                                    next_nodes[i]);
+  }
+  for(; i < 4; i++) links[i] = 0;
+
+  *packed_bases = binary_seq_pack_byte(next_bases);
+  return n;
+}
+
+static void unitig_link_thread(void *arg)
+{
+  UnitigJob *job = (UnitigJob*)arg;
+  UnitigIndex *ui = job->ui;
+  const dBGraph *db_graph = job->db_graph;
+  const size_t ncols = ui->num_of_cols;
+  size_t uid, i, col;
+  Unitig *ut;
+  const dBNode *nodes;
+  uint64_t *covgs;
+  bool links_ok;
+
+  for(uid = job->start; uid < job->end; uid++)
+  {
+    ut = &ui->unitigs[uid];
+    nodes = unitig_index_nodes(ui, ut);
+    links_ok = true;
+    ut->num_prev = unitig_get_links(ui, db_node_reverse(nodes[0]),
+                                    ut->prev, &ut->prev_bases,
+                                    &links_ok, db_graph);
+    ut->num_next = unitig_get_links(ui, nodes[ut->len-1],
+                                    ut->next, &ut->next_bases,
+                                    &links_ok, db_graph);
+    ut->links_ok = links_ok;
+
+    covgs = ui->covgs + uid * ncols;
+    for(i = 0; i < ut->len; i++)
+      for(col = 0; col < ncols; col++)
+        covgs[col] += db_node_get_covg(db_graph, nodes[i].key, col);
+  }
+}
+
+//
+// Build
+//
+
+typedef struct
+{
+  UnitigIndex *ui;
+  UnitigBuffer *ubufs; // unitigs found by each thread
+  dBNodeBuffer *nbufs; // per thread
+  uint8_t *claimed;
+  size_t num_nodes;
+  const dBGraph *db_graph;
+} UnitigBuilder;
+
+// Called by supernodes_iterate() with each supernode
+static void unitig_add(const dBNodeBuffer *snode, size_t threadid, void *arg)
+{
+  UnitigBuilder *bld = (UnitigBuilder*)arg;
+  UnitigIndex *ui = bld->ui;
+  dBNodeBuffer *nbuf = &bld->nbufs[threadid];
+  size_t i, uid, first;
+  bool got_lock = false;
+
+  db_node_buf_reset(nbuf);
+  db_node_buf_append(nbuf, snode->data, snode->len);
+  supernode_normalise(nbuf->data, nbuf->len, bld->db_graph);
+
+  // A cycle may be found by two threads starting from different nodes.
+  // Normalised cycles start at the same node, so only one gets the lock.
+  bitlock_try_acquire(bld->claimed, nbuf->data[0].key, &got_lock);
+  if(!got_lock) return;
+
+  uid = __sync_fetch_and_add((volatile size_t*)&ui->num_unitigs, 1);
+  first = __sync_fetch_and_add((volatile size_t*)&bld->num_nodes, nbuf->len);
+
+  if(uid > UNITIG_MAX_ID) die("Too many unitigs for index [%zu]", uid);
+  if(first + nbuf->len > ui->num_kmers) die("Unitigs overlap");
+
+  memcpy(ui->nodes + first, nbuf->data, nbuf->len * sizeof(dBNode));
+  for(i = 0; i < nbuf->len; i++) {
+    UnitigPos pos = {.uid = (uint32_t)uid, .offset = (uint32_t)i};
+    ui->pos[nbuf->data[i].key] = pos;
+  }
+
+  Unitig ut = {.first = first, .len = (uint32_t)nbuf->len};
+  unitig_buf_add(&bld->ubufs[threadid], ut);
+}
+
+static void unitig_index_alloc(UnitigIndex *ui, size_t num_kmers,
+                               size_t num_of_cols, const dBGraph *db_graph)
+{
+  memset(ui, 0, sizeof(*ui));
+  ui->kmer_size = db_graph->kmer_size;
+  ui->num_of_cols = num_of_cols;
+  ui->num_kmers = num_kmers;
+  ui->nodes = ctx_malloc(num_kmers * sizeof(dBNode));
+  ui->pos = ctx_malloc(db_graph->ht.capacity * sizeof(UnitigPos));
+  memset(ui->pos, 0xff, db_graph->ht.capacity * sizeof(UnitigPos));
+}
+
+static void unitig_index_print_stats(const UnitigIndex *ui, const char *action)
+{
+  char nunitigs_str[50], nkmers_str[50];
+  ulong_to_str(ui->num_unitigs, nunitigs_str);
+  ulong_to_str(ui->num_kmers, nkmers_str);
+  status("[unitigs] %s %s unitigs of %s kmers [mean length: %.1f]", action,
+         nunitigs_str, nkmers_str,
+         ui->num_unitigs ? (double)ui->num_kmers / ui->num_unitigs : 0.0);
+}
+
+void unitig_index_build(UnitigIndex *ui, size_t nthreads,
+                        const dBGraph *db_graph)
+{
+  ctx_assert(db_graph->unitigs == NULL);
+
+  const size_t capacity = db_graph->ht.capacity;
+  size_t i, j, ncols = db_graph->col_covgs ? db_graph->num_of_cols : 0;
+
+  unitig_index_alloc(ui, db_graph->ht.num_kmers, ncols, db_graph);
+  ui->checksum = unitig_index_checksum(nthreads, db_graph);
+
+  UnitigBuilder bld = {.ui = ui, .num_nodes = 0, .db_graph = db_graph};
+  bld.ubufs = ctx_calloc(nthreads, sizeof(UnitigBuffer));
+  bld.nbufs = ctx_calloc(nthreads, sizeof(dBNodeBuffer));
+  bld.claimed = ctx_calloc(roundup_bits2bytes(capacity), 1);
+  uint8_t *visited = ctx_calloc(roundup_bits2bytes(capacity), 1);
+
+  for(i = 0; i < nthreads; i++) {
+    unitig_buf_alloc(&bld.ubufs[i], 1024);
+    db_node_buf_alloc(&bld.nbufs[i], 1024);
+  }
+
+  supernodes_iterate(nthreads, visited, db_graph, unitig_add, &bld);
+
+  ctx_free(visited);
+  ctx_free(bld.claimed);
+
+  if(bld.num_nodes != ui->num_kmers)
+    die("Unitigs missed kmers [%zu / %zu]", bld.num_nodes, ui->num_kmers);
+
+  // Place unitigs by id
+  ui->unitigs = ctx_malloc(ui->num_unitigs * sizeof(Unitig));
+  ui->covgs = ctx_calloc(ui->num_unitigs * ncols, sizeof(uint64_t));
+
+  for(i = 0; i < nthreads; i++) {
+    for(j = 0; j < bld.ubufs[i].len; j++) {
+      const Unitig *ut = &bld.ubufs[i].data[j];
+      ui->unitigs[ui->pos[ui->nodes[ut->first].key].uid] = *ut;
+    }
+    unitig_buf_dealloc(&bld.ubufs[i]);
+    db_node_buf_dealloc(&bld.nbufs[i]);
+  }
+  ctx_free(bld.ubufs);
+  ctx_free(bld.nbufs);
+
+  // Link unitigs and sum coverage
+  UnitigJob *jobs = ctx_calloc(nthreads, sizeof(UnitigJob));
+  unitig_jobs_init(jobs, nthreads, ui, db_graph);
+  util_run_threads(jobs, nthreads, sizeof(UnitigJob),
+                   nthreads, unitig_link_thread);
+  ctx_free(jobs);
+
+  unitig_index_print_stats(ui, "Found");
+}
+
+void unitig_index_dealloc(UnitigIndex *ui)
+{
+  ctx_free(ui->unitigs);
+  ctx_free(ui->covgs);
+  ctx_free(ui->nodes);
+  ctx_free(ui->pos);
+  memset(ui, 0, sizeof(*ui));
+}
+
+//
+// Save / load
+//
+
+static void unitig_write(FILE *fh, const void *ptr, size_t len,
+                         const char *path)
+{
+  if(fwrite(ptr, 1, len, fh) != len)
+    die("Cannot write file: %s [%s]", path, strerror(errno));
+}
+
+// Unitigs are written field by field, so the file does not depend on how the
+// compiler lays out Unitig
+static void unitig_pack(const Unitig *ut, uint8_t *rec)
+{
+  uint8_t small[5] = {ut->num_prev, ut->num_next,
+                      ut->prev_bases, ut->next_bases, ut->links_ok};
+  memcpy(rec, &ut->first, sizeof(uint64_t));
+  memcpy(rec+8, &ut->len, sizeof(uint32_t));
+  memcpy(rec+12, small, sizeof(small));
+  memcpy(rec+17, ut->prev, 4*sizeof(uint64_t));
+  memcpy(rec+49, ut->next, 4*sizeof(uint64_t));
+}
+
+static void unitig_unpack(const uint8_t *rec, Unitig *ut)
+{
+  memset(ut, 0, sizeof(*ut));
+  memcpy(&ut->first, rec, sizeof(uint64_t));
+  memcpy(&ut->len, rec+8, sizeof(uint32_t));
+  ut->num_prev = rec[12] & 0xf;
+  ut->num_next = rec[13] & 0xf;
+  ut->prev_bases = rec[14];
+  ut->next_bases = rec[15];
+  ut->links_ok = rec[16];
+  memcpy(ut->prev, rec+17, 4*sizeof(uint64_t));
+  memcpy(ut->next, rec+49, 4*sizeof(uint64_t));
+}
+
+void unitig_index_save(const UnitigIndex *ui, const char *path,
+                       const dBGraph *db_graph)
+{
+  ctx_assert(ui->kmer_size == db_graph->kmer_size);
+
+  size_t i, j, n;
+
+  UnitigFileHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, CTX_UNITIG_MAGIC, sizeof(hdr.magic));
+  hdr.version = CTX_UNITIG_FILEFORMAT;
+  hdr.kmer_size = ui->kmer_size;
+  hdr.num_of_cols = ui->num_of_cols;
+  hdr.capacity = db_graph->ht.capacity;
+  hdr.num_kmers = ui->num_kmers;
+  hdr.num_unitigs = ui->num_unitigs;
+  hdr.checksum = ui->checksum;
+
+  FILE *fh = fopen(path, "w");
+  if(fh == NULL) die("Cannot open file: %s [%s]", path, strerror(errno));
+
+  unitig_write(fh, &hdr, sizeof(hdr), path);
+
+  uint8_t *buf = ctx_malloc(UNITIG_IO_RECS * UNITIG_RECORD_BYTES);
+  uint64_t *words = (uint64_t*)buf;
+  ctx_assert(UNITIG_RECORD_BYTES >= sizeof(uint64_t));
+
+  for(i = 0; i < ui->num_unitigs; i += n) {
+    n = MIN2(UNITIG_IO_RECS, ui->num_unitigs - i);
+    for(j = 0; j < n; j++)
+      unitig_pack(&ui->unitigs[i+j], buf + j*UNITIG_RECORD_BYTES);
+    unitig_write(fh, buf, n * UNITIG_RECORD_BYTES, path);
+  }
+
+  unitig_write(fh, ui->covgs,
+               ui->num_unitigs * ui->num_of_cols * sizeof(uint64_t), path);
+
+  for(i = 0; i < ui->num_kmers; i += n) {
+    n = MIN2(UNITIG_IO_RECS, ui->num_kmers - i);
+    for(j = 0; j < n; j++)
+      words[j] = unitig_node_word(ui->nodes[i+j]);
+    unitig_write(fh, words, n * sizeof(uint64_t), path);
+  }
+
+  ctx_free(buf);
+  if(fclose(fh) != 0) die("Cannot write file: %s [%s]", path, strerror(errno));
+
+  char nunitigs_str[50], mem_str[50];
+  ulong_to_str(ui->num_unitigs, nunitigs_str);
+  bytes_to_str(unitig_file_size(ui->num_unitigs, ui->num_of_cols,
+                                ui->num_kmers), 1, mem_str);
+  status("[unitigs] Saved %s unitigs to %s [%s]", nunitigs_str, path, mem_str);
+}
+
+static bool unitig_read_header(FILE *fh, const char *path,
+                               UnitigFileHeader *hdr)
+{
+  if(fread(hdr, 1, sizeof(*hdr), fh) != sizeof(*hdr) ||
+     memcmp(hdr->magic, CTX_UNITIG_MAGIC, sizeof(hdr->magic)) != 0) {
+    warn("Not a unitig index: %s", path);
+    return false;
+  }
+  if(hdr->version != CTX_UNITIG_FILEFORMAT) {
+    warn("Unitig index version not supported [%zu]: %s",
+         (size_t)hdr->version, path);
+    return false;
+  }
+  return true;
+}
+
+size_t unitig_index_capacity(const char *path)
+{
+  UnitigFileHeader hdr;
+  FILE *fh = fopen(path, "r");
+  if(fh == NULL) {
+    warn("Cannot open file: %s [%s]", path, strerror(errno));
+    return 0;
+  }
+  bool success = unitig_read_header(fh, path, &hdr);
+  fclose(fh);
+  return success ? hdr.capacity : 0;
+}
+
+// Nodes were read into ui->nodes as words, convert them in place and fill in
+// the position of each kmer. No hash table lookups are needed since the
+// checksum has already told us the hash table layout is the same.
+static void unitig_load_thread(void *arg)
+{
+  UnitigJob *job = (UnitigJob*)arg;
+  UnitigIndex *ui = job->ui;
+  const uint64_t capacity = job->db_graph->ht.capacity;
+  size_t uid, i;
+  uint64_t word;
+  dBNode *nodes;
+
+  for(uid = job->start; uid < job->end; uid++)
+  {
+    const Unitig *ut = &ui->unitigs[uid];
+    nodes = ui->nodes + ut->first;
+
+    for(i = 0; i < ut->len; i++) {
+      memcpy(&word, &nodes[i], sizeof(uint64_t));
+      nodes[i].key = word >> 1;
+      nodes[i].orient = word & 1;
+      if(nodes[i].key >= capacity || ui->pos[nodes[i].key].uid != UINT32_MAX) {
+        job->success = false;
+        return;
+      }
+      UnitigPos pos = {.uid = (uint32_t)uid, .offset = (uint32_t)i};
+      ui->pos[nodes[i].key] = pos;
+    }
+  }
+}
+
+// Check unitig records are consistent. Returns false on error.
+static bool unitigs_check(const UnitigIndex *ui)
+{
+  size_t uid, i, first = 0;
+
+  for(uid = 0; uid < ui->num_unitigs; uid++)
+  {
+    const Unitig *ut = &ui->unitigs[uid];
+
+    if(ut->first != first || ut->len == 0 || ut->len > ui->num_kmers - first ||
+       ut->num_prev > 4 || ut->num_next > 4) return false;
+
+    for(i = 0; i < ut->num_prev; i++)
+      if(unitig_link_id(ut->prev[i]) >= ui->num_unitigs) return false;
+    for(i = 0; i < ut->num_next; i++)
+      if(unitig_link_id(ut->next[i]) >= ui->num_unitigs) return false;
+
+    first += ut->len;
+  }
+
+  return first == ui->num_kmers;
+}
+
+bool unitig_index_load(UnitigIndex *ui, const char *path, size_t nthreads,
+                       const dBGraph *db_graph)
+{
+  UnitigFileHeader hdr;
+  struct stat st;
+  size_t i, j, n, ncovgs;
+  bool success = true;
+
+  FILE *fh = fopen(path, "r");
+  if(fh == NULL) {
+    warn("Cannot open file: %s [%s]", path, strerror(errno));
+    return false;
+  }
+
+  if(!unitig_read_header(fh, path, &hdr)) {
+    fclose(fh);
+    return false;
+  }
+  if(hdr.kmer_size != db_graph->kmer_size ||
+     hdr.capacity != db_graph->ht.capacity ||
+     hdr.num_kmers != db_graph->ht.num_kmers) {
+    warn("Unitig index was built from a different graph or hash table size: %s",
+         path);
+    fclose(fh);
+    return false;
+  }
+
+  if(fstat(fileno(fh), &st) != 0 || hdr.num_unitigs > hdr.num_kmers ||
+     (size_t)st.st_size != unitig_file_size(hdr.num_unitigs, hdr.num_of_cols,
+                                            hdr.num_kmers)) {
+    warn("Corrupt unitig index: %s", path);
+    fclose(fh);
+    return false;
+  }
+
+  // One pass over the hash table, which also checks kmers are in the same
+  // place as when the index was built
+  if(hdr.checksum != unitig_index_checksum(nthreads, db_graph)) {
+    warn("Unitig index was built from a different graph: %s", path);
+    fclose(fh);
+    return false;
+  }
+
+  unitig_index_alloc(ui, hdr.num_kmers, hdr.num_of_cols, db_graph);
+  ui->num_unitigs = hdr.num_unitigs;
+  ui->checksum = hdr.checksum;
+  ui->unitigs = ctx_malloc(ui->num_unitigs * sizeof(Unitig));
+  ncovgs = ui->num_unitigs * ui->num_of_cols;
+  ui->covgs = ctx_malloc(ncovgs * sizeof(uint64_t));
+
+  uint8_t *buf = ctx_malloc(UNITIG_IO_RECS * UNITIG_RECORD_BYTES);
+
+  for(i = 0; i < ui->num_unitigs && success; i += n) {
+    n = MIN2(UNITIG_IO_RECS, ui->num_unitigs - i);
+    if(fread(buf, UNITIG_RECORD_BYTES, n, fh) != n) success = false;
+    else {
+      for(j = 0; j < n; j++)
+        unitig_unpack(buf + j*UNITIG_RECORD_BYTES, &ui->unitigs[i+j]);
+    }
+  }
+
+  ctx_free(buf);
+
+  // dBNode is the same size as a word, read nodes straight into place
+  ctx_assert(sizeof(dBNode) == sizeof(uint64_t));
+  if(success &&
+     (fread(ui->covgs, sizeof(uint64_t), ncovgs, fh) != ncovgs ||
+      fread(ui->nodes, sizeof(uint64_t), ui->num_kmers, fh) != ui->num_kmers)) {
+    success = false;
+  }
+
+  if(!success) warn("Cannot read file: %s [%s]", path, strerror(errno));
+
+  fclose(fh);
+
+  if(success && !unitigs_check(ui)) {
+    warn("Corrupt unitig index: %s", path);
+    success = false;
+  }
+
+  if(success) {
+    UnitigJob *jobs = ctx_calloc(nthreads, sizeof(UnitigJob));
+    unitig_jobs_init(jobs, nthreads, ui, db_graph);
+    util_run_threads(jobs, nthreads, sizeof(UnitigJob),
+                     nthreads, unitig_load_thread);
+    for(i = 0; i < nthreads; i++) success &= jobs[i].success;
+    ctx_free(jobs);
+    if(!success) warn("Corrupt unitig index: %s", path);
+  }
+
+  if(!success) { unitig_index_dealloc(ui); return false; }
+
+  unitig_index_print_stats(ui, "Loaded");
+  return true;
+}
@@ -0,0 +1,140 @@
+#ifndef UNITIG_INDEX_H_
+#define UNITIG_INDEX_H_
+
+#include "db_graph.h"
+#include "db_node.h"
+
+//
+// Unitig (supernode) index
+//
+// Stores every unitig in the graph once: its nodes, coverage summed per colour
+// and the unitigs either side of it. Each kmer maps to its unitig and offset.
+// When an index is attached to a graph (db_graph->unitigs), supernode_find(),
+// GraphCache and GraphWalker take supernodes from the index rather than
+// walking them one hash table lookup at a time.
+//
+// Unitigs are found using edges merged across colours, so an index can be
+// reused by any command that loads the same graph files with the same hash
+// table size. Nodes are saved as hash table positions, so loading needs no
+// kmer lookups. A checksum of kmers, edges and their positions is saved so
+// that an index for a different graph or hash table is rejected.
+// The graph must not be changed while an index is attached.
+//
+// In memory an index uses sizeof(UnitigPos) bytes per hash table entry plus
+// sizeof(dBNode) per kmer, and a Unitig and coverage per unitig.
+//
+// File layout (.unitigs): UnitigFileHeader, then num_unitigs records of
+//   <first:u64><len:u32><num_prev:u8><num_next:u8><prev_bases:u8>
+//   <next_bases:u8><links_ok:u8><prev:u64 x 4><next:u64 x 4>
+// then covgs[num_unitigs][num_of_cols] (u64) and the nodes of all unitigs
+// in order as <key:63><orient:1> (u64).
+//
+
+#define CTX_UNITIG_FILEFORMAT 2
+#define CTX_UNITIG_MAGIC "CTXUNITG"
+
+// Link to a neighbouring unitig: id and orientation we enter it in
+#define unitig_link(uid,orient) (((uint64_t)(uid) << 1) | (orient))
+#define unitig_link_id(link) ((size_t)((link) >> 1))
+#define unitig_link_orient(link) ((Orientation)((link) & 1))
+
+typedef struct
+{
+  uint64_t first; // index of first node in UnitigIndex.nodes
+  uint32_t len; // number of kmers
+  uint8_t num_prev:4, num_next:4;
+  uint8_t prev_bases, next_bases; // packed 2 bits per base
+  // 1 if every neighbour is the first node of its unitig in that direction.
+  // Not true for some loops, where links cannot be used in place of nodes.
+  uint8_t links_ok;
+  uint64_t prev[4], next[4]; // unitig_link()s, in the order of prev/next_bases
+} Unitig;
+
+typedef struct
+{
+  uint32_t uid, offset;
+} UnitigPos;
+
+typedef struct
+{
+  char magic[8];
+  uint64_t version, kmer_size, num_of_cols;
+  uint64_t capacity; // hash table capacity
+  uint64_t num_kmers, num_unitigs, checksum;
+} UnitigFileHeader;
+
+typedef struct UnitigIndex
+{
+  size_t kmer_size, num_of_cols, num_kmers, num_unitigs;
+  uint64_t checksum;
+  Unitig *unitigs;
+  uint64_t *covgs; // [uid*num_of_cols + col]
+  dBNode *nodes; // nodes of each unitig in order, normalised
+  UnitigPos *pos; // one per hash table entry
+} UnitigIndex;
+
+// Memory used per kmer, not including data stored per unitig
+#define UNITIG_INDEX_BYTES_PER_KMER (sizeof(UnitigPos) + sizeof(dBNode))
+
+// Find unitigs using `nthreads` threads
+void unitig_index_build(UnitigIndex *ui, size_t nthreads,
+                        const dBGraph *db_graph);
+
+// Save index to a file, dies on error
+void unitig_index_save(const UnitigIndex *ui, const char *path,
+                       const dBGraph *db_graph);
+
+// Load an index saved for this graph. Returns false (and prints why) if the
+// file cannot be read or was built from a different graph.
+bool unitig_index_load(UnitigIndex *ui, const char *path, size_t nthreads,
+                       const dBGraph *db_graph);
+
+void unitig_index_dealloc(UnitigIndex *ui);
+
+// Hash table capacity an index was built with, 0 if it cannot be read
+size_t unitig_index_capacity(const char *path);
+
+// Order independent hash of kmers, their merged edges and hash table positions
+uint64_t unitig_index_checksum(size_t nthreads, const dBGraph *db_graph);
+
+#define unitig_index_nodes(ui,ut) ((ui)->nodes + (ut)->first)
+
+// Node we reach first when entering a unitig through `link`
+static inline dBNode unitig_index_link_node(const UnitigIndex *ui,
+                                            uint64_t link)
+{
+  const Unitig *ut = &ui->unitigs[unitig_link_id(link)];
+  const dBNode *nodes = unitig_index_nodes(ui, ut);
+  return unitig_link_orient(link) == FORWARD ? nodes[0]
+                                             : db_node_reverse(nodes[ut->len-1]);
+}
+
+// Returns true if walking from `node` covers its whole unitig
+static inline bool unitig_index_is_start(const UnitigIndex *ui, dBNode node)
+{
+  UnitigPos pos = ui->pos[node.key];
+  const Unitig *ut = &ui->unitigs[pos.uid];
+  Orientation orient = unitig_index_nodes(ui, ut)[pos.offset].orient;
+  return (orient == node.orient ? pos.offset == 0 : pos.offset+1 == ut->len);
+}
+
+// Get the node after `node` in its unitig, without a hash table lookup.
+// Returns false at the end of a unitig.
+static inline bool unitig_index_next_node(const UnitigIndex *ui, dBNode node,
+                                          dBNode *next)
+{
+  UnitigPos pos = ui->pos[node.key];
+  const Unitig *ut = &ui->unitigs[pos.uid];
+  const dBNode *nodes = unitig_index_nodes(ui, ut);
+
+  if(nodes[pos.offset].orient == node.orient) {
+    if(pos.offset+1 == ut->len) return false;
+    *next = nodes[pos.offset+1];
+  } else {
+    if(pos.offset == 0) return false;
+    *next = db_node_reverse(nodes[pos.offset-1]);
+  }
+  return true;
+}
+
+#endif /* UNITIG_INDEX_H_ */
@@ -65,7 +65,7 @@ CtxCmd cmdobjs[] = {
 },
 {
   .cmd = "reads", .func = ctx_reads, .hide = 1,
-  .minargs = 4, .maxargs = INT_MAX, .optargs = "mn", .reqargs = "",
+  .minargs = 4, .maxargs = INT_MAX, .optargs = "mnt", .reqargs = "",
   .blurb = "filter reads against a graph",
   .usage = reads_usage
 },
@@ -77,7 +77,7 @@ CtxCmd cmdobjs[] = {
 },
 {
   .cmd = "contigs", .func = ctx_contigs, .hide = 0,
-  .minargs = 1, .maxargs = INT_MAX, .optargs = "mnpo", .reqargs = "",
+  .minargs = 1, .maxargs = INT_MAX, .optargs = "mnpot", .reqargs = "",
   .blurb = "pull out contigs for a sample",
   .usage = contigs_usage
 },
@@ -146,6 +146,24 @@ CtxCmd cmdobjs[] = {
   .minargs = 0, .maxargs = INT_MAX, .optargs = "mno", .reqargs = "",
   .blurb = "reduce set of strings to remove substrings",
   .usage = rmsubstr_usage
+},
+{
+  .cmd = "sort", .func = NULL, .func2 = ctx_sort, .hide = 0,
+  .minargs = 1, .maxargs = INT_MAX, .optargs = "", .reqargs = "",
+  .blurb = "sort kmers in a graph file for on-disk queries",
+  .usage = sort_usage
+},
+{
+  .cmd = "index", .func = NULL, .func2 = ctx_index, .hide = 0,
+  .minargs = 1, .maxargs = INT_MAX, .optargs = "o", .reqargs = "o",
+  .blurb = "build a static index of a graph for on-disk queries",
+  .usage = index_usage
+},
+{
+  .cmd = "unitigs", .func = NULL, .func2 = ctx_unitigs, .hide = 0,
+  .minargs = 1, .maxargs = INT_MAX, .optargs = "tmno", .reqargs = "",
+  .blurb = "build an index of unitigs (supernodes) to reuse between commands",
+  .usage = unitigs_usage
 }
 };
 
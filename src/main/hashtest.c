@@ -5,10 +5,86 @@
 #include "util.h"
 #include "db_graph.h"
 #include "binary_kmer.h"
+#include "path_hash.h"
+
+#include <sys/time.h>
 
 static const char usage[] =
 "usage: hashtest [options] <num_ops>\n"
-"  Test hash table speed.  Assume kmer size of "QUOTE_VALUE(MAX_KMER_SIZE)" if none given\n";
+"  Test hash table speed.  Assume kmer size of "QUOTE_VALUE(MAX_KMER_SIZE)" if none given\n"
+"  --pathhash <len>  Test PathHash insert speed with paths of up to <len> bases\n";
+
+// Insert random paths into a PathHash. Paths are generated first, in a fake
+// PathStore with one colour: <prev:8><colset:1><PathLen:2><seq>, then only
+// the inserts are timed.
+static void path_hash_test(size_t mem_to_use, unsigned long num_ops,
+                           size_t max_plen)
+{
+  const size_t colbytes = 1, hdrbytes = sizeof(PathIndex) + colbytes;
+  size_t recmem = hdrbytes + sizeof(PathLen) + (max_plen+3)/4;
+  size_t i, j, plen, nbytes, pos, num_kmers = MAX2(num_ops/4, 1);
+  size_t num_inserted = 0, num_found = 0, num_full = 0;
+  uint8_t *store = ctx_calloc(num_ops, recmem), *packed;
+  PathIndex *pindices = ctx_malloc(num_ops * sizeof(PathIndex));
+  hkey_t *hkeys = ctx_malloc(num_ops * sizeof(hkey_t));
+  PathIndex next = 0;
+  PathLen lenword;
+  int ret;
+
+  for(i = 0; i < num_ops; i++)
+  {
+    hkeys[i] = (hkey_t)rand() % num_kmers;
+    plen = 1 + rand() % max_plen;
+    nbytes = (plen+3)/4;
+    lenword = (PathLen)plen;
+
+    pindices[i] = next;
+    packed = store + next + hdrbytes;
+    memcpy(packed, &lenword, sizeof(PathLen));
+    for(j = 0; j < nbytes; j++) packed[sizeof(PathLen)+j] = rand() & 0xff;
+    // Zero unused bits in the last byte
+    if(plen & 3) packed[sizeof(PathLen)+nbytes-1] &= (1 << (2*(plen&3))) - 1;
+    next += hdrbytes + sizeof(PathLen) + nbytes;
+  }
+
+  PathHash phash;
+  path_hash_alloc(&phash, mem_to_use);
+
+  struct timeval start, end;
+  gettimeofday(&start, NULL);
+
+  for(i = 0; i < num_ops; i++)
+  {
+    packed = store + pindices[i] + hdrbytes;
+    ret = path_hash_find_or_insert_mt(&phash, hkeys[i], packed,
+                                      store, colbytes, &pos);
+
+    if(ret == 1) {
+      path_hash_set_pindex(&phash, pos, pindices[i]);
+      num_inserted++;
+    }
+    else if(ret == 0) num_found++;
+    else num_full++;
+  }
+
+  gettimeofday(&end, NULL);
+  double secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+
+  char ops_str[50], ins_str[50], found_str[50], full_str[50], rate_str[50];
+  ulong_to_str(num_ops, ops_str);
+  ulong_to_str(num_inserted, ins_str);
+  ulong_to_str(num_found, found_str);
+  ulong_to_str(num_full, full_str);
+  ulong_to_str(secs > 0 ? (unsigned long)(num_ops / secs) : 0, rate_str);
+  status("[hashtest] %s paths: %s inserted, %s found, %s failed (hash full)",
+         ops_str, ins_str, found_str, full_str);
+  status("[hashtest] %.2f seconds, %s paths per second", secs, rate_str);
+
+  path_hash_dealloc(&phash);
+  ctx_free(hkeys);
+  ctx_free(pindices);
+  ctx_free(store);
+}
 
 int main(int argc, char **argv)
 {
@@ -36,12 +112,31 @@ int main(int argc, char **argv)
     argv += 2;
   }
 
-  if(args.argc != 1) print_usage(usage, NULL);
+  size_t max_plen = 0;
+
+  if(argc > 0 && !strcmp(argv[0],"--pathhash")) {
+    if(argc == 1) die("%s <len> requires an argument", argv[0]);
+    if(!parse_entire_size(argv[1], &max_plen) || max_plen == 0 ||
+       max_plen > PP_LENMASK) {
+      die("Invalid path length (%s %s)", argv[0], argv[1]);
+    }
+    argc -= 2;
+    argv += 2;
+  }
+
+  if(argc != 1) print_usage(usage, NULL);
 
   unsigned long i, num_ops;
   if(!parse_entire_ulong(argv[0], &num_ops))
     print_usage(usage, "Invalid <num_ops>");
 
+  if(max_plen > 0) {
+    path_hash_test(args.mem_to_use, num_ops, max_plen);
+    cmd_free(&args);
+    cortex_destroy();
+    return EXIT_SUCCESS;
+  }
+
   // Decide on memory
   size_t kmers_in_hash, graph_mem;
   kmers_in_hash = cmd_get_kmers_in_hash(&args, 0, num_ops, num_ops, true, &graph_mem);
@@ -31,6 +31,9 @@ int main()
   test_bubble_caller();
   test_kmer_occur();
   test_infer_edges_tests();
+  test_kmer_mphf();
+  test_unitig_index();
+  test_db_adjacency();
 
   // Check we free'd all our memory
   size_t still_alloced = alloc_get_num_allocs() - alloc_get_num_frees();
@@ -150,4 +150,13 @@ void test_graph_crawler();
 // infer_edges_tests.c
 void test_infer_edges_tests();
 
+// kmer_mphf_tests.c
+void test_kmer_mphf();
+
+// unitig_index_tests.c
+void test_unitig_index();
+
+// db_adjacency_tests.c
+void test_db_adjacency();
+
 #endif  /* ALL_TESTS_H_ */
@@ -5,6 +5,50 @@
 #include "build_graph.h"
 #include "clean_graph.h"
 
+// Build a graph from seqs[i] (first lens[i] bases) nreps[i] times each, clean
+// it with an auto threshold, then rebuild it and clean with the threshold from
+// cleaning_get_threshold(). Checks both remove the same kmers.
+// Returns the threshold
+static size_t _test_auto_threshold(dBGraph *graph, char **seqs,
+                                   const size_t *lens, const size_t *nreps,
+                                   size_t nseqs, double seq_depth,
+                                   size_t min_keep_tip,
+                                   uint8_t *visited, uint8_t *keep)
+{
+  const size_t nthreads = 2;
+  size_t i, j, run, thresh_auto = 0, thresh = 0, nkmers_auto = 0;
+
+  for(run = 0; run < 2; run++)
+  {
+    hash_table_empty(&graph->ht);
+    memset(graph->col_edges, 0, graph->ht.capacity*sizeof(Edges));
+    memset(graph->col_covgs, 0, graph->ht.capacity*sizeof(Covg));
+
+    for(i = 0; i < nseqs; i++)
+      for(j = 0; j < nreps[i]; j++)
+        build_graph_from_str_mt(graph, 0, seqs[i], lens[i]);
+
+    if(run == 0) {
+      thresh_auto = clean_graph(nthreads, CLEANING_THRESH_AUTO, seq_depth,
+                                min_keep_tip, NULL, NULL, NULL, NULL,
+                                visited, keep, graph);
+      nkmers_auto = graph->ht.num_kmers;
+    } else {
+      thresh = cleaning_get_threshold(nthreads, seq_depth, NULL, NULL,
+                                      visited, graph);
+      clean_graph(nthreads, thresh, seq_depth, min_keep_tip,
+                  NULL, NULL, NULL, NULL, visited, keep, graph);
+      TASSERT2(thresh == thresh_auto, "%zu vs %zu", thresh, thresh_auto);
+      TASSERT2(graph->ht.num_kmers == nkmers_auto, "%zu vs %zu",
+               (size_t)graph->ht.num_kmers, nkmers_auto);
+    }
+
+    TASSERT(graph->ht.num_kmers == hash_table_count_kmers(&graph->ht));
+  }
+
+  return thresh;
+}
+
 void test_cleaning()
 {
   test_status("Testing graph cleaning...");
@@ -44,17 +88,20 @@ void test_cleaning()
            "%"PRIu64" kmers", graph.ht.num_kmers);
 
   // No change (min_tip_len must be > 1)
-  clean_graph(nthreads, 0, 2, NULL, NULL, visited, keep, &graph);
+  clean_graph(nthreads, 0, 0, 2, NULL, NULL, NULL, NULL,
+              visited, keep, &graph);
   TASSERT(graph.ht.num_kmers == 1000-19+1);
   TASSERT(graph.ht.num_kmers == hash_table_count_kmers(&graph.ht));
 
   // No change (min_tip_len must be > 1)
-  clean_graph(nthreads, 0, 1000-19+1, NULL, NULL, visited, keep, &graph);
+  clean_graph(nthreads, 0, 0, 1000-19+1, NULL, NULL, NULL, NULL,
+              visited, keep, &graph);
   TASSERT(graph.ht.num_kmers == 1000-19+1);
   TASSERT(graph.ht.num_kmers == hash_table_count_kmers(&graph.ht));
 
   // All removed
-  clean_graph(nthreads, 0, 1000-19+2, NULL, NULL, visited, keep, &graph);
+  clean_graph(nthreads, 0, 0, 1000-19+2, NULL, NULL, NULL, NULL,
+              visited, keep, &graph);
   TASSERT2(graph.ht.num_kmers == 0, "%"PRIu64" kmers", graph.ht.num_kmers);
   TASSERT(graph.ht.num_kmers == hash_table_count_kmers(&graph.ht));
 
@@ -72,7 +119,8 @@ void test_cleaning()
   build_graph_from_str_mt(&graph, 0, tmp, strlen(tmp));
 
   size_t thresh = cleaning_get_threshold(nthreads, 4, NULL, NULL, visited, &graph);
-  clean_graph(nthreads, thresh, 0, NULL, NULL, visited, keep, &graph);
+  clean_graph(nthreads, thresh, 0, 0, NULL, NULL, NULL, NULL,
+              visited, keep, &graph);
   TASSERT2(thresh > 1, "threshold: %zu", thresh);
 
   TASSERT2(graph.ht.num_kmers == 200-19+1, "%"PRIu64" kmers", graph.ht.num_kmers);
@@ -87,7 +135,8 @@ void test_cleaning()
   TASSERT2(graph.ht.num_kmers == 200-19+1 + 23-19+1,
            "%"PRIu64" kmers", graph.ht.num_kmers);
   TASSERT(graph.ht.num_kmers == hash_table_count_kmers(&graph.ht));
-  clean_graph(nthreads, 0, 2*19-1, NULL, NULL, visited, keep, &graph);
+  clean_graph(nthreads, 0, 0, 2*19-1, NULL, NULL, NULL, NULL,
+              visited, keep, &graph);
   TASSERT2(graph.ht.num_kmers == 200-19+1, "%"PRIu64" kmers", graph.ht.num_kmers);
   TASSERT(graph.ht.num_kmers == hash_table_count_kmers(&graph.ht));
 
@@ -101,10 +150,57 @@ void test_cleaning()
   build_graph_from_str_mt(&graph, 0, tmp3, strlen(tmp3));
   TASSERT2(graph.ht.num_kmers == 1, "%zu", (size_t)graph.ht.num_kmers);
   TASSERT(graph.ht.num_kmers == hash_table_count_kmers(&graph.ht));
-  clean_graph(nthreads, 0, 2*19-1, NULL, NULL, visited, keep, &graph);
+  clean_graph(nthreads, 0, 0, 2*19-1, NULL, NULL, NULL, NULL,
+              visited, keep, &graph);
   TASSERT(graph.ht.num_kmers == 0, "%"PRIu64" kmers", graph.ht.num_kmers);
   TASSERT(graph.ht.num_kmers == hash_table_count_kmers(&graph.ht));
 
+  // Tip with two tips of its own: clipping them leaves a new tip that must be
+  // clipped in a later round
+  char fork1[] = "AACGACAGAAATCCCCTTC" "ACGTTGCAAT" "GGATCCTTAGCAGTCAGACTTG";
+  char fork2[] = "AACGACAGAAATCCCCTTC" "ACGTTGCAAT" "CTAGTTCGGAAGCATTGACA";
+
+  hash_table_empty(&graph.ht);
+  memset(graph.col_edges, 0, ncols*graph.ht.capacity*sizeof(Edges));
+  memset(graph.col_covgs, 0, ncols*graph.ht.capacity*sizeof(Covg));
+
+  for(i = 0; i < 3; i++)
+    build_graph_from_str_mt(&graph, 0, graphseq, 200);
+  build_graph_from_str_mt(&graph, 0, fork1, strlen(fork1));
+  build_graph_from_str_mt(&graph, 0, fork2, strlen(fork2));
+  TASSERT2(graph.ht.num_kmers == 200-19+1 + 10 + 22 + 20,
+           "%"PRIu64" kmers", graph.ht.num_kmers);
+
+  clean_graph(nthreads, 0, 0, 2*19-1, NULL, NULL, NULL, NULL,
+              visited, keep, &graph);
+  TASSERT2(graph.ht.num_kmers == 200-19+1, "%"PRIu64" kmers", graph.ht.num_kmers);
+  TASSERT(graph.ht.num_kmers == hash_table_count_kmers(&graph.ht));
+
+  // Auto threshold in clean_graph() removes the same kmers as estimating the
+  // threshold first
+  char *seqs[] = {graphseq, tmp, fork1};
+  size_t lens[] = {500, strlen(tmp), strlen(fork1)}, nreps[] = {10, 3, 1};
+  _test_auto_threshold(&graph, seqs, lens, nreps, 3, 0, 2*19-1, visited, keep);
+  _test_auto_threshold(&graph, seqs, lens, nreps, 3, 1, 2*19-1, visited, keep);
+  _test_auto_threshold(&graph, seqs, lens, nreps, 3, 10, 2*19-1, visited, keep);
+
+  // Histogram of supernode coverage with a threshold of 4, which is above the
+  // coverage of supernodes deferred for a sequencing depth of 1
+  // 63 x covg 1, 15 x covg 2, 5 x covg 3, 2 x covg 4, 1 x covg 5
+  const size_t nrand = 63+15+5+2+1, rlen = 30;
+  char *rseqs[nrand], rbuf[nrand*(rlen+1)];
+  size_t rlens[nrand], rreps[nrand];
+  for(i = 0; i < nrand; i++) {
+    rseqs[i] = rbuf + i*(rlen+1);
+    rand_bases(rseqs[i], rlen);
+    rseqs[i][rlen] = '\0';
+    rlens[i] = rlen;
+    rreps[i] = i < 63 ? 1 : (i < 78 ? 2 : (i < 83 ? 3 : (i < 85 ? 4 : 5)));
+  }
+  thresh = _test_auto_threshold(&graph, rseqs, rlens, rreps, nrand, 1, 0,
+                                visited, keep);
+  TASSERT2(thresh == 4, "threshold: %zu", thresh);
+
   ctx_free(visited);
   ctx_free(keep);
 
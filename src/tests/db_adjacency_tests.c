@@ -0,0 +1,107 @@
+#include "global.h"
+#include "all_tests.h"
+
+#include "db_graph.h"
+#include "db_node.h"
+#include "supernode.h"
+#include "db_adjacency.h"
+
+// Compare cached neighbours against looking them up in the hash table
+static void _check_adjacency(dBGraph *db_graph)
+{
+  hkey_t hkey;
+  size_t i, n0, n1, num_nodes = 0;
+  Orientation orient;
+  BinaryKmer bkey;
+  Edges union_edges, edges, subset;
+  dBNode nodes0[4], nodes1[4];
+  Nucleotide nucs0[4], nucs1[4];
+  const dBAdjacency *adj = db_graph->adj;
+
+  dBNodeBuffer nbuf0, nbuf1;
+  db_node_buf_alloc(&nbuf0, 64);
+  db_node_buf_alloc(&nbuf1, 64);
+
+  for(hkey = 0; hkey < db_graph->ht.capacity; hkey++)
+  {
+    if(!db_graph_node_assigned(db_graph, hkey)) continue;
+
+    bkey = db_node_get_bkmer(db_graph, hkey);
+    union_edges = db_node_get_edges_union(db_graph, hkey);
+    num_nodes += edges_get_outdegree(union_edges, FORWARD) +
+                 edges_get_outdegree(union_edges, REVERSE);
+
+    for(orient = 0; orient < 2; orient++)
+    {
+      // Every subset of the edges leaving in this orientation
+      edges = edges_with_orientation(union_edges, orient);
+      for(subset = 0; subset < 16; subset++)
+      {
+        if(subset & ~edges) continue;
+        n0 = db_graph_next_nodes(db_graph, bkey, orient, subset << (orient*4),
+                                 nodes0, nucs0);
+        n1 = db_adj_next_nodes(adj, (dBNode){.key = hkey, .orient = orient},
+                               union_edges, subset << (orient*4),
+                               nodes1, nucs1);
+        TASSERT(n0 == n1);
+        for(i = 0; i < n0 && i < n1; i++) {
+          TASSERT(db_nodes_are_equal(nodes0[i], nodes1[i]));
+          TASSERT(nucs0[i] == nucs1[i]);
+        }
+      }
+    }
+
+    // Supernodes are the same with and without the cache
+    db_node_buf_reset(&nbuf0);
+    db_node_buf_reset(&nbuf1);
+    db_graph->adj = NULL;
+    supernode_find(hkey, &nbuf0, db_graph);
+    db_graph->adj = adj;
+    supernode_find(hkey, &nbuf1, db_graph);
+    TASSERT(nbuf0.len == nbuf1.len);
+    for(i = 0; i < nbuf0.len && i < nbuf1.len; i++)
+      TASSERT(db_nodes_are_equal(nbuf0.data[i], nbuf1.data[i]));
+  }
+
+  TASSERT(num_nodes == adj->num_nodes);
+
+  db_node_buf_dealloc(&nbuf0);
+  db_node_buf_dealloc(&nbuf1);
+}
+
+void test_db_adjacency()
+{
+  test_status("Testing adjacency cache...");
+
+  dBGraph graph;
+  const size_t kmer_size = 11, ncols = 2;
+
+  db_graph_alloc(&graph, kmer_size, ncols, 1, 2048);
+  graph.bktlocks = ctx_calloc(roundup_bits2bytes(graph.ht.num_of_buckets), 1);
+  graph.col_edges = ctx_calloc(graph.ht.capacity, sizeof(Edges));
+  graph.col_covgs = ctx_calloc(graph.ht.capacity * ncols, sizeof(Covg));
+
+  // Bubble, tip, a loop and a kmer that is its own reverse complement
+  const char *seqs[] = {
+    "GTTCCAGAGCGGAGGTCTCCCAACAACATGGTATAAGTTGTCTAGCCCCGGTTCGCGCGGGTACTTCTTACAG",
+    "GTTCCAGAGCGGAGGTCTCCCAACAACTTGGTATAAGTTGTCTAGCCCCGGTTCGCG",
+    "CTCCCAACAACATGGTATCAGCATTGTTA",
+    "ACGTACGTACGTACAAAAAACGTACGTACG",
+    "CACCGATCGGTG"};
+
+  size_t i, nthreads;
+  for(i = 0; i < sizeof(seqs)/sizeof(seqs[0]); i++)
+    build_graph_from_str_mt(&graph, i % ncols, seqs[i], strlen(seqs[i]));
+
+  dBAdjacency adj;
+
+  for(nthreads = 1; nthreads <= 4; nthreads += 3) {
+    TASSERT(db_adj_build(&adj, nthreads, &graph));
+    graph.adj = &adj;
+    _check_adjacency(&graph);
+    graph.adj = NULL;
+    db_adj_dealloc(&adj);
+  }
+
+  db_graph_dealloc(&graph);
+}
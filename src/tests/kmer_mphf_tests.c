@@ -0,0 +1,62 @@
+#include "global.h"
+#include "all_tests.h"
+#include "kmer_mphf.h"
+#include "binary_kmer.h"
+
+static int bkmer_cmp(const void *aa, const void *bb)
+{
+  const BinaryKmer *a = (const BinaryKmer*)aa, *b = (const BinaryKmer*)bb;
+  if(binary_kmers_are_equal(*a, *b)) return 0;
+  return binary_kmer_less_than(*a, *b) ? -1 : 1;
+}
+
+// Check every key gets a unique value in [0,n)
+static void test_mphf_keys(size_t n)
+{
+  size_t i, j, num_seen = 0;
+  BinaryKmer *keys = ctx_malloc(MAX2(n,1) * sizeof(BinaryKmer));
+  BinaryKmer *tmp = ctx_malloc(MAX2(n,1) * sizeof(BinaryKmer));
+  uint8_t *seen = ctx_calloc(MAX2(n,1), sizeof(uint8_t));
+  uint64_t v;
+
+  // Generate distinct random keys
+  for(i = 0; i < n; i++) keys[i] = binary_kmer_random(MAX_KMER_SIZE);
+  qsort(keys, n, sizeof(BinaryKmer), bkmer_cmp);
+  for(i = j = 0; i < n; i++)
+    if(j == 0 || !binary_kmers_are_equal(keys[i], keys[j-1])) keys[j++] = keys[i];
+  n = j;
+
+  memcpy(tmp, keys, n * sizeof(BinaryKmer));
+
+  KmerMphf mphf;
+  kmer_mphf_build(&mphf, tmp, n);
+
+  TASSERT(mphf.nkeys == n);
+  TASSERT(mphf.nplaced + mphf.nfallback == n);
+
+  for(i = 0; i < n; i++) {
+    v = kmer_mphf_lookup(&mphf, keys[i]);
+    TASSERT2(v < n, "v: %zu n: %zu", (size_t)v, n);
+    if(v < n) {
+      TASSERT(!seen[v]);
+      num_seen += !seen[v];
+      seen[v] = 1;
+    }
+  }
+
+  TASSERT(num_seen == n);
+
+  kmer_mphf_dealloc(&mphf);
+  ctx_free(seen);
+  ctx_free(tmp);
+  ctx_free(keys);
+}
+
+void test_kmer_mphf()
+{
+  test_status("Testing minimal perfect hash of kmers");
+  test_mphf_keys(0);
+  test_mphf_keys(1);
+  test_mphf_keys(100);
+  test_mphf_keys(10000);
+}
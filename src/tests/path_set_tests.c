@@ -210,9 +210,150 @@ static void _fake_set_test()
   path_set_dealloc(&set3);
   path_set_dealloc(&set4);
 
+  //
+  // Merging duplicates
+  //
+
+  // Set: [colourset,path]
+  //   1=001 A
+  //   4=100 AC
+  //   2=010 AC
+  //   1=001 ACG
+  //   2=010 ACG
+  // Should go to:
+  //   1=001 A
+  //   6=110 AC
+  //   3=011 ACG
+
+  PathSet set5;
+  path_set_alloc(&set5);
+
+  const char *paths5a[5] = {"A","AC","AC","ACG","ACG"};
+  const uint8_t colset5a[5] = {1,4,2,1,2};
+
+  const char *paths5b[3] = {"A","AC","ACG"}; // output
+  const uint8_t colset5b[3] = {1,6,3};
+
+  _fake_path_set(&set5, 1, paths5a, 5);
+  _set_paths_colsets(&set5, colset5a);
+  set5.members.data[1].count = 200;
+  set5.members.data[2].count = 100;
+
+  path_set_merge_dups(&set5);
+  _check_fake_test_case(&set5, &sbuf, paths5b, 3);
+  _check_paths_colsets(&set5, colset5b);
+  TASSERT(set5.members.data[1].count == 255);
+
+  path_set_dealloc(&set5);
+
   strbuf_dealloc(&sbuf);
 }
 
+//
+// Random sets, large enough to use radix sort
+//
+
+static void _rand_path_set(PathSet *set, size_t npaths, size_t maxlen)
+{
+  size_t i, j, plen, nbytes;
+  path_set_reset(set);
+  set->cbytes = 1;
+
+  for(i = 0; i < npaths; i++) {
+    plen = rand() % (maxlen+1);
+    nbytes = (plen+3)/4;
+    bytebuf_ensure_capacity(&set->seqs, set->seqs.len + 1 + nbytes);
+    PathEntry entry = {.seq = set->seqs.len + 1, .pindex = npaths - i,
+                       .orient = rand() & 1, .plen = plen, .count = 0};
+    memset(set->seqs.data + set->seqs.len, 0, 1 + nbytes);
+    set->seqs.data[set->seqs.len] = rand() & 0xf;
+    for(j = 0; j < plen; j++)
+      binary_seq_set(path_set_seq(&entry, set), j, rand() & 3);
+    set->seqs.len += 1 + nbytes;
+    pentrybuf_add(&set->members, entry);
+  }
+}
+
+// Returns true if a is a prefix of or equal to b
+static bool _entry_is_prefix(const PathEntry *a, const PathSet *aset,
+                             const PathEntry *b, const PathSet *bset)
+{
+  return a->orient == b->orient && a->plen <= b->plen &&
+         binary_seqs_cmp(path_set_seq(a,aset), a->plen,
+                         path_set_seq(b,bset), a->plen) == 0;
+}
+
+static void _rand_set_test()
+{
+  test_status("Testing path_set.c sort and slim with random sets...");
+
+  PathSet set, orig;
+  path_set_alloc(&set);
+  path_set_alloc(&orig);
+
+  size_t r, i, j, col;
+  const PathEntry *a, *b;
+  int cmp;
+  bool found;
+
+  for(r = 0; r < 20; r++)
+  {
+    _rand_path_set(&set, 50 + rand() % 500, r < 10 ? 4 : 40);
+
+    // Check sorted by orientation, sequence then pindex
+    path_set_sort(&set);
+    for(i = 1; i < set.members.len; i++) {
+      a = &set.members.data[i-1];
+      b = &set.members.data[i];
+      cmp = binary_seqs_cmp(path_set_seq(a,&set), a->plen,
+                            path_set_seq(b,&set), b->plen);
+      TASSERT(a->orient < b->orient ||
+              (a->orient == b->orient && (cmp < 0 ||
+                                          (cmp == 0 && a->pindex < b->pindex))));
+    }
+
+    // Keep a copy to check slimming against
+    path_set_reset(&orig);
+    orig.cbytes = set.cbytes;
+    bytebuf_ensure_capacity(&orig.seqs, set.seqs.len);
+    memcpy(orig.seqs.data, set.seqs.data, set.seqs.len);
+    orig.seqs.len = set.seqs.len;
+    for(i = 0; i < set.members.len; i++)
+      pentrybuf_add(&orig.members, set.members.data[i]);
+
+    path_set_slim(&set);
+
+    for(i = 0; i < set.members.len; i++) {
+      a = &set.members.data[i];
+      TASSERT(!packedpath_is_colset_zero(path_set_colset(a,&set), 1));
+      // No path in a colour is a prefix of another path in that colour
+      for(j = 0; j < set.members.len; j++) {
+        b = &set.members.data[j];
+        if(i != j && _entry_is_prefix(a, &set, b, &set)) {
+          TASSERT((*path_set_colset(a,&set) & *path_set_colset(b,&set)) == 0);
+        }
+      }
+    }
+
+    // Every path in every colour is still covered
+    for(i = 0; i < orig.members.len; i++) {
+      a = &orig.members.data[i];
+      for(col = 0; col < 4; col++) {
+        if(!bitset_get(path_set_colset(a,&orig), col)) continue;
+        for(j = 0, found = false; j < set.members.len && !found; j++) {
+          b = &set.members.data[j];
+          found = _entry_is_prefix(a, &orig, b, &set) &&
+                  bitset_get(path_set_colset(b,&set), col);
+        }
+        TASSERT(found);
+      }
+    }
+  }
+
+  path_set_dealloc(&set);
+  path_set_dealloc(&orig);
+}
+
 //
 // Real Graph
 //
@@ -356,4 +497,5 @@ void test_path_sets()
 {
   _real_graph_test();
   _fake_set_test();
+  _rand_set_test();
 }
@@ -5,6 +5,88 @@
 #include "path_store.h"
 #include "generate_paths.h"
 #include "graph_paths.h"
+#include "path_spill.h"
+#include "path_format.h"
+
+// Build graph from `seqs`, then thread seqs[0] `nreads` times into a path
+// store that only has room for two paths and merge the runs on disk.
+// Returns the number of paths kept.
+static size_t _test_spill_paths(char **seqs, size_t nseqs,
+                                size_t nreads, uint8_t threshold)
+{
+  dBGraph graph;
+  size_t i, kmer_size = 11, ncols = 1, npaths;
+
+  db_graph_alloc(&graph, kmer_size, ncols, ncols, 1024);
+  graph.bktlocks = ctx_calloc(roundup_bits2bytes(graph.ht.num_of_buckets), 1);
+  graph.col_edges = ctx_calloc(graph.ht.capacity * ncols, sizeof(Edges));
+  graph.col_covgs = ctx_calloc(graph.ht.capacity * ncols, sizeof(Covg));
+  graph.node_in_cols = ctx_calloc(roundup_bits2bytes(graph.ht.capacity) * ncols, 1);
+
+  for(i = 0; i < nseqs; i++)
+    build_graph_from_str_mt(&graph, 0, seqs[i], strlen(seqs[i]));
+
+  path_store_alloc(&graph.pstore, 1024, true, graph.ht.capacity, ncols);
+  graph.pstore.kmer_locks = ctx_calloc(roundup_bits2bytes(graph.ht.capacity), 1);
+  graph.pstore.extra_bytes = 1;
+
+  // Each path is <prev:8><colset:1><len:2><seq:1><count:1>
+  graph.pstore.end = graph.pstore.store + 2 * (sizeof(PathIndex) + 5);
+
+  PathSpill spill;
+  path_spill_alloc(&spill, "-", &graph);
+
+  CorrectAlnParam params = {.ctpcol = 0, .ctxcol = 0,
+                            .ins_gap_min = 0, .ins_gap_max = 0,
+                            .one_way_gap_traverse = true, .use_end_check = true,
+                            .max_context = 10,
+                            .gap_variance = 0.1, .gap_wiggle = 5};
+
+  AsyncIOReadInput io = {.file1 = NULL, .file2 = NULL,
+                         .fq_offset = 0, .interleaved = false};
+
+  CorrectAlnInput task = {.files = io, .fq_cutoff = 0, .hp_cutoff = 0,
+                         .matedir = READPAIR_FR, .crt_params = params,
+                         .out_base = NULL, .output = NULL};
+
+  AsyncIOData iodata;
+  asynciodata_alloc(&iodata);
+
+  GenPathWorker *wrkrs = gen_paths_workers_alloc(1, &graph, &spill);
+
+  for(i = 0; i < nreads; i++) {
+    seq_read_set(&iodata.r1, seqs[0]);
+    seq_read_reset(&iodata.r2);
+    iodata.fq_offset1 = iodata.fq_offset2 = 0;
+    iodata.ptr = NULL;
+    gen_paths_worker_seq(wrkrs, &iodata, &task);
+  }
+
+  gen_paths_workers_dealloc(wrkrs, 1);
+  path_store_combine_updated_paths(&graph.pstore);
+
+  // Store filled up part way through the first read
+  TASSERT(spill.num_runs > 0);
+
+  PathFileHeader phdr = INIT_PATH_FILE_HDR_MACRO;
+  paths_header_alloc(&phdr, ncols);
+  phdr.num_of_cols = ncols;
+  phdr.kmer_size = kmer_size;
+
+  FILE *fout = tmpfile();
+  TASSERT(fout != NULL);
+  path_spill_write(&spill, &phdr, threshold, fout);
+  fclose(fout);
+
+  npaths = phdr.num_of_paths;
+
+  paths_header_dealloc(&phdr);
+  path_spill_dealloc(&spill);
+  asynciodata_dealloc(&iodata);
+  db_graph_dealloc(&graph);
+
+  return npaths;
+}
 
 void test_paths()
 {
@@ -85,6 +167,14 @@ void test_paths()
 
   asynciodata_dealloc(&iodata);
   db_graph_dealloc(&graph);
+
+  // Spilling to disk: paths stored before a flush are not counted again when
+  // the read is redone, so a single read does not pass a threshold of two
+  test_status("Testing spilling paths to disk in generate_paths.c");
+  char *seqs[] = {seq0, seq1, seq2, seq3};
+  TASSERT(_test_spill_paths(seqs, 4, 1, 0) == 5);
+  TASSERT(_test_spill_paths(seqs, 4, 1, 2) == 0);
+  TASSERT(_test_spill_paths(seqs, 4, 2, 2) == 5);
 }
 
 /*
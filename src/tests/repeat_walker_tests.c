@@ -28,7 +28,7 @@ static void test_walk(GraphWalker *gwlk, RepeatWalker *rptwlk,
   TASSERT2(strcmp(tmp,ans) == 0, "%s vs %s", tmp, ans);
 
   graph_walker_finish(gwlk);
-  rpt_walker_fast_clear(rptwlk, nbuf->data, nbuf->len);
+  rpt_walker_clear(rptwlk);
 }
 
 static void test_repeat_loop()
@@ -106,8 +106,53 @@ static void test_repeat_loop()
   db_graph_dealloc(&graph);
 }
 
+// Visited set grows, falls back to a bitset and is cleared
+static void test_visited_set()
+{
+  RepeatWalker rptwlk;
+  rpt_walker_alloc(&rptwlk, 1UL<<20, 12);
+
+  size_t i, n, nrepeat = 0, nseen = 0;
+  dBNode node;
+
+  for(n = 100; n <= 10000; n *= 100)
+  {
+    for(i = 0; i < n; i++) {
+      node = (dBNode){.key = i*7, .orient = i&1};
+      nseen += rpt_walker_visit(&rptwlk, node);
+    }
+    for(i = 0; i < n; i++) {
+      node = (dBNode){.key = i*7, .orient = i&1};
+      nrepeat += rpt_walker_visit(&rptwlk, node);
+      node.orient = !node.orient;
+      nseen += rpt_walker_visit(&rptwlk, node);
+    }
+
+    TASSERT2(nseen == 0, "%zu", nseen);
+    TASSERT2(nrepeat == n, "%zu vs %zu", nrepeat, n);
+    // 10000 entries need more memory than a bitset of 2^20 kmers
+    TASSERT((rptwlk.visited != NULL) == (n > 100));
+
+    rpt_walker_clear(&rptwlk);
+    TASSERT(rptwlk.visited == NULL && rptwlk.set_len == 0);
+    nrepeat = nseen = 0;
+  }
+
+  // Epoch wraps around
+  rptwlk.epoch = UINT32_MAX;
+  node = (dBNode){.key = 5, .orient = FORWARD};
+  TASSERT(!rpt_walker_visit(&rptwlk, node));
+  TASSERT(rpt_walker_visit(&rptwlk, node));
+  rpt_walker_clear(&rptwlk);
+  TASSERT(rptwlk.epoch == 1);
+  TASSERT(!rpt_walker_visit(&rptwlk, node));
+
+  rpt_walker_dealloc(&rptwlk);
+}
+
 void test_repeat_walker()
 {
   test_status("Testing repeat_walker.h");
   test_repeat_loop();
+  test_visited_set();
 }
@@ -0,0 +1,185 @@
+#include "global.h"
+#include "all_tests.h"
+
+#include "db_graph.h"
+#include "db_node.h"
+#include "supernode.h"
+#include "unitig_index.h"
+
+#include <unistd.h> // close, unlink
+
+static void _check_unitig_index(const UnitigIndex *ui, const dBGraph *db_graph)
+{
+  size_t i, j, n, num_kmers = 0;
+  dBNodeBuffer nbuf;
+  db_node_buf_alloc(&nbuf, 64);
+
+  dBNode next_nodes[4], node;
+  Nucleotide next_nucs[4];
+  BinaryKmer bkey;
+  Edges edges;
+
+  TASSERT(ui->num_kmers == db_graph->ht.num_kmers);
+
+  for(i = 0; i < ui->num_unitigs; i++)
+  {
+    const Unitig *ut = &ui->unitigs[i];
+    const dBNode *nodes = unitig_index_nodes(ui, ut);
+    num_kmers += ut->len;
+
+    // Same nodes as supernode_find()
+    db_node_buf_reset(&nbuf);
+    supernode_find(nodes[0].key, &nbuf, db_graph);
+    supernode_normalise(nbuf.data, nbuf.len, db_graph);
+    TASSERT(nbuf.len == ut->len);
+    for(j = 0; j < ut->len && j < nbuf.len; j++)
+      TASSERT(db_nodes_are_equal(nbuf.data[j], nodes[j]));
+
+    // Every kmer maps back to this unitig
+    for(j = 0; j < ut->len; j++) {
+      TASSERT(ui->pos[nodes[j].key].uid == i);
+      TASSERT(ui->pos[nodes[j].key].offset == j);
+      TASSERT(unitig_index_is_start(ui, nodes[j]) == (j == 0));
+      TASSERT(unitig_index_next_node(ui, nodes[j], &node) == (j+1 < ut->len));
+      if(j+1 < ut->len) TASSERT(db_nodes_are_equal(node, nodes[j+1]));
+    }
+
+    // Links agree with db_graph_next_nodes()
+    node = nodes[ut->len-1];
+    bkey = db_node_get_bkmer(db_graph, node.key);
+    edges = db_node_get_edges_union(db_graph, node.key);
+    n = db_graph_next_nodes(db_graph, bkey, node.orient, edges,
+                            next_nodes, next_nucs);
+    TASSERT(n == ut->num_next);
+    for(j = 0; j < n && ut->links_ok; j++) {
+      TASSERT(db_nodes_are_equal(unitig_index_link_node(ui, ut->next[j]),
+                                 next_nodes[j]));
+    }
+  }
+
+  TASSERT(num_kmers == ui->num_kmers);
+  db_node_buf_dealloc(&nbuf);
+}
+
+static void _check_unitig_indexes_match(const UnitigIndex *ui0,
+                                        const UnitigIndex *ui1,
+                                        const dBGraph *db_graph)
+{
+  size_t i, j;
+  hkey_t hkey;
+
+  TASSERT(ui0->num_unitigs == ui1->num_unitigs);
+  TASSERT(ui0->num_kmers == ui1->num_kmers);
+  TASSERT(ui0->num_of_cols == ui1->num_of_cols);
+  TASSERT(ui0->checksum == ui1->checksum);
+  if(ui0->num_unitigs != ui1->num_unitigs) return;
+
+  for(i = 0; i < ui0->num_unitigs; i++) {
+    const Unitig *u0 = &ui0->unitigs[i], *u1 = &ui1->unitigs[i];
+    TASSERT(u0->first == u1->first && u0->len == u1->len);
+    TASSERT(u0->num_prev == u1->num_prev && u0->num_next == u1->num_next);
+    TASSERT(u0->prev_bases == u1->prev_bases);
+    TASSERT(u0->next_bases == u1->next_bases);
+    TASSERT(u0->links_ok == u1->links_ok);
+    for(j = 0; j < u0->num_prev; j++) TASSERT(u0->prev[j] == u1->prev[j]);
+    for(j = 0; j < u0->num_next; j++) TASSERT(u0->next[j] == u1->next[j]);
+  }
+
+  for(i = 0; i < ui0->num_unitigs * ui0->num_of_cols; i++)
+    TASSERT(ui0->covgs[i] == ui1->covgs[i]);
+
+  for(i = 0; i < ui0->num_kmers; i++)
+    TASSERT(db_nodes_are_equal(ui0->nodes[i], ui1->nodes[i]));
+
+  for(hkey = 0; hkey < db_graph->ht.capacity; hkey++) {
+    if(!db_graph_node_assigned(db_graph, hkey)) continue;
+    TASSERT(ui0->pos[hkey].uid == ui1->pos[hkey].uid);
+    TASSERT(ui0->pos[hkey].offset == ui1->pos[hkey].offset);
+  }
+}
+
+// Save index, load it back and check it is only accepted by the same graph
+static void _test_unitig_index_save_load(const UnitigIndex *ui, dBGraph *graph)
+{
+  UnitigIndex ui2;
+  char path[] = "/tmp/ctx_unitigs_test.XXXXXX";
+  int fd = mkstemp(path);
+  TASSERT(fd != -1);
+  if(fd == -1) return;
+  close(fd);
+
+  unitig_index_save(ui, path, graph);
+  TASSERT(unitig_index_capacity(path) == graph->ht.capacity);
+
+  size_t nthreads;
+  for(nthreads = 1; nthreads <= 4; nthreads += 3) {
+    TASSERT(unitig_index_load(&ui2, path, nthreads, graph));
+    _check_unitig_indexes_match(ui, &ui2, graph);
+    _check_unitig_index(&ui2, graph);
+    unitig_index_dealloc(&ui2);
+  }
+
+  // Graph with an edge removed is rejected
+  hkey_t hkey = ui->nodes[0].key;
+  Edges edges = graph->col_edges[hkey];
+  graph->col_edges[hkey] ^= 0x11;
+  TASSERT(!unitig_index_load(&ui2, path, 1, graph));
+  graph->col_edges[hkey] = edges;
+
+  // Graph with an extra kmer is rejected
+  const char extra[] = "AAAAAAAAAAAA";
+  build_graph_from_str_mt(graph, 0, extra, strlen(extra));
+  TASSERT(!unitig_index_load(&ui2, path, 1, graph));
+
+  unlink(path);
+}
+
+void test_unitig_index()
+{
+  test_status("Testing unitig index...");
+
+  dBGraph graph;
+  const size_t kmer_size = 11, ncols = 2;
+
+  db_graph_alloc(&graph, kmer_size, ncols, 1, 2048);
+  graph.bktlocks = ctx_calloc(roundup_bits2bytes(graph.ht.num_of_buckets), 1);
+  graph.col_edges = ctx_calloc(graph.ht.capacity, sizeof(Edges));
+  graph.col_covgs = ctx_calloc(graph.ht.capacity * ncols, sizeof(Covg));
+
+  // Bubble, tip, a loop and a kmer that is its own reverse complement
+  const char *seqs[] = {
+    "GTTCCAGAGCGGAGGTCTCCCAACAACATGGTATAAGTTGTCTAGCCCCGGTTCGCGCGGGTACTTCTTACAG",
+    "GTTCCAGAGCGGAGGTCTCCCAACAACTTGGTATAAGTTGTCTAGCCCCGGTTCGCG",
+    "CTCCCAACAACATGGTATCAGCATTGTTA",
+    "ACGTACGTACGTACAAAAAACGTACGTACG",
+    "CACCGATCGGTG"};
+
+  size_t i, nthreads;
+  for(i = 0; i < sizeof(seqs)/sizeof(seqs[0]); i++)
+    build_graph_from_str_mt(&graph, i % ncols, seqs[i], strlen(seqs[i]));
+
+  UnitigIndex ui;
+
+  for(nthreads = 1; nthreads <= 4; nthreads += 3) {
+    unitig_index_build(&ui, nthreads, &graph);
+    _check_unitig_index(&ui, &graph);
+
+    // Coverage sums to the coverage in the graph
+    uint64_t sum_ui = 0, sum_graph = 0;
+    size_t col;
+    for(i = 0; i < ui.num_unitigs * ncols; i++) sum_ui += ui.covgs[i];
+    for(i = 0; i < graph.ht.capacity; i++)
+      if(HASH_ENTRY_ASSIGNED(graph.ht.table[i]))
+        for(col = 0; col < ncols; col++)
+          sum_graph += db_node_get_covg(&graph, i, col);
+    TASSERT(sum_ui == sum_graph);
+
+    unitig_index_dealloc(&ui);
+  }
+
+  unitig_index_build(&ui, 1, &graph);
+  _test_unitig_index_save_load(&ui, &graph);
+  unitig_index_dealloc(&ui);
+
+  db_graph_dealloc(&graph);
+}
@@ -83,7 +83,7 @@ size_t multicol_walker_assemble_contig(MulticolWalker *walker,
   for(i = 0; i < num_remaining_wlkrs; i++)
     graph_walker_finish(&walker->wlks[i]);
 
-  rpt_walker_fast_clear(rptwlk, nbuf->data, nbuf->len);
+  rpt_walker_clear(rptwlk);
 
   return num_remaining_wlkrs + num_finished_cols;
 }
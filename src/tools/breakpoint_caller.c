@@ -39,12 +39,13 @@ typedef struct
   PathRefRun *allele_refs, *flank5p_refs;
   KOccurRunBuffer allele_run_buf, flank5p_run_buf;
 
+  // Calls are printed here before being passed to output
+  StrBuf output_buf;
+
   // Passed to all instances
   const KOGraph kograph;
   const dBGraph *db_graph;
-  gzFile gzout;
-  pthread_mutex_t *const out_lock;
-  size_t *callid;
+  CallerOutput *output;
   const size_t min_ref_nkmers, max_ref_nkmers; // how many kmers of homology req
 } BreakpointCaller;
 
@@ -56,7 +57,7 @@ typedef struct
 #define MAX_REFRUNS_PER_CALLER(ncols) MAX_REFRUNS_PER_ORIENT(ncols)*2
 
 static BreakpointCaller* brkpt_callers_new(size_t num_callers,
-                                           gzFile gzout,
+                                           CallerOutput *output,
                                            size_t min_ref_flank,
                                            size_t max_ref_flank,
                                            const KOGraph kograph,
@@ -67,11 +68,6 @@ static BreakpointCaller* brkpt_callers_new(size_t num_callers,
   const size_t ncols = db_graph->num_of_cols;
   BreakpointCaller *callers = ctx_malloc(num_callers * sizeof(BreakpointCaller));
 
-  pthread_mutex_t *out_lock = ctx_malloc(sizeof(pthread_mutex_t));
-  if(pthread_mutex_init(out_lock, NULL) != 0) die("mutex init failed");
-
-  size_t *callid = ctx_calloc(1, sizeof(size_t));
-
   // Each colour in each caller can have a GraphCache path at once
   PathRefRun *path_ref_runs = ctx_calloc(num_callers*MAX_REFRUNS_PER_CALLER(ncols),
                                          sizeof(PathRefRun));
@@ -83,9 +79,7 @@ static BreakpointCaller* brkpt_callers_new(size_t num_callers,
                             .nthreads = num_callers,
                             .kograph = kograph,
                             .db_graph = db_graph,
-                            .gzout = gzout,
-                            .out_lock = out_lock,
-                            .callid = callid,
+                            .output = output,
                             .allele_refs = path_ref_runs,
                             .flank5p_refs = path_ref_runs+MAX_REFRUNS_PER_ORIENT(ncols),
                             .min_ref_nkmers = min_ref_flank,
@@ -105,6 +99,7 @@ static BreakpointCaller* brkpt_callers_new(size_t num_callers,
     kmer_run_buf_alloc(&callers[i].flank5p_run_buf, 128);
     graph_crawler_alloc(&callers[i].crawlers[0], db_graph);
     graph_crawler_alloc(&callers[i].crawlers[1], db_graph);
+    strbuf_alloc(&callers[i].output_buf, 2048);
   }
 
   return callers;
@@ -124,17 +119,15 @@ static void brkpt_callers_destroy(BreakpointCaller *callers, size_t num_callers)
     kmer_run_buf_dealloc(&callers[i].flank5p_run_buf);
     graph_crawler_dealloc(&callers[i].crawlers[0]);
     graph_crawler_dealloc(&callers[i].crawlers[1]);
+    strbuf_dealloc(&callers[i].output_buf);
   }
-  pthread_mutex_destroy(callers[0].out_lock);
-  ctx_free(callers[0].out_lock);
-  ctx_free(callers[0].callid);
   ctx_free(callers[0].allele_refs);
   ctx_free(callers);
 }
 
-static inline void ko_gzprint(gzFile gzout, size_t kmer_size,
-                              KOGraph kograph, KOccurRun korun,
-                              size_t first_kmer_idx, size_t kmer_offset)
+static inline void korun_to_str(StrBuf *sbuf, size_t kmer_size,
+                                KOGraph kograph, KOccurRun korun,
+                                size_t first_kmer_idx, size_t kmer_offset)
 {
   const char strand[] = {'+','-'};
   const char *chrom = kograph_chrom(kograph,korun).name;
@@ -151,22 +144,38 @@ static inline void ko_gzprint(gzFile gzout, size_t kmer_size,
   }
   qoffset = korun.qoffset - first_kmer_idx;
   // +1 to coords to convert to 1-based
-  gzprintf(gzout, "%s:%zu-%zu:%c:%u",
-           chrom, start+1, end+1, strand[korun.strand], qoffset+1);
+  strbuf_sprintf(sbuf, "%s:%zu-%zu:%c:%zu",
+                 chrom, start+1, end+1, strand[korun.strand], qoffset+1);
 }
 
-static inline void koruns_gzprint(gzFile gzout, size_t kmer_size,
-                                  KOGraph kograph,
-                                  const KOccurRun *koruns, size_t n,
-                                  size_t first_kmer_idx, size_t kmer_offset)
+static inline void koruns_to_str(StrBuf *sbuf, size_t kmer_size,
+                                 KOGraph kograph,
+                                 const KOccurRun *koruns, size_t n,
+                                 size_t first_kmer_idx, size_t kmer_offset)
 {
   size_t i;
   if(n == 0) return;
-  ko_gzprint(gzout, kmer_size, kograph, koruns[0], first_kmer_idx, kmer_offset);
+  korun_to_str(sbuf, kmer_size, kograph, koruns[0],
+               first_kmer_idx, kmer_offset);
   for(i = 1; i < n; i++) {
-    gzputc(gzout, ',');
-    ko_gzprint(gzout, kmer_size, kograph, koruns[i], first_kmer_idx, kmer_offset);
+    strbuf_append_char(sbuf, ',');
+    korun_to_str(sbuf, kmer_size, kograph, koruns[i],
+                 first_kmer_idx, kmer_offset);
+  }
+}
+
+// Print kmers without the first k-1 bases
+static inline void nodes_print_cont(StrBuf *sbuf, const dBNode *nodes,
+                                    size_t num, const dBGraph *db_graph)
+{
+  size_t i;
+  Nucleotide nuc;
+  strbuf_ensure_capacity(sbuf, sbuf->len + num);
+  for(i = 0; i < num; i++) {
+    nuc = db_node_get_last_nuc(nodes[i], db_graph);
+    sbuf->buff[sbuf->len++] = dna_nuc_to_char(nuc);
   }
+  sbuf->buff[sbuf->len] = '\0';
 }
 
 static void process_contig(BreakpointCaller *caller,
@@ -176,7 +185,7 @@ static void process_contig(BreakpointCaller *caller,
                            const KOccurRun *flank5p_runs, size_t num_flank5p_runs,
                            const KOccurRun *flank3p_runs, size_t num_flank3p_runs)
 {
-  gzFile gzout = caller->gzout;
+  StrBuf *sbuf = &caller->output_buf;
   KOGraph kograph = caller->kograph;
   const size_t kmer_size = caller->db_graph->kmer_size;
 
@@ -186,7 +195,7 @@ static void process_contig(BreakpointCaller *caller,
   if(num_flank3p_runs == 0) return;
 
   // Find first place we meet the ref
-  size_t callid = __sync_fetch_and_add((volatile size_t*)caller->callid, 1);
+  size_t callid = caller_output_callid(caller->output, caller->threadid);
 
   // Swallow up some of the path into the 3p flank
   size_t i, flank3pidx = flank3p_runs[0].qoffset;
@@ -194,33 +203,35 @@ static void process_contig(BreakpointCaller *caller,
   size_t num_path_kmers = flank3pidx - extra3pbases;
   size_t kmer3poffset = kmer_size-1-extra3pbases;
 
-  pthread_mutex_lock(caller->out_lock);
+  strbuf_reset(sbuf);
 
   // 5p flank with list of ref intersections
-  gzprintf(gzout, ">brkpnt.%zu.5pflank chr=", callid);
-  koruns_gzprint(gzout, kmer_size, kograph, flank5p_runs, num_flank5p_runs, 0, 0);
-  gzputc(gzout, '\n');
-  db_nodes_gzprint(flank5p->data, flank5p->len, caller->db_graph, gzout);
-  gzputc(gzout, '\n');
+  strbuf_sprintf(sbuf, ">brkpnt.%zu.5pflank chr=", callid);
+  koruns_to_str(sbuf, kmer_size, kograph, flank5p_runs, num_flank5p_runs, 0, 0);
+  strbuf_append_char(sbuf, '\n');
+  strbuf_ensure_capacity(sbuf, sbuf->len + flank5p->len + kmer_size);
+  sbuf->len += db_nodes_to_str(flank5p->data, flank5p->len, caller->db_graph,
+                               sbuf->buff + sbuf->len);
+  strbuf_append_char(sbuf, '\n');
 
   // 3p flank with list of ref intersections
-  gzprintf(gzout, ">brkpnt.%zu.3pflank chr=", callid);
-  koruns_gzprint(gzout, kmer_size, kograph, flank3p_runs, num_flank3p_runs,
-                 flank3pidx, kmer3poffset);
-  gzputc(gzout, '\n');
-  db_nodes_gzprint_cont(allelebuf->data+num_path_kmers,
-                        allelebuf->len-num_path_kmers,
-                        caller->db_graph, gzout);
-  gzputc(gzout, '\n');
+  strbuf_sprintf(sbuf, ">brkpnt.%zu.3pflank chr=", callid);
+  koruns_to_str(sbuf, kmer_size, kograph, flank3p_runs, num_flank3p_runs,
+                flank3pidx, kmer3poffset);
+  strbuf_append_char(sbuf, '\n');
+  nodes_print_cont(sbuf, allelebuf->data+num_path_kmers,
+                   allelebuf->len-num_path_kmers, caller->db_graph);
+  strbuf_append_char(sbuf, '\n');
 
   // Print path with list of colours
-  gzprintf(gzout, ">brkpnt.%zu.path cols=%zu", callid, cols[0]);
-  for(i = 1; i < ncols; i++) gzprintf(gzout, ",%zu", cols[i]);
-  gzputc(gzout, '\n');
-  db_nodes_gzprint_cont(allelebuf->data, num_path_kmers, caller->db_graph, gzout);
-  gzprintf(gzout, "\n\n");
-
-  pthread_mutex_unlock(caller->out_lock);
+  strbuf_sprintf(sbuf, ">brkpnt.%zu.path cols=%zu", callid, (size_t)cols[0]);
+  for(i = 1; i < ncols; i++) strbuf_sprintf(sbuf, ",%zu", (size_t)cols[i]);
+  strbuf_append_char(sbuf, '\n');
+  nodes_print_cont(sbuf, allelebuf->data, num_path_kmers, caller->db_graph);
+  strbuf_append_str(sbuf, "\n\n");
+
+  // Buffered and compressed without locking
+  caller_output_write(caller->output, caller->threadid, sbuf);
 }
 
 // If `pickup_new_runs` is true we pick up runs starting at this supernode
@@ -555,7 +566,7 @@ static void breakpoint_caller(void *ptr)
                     breakpoint_caller_node, caller);
 }
 
-static void breakpoints_print_header(gzFile gzout, const char *out_path,
+static void breakpoints_print_header(StrBuf *sbuf, const char *out_path,
                                      char **seq_paths, size_t nseq_paths,
                                      const read_t *reads, size_t nreads,
                                      const dBGraph *db_graph)
@@ -563,33 +574,40 @@ static void breakpoints_print_header(gzFile gzout, const char *out_path,
   size_t i;
   ctx_assert(nseq_paths > 0);
 
-  caller_gzprint_header(gzout, out_path, "CtxBreakpointsv0.1", db_graph);
+  caller_print_header(sbuf, out_path, "CtxBreakpointsv0.1", db_graph);
 
   for(i = 0; i < nseq_paths; i++)
-    gzprintf(gzout, "##reference=%s\n", seq_paths[i]);
+    strbuf_sprintf(sbuf, "##reference=%s\n", seq_paths[i]);
 
   for(i = 0; i < nreads; i++) {
-    gzprintf(gzout, "##contig=<ID=%s,length=%zu>\n",
-             reads[i].name.b, reads[i].seq.end);
+    strbuf_sprintf(sbuf, "##contig=<ID=%s,length=%zu>\n",
+                   reads[i].name.b, (size_t)reads[i].seq.end);
   }
 }
 
 void breakpoints_call(size_t num_of_threads,
-                      gzFile gzout, const char *out_path,
+                      FILE *fout, const char *out_path, bool sorted,
                       const read_t *reads, size_t num_reads,
                       char **seq_paths, size_t num_seq_paths,
                       size_t min_ref_flank, size_t max_ref_flank,
                       dBGraph *db_graph)
 {
-  breakpoints_print_header(gzout, out_path,
+  StrBuf hdr;
+  strbuf_alloc(&hdr, 1024);
+  breakpoints_print_header(&hdr, out_path,
                            seq_paths, num_seq_paths,
                            reads, num_reads,
                            db_graph);
 
+  CallerOutput output;
+  caller_output_open(&output, fout, futil_outpath_str(out_path), ">brkpnt.",
+                     num_of_threads, sorted, &hdr);
+  strbuf_dealloc(&hdr);
+
   KOGraph kograph = kograph_create(reads, num_reads, true,
                                    num_of_threads, db_graph);
 
-  BreakpointCaller *callers = brkpt_callers_new(num_of_threads, gzout,
+  BreakpointCaller *callers = brkpt_callers_new(num_of_threads, &output,
                                                 min_ref_flank, max_ref_flank,
                                                 kograph, db_graph);
 
@@ -603,8 +621,9 @@ void breakpoints_call(size_t num_of_threads,
   util_run_threads(callers, num_of_threads, sizeof(callers[0]),
                    num_of_threads, breakpoint_caller);
 
+  size_t num_calls = caller_output_close(&output);
   char call_num_str[100];
-  ulong_to_str(callers[0].callid[0], call_num_str);
+  ulong_to_str(num_calls, call_num_str);
   status("  %s calls printed to %s", call_num_str, futil_outpath_str(out_path));
 
   brkpt_callers_destroy(callers, num_of_threads);
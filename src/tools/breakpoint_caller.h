@@ -10,8 +10,9 @@
 #define DEFAULT_MAX_REF_NKMERS 1000
 
 // Adds input bkmers to the graph
+// If `sorted` is true, calls are sorted by seed kmer (reproducible output)
 void breakpoints_call(size_t num_of_threads,
-                      gzFile gzout, const char *out_path,
+                      FILE *fout, const char *out_path, bool sorted,
                       const read_t *reads, size_t num_reads,
                       char **seq_paths, size_t num_seq_paths,
                       size_t min_ref_flank, size_t max_ref_flank,
@@ -17,7 +17,7 @@
 
 BubbleCaller* bubble_callers_new(size_t num_callers,
                                  BubbleCallingPrefs prefs,
-                                 gzFile gzout,
+                                 CallerOutput *output,
                                  const dBGraph *db_graph)
 {
   ctx_assert(num_callers > 0);
@@ -28,19 +28,12 @@ BubbleCaller* bubble_callers_new(size_t num_callers,
 
   BubbleCaller *callers = ctx_malloc(num_callers * sizeof(BubbleCaller));
 
-  pthread_mutex_t *out_lock = ctx_malloc(sizeof(pthread_mutex_t));
-  if(pthread_mutex_init(out_lock, NULL) != 0) die("mutex init failed");
-
-  size_t *num_bubbles_ptr = ctx_calloc(1, sizeof(size_t));
-
   for(i = 0; i < num_callers; i++)
   {
     BubbleCaller tmp = {.threadid = i, .nthreads = num_callers,
                         .haploid_seen = ctx_calloc(1+prefs.num_haploid, sizeof(bool)),
-                        .num_bubbles_ptr = num_bubbles_ptr,
                         .prefs = prefs,
-                        .db_graph = db_graph, .gzout = gzout,
-                        .out_lock = out_lock};
+                        .db_graph = db_graph, .output = output};
   
     memcpy(&callers[i], &tmp, sizeof(BubbleCaller));
 
@@ -80,17 +73,14 @@ void bubble_callers_destroy(BubbleCaller *callers, size_t num_callers)
     cache_stepptr_buf_dealloc(&callers[i].spp_reverse);
     strbuf_dealloc(&callers[i].output_buf);
   }
-  pthread_mutex_destroy(callers[0].out_lock);
-  ctx_free(callers[0].out_lock);
-  ctx_free(callers[0].num_bubbles_ptr);
   ctx_free(callers);
 }
 
 
-static void bubble_caller_print_header(gzFile gzout, const char* out_path,
+static void bubble_caller_print_header(StrBuf *sbuf, const char* out_path,
                                        const dBGraph *db_graph)
 {
-  caller_gzprint_header(gzout, out_path, "CtxBubblesv0.1", db_graph);
+  caller_print_header(sbuf, out_path, "CtxBubblesv0.1", db_graph);
 }
 
 static void branch_to_str(const dBNode *nodes, size_t len, bool print_first_kmer,
@@ -176,7 +166,7 @@ static void print_bubble(BubbleCaller *caller,
   // Print Bubble
   //
 
-  // write to string buffer then flush to gzFile
+  // write to string buffer then pass to output
   StrBuf *sbuf = &caller->output_buf;
   strbuf_reset(sbuf);
 
@@ -184,8 +174,8 @@ static void print_bubble(BubbleCaller *caller,
   dBNodeBuffer *pathbuf = &caller->pathbuf;
   db_node_buf_reset(pathbuf);
 
-  // Get bubble number (threadsafe num_bubbles_ptr++)
-  size_t id = __sync_fetch_and_add((volatile size_t*)caller->num_bubbles_ptr, 1);
+  // Get bubble number (threadsafe)
+  size_t id = caller_output_callid(caller->output, caller->threadid);
 
   // 5p flank
   strbuf_sprintf(sbuf, ">bubble.%zu.5pflank kmers=%zu\n", id, flank5p->len);
@@ -212,10 +202,8 @@ static void print_bubble(BubbleCaller *caller,
 
   ctx_assert(strlen(sbuf->buff) == sbuf->len);
 
-  // lock, print, unlock
-  pthread_mutex_lock(caller->out_lock);
-  gzputs(caller->gzout, sbuf->buff);
-  pthread_mutex_unlock(caller->out_lock);
+  // Buffered and compressed without locking
+  caller_output_write(caller->output, caller->threadid, sbuf);
 }
 
 // `fork_node` is a node with outdegree > 1
@@ -237,16 +225,15 @@ void find_bubbles(BubbleCaller *caller, dBNode fork_node)
   size_t i, num_next, num_edges_in_col;
   BinaryKmer fork_bkmer = db_node_get_bkmer(db_graph, fork_node.key);
 
-  num_next = db_graph_next_nodes(db_graph, fork_bkmer, fork_node.orient,
-                                 db_node_edges(db_graph, fork_node.key, 0),
-                                 nodes, bases);
+  num_next = db_graph_next_nodes2(db_graph, fork_node.key, fork_bkmer,
+                                  fork_node.orient,
+                                  db_node_edges(db_graph, fork_node.key, 0),
+                                  nodes, bases);
 
   // loop over alleles, then colours
   Colour colour, colours_loaded = db_graph->num_of_cols;
   bool node_has_col[4];
 
-  uint32_t pathid;
-
   for(colour = 0; colour < colours_loaded; colour++)
   {
     if(!db_node_has_col(db_graph, fork_node.key, colour)) continue;
@@ -265,11 +252,11 @@ void find_bubbles(BubbleCaller *caller, dBNode fork_node)
         graph_walker_init(wlk, db_graph, colour, colour, fork_node);
         graph_walker_force(wlk, nodes[i].key, bases[i], num_edges_in_col > 1);
 
-        pathid = graph_crawler_load_path_limit(cache, nodes[i], wlk, rptwlk,
-                                               caller->prefs.max_allele_len);
+        graph_crawler_load_path_limit(cache, nodes[i], wlk, rptwlk,
+                                      caller->prefs.max_allele_len);
 
         graph_walker_finish(wlk);
-        graph_crawler_reset_rpt_walker(rptwlk, cache, pathid);
+        rpt_walker_clear(rptwlk);
       }
     }
   }
@@ -368,7 +355,7 @@ void bubble_caller(void *args)
 }
 
 void invoke_bubble_caller(size_t num_of_threads, BubbleCallingPrefs prefs,
-                          gzFile gzout, const char *out_path,
+                          FILE *fout, const char *out_path, bool sorted,
                           const dBGraph *db_graph)
 {
   ctx_assert(db_graph->num_edge_cols == 1);
@@ -377,17 +364,24 @@ void invoke_bubble_caller(size_t num_of_threads, BubbleCallingPrefs prefs,
   status("Calling bubbles with %zu threads, output: %s", num_of_threads, out_path);
 
   // Print header
-  bubble_caller_print_header(gzout, out_path, db_graph);
+  StrBuf hdr;
+  strbuf_alloc(&hdr, 1024);
+  bubble_caller_print_header(&hdr, out_path, db_graph);
+
+  CallerOutput output;
+  caller_output_open(&output, fout, futil_outpath_str(out_path), ">bubble.",
+                     num_of_threads, sorted, &hdr);
+  strbuf_dealloc(&hdr);
 
   BubbleCaller *callers = bubble_callers_new(num_of_threads, prefs,
-                                             gzout, db_graph);
+                                             &output, db_graph);
 
   // Run
   util_run_threads(callers, num_of_threads, sizeof(callers[0]),
                    num_of_threads, bubble_caller);
 
   // Report number of bubble called+printed
-  size_t num_of_bubbles = callers[0].num_bubbles_ptr[0];
+  size_t num_of_bubbles = caller_output_close(&output);
   char num_bubbles_str[100];
   ulong_to_str(num_of_bubbles, num_bubbles_str);
   status("%s bubbles called with Paths-Bubble-Caller\n", num_bubbles_str);
@@ -6,6 +6,7 @@
 #include "graph_walker.h"
 #include "repeat_walker.h"
 #include "cmd.h"
+#include "caller_output.h"
 
 typedef struct
 {
@@ -36,16 +37,14 @@ typedef struct
   StrBuf output_buf;
 
   // Shared data
-  size_t *num_bubbles_ptr; // statistics - shared pointer
   const BubbleCallingPrefs prefs;
   const dBGraph *db_graph;
-  gzFile gzout;
-  pthread_mutex_t *const out_lock;
+  CallerOutput *output;
 } BubbleCaller;
 
 BubbleCaller* bubble_callers_new(size_t num_callers,
                                  BubbleCallingPrefs prefs,
-                                 gzFile gzout,
+                                 CallerOutput *output,
                                  const dBGraph *db_graph);
 
 void bubble_callers_destroy(BubbleCaller *callers, size_t num_callers);
@@ -57,8 +56,9 @@ void find_bubbles(BubbleCaller *caller, dBNode fork_node);
 // or caller->spp_reverse (if they traverse the snode in reverse)
 void find_bubbles_ending_with(BubbleCaller *caller, GCacheSnode *snode);
 
+// If `sorted` is true, calls are sorted by seed kmer (reproducible output)
 void invoke_bubble_caller(size_t num_of_threads, BubbleCallingPrefs prefs,
-                          gzFile gzout, const char *out_path,
+                          FILE *fout, const char *out_path, bool sorted,
                           const dBGraph *db_graph);
 
 #endif /* BUBBLE_CALLER_H_ */
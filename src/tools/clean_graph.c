@@ -5,51 +5,76 @@
 #include "prune_nodes.h"
 #include "clean_graph.h"
 
-#define DUMP_COVG_ARRSIZE 1000
-#define DUMP_LEN_ARRSIZE 1000
-
 // Define a vector of Covg
 #include "objbuf_macro.h"
 create_objbuf(covg_buf,CovgBuffer,Covg);
+create_objbuf(hkey_buf,HKeyBuffer,hkey_t);
 
+// A supernode to be removed: first node and number of kmers
+typedef struct
+{
+  dBNode first;
+  size_t len;
+} RemovedSnode;
+
+create_objbuf(rmv_snode_buf,RemovedSnodeBuffer,RemovedSnode);
 
 typedef struct
 {
-  const size_t nthreads, covg_threshold, min_keep_tip;
-  CovgBuffer *cbufs;
-  // uint64_t *covg_hist;
+  dBNodeBuffer nbuf;
+  CovgBuffer cbuf;
+  HKeyBuffer frontier, claimed, candidates;
+  RemovedSnodeBuffer removed;
+} CleanerThread;
+
+//
+// Cleaning works in rounds. The first round visits every supernode, filling
+// histograms and flagging supernodes to remove. Nodes next to removed
+// supernodes are the frontier. Only supernodes at the frontier can change
+// (new tips, merged supernodes), so once flagged supernodes are pruned, only
+// those are re-checked in the next round. Repeat until nothing is removed.
+//
+typedef struct
+{
+  const size_t nthreads, min_keep_tip;
+  size_t covg_threshold; // CLEANING_THRESH_AUTO until estimated
+  size_t defer_limit; // auto threshold: defer supernodes with covg below this
+  bool first_pass;
+  CleanerThread *threads;
   uint64_t *covg_hist_init, *covg_hist_cleaned;
   uint64_t *covg_kmers_hist_init, *covg_kmers_hist_cleaned;
   uint64_t *len_hist_init, *len_hist_cleaned;
   const size_t covg_arrlen, len_arrlen;
-  uint8_t *keep_flags;
+  uint8_t *visited, *rmv_flags;
+  HKeyBuffer frontier, recheck; // nodes merged from all threads
+  RemovedSnodeBuffer removed;
   uint64_t num_tip_kmers, num_low_covg_snode_kmers, num_tip_and_low_snode_kmers;
-  const dBGraph *db_graph;
+  dBGraph *db_graph;
 } SupernodeCleaner;
 
-// #define supernode_covg(covgs,len) supernode_covg_mean(covgs,len)
-#define supernode_covg(covgs,len) supernode_read_starts(covgs,len)
+// Mean kmer coverage, summed over colours
+double cleaning_kmer_depth(const dBGraph *db_graph)
+{
+  ctx_assert(db_graph->ht.num_kmers > 0);
+  uint64_t i, covg_sum = 0;
+  uint64_t capacity = db_graph->ht.capacity * db_graph->num_of_cols;
+  for(i = 0; i < capacity; i++) covg_sum += db_graph->col_covgs[i];
+  return (double)covg_sum / db_graph->ht.num_kmers;
+}
 
 // Calculate cleaning threshold for supernodes from a given distribution
 // of supernode coverages
 size_t cleaning_supernode_threshold(const uint64_t *covgs, size_t len,
-                                    double seq_depth,
-                                    const dBGraph *db_graph)
+                                    double seq_depth, double kmer_depth)
 {
   ctx_assert(len > 5);
-  ctx_assert(db_graph->ht.num_kmers > 0);
 
   size_t i, d1len = len-2, d2len = len-3, f1, f2;
   double *tmp = ctx_malloc((d1len+d2len) * sizeof(double));
   double *delta1 = tmp, *delta2 = tmp + d1len;
 
-  // Get sequencing depth from coverage
-  uint64_t covg_sum = 0, capacity = db_graph->ht.capacity * db_graph->num_of_cols;
-  for(i = 0; i < capacity; i++) covg_sum += db_graph->col_covgs[i];
-  double seq_depth_est = (double)covg_sum / db_graph->ht.num_kmers;
-
-  status("[cleaning] Kmer depth before cleaning supernodes: %.2f", seq_depth_est);
-  if(seq_depth <= 0) seq_depth = seq_depth_est;
+  status("[cleaning] Kmer depth before cleaning supernodes: %.2f", kmer_depth);
+  if(seq_depth <= 0) seq_depth = kmer_depth;
   else status("[cleaning] Using sequence depth argument: %f", seq_depth);
 
   size_t fallback_thresh = (size_t)MAX2(1, (seq_depth+1)/2);
@@ -82,6 +107,14 @@ size_t cleaning_supernode_threshold(const uint64_t *covgs, size_t len,
   { status("[cleaning]   (using fallback1)"); return fallback_thresh+1; }
 }
 
+// Highest threshold cleaning_supernode_threshold() can pick, unless it uses f2
+size_t cleaning_threshold_bound(double seq_depth, double kmer_depth)
+{
+  if(seq_depth <= 0) seq_depth = kmer_depth;
+  size_t fallback_thresh = (size_t)MAX2(1, (seq_depth+1)/2);
+  return MAX2((size_t)(seq_depth*0.75)+1, fallback_thresh+1);
+}
+
 // Get coverages from nodes in nbuf, store in cbuf
 static inline void fetch_coverages(const dBNodeBuffer *nbuf, CovgBuffer *cbuf,
                                    const dBGraph *db_graph)
@@ -114,13 +147,19 @@ static inline bool nodes_are_removable_tip(const dBNodeBuffer *nbuf,
 
 static void supernode_cleaner_alloc(SupernodeCleaner *cl, size_t nthreads,
                                     size_t covg_threshold, size_t min_keep_tip,
-                                    uint8_t *keep_flags,
-                                    const dBGraph *db_graph)
+                                    uint8_t *visited, uint8_t *rmv_flags,
+                                    dBGraph *db_graph)
 {
   size_t i;
-  CovgBuffer *cbufs = ctx_calloc(nthreads, sizeof(CovgBuffer));
-  for(i = 0; i < nthreads; i++)
-    covg_buf_alloc(&cbufs[i], 1024);
+  CleanerThread *threads = ctx_calloc(nthreads, sizeof(CleanerThread));
+  for(i = 0; i < nthreads; i++) {
+    db_node_buf_alloc(&threads[i].nbuf, 1024);
+    covg_buf_alloc(&threads[i].cbuf, 1024);
+    hkey_buf_alloc(&threads[i].frontier, 256);
+    hkey_buf_alloc(&threads[i].claimed, 256);
+    hkey_buf_alloc(&threads[i].candidates, 256);
+    rmv_snode_buf_alloc(&threads[i].removed, 256);
+  }
 
   uint64_t *covg_hist_init, *covg_hist_cleaned;
   uint64_t *covg_kmers_hist_init, *covg_kmers_hist_cleaned;
@@ -135,8 +174,10 @@ static void supernode_cleaner_alloc(SupernodeCleaner *cl, size_t nthreads,
 
   SupernodeCleaner tmp = {.nthreads = nthreads,
                           .covg_threshold = covg_threshold,
+                          .defer_limit = 0,
                           .min_keep_tip = min_keep_tip,
-                          .cbufs = cbufs,
+                          .first_pass = true,
+                          .threads = threads,
                           .covg_hist_init    = covg_hist_init,
                           .covg_hist_cleaned = covg_hist_cleaned,
                           .covg_kmers_hist_init = covg_kmers_hist_init,
@@ -145,47 +186,78 @@ static void supernode_cleaner_alloc(SupernodeCleaner *cl, size_t nthreads,
                           .len_hist_cleaned  = len_hist_cleaned,
                           .covg_arrlen = DUMP_COVG_ARRSIZE,
                           .len_arrlen = DUMP_LEN_ARRSIZE,
-                          .keep_flags = keep_flags,
+                          .visited = visited,
+                          .rmv_flags = rmv_flags,
                           .num_tip_kmers = 0,
                           .num_low_covg_snode_kmers = 0,
                           .num_tip_and_low_snode_kmers = 0,
                           .db_graph = db_graph};
 
   memcpy(cl, &tmp, sizeof(SupernodeCleaner));
+
+  hkey_buf_alloc(&cl->frontier, 1024);
+  hkey_buf_alloc(&cl->recheck, 1024);
+  rmv_snode_buf_alloc(&cl->removed, 1024);
 }
 
 static void supernode_cleaner_dealloc(SupernodeCleaner *cl)
 {
   size_t i;
-  for(i = 0; i < cl->nthreads; i++)
-    covg_buf_dealloc(&cl->cbufs[i]);
-  ctx_free(cl->cbufs);
+  for(i = 0; i < cl->nthreads; i++) {
+    db_node_buf_dealloc(&cl->threads[i].nbuf);
+    covg_buf_dealloc(&cl->threads[i].cbuf);
+    hkey_buf_dealloc(&cl->threads[i].frontier);
+    hkey_buf_dealloc(&cl->threads[i].claimed);
+    hkey_buf_dealloc(&cl->threads[i].candidates);
+    rmv_snode_buf_dealloc(&cl->threads[i].removed);
+  }
+  ctx_free(cl->threads);
   ctx_free(cl->covg_hist_init);
   ctx_free(cl->covg_hist_cleaned);
   ctx_free(cl->covg_kmers_hist_init);
   ctx_free(cl->covg_kmers_hist_cleaned);
   ctx_free(cl->len_hist_init);
   ctx_free(cl->len_hist_cleaned);
+  hkey_buf_dealloc(&cl->frontier);
+  hkey_buf_dealloc(&cl->recheck);
+  rmv_snode_buf_dealloc(&cl->removed);
   memset(cl, 0, sizeof(SupernodeCleaner));
 }
 
+// Add a supernode to the initial histograms
+static inline void hist_add_init(SupernodeCleaner *cl, size_t covg, size_t len)
+{
+  size_t cidx = MIN2(covg, cl->covg_arrlen-1);
+  size_t lidx = MIN2(len, cl->len_arrlen-1);
+  __sync_fetch_and_add((volatile uint64_t *)&cl->covg_hist_init[cidx], 1);
+  __sync_fetch_and_add((volatile uint64_t *)&cl->covg_kmers_hist_init[cidx], len);
+  __sync_fetch_and_add((volatile uint64_t *)&cl->len_hist_init[lidx], 1);
+}
+
+// Add a kept supernode to, or take it off, the cleaned histograms
+static inline void hist_update_cleaned(SupernodeCleaner *cl,
+                                       size_t covg, size_t len, bool add)
+{
+  size_t cidx = MIN2(covg, cl->covg_arrlen-1);
+  size_t lidx = MIN2(len, cl->len_arrlen-1);
+  if(add) {
+    __sync_fetch_and_add((volatile uint64_t *)&cl->covg_hist_cleaned[cidx], 1);
+    __sync_fetch_and_add((volatile uint64_t *)&cl->covg_kmers_hist_cleaned[cidx], len);
+    __sync_fetch_and_add((volatile uint64_t *)&cl->len_hist_cleaned[lidx], 1);
+  } else {
+    __sync_fetch_and_sub((volatile uint64_t *)&cl->covg_hist_cleaned[cidx], 1);
+    __sync_fetch_and_sub((volatile uint64_t *)&cl->covg_kmers_hist_cleaned[cidx], len);
+    __sync_fetch_and_sub((volatile uint64_t *)&cl->len_hist_cleaned[lidx], 1);
+  }
+}
+
 static inline void supernode_get_covg(const dBNodeBuffer *nbuf, size_t threadid,
                                       void *arg)
 {
-  const SupernodeCleaner *cl = (const SupernodeCleaner*)arg;
-  size_t covg, len;
-
-  // Get coverage
-  CovgBuffer *cbuf = &cl->cbufs[threadid];
+  SupernodeCleaner *cl = (SupernodeCleaner*)arg;
+  CovgBuffer *cbuf = &cl->threads[threadid].cbuf;
   fetch_coverages(nbuf, cbuf, cl->db_graph);
-  covg = supernode_covg(cbuf->data, cbuf->len);
-  covg = MIN2(covg, cl->covg_arrlen-1);
-  len = MIN2(cbuf->len, cl->len_arrlen-1);
-
-  // Add to histograms
-  __sync_fetch_and_add((volatile uint64_t *)&cl->covg_hist_init[covg], 1);
-  __sync_fetch_and_add((volatile uint64_t *)&cl->covg_kmers_hist_init[covg], cbuf->len);
-  __sync_fetch_and_add((volatile uint64_t *)&cl->len_hist_init[len], 1);
+  hist_add_init(cl, supernode_covg(cbuf->data, cbuf->len), nbuf->len);
 }
 
 // Get coverage threshold for removing supernodes
@@ -204,7 +276,7 @@ Covg cleaning_get_threshold(size_t num_threads, double seq_depth,
 
   // Get supernode coverages and lengths
   SupernodeCleaner cl;
-  supernode_cleaner_alloc(&cl, num_threads, 0, 0, NULL, db_graph);
+  supernode_cleaner_alloc(&cl, num_threads, 0, 0, visited, NULL, db_graph);
 
   supernodes_iterate(num_threads, visited, db_graph, supernode_get_covg, &cl);
 
@@ -222,10 +294,10 @@ Covg cleaning_get_threshold(size_t num_threads, double seq_depth,
   }
 
   // set threshold using histogram and genome size
+  double kmer_depth = cleaning_kmer_depth(db_graph);
   size_t threshold_est = cleaning_supernode_threshold(cl.covg_hist_init,
                                                       cl.covg_arrlen,
-                                                      seq_depth,
-                                                      db_graph);
+                                                      seq_depth, kmer_depth);
 
   status("[cleaning] Recommended supernode cleaning threshold: < %zu",
          threshold_est);
@@ -235,21 +307,59 @@ Covg cleaning_get_threshold(size_t num_threads, double seq_depth,
   return threshold_est;
 }
 
-static inline void supernode_mark(const dBNodeBuffer *nbuf, size_t threadid,
-                                  void *arg)
+// Add nodes adjacent to either end of a supernode to the frontier
+static inline void supernode_add_neighbours(const dBNodeBuffer *nbuf,
+                                            HKeyBuffer *frontier,
+                                            const dBGraph *db_graph)
+{
+  dBNode ends[2] = {db_node_reverse(nbuf->data[0]), nbuf->data[nbuf->len-1]};
+  dBNode next_nodes[4];
+  Nucleotide next_nucs[4];
+  size_t i, j, n;
+
+  for(i = 0; i < 2; i++) {
+    n = db_graph_next_nodes(db_graph,
+                            db_node_get_bkmer(db_graph, ends[i].key),
+                            ends[i].orient,
+                            db_node_get_edges_union(db_graph, ends[i].key),
+                            next_nodes, next_nucs);
+    for(j = 0; j < n; j++) hkey_buf_add(frontier, next_nodes[j].key);
+  }
+}
+
+// Decide whether to keep a supernode
+// Kept supernodes are added to the cleaned histograms. Removed supernodes have
+// their kmers flagged and their neighbours added to the frontier.
+// In the first pass with an automatic threshold, the decision on supernodes
+// that are not tips, with coverage below cl->defer_limit, is deferred until
+// the coverage histogram is complete. Others are kept for now.
+static void supernode_mark(const dBNodeBuffer *nbuf, size_t threadid,
+                           void *arg)
 {
   SupernodeCleaner *cl = (SupernodeCleaner*)arg;
+  CleanerThread *thrd = &cl->threads[threadid];
   bool low_covg_snode = false, removable_tip = false;
-  size_t i, covg = 0, len = nbuf->len;
+  size_t i, covg = 0;
 
-  CovgBuffer *cbuf = &cl->cbufs[threadid];
+  CovgBuffer *cbuf = &thrd->cbuf;
   fetch_coverages(nbuf, cbuf, cl->db_graph);
   covg = supernode_covg(cbuf->data, cbuf->len);
-  low_covg_snode = (covg < cl->covg_threshold);
+
+  if(cl->first_pass) hist_add_init(cl, covg, nbuf->len);
 
   // Remove tips
   removable_tip = nodes_are_removable_tip(nbuf, cl->min_keep_tip, cl->db_graph);
 
+  if(cl->covg_threshold == CLEANING_THRESH_AUTO) {
+    // Supernodes with coverage too high to be removed by the threshold we
+    // expect to pick are kept now
+    if(!removable_tip && covg < cl->defer_limit) {
+      hkey_buf_add(&thrd->candidates, nbuf->data[0].key);
+      return;
+    }
+  }
+  else low_covg_snode = (covg < cl->covg_threshold);
+
   if(low_covg_snode && removable_tip)
     __sync_fetch_and_add((volatile uint64_t *)&cl->num_tip_and_low_snode_kmers, nbuf->len);
   else if(low_covg_snode)
@@ -257,53 +367,354 @@ static inline void supernode_mark(const dBNodeBuffer *nbuf, size_t threadid,
   else if(removable_tip)
     __sync_fetch_and_add((volatile uint64_t *)&cl->num_tip_kmers, nbuf->len);
   else {
-    for(i = 0; i < nbuf->len; i ++)
-      bitset_set_mt(cl->keep_flags, nbuf->data[i].key);
+    hist_update_cleaned(cl, covg, nbuf->len, true);
+    return;
+  }
+
+  for(i = 0; i < nbuf->len; i++)
+    bitset_set_mt(cl->rmv_flags, nbuf->data[i].key);
+
+  RemovedSnode rmv = {.first = nbuf->data[0], .len = nbuf->len};
+  rmv_snode_buf_add(&thrd->removed, rmv);
+  supernode_add_neighbours(nbuf, &thrd->frontier, cl->db_graph);
+}
+
+// Find the supernode of a node, then claim it by its lowest end hkey, so that
+// each supernode is only dealt with once per round.
+// Returns NULL if another thread already has it.
+static inline const dBNodeBuffer* supernode_claim(SupernodeCleaner *cl,
+                                                  size_t threadid, hkey_t hkey)
+{
+  CleanerThread *thrd = &cl->threads[threadid];
+  dBNodeBuffer *nbuf = &thrd->nbuf;
+  bool got_lock = false;
+
+  db_node_buf_reset(nbuf);
+  supernode_find(hkey, nbuf, cl->db_graph);
+
+  hkey_t node0 = MIN2(nbuf->data[0].key, nbuf->data[nbuf->len-1].key);
+  bitlock_try_acquire(cl->visited, node0, &got_lock);
+  if(!got_lock) return NULL;
+
+  hkey_buf_add(&thrd->claimed, node0);
+  return nbuf;
+}
 
-    // Add to histograms
-    covg = MIN2(covg, cl->covg_arrlen-1);
-    len = MIN2(nbuf->len, cl->covg_arrlen-1);
+// Take a kept supernode off the cleaned histograms and queue it for
+// re-checking after pruning
+static inline void frontier_claim_snode(SupernodeCleaner *cl, size_t threadid,
+                                        hkey_t hkey)
+{
+  const dBNodeBuffer *nbuf = supernode_claim(cl, threadid, hkey);
+  if(nbuf != NULL) {
+    CovgBuffer *cbuf = &cl->threads[threadid].cbuf;
+    fetch_coverages(nbuf, cbuf, cl->db_graph);
+    hist_update_cleaned(cl, supernode_covg(cbuf->data, cbuf->len),
+                        nbuf->len, false);
+  }
+}
 
-    __sync_fetch_and_add((volatile uint64_t *)&cl->covg_hist_cleaned[covg], 1);
-    __sync_fetch_and_add((volatile uint64_t *)&cl->covg_kmers_hist_cleaned[covg], cbuf->len);
-    __sync_fetch_and_add((volatile uint64_t *)&cl->len_hist_cleaned[len], 1);
+// A kept node next to a removed supernode may become a tip or join up with its
+// remaining neighbours, so its supernode and theirs need re-checking.
+// Must be called before the graph is pruned.
+static void frontier_claim(size_t idx, size_t threadid, SupernodeCleaner *cl)
+{
+  const dBGraph *db_graph = cl->db_graph;
+  hkey_t hkey = cl->frontier.data[idx];
+  dBNode next_nodes[4];
+  Nucleotide next_nucs[4];
+  Orientation orient;
+  size_t i, n;
+
+  if(bitset_get(cl->rmv_flags, hkey)) return;
+
+  frontier_claim_snode(cl, threadid, hkey);
+
+  for(orient = 0; orient < 2; orient++) {
+    n = db_graph_next_nodes(db_graph, db_node_get_bkmer(db_graph, hkey), orient,
+                            db_node_get_edges_union(db_graph, hkey),
+                            next_nodes, next_nucs);
+    for(i = 0; i < n; i++) {
+      if(!bitset_get(cl->rmv_flags, next_nodes[i].key))
+        frontier_claim_snode(cl, threadid, next_nodes[i].key);
+    }
+  }
+}
+
+// Remove edges from a kept frontier node to removed nodes
+static void frontier_trim(size_t idx, size_t threadid, SupernodeCleaner *cl)
+{
+  (void)threadid;
+  hkey_t hkey = cl->frontier.data[idx];
+  if(!bitset_get(cl->rmv_flags, hkey))
+    prune_edges_to_flagged_nodes(cl->db_graph, hkey, cl->rmv_flags);
+}
+
+// Remove the nodes of a flagged supernode. We walk a fixed number of nodes
+// since edges into the supernode may already have been trimmed, which would
+// let supernode_find() run on into a kept supernode.
+// The hash table kmer count is updated by the caller.
+static void supernode_prune(size_t idx, size_t threadid, SupernodeCleaner *cl)
+{
+  (void)threadid;
+  dBGraph *db_graph = cl->db_graph;
+  const RemovedSnode *rmv = &cl->removed.data[idx];
+  dBNode node = rmv->first;
+  BinaryKmer bkmer;
+  Edges edges;
+  Nucleotide nuc;
+  size_t i;
+
+  for(i = 0; ; i++)
+  {
+    bkmer = db_node_get_bkmer(db_graph, node.key);
+    edges = db_node_get_edges_union(db_graph, node.key);
+    prune_node_without_edges_nocount(db_graph, node.key);
+
+    if(i+1 == rmv->len) break;
+
+    if(!edges_has_precisely_one_edge(edges, node.orient, &nuc))
+      die("Supernode changed whilst being removed");
+
+    node = db_graph_next_node(db_graph, bkmer, nuc, node.orient);
+  }
+}
+
+// Evaluate a supernode that has changed since it was last checked
+static void supernode_recheck(size_t idx, size_t threadid, SupernodeCleaner *cl)
+{
+  const dBNodeBuffer *nbuf = supernode_claim(cl, threadid, cl->recheck.data[idx]);
+  if(nbuf != NULL) supernode_mark(nbuf, threadid, cl);
+}
+
+// The threshold was higher than cl->defer_limit, so supernodes with coverage
+// between the two were kept in the first pass. Take them back off the cleaned
+// histograms and remove them.
+static void supernode_mark_late(const dBNodeBuffer *nbuf, size_t threadid,
+                                void *arg)
+{
+  SupernodeCleaner *cl = (SupernodeCleaner*)arg;
+  CovgBuffer *cbuf = &cl->threads[threadid].cbuf;
+  size_t covg;
+
+  // Removed as a tip
+  if(bitset_get(cl->rmv_flags, nbuf->data[0].key)) return;
+
+  fetch_coverages(nbuf, cbuf, cl->db_graph);
+  covg = supernode_covg(cbuf->data, cbuf->len);
+
+  if(covg >= cl->defer_limit && covg < cl->covg_threshold) {
+    hist_update_cleaned(cl, covg, nbuf->len, false);
+    supernode_mark(nbuf, threadid, cl);
+  }
+}
+
+// Decide on supernodes deferred until we had a threshold
+static void supernode_decide(size_t idx, size_t threadid, SupernodeCleaner *cl)
+{
+  dBNodeBuffer *nbuf = &cl->threads[threadid].nbuf;
+  db_node_buf_reset(nbuf);
+  supernode_find(cl->recheck.data[idx], nbuf, cl->db_graph);
+  supernode_mark(nbuf, threadid, cl);
+}
+
+typedef struct
+{
+  const size_t threadid, nthreads, n;
+  SupernodeCleaner *cl;
+  void (*func)(size_t idx, size_t threadid, SupernodeCleaner *cl);
+} CleanerWorker;
+
+static void cleaner_worker(void *arg)
+{
+  const CleanerWorker *wrkr = (const CleanerWorker*)arg;
+  size_t i, start, end;
+  start = (wrkr->n * wrkr->threadid) / wrkr->nthreads;
+  end = (wrkr->n * (wrkr->threadid+1)) / wrkr->nthreads;
+  for(i = start; i < end; i++) wrkr->func(i, wrkr->threadid, wrkr->cl);
+}
+
+// Call func for each of idx = 0..n-1 with n split between threads
+static void cleaner_run(SupernodeCleaner *cl, size_t n,
+                        void (*func)(size_t idx, size_t threadid,
+                                     SupernodeCleaner *cl))
+{
+  if(n == 0) return;
+
+  size_t i, nthreads = MIN2(cl->nthreads, n);
+  CleanerWorker *wrkrs = ctx_calloc(nthreads, sizeof(CleanerWorker));
+
+  for(i = 0; i < nthreads; i++) {
+    CleanerWorker tmp = {.threadid = i, .nthreads = nthreads, .n = n,
+                         .cl = cl, .func = func};
+    memcpy(&wrkrs[i], &tmp, sizeof(CleanerWorker));
+  }
+
+  util_run_threads(wrkrs, nthreads, sizeof(CleanerWorker),
+                   nthreads, cleaner_worker);
+
+  ctx_free(wrkrs);
+}
+
+// Move the frontier and removed supernodes of all threads into `cl`
+// Returns number of supernodes to remove
+static size_t cleaner_gather_removed(SupernodeCleaner *cl)
+{
+  size_t i;
+  hkey_buf_reset(&cl->frontier);
+  rmv_snode_buf_reset(&cl->removed);
+  for(i = 0; i < cl->nthreads; i++) {
+    CleanerThread *thrd = &cl->threads[i];
+    hkey_buf_append(&cl->frontier, thrd->frontier.data, thrd->frontier.len);
+    rmv_snode_buf_append(&cl->removed, thrd->removed.data, thrd->removed.len);
+    hkey_buf_reset(&thrd->frontier);
+    rmv_snode_buf_reset(&thrd->removed);
+  }
+  return cl->removed.len;
+}
+
+// Release claims on supernodes, optionally keeping them to recheck
+static void cleaner_release_claims(SupernodeCleaner *cl, HKeyBuffer *keep)
+{
+  size_t i, j;
+  if(keep) hkey_buf_reset(keep);
+  for(i = 0; i < cl->nthreads; i++) {
+    HKeyBuffer *claimed = &cl->threads[i].claimed;
+    for(j = 0; j < claimed->len; j++) bitset_del(cl->visited, claimed->data[j]);
+    if(keep) hkey_buf_append(keep, claimed->data, claimed->len);
+    hkey_buf_reset(claimed);
   }
 }
 
 // Remove low coverage supernodes and clip tips
 // - Remove supernodes with coverage < `covg_threshold`
 // - Remove tips shorter than `min_keep_tip`
-// `visited`, `keep` should each be at least db_graph.ht.capcity bits long
-//   and initialised to zero. On return,
-//   `visited` will be 1 at each original kmer index
-//   `keep` will be 1 at each retained kmer index
-void clean_graph(size_t num_threads, size_t covg_threshold, size_t min_keep_tip,
-                 const char *covgs_csv_path, const char *lens_csv_path,
-                 uint8_t *visited, uint8_t *keep, dBGraph *db_graph)
+// `visited`, `flags` should each be at least db_graph.ht.capcity bits long
+//   and initialised to zero. They are zero again on return.
+// Returns the coverage threshold used
+Covg clean_graph(size_t num_threads, Covg covg_threshold, double seq_depth,
+                 size_t min_keep_tip,
+                 const char *covgs_before_csv, const char *lens_before_csv,
+                 const char *covgs_after_csv, const char *lens_after_csv,
+                 uint8_t *visited, uint8_t *flags, dBGraph *db_graph)
 {
   ctx_assert(db_graph->num_of_cols == 1);
   ctx_assert(db_graph->num_edge_cols > 0);
 
-  size_t init_nkmers = db_graph->ht.num_kmers;
+  size_t i, init_nkmers = db_graph->ht.num_kmers;
 
-  if(db_graph->ht.num_kmers == 0) return;
+  if(db_graph->ht.num_kmers == 0) return covg_threshold;
   if(covg_threshold == 0 && min_keep_tip == 0) {
     warn("[cleaning] No cleaning specified");
-    return;
+    return covg_threshold;
   }
 
-  if(covg_threshold > 0)
-    status("[cleaning] Removing supernodes with coverage < %zu...", covg_threshold);
+  if(covg_threshold == CLEANING_THRESH_AUTO)
+    status("[cleaning] Removing supernodes with auto-detected threshold...");
+  else if(covg_threshold > 0)
+    status("[cleaning] Removing supernodes with coverage < %zu...",
+           (size_t)covg_threshold);
   if(min_keep_tip > 0)
     status("[cleaning] Removing tips shorter than %zu...", min_keep_tip);
 
   status("[cleaning]   using %zu threads", num_threads);
 
-  // Mark nodes to keep
+  // Mark nodes to remove
   SupernodeCleaner cl;
   supernode_cleaner_alloc(&cl, num_threads, covg_threshold, min_keep_tip,
-                          keep, db_graph);
+                          visited, flags, db_graph);
+
+  double kmer_depth = cleaning_kmer_depth(db_graph);
+
+  // With an auto threshold, only supernodes that are likely to fall below it
+  // are remembered until it is known
+  if(covg_threshold == CLEANING_THRESH_AUTO) {
+    cl.defer_limit = cleaning_threshold_bound(seq_depth, kmer_depth);
+    if(cl.defer_limit > cl.covg_arrlen-1) {
+      status("[cleaning] Deferring supernodes with coverage < %zu (capped from %zu)",
+             cl.covg_arrlen-1, cl.defer_limit);
+      cl.defer_limit = cl.covg_arrlen-1;
+    }
+    else status("[cleaning] Deferring supernodes with coverage < %zu",
+                cl.defer_limit);
+  }
+
   supernodes_iterate(num_threads, visited, db_graph, supernode_mark, &cl);
+  memset(visited, 0, roundup_bits2bytes(db_graph->ht.capacity));
+  cl.first_pass = false;
+
+  if(covgs_before_csv != NULL) {
+    cleaning_write_covg_histogram(covgs_before_csv, cl.covg_hist_init,
+                                  cl.covg_kmers_hist_init, cl.covg_arrlen);
+  }
+
+  if(lens_before_csv != NULL) {
+    cleaning_write_len_histogram(lens_before_csv, cl.len_hist_init,
+                                 cl.len_arrlen, db_graph->kmer_size);
+  }
+
+  if(covg_threshold == CLEANING_THRESH_AUTO)
+  {
+    covg_threshold = cleaning_supernode_threshold(cl.covg_hist_init,
+                                                  cl.covg_arrlen, seq_depth,
+                                                  kmer_depth);
+
+    status("[cleaning] Recommended supernode cleaning threshold: < %zu",
+           (size_t)covg_threshold);
+
+    cl.covg_threshold = covg_threshold;
+
+    hkey_buf_reset(&cl.recheck);
+    for(i = 0; i < num_threads; i++) {
+      HKeyBuffer *cands = &cl.threads[i].candidates;
+      hkey_buf_append(&cl.recheck, cands->data, cands->len);
+      hkey_buf_dealloc(cands);
+      hkey_buf_alloc(cands, 256);
+    }
+
+    char ncands_str[50];
+    ulong_to_str(cl.recheck.len, ncands_str);
+    status("[cleaning] Deciding on %s deferred supernode%s", ncands_str,
+           util_plural_str(cl.recheck.len));
+
+    cleaner_run(&cl, cl.recheck.len, supernode_decide);
+
+    // Rare: threshold picked from the second derivative of the histogram is
+    // above the supernodes we deferred, so scan again
+    if(covg_threshold > cl.defer_limit) {
+      status("[cleaning] Threshold above deferred coverage (%zu), "
+             "re-scanning supernodes", cl.defer_limit);
+      supernodes_iterate(num_threads, visited, db_graph,
+                         supernode_mark_late, &cl);
+      memset(visited, 0, roundup_bits2bytes(db_graph->ht.capacity));
+    }
+  }
+
+  // Prune flagged supernodes, then re-check supernodes at the frontier until
+  // no more are removed
+  size_t round, nsnodes, nkmers;
+  char nsnodes_str[50], nrecheck_str[50];
+
+  for(round = 0; (nsnodes = cleaner_gather_removed(&cl)) > 0; round++)
+  {
+    cleaner_run(&cl, cl.frontier.len, frontier_claim);
+    cleaner_release_claims(&cl, &cl.recheck);
+
+    ulong_to_str(nsnodes, nsnodes_str);
+    ulong_to_str(cl.recheck.len, nrecheck_str);
+    status("[cleaning] Round %zu: removing %s supernode%s, re-checking %s",
+           round, nsnodes_str, util_plural_str(nsnodes), nrecheck_str);
+
+    cleaner_run(&cl, cl.frontier.len, frontier_trim);
+    cleaner_run(&cl, cl.removed.len, supernode_prune);
+
+    for(i = 0, nkmers = 0; i < cl.removed.len; i++)
+      nkmers += cl.removed.data[i].len;
+    db_graph->ht.num_kmers -= nkmers;
+
+    cleaner_run(&cl, cl.recheck.len, supernode_recheck);
+    cleaner_release_claims(&cl, NULL);
+  }
 
   // Print numbers of kmers that are being removed
   size_t n_lcovg_snodes = cl.num_low_covg_snode_kmers;
@@ -315,17 +726,13 @@ void clean_graph(size_t num_threads, size_t covg_threshold, size_t min_keep_tip,
   ulong_to_str(n_tips_snodes, tip_kmers_str);
   ulong_to_str(n_tips_lcovg_snodes, tip_snode_kmers_str);
 
-  status("[cleaning] Removing %s supernode kmer%s, %s tip kmer%s and %s of both",
+  status("[cleaning] Removed %s supernode kmer%s, %s tip kmer%s and %s of both",
          snode_kmers_str, util_plural_str(n_lcovg_snodes),
          tip_kmers_str, util_plural_str(n_tips_snodes),
          tip_snode_kmers_str);
 
-  // Remove nodes not marked to keep
-  prune_nodes_lacking_flag(num_threads, keep, db_graph);
-
   // Wipe memory
-  memset(visited, 0, roundup_bits2bytes(db_graph->ht.capacity));
-  memset(keep, 0, roundup_bits2bytes(db_graph->ht.capacity));
+  memset(flags, 0, roundup_bits2bytes(db_graph->ht.capacity));
 
   // Print status update
   char remain_nkmers_str[100], removed_nkmers_str[100];
@@ -337,17 +744,19 @@ void clean_graph(size_t num_threads, size_t covg_threshold, size_t min_keep_tip,
          remain_nkmers_str, removed_nkmers_str,
          (100.0*removed_nkmers)/init_nkmers);
 
-  if(covgs_csv_path != NULL) {
-    cleaning_write_covg_histogram(covgs_csv_path, cl.covg_hist_cleaned,
+  if(covgs_after_csv != NULL) {
+    cleaning_write_covg_histogram(covgs_after_csv, cl.covg_hist_cleaned,
                                   cl.covg_kmers_hist_cleaned, cl.covg_arrlen);
   }
 
-  if(lens_csv_path != NULL) {
-    cleaning_write_len_histogram(lens_csv_path, cl.len_hist_cleaned,
+  if(lens_after_csv != NULL) {
+    cleaning_write_len_histogram(lens_after_csv, cl.len_hist_cleaned,
                                  cl.len_arrlen, db_graph->kmer_size);
   }
 
   supernode_cleaner_dealloc(&cl);
+
+  return covg_threshold;
 }
 
 static FILE* _open_histogram_file(const char *path, const char *name)
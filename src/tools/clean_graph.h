@@ -2,6 +2,28 @@
 #define CLEAN_GRAPH_H_
 
 #include "db_graph.h"
+#include "supernode.h"
+
+// Length of coverage and length histograms
+#define DUMP_COVG_ARRSIZE 1000
+#define DUMP_LEN_ARRSIZE 1000
+
+// Coverage of a supernode given the coverages of its kmers
+// #define supernode_covg(covgs,len) supernode_covg_mean(covgs,len)
+#define supernode_covg(covgs,len) supernode_read_starts(covgs,len)
+
+// Mean kmer coverage, summed over colours
+double cleaning_kmer_depth(const dBGraph *db_graph);
+
+// Calculate cleaning threshold for supernodes from a histogram of supernode
+// coverages. `kmer_depth` is the mean kmer coverage, used as the sequencing
+// depth unless `seq_depth` > 0.
+size_t cleaning_supernode_threshold(const uint64_t *covgs, size_t len,
+                                    double seq_depth, double kmer_depth);
+
+// Highest threshold cleaning_supernode_threshold() can return for these depths,
+// unless it picks one from the second derivative of the histogram (f2)
+size_t cleaning_threshold_bound(double seq_depth, double kmer_depth);
 
 // Get coverage threshold for removing supernodes
 // If `min_keep_tip` is > 0, tips shorter than `min_keep_tip` are not used
@@ -16,17 +38,32 @@ Covg cleaning_get_threshold(size_t num_threads, double seq_depth,
                             const char *lens_csv_path,
                             uint8_t *visited, dBGraph *db_graph);
 
+// Pass as `covg_threshold` to clean_graph() to pick a threshold from the
+// supernode coverage histogram
+#define CLEANING_THRESH_AUTO UINT32_MAX
+
 // Remove low coverage supernodes and clip tips
-// - Remove supernodes with coverage < `covg_threshold`
+// - Remove supernodes with coverage < `covg_threshold` (none if 0)
 // - Remove tips shorter than `min_keep_tip`
-// `visited`, `keep` should each be at least db_graph.ht.capcity bits long
-//   and initialised to zero.
-// `covgs_csv_path` and `lens_csv_path` are paths to files to write CSV
-//   histogram of supernodes coverages and lengths AFTER CLEANING.
+// With CLEANING_THRESH_AUTO, the threshold is estimated (using `seq_depth` if
+// > 0) from the histogram gathered in the same pass as tips are marked.
+// Supernodes with coverage below the threshold expected from the sequencing
+// depth are remembered until the threshold is known. If the estimate is
+// higher than that, the supernodes are scanned a second time.
+// After one pass over all supernodes, only supernodes next to those removed
+// are re-checked, until no more are removed. So tips exposed by removing other
+// tips are also clipped.
+// `visited`, `flags` should each be at least db_graph.ht.capcity bits long
+//   and initialised to zero. They are zero again on return.
+// `covgs_*_csv` and `lens_*_csv` are paths to files to write CSV
+//   histogram of supernodes coverages and lengths before / after cleaning.
 //   If NULL these are ignored.
-void clean_graph(size_t num_threads, size_t covg_threshold, size_t min_keep_tip,
-                 const char *covgs_csv_path, const char *lens_csv_path,
-                 uint8_t *visited, uint8_t *keep, dBGraph *db_graph);
+// Returns the coverage threshold used
+Covg clean_graph(size_t num_threads, Covg covg_threshold, double seq_depth,
+                 size_t min_keep_tip,
+                 const char *covgs_before_csv, const char *lens_before_csv,
+                 const char *covgs_after_csv, const char *lens_after_csv,
+                 uint8_t *visited, uint8_t *flags, dBGraph *db_graph);
 
 void cleaning_write_covg_histogram(const char *path,
                                    const uint64_t *covg_hist,
@@ -0,0 +1,571 @@
+#include "global.h"
+#include "util.h"
+#include "supernode.h"
+#include "graph_info.h"
+#include "clean_graph.h"
+#include "clean_stream.h"
+
+#include "objbuf_macro.h"
+create_objbuf(covg_buf,CovgBuffer,Covg);
+create_objbuf(hkey_buf,HKeyBuffer,hkey_t);
+
+typedef struct
+{
+  dBNodeBuffer nbuf;
+  CovgBuffer cbuf;
+  HKeyBuffer candidates;
+} StreamThread;
+
+//
+// Supernodes are walked in the file with the same rules as supernode_find(),
+// using record indices in place of hash table keys. Decisions are made as in
+// the first round of clean_graph().
+//
+typedef struct
+{
+  CleanStream *cs;
+  GraphMmap *gm;
+  const size_t nthreads, min_keep_tip;
+  size_t covg_threshold; // CLEANING_THRESH_AUTO until estimated
+  size_t defer_limit; // with auto threshold, defer supernodes below this
+  bool first_pass, counted; // counted: num_kmers, covg_sum already known
+  StreamThread *threads;
+  uint8_t *visited;
+  uint64_t *covg_hist, *covg_kmers_hist, *len_hist;
+  uint64_t num_kmers, covg_sum, num_removed;
+} StreamCleaner;
+
+// Coverage and edges of a record, merged over the colours selected
+static inline Covg stream_covg(const GraphMmap *gm, hkey_t hkey)
+{
+  const FileFilter *fltr = &gm->file.fltr;
+  Covg covg = 0;
+  size_t i;
+  for(i = 0; i < fltr->ncols; i++)
+    covg += graph_mmap_covg(gm, hkey, fltr->cols[i]);
+  return covg;
+}
+
+static inline Edges stream_edges(const GraphMmap *gm, hkey_t hkey)
+{
+  const FileFilter *fltr = &gm->file.fltr;
+  Edges edges = 0;
+  size_t i;
+  for(i = 0; i < fltr->ncols; i++)
+    edges |= graph_mmap_edges(gm, hkey, fltr->cols[i]);
+  return edges;
+}
+
+// Records without coverage or edges in the colours selected are not loaded by
+// graph_load(), so are treated as missing
+static inline dBNode stream_next_node(GraphMmap *gm, BinaryKmer bkey,
+                                      Nucleotide nuc, Orientation orient)
+{
+  BinaryKmer bkmer;
+
+  if(orient == FORWARD)
+    bkmer = binary_kmer_left_shift_add(bkey, gm->kmer_size, nuc);
+  else
+    bkmer = binary_kmer_right_shift_add(bkey, gm->kmer_size,
+                                        dna_nuc_complement(nuc));
+
+  dBNode node = graph_mmap_find(gm, bkmer);
+  node.orient ^= orient;
+
+  if(node.key != HASH_NOT_FOUND &&
+     !stream_covg(gm, node.key) && !stream_edges(gm, node.key)) {
+    node.key = HASH_NOT_FOUND;
+  }
+
+  return node;
+}
+
+// See supernode_extend()
+static void stream_snode_extend(GraphMmap *gm, dBNodeBuffer *nbuf)
+{
+  dBNode node0 = nbuf->data[0], node = nbuf->data[nbuf->len-1];
+  BinaryKmer bkey = graph_mmap_bkmer(gm, node.key);
+  Edges edges = stream_edges(gm, node.key);
+  Nucleotide nuc;
+
+  while(edges_has_precisely_one_edge(edges, node.orient, &nuc))
+  {
+    node = stream_next_node(gm, bkey, nuc, node.orient);
+
+    // Edge to a kmer that is not in the file
+    if(node.key == HASH_NOT_FOUND) break;
+
+    bkey = graph_mmap_bkmer(gm, node.key);
+    edges = stream_edges(gm, node.key);
+
+    if(edges_has_precisely_one_edge(edges, rev_orient(node.orient), &nuc))
+    {
+      if(node.key == node0.key || node.key == nbuf->data[nbuf->len-1].key) {
+        // don't create a loop A->B->A or a->b->B->A
+        break;
+      }
+
+      db_node_buf_add(nbuf, node);
+    }
+    else break;
+  }
+}
+
+// See supernode_find()
+static void stream_snode_find(GraphMmap *gm, hkey_t hkey, dBNodeBuffer *nbuf)
+{
+  dBNode first = {.key = hkey, .orient = REVERSE};
+  db_node_buf_reset(nbuf);
+  db_node_buf_add(nbuf, first);
+  stream_snode_extend(gm, nbuf);
+  db_nodes_reverse_complement(nbuf->data, nbuf->len);
+  stream_snode_extend(gm, nbuf);
+}
+
+static inline bool stream_snode_is_tip(const GraphMmap *gm,
+                                       const dBNodeBuffer *nbuf)
+{
+  Edges first = stream_edges(gm, nbuf->data[0].key);
+  Edges last = stream_edges(gm, nbuf->data[nbuf->len-1].key);
+  int in = edges_get_indegree(first, nbuf->data[0].orient);
+  int out = edges_get_outdegree(last, nbuf->data[nbuf->len-1].orient);
+  return (in+out <= 1);
+}
+
+// Flag kmers of a supernode as removed, and its neighbours as needing their
+// edges trimmed when they are loaded
+static void stream_snode_remove(StreamCleaner *sc, const dBNodeBuffer *nbuf)
+{
+  GraphMmap *gm = sc->gm;
+  dBNode ends[2] = {db_node_reverse(nbuf->data[0]), nbuf->data[nbuf->len-1]};
+  dBNode next_node;
+  BinaryKmer bkey;
+  Edges edges;
+  Nucleotide nuc;
+  size_t i;
+
+  for(i = 0; i < nbuf->len; i++)
+    bitset_set_mt(sc->cs->removed, nbuf->data[i].key);
+
+  for(i = 0; i < 2; i++) {
+    bkey = graph_mmap_bkmer(gm, ends[i].key);
+    edges = stream_edges(gm, ends[i].key);
+    for(nuc = 0; nuc < 4; nuc++) {
+      if(edges_has_edge(edges, nuc, ends[i].orient)) {
+        next_node = stream_next_node(gm, bkey, nuc, ends[i].orient);
+        if(next_node.key != HASH_NOT_FOUND)
+          bitset_set_mt(sc->cs->trim, next_node.key);
+      }
+    }
+  }
+
+  __sync_fetch_and_add((volatile uint64_t *)&sc->num_removed, nbuf->len);
+}
+
+// Decide whether to keep the supernode in a thread's nbuf. See supernode_mark()
+static void stream_snode_mark(StreamCleaner *sc, size_t threadid,
+                              bool first_pass)
+{
+  StreamThread *thrd = &sc->threads[threadid];
+  const dBNodeBuffer *nbuf = &thrd->nbuf;
+  CovgBuffer *cbuf = &thrd->cbuf;
+  bool low_covg_snode = false, removable_tip;
+  size_t i, covg, cidx, lidx;
+
+  covg_buf_reset(cbuf);
+  covg_buf_ensure_capacity(cbuf, nbuf->len);
+  cbuf->len = nbuf->len;
+  for(i = 0; i < nbuf->len; i++)
+    cbuf->data[i] = stream_covg(sc->gm, nbuf->data[i].key);
+
+  covg = supernode_covg(cbuf->data, cbuf->len);
+
+  if(first_pass) {
+    cidx = MIN2(covg, DUMP_COVG_ARRSIZE-1);
+    lidx = MIN2(nbuf->len, DUMP_LEN_ARRSIZE-1);
+    __sync_fetch_and_add((volatile uint64_t *)&sc->covg_hist[cidx], 1);
+    __sync_fetch_and_add((volatile uint64_t *)&sc->covg_kmers_hist[cidx], nbuf->len);
+    __sync_fetch_and_add((volatile uint64_t *)&sc->len_hist[lidx], 1);
+  }
+
+  removable_tip = (nbuf->len < sc->min_keep_tip &&
+                   stream_snode_is_tip(sc->gm, nbuf));
+
+  if(sc->covg_threshold == CLEANING_THRESH_AUTO) {
+    // Supernodes with coverage too high to be removed by the threshold we
+    // expect to pick are kept now
+    if(!removable_tip && covg < sc->defer_limit) {
+      hkey_buf_add(&thrd->candidates, nbuf->data[0].key);
+      return;
+    }
+  }
+  else low_covg_snode = (covg < sc->covg_threshold);
+
+  if(low_covg_snode || removable_tip) stream_snode_remove(sc, nbuf);
+}
+
+// The threshold was higher than sc->defer_limit, so supernodes with coverage
+// between the two were kept in the first pass. Remove them. See
+// supernode_mark_late()
+static void stream_snode_mark_late(StreamCleaner *sc, size_t threadid)
+{
+  StreamThread *thrd = &sc->threads[threadid];
+  const dBNodeBuffer *nbuf = &thrd->nbuf;
+  CovgBuffer *cbuf = &thrd->cbuf;
+  size_t i, covg;
+
+  // Already removed
+  if(bitset_get_mt(sc->cs->removed, nbuf->data[0].key)) return;
+
+  covg_buf_reset(cbuf);
+  covg_buf_ensure_capacity(cbuf, nbuf->len);
+  cbuf->len = nbuf->len;
+  for(i = 0; i < nbuf->len; i++)
+    cbuf->data[i] = stream_covg(sc->gm, nbuf->data[i].key);
+
+  covg = supernode_covg(cbuf->data, cbuf->len);
+
+  if(covg >= sc->defer_limit && covg < sc->covg_threshold)
+    stream_snode_remove(sc, nbuf);
+}
+
+// Count kmers and coverage in records [start, end)
+static void stream_count_records(size_t start, size_t end, size_t threadid,
+                                 StreamCleaner *sc)
+{
+  (void)threadid;
+  uint64_t nkmers = 0, covg_sum = 0;
+  hkey_t hkey;
+  Covg covg;
+
+  for(hkey = start; hkey < end; hkey++) {
+    covg = stream_covg(sc->gm, hkey);
+    if(!covg && !stream_edges(sc->gm, hkey)) continue;
+    nkmers++;
+    covg_sum += covg;
+  }
+
+  __sync_fetch_and_add((volatile uint64_t *)&sc->num_kmers, nkmers);
+  __sync_fetch_and_add((volatile uint64_t *)&sc->covg_sum, covg_sum);
+}
+
+// Visit every supernode with a kmer in records [start, end)
+// See supernodes_iterate()
+static void stream_visit_records(size_t start, size_t end, size_t threadid,
+                                 StreamCleaner *sc)
+{
+  GraphMmap *gm = sc->gm;
+  dBNodeBuffer *nbuf = &sc->threads[threadid].nbuf;
+  uint64_t nkmers = 0, covg_sum = 0;
+  hkey_t hkey, node0;
+  bool got_lock;
+  Covg covg;
+  size_t i;
+
+  for(hkey = start; hkey < end; hkey++)
+  {
+    covg = stream_covg(gm, hkey);
+    if(!covg && !stream_edges(gm, hkey)) continue;
+
+    nkmers++;
+    covg_sum += covg;
+
+    if(bitset_get_mt(sc->visited, hkey)) continue;
+
+    stream_snode_find(gm, hkey, nbuf);
+
+    // Claim supernode by its lowest end record
+    node0 = MIN2(nbuf->data[0].key, nbuf->data[nbuf->len-1].key);
+    got_lock = false;
+    bitlock_try_acquire(sc->visited, node0, &got_lock);
+
+    if(got_lock) {
+      for(i = 0; i < nbuf->len; i++)
+        bitset_set_mt(sc->visited, nbuf->data[i].key);
+      if(sc->first_pass) stream_snode_mark(sc, threadid, true);
+      else stream_snode_mark_late(sc, threadid);
+    }
+  }
+
+  if(!sc->counted) {
+    __sync_fetch_and_add((volatile uint64_t *)&sc->num_kmers, nkmers);
+    __sync_fetch_and_add((volatile uint64_t *)&sc->covg_sum, covg_sum);
+  }
+}
+
+// Decide on supernodes deferred until we had a threshold
+// [start, end) are the threads whose deferred supernodes we decide on
+static void stream_decide(size_t start, size_t end, size_t threadid,
+                          StreamCleaner *sc)
+{
+  const HKeyBuffer *cands;
+  size_t i, j;
+  for(i = start; i < end; i++) {
+    cands = &sc->threads[i].candidates;
+    for(j = 0; j < cands->len; j++) {
+      stream_snode_find(sc->gm, cands->data[j], &sc->threads[threadid].nbuf);
+      stream_snode_mark(sc, threadid, false);
+    }
+  }
+}
+
+typedef struct
+{
+  const size_t threadid, nthreads, n;
+  StreamCleaner *sc;
+  void (*func)(size_t start, size_t end, size_t threadid, StreamCleaner *sc);
+} StreamWorker;
+
+static void stream_worker(void *arg)
+{
+  const StreamWorker *wrkr = (const StreamWorker*)arg;
+  size_t start = (wrkr->n * wrkr->threadid) / wrkr->nthreads;
+  size_t end = (wrkr->n * (wrkr->threadid+1)) / wrkr->nthreads;
+  wrkr->func(start, end, wrkr->threadid, wrkr->sc);
+}
+
+// Call func on ranges of 0..n-1, split between threads
+static void stream_run(StreamCleaner *sc, size_t n,
+                       void (*func)(size_t start, size_t end, size_t threadid,
+                                    StreamCleaner *sc))
+{
+  if(n == 0) return;
+
+  size_t i, nthreads = MIN2(sc->nthreads, n);
+  StreamWorker *wrkrs = ctx_calloc(nthreads, sizeof(StreamWorker));
+
+  for(i = 0; i < nthreads; i++) {
+    StreamWorker tmp = {.threadid = i, .nthreads = nthreads, .n = n,
+                        .sc = sc, .func = func};
+    memcpy(&wrkrs[i], &tmp, sizeof(StreamWorker));
+  }
+
+  util_run_threads(wrkrs, nthreads, sizeof(StreamWorker),
+                   nthreads, stream_worker);
+
+  ctx_free(wrkrs);
+}
+
+// Each record takes a bit in the removed, trim and visited bitsets. With an
+// automatic threshold, a supernode may be deferred until the first pass is
+// done, which costs an hkey_t in its thread's buffer. There is at most one
+// supernode per record.
+size_t clean_stream_mem(size_t num_records, bool auto_threshold)
+{
+  size_t mem = 3 * roundup_bits2bytes(num_records);
+  if(auto_threshold) mem += num_records * sizeof(hkey_t);
+  return mem;
+}
+
+// Memory kept in a CleanStream until clean_stream_dealloc()
+size_t clean_stream_kept_mem(size_t num_records)
+{
+  return 2 * roundup_bits2bytes(num_records);
+}
+
+Covg clean_stream_prefilter(CleanStream *cs, GraphMmap *gm, size_t num_threads,
+                            Covg covg_threshold, double seq_depth,
+                            size_t min_keep_tip,
+                            const char *covgs_csv_path,
+                            const char *lens_csv_path)
+{
+  size_t i, nbytes = roundup_bits2bytes(gm->num_kmers);
+
+  memset(cs, 0, sizeof(*cs));
+  cs->gm = gm;
+  cs->removed = ctx_calloc(nbytes, 1);
+  cs->trim = ctx_calloc(nbytes, 1);
+
+  StreamThread *threads = ctx_calloc(num_threads, sizeof(StreamThread));
+  for(i = 0; i < num_threads; i++) {
+    db_node_buf_alloc(&threads[i].nbuf, 1024);
+    covg_buf_alloc(&threads[i].cbuf, 1024);
+    hkey_buf_alloc(&threads[i].candidates, 256);
+  }
+
+  uint64_t *covg_hist, *covg_kmers_hist, *len_hist;
+  covg_hist       = ctx_calloc(DUMP_COVG_ARRSIZE, sizeof(uint64_t));
+  covg_kmers_hist = ctx_calloc(DUMP_COVG_ARRSIZE, sizeof(uint64_t));
+  len_hist        = ctx_calloc(DUMP_LEN_ARRSIZE, sizeof(uint64_t));
+
+  StreamCleaner tmp = {.cs = cs, .gm = gm,
+                       .nthreads = num_threads,
+                       .min_keep_tip = min_keep_tip,
+                       .covg_threshold = covg_threshold,
+                       .defer_limit = 0,
+                       .first_pass = true, .counted = false,
+                       .threads = threads,
+                       .visited = ctx_calloc(nbytes, 1),
+                       .covg_hist = covg_hist,
+                       .covg_kmers_hist = covg_kmers_hist,
+                       .len_hist = len_hist,
+                       .num_kmers = 0, .covg_sum = 0, .num_removed = 0};
+
+  StreamCleaner sc;
+  memcpy(&sc, &tmp, sizeof(StreamCleaner));
+
+  // With an auto threshold, only supernodes that are likely to fall below it
+  // are remembered until it is known. Without a sequencing depth, that needs
+  // the kmer depth first. See clean_graph()
+  if(covg_threshold == CLEANING_THRESH_AUTO) {
+    double kmer_depth = 0;
+    if(seq_depth <= 0) {
+      stream_run(&sc, gm->num_kmers, stream_count_records);
+      sc.counted = true;
+      if(sc.num_kmers > 0) kmer_depth = (double)sc.covg_sum / sc.num_kmers;
+    }
+    sc.defer_limit = cleaning_threshold_bound(seq_depth, kmer_depth);
+    if(sc.defer_limit > DUMP_COVG_ARRSIZE-1) {
+      status("[CleanStream] Deferring supernodes with coverage < %zu (capped from %zu)",
+             (size_t)DUMP_COVG_ARRSIZE-1, sc.defer_limit);
+      sc.defer_limit = DUMP_COVG_ARRSIZE-1;
+    }
+    else status("[CleanStream] Deferring supernodes with coverage < %zu",
+                sc.defer_limit);
+  }
+
+  status("[CleanStream] First pass over %s with %zu threads",
+         gm->file.fltr.file_path.buff, num_threads);
+
+  stream_run(&sc, gm->num_kmers, stream_visit_records);
+  sc.first_pass = false;
+  sc.counted = true;
+
+  if(covgs_csv_path != NULL) {
+    cleaning_write_covg_histogram(covgs_csv_path, sc.covg_hist,
+                                  sc.covg_kmers_hist, DUMP_COVG_ARRSIZE);
+  }
+
+  if(lens_csv_path != NULL) {
+    cleaning_write_len_histogram(lens_csv_path, sc.len_hist, DUMP_LEN_ARRSIZE,
+                                 gm->kmer_size);
+  }
+
+  bool report_only = (covg_threshold == 0 && min_keep_tip == 0);
+
+  if(sc.num_kmers > 0 &&
+     (covg_threshold == CLEANING_THRESH_AUTO || report_only))
+  {
+    double kmer_depth = (double)sc.covg_sum / sc.num_kmers;
+    size_t threshold_est = cleaning_supernode_threshold(sc.covg_hist,
+                                                        DUMP_COVG_ARRSIZE,
+                                                        seq_depth, kmer_depth);
+
+    status("[cleaning] Recommended supernode cleaning threshold: < %zu",
+           threshold_est);
+
+    if(!report_only)
+    {
+      covg_threshold = sc.covg_threshold = threshold_est;
+
+      // Each thread decides on the supernodes it deferred
+      stream_run(&sc, num_threads, stream_decide);
+
+      // Rare: threshold picked from the second derivative of the histogram is
+      // above the supernodes we deferred, so scan again
+      if(covg_threshold > sc.defer_limit) {
+        status("[CleanStream] Threshold above deferred coverage (%zu), "
+               "re-scanning supernodes", sc.defer_limit);
+        memset(sc.visited, 0, nbytes);
+        stream_run(&sc, gm->num_kmers, stream_visit_records);
+      }
+    }
+  }
+  else if(covg_threshold == CLEANING_THRESH_AUTO) covg_threshold = 0;
+
+  ctx_free(sc.visited);
+
+  cs->num_kmers = sc.num_kmers;
+  cs->num_kept = sc.num_kmers - sc.num_removed;
+
+  char kept_str[50], nkmers_str[50];
+  ulong_to_str(cs->num_kept, kept_str);
+  ulong_to_str(cs->num_kmers, nkmers_str);
+  status("[CleanStream] Keeping %s of %s kmers after first pass",
+         kept_str, nkmers_str);
+
+  for(i = 0; i < num_threads; i++) {
+    db_node_buf_dealloc(&threads[i].nbuf);
+    covg_buf_dealloc(&threads[i].cbuf);
+    hkey_buf_dealloc(&threads[i].candidates);
+  }
+  ctx_free(threads);
+  ctx_free(sc.covg_hist);
+  ctx_free(sc.covg_kmers_hist);
+  ctx_free(sc.len_hist);
+
+  return covg_threshold;
+}
+
+// Remove edges from a record to removed kmers
+static Edges stream_trim_edges(const CleanStream *cs, hkey_t hkey, Edges edges)
+{
+  BinaryKmer bkey = graph_mmap_bkmer(cs->gm, hkey);
+  Edges keep_edges = edges;
+  Orientation orient;
+  Nucleotide nuc;
+  dBNode next_node;
+
+  for(orient = 0; orient < 2; orient++) {
+    for(nuc = 0; nuc < 4; nuc++) {
+      if(edges_has_edge(edges, nuc, orient)) {
+        next_node = stream_next_node(cs->gm, bkey, nuc, orient);
+        if(next_node.key != HASH_NOT_FOUND &&
+           bitset_get(cs->removed, next_node.key))
+          keep_edges = edges_del_edge(keep_edges, nuc, orient);
+      }
+    }
+  }
+
+  return keep_edges;
+}
+
+void clean_stream_load(const CleanStream *cs, dBGraph *db_graph)
+{
+  GraphMmap *gm = cs->gm;
+  const FileFilter *fltr = &gm->file.fltr;
+  hkey_t rec, hkey;
+  BinaryKmer bkmer;
+  Covg covg;
+  Edges edges;
+  bool found;
+  size_t i;
+
+  ctx_assert(db_graph->kmer_size == gm->kmer_size);
+  ctx_assert(db_graph->num_of_cols > 0);
+
+  for(i = 0; i < fltr->ncols; i++)
+    graph_info_merge(&db_graph->ginfo[0], &gm->file.hdr.ginfo[fltr->cols[i]]);
+
+  db_graph->num_of_cols_used = MAX2(db_graph->num_of_cols_used, 1);
+
+  char kept_str[50];
+  ulong_to_str(cs->num_kept, kept_str);
+  status("[CleanStream] Loading %s kmers from %s",
+         kept_str, fltr->file_path.buff);
+
+  for(rec = 0; rec < gm->num_kmers; rec++)
+  {
+    if(bitset_get(cs->removed, rec)) continue;
+
+    covg = stream_covg(gm, rec);
+    edges = stream_edges(gm, rec);
+    if(!covg && !edges) continue;
+
+    if(bitset_get(cs->trim, rec)) edges = stream_trim_edges(cs, rec, edges);
+
+    bkmer = graph_mmap_bkmer(gm, rec);
+    hkey = hash_table_find_or_insert(&db_graph->ht, bkmer, &found);
+
+    if(db_graph->node_in_cols != NULL) db_node_set_col(db_graph, hkey, 0);
+    if(db_graph->col_covgs != NULL) db_node_add_col_covg(db_graph, hkey, 0, covg);
+    if(db_graph->col_edges != NULL) db_node_edges(db_graph, hkey, 0) |= edges;
+  }
+}
+
+void clean_stream_dealloc(CleanStream *cs)
+{
+  ctx_free(cs->removed);
+  ctx_free(cs->trim);
+  memset(cs, 0, sizeof(*cs));
+}
@@ -0,0 +1,49 @@
+#ifndef CLEAN_STREAM_H_
+#define CLEAN_STREAM_H_
+
+#include "db_graph.h"
+#include "graph_mmap.h"
+
+//
+// Cleaning a sorted graph file without loading all of it
+//
+// A first pass walks supernodes straight from the memory mapped file to build
+// the coverage histograms, pick a threshold and make the first round of
+// cleaning decisions (see clean_graph()). Only kmers that survive that round
+// are loaded, with their edges into removed supernodes trimmed. Running
+// clean_graph() on the loaded kmers with the same threshold then gives the
+// same graph as cleaning the whole graph in memory.
+//
+// Colours selected from the file are merged into one for cleaning.
+//
+
+typedef struct
+{
+  GraphMmap *gm;
+  uint8_t *removed, *trim; // one bit per record
+  size_t num_kmers, num_kept; // kmers in file (non-empty), kmers to load
+} CleanStream;
+
+// Upper bound on the memory clean_stream_prefilter() uses for a file of
+// `num_records` records
+size_t clean_stream_mem(size_t num_records, bool auto_threshold);
+
+// Memory kept by a CleanStream after clean_stream_prefilter() returns
+size_t clean_stream_kept_mem(size_t num_records);
+
+// First pass over a sorted graph file. Arguments are as for clean_graph().
+// `covg_threshold` may be CLEANING_THRESH_AUTO, or 0 with no tip cleaning to
+// only write the histograms and report a recommended threshold.
+// Returns the coverage threshold to pass to clean_graph()
+Covg clean_stream_prefilter(CleanStream *cs, GraphMmap *gm, size_t num_threads,
+                            Covg covg_threshold, double seq_depth,
+                            size_t min_keep_tip,
+                            const char *covgs_csv_path,
+                            const char *lens_csv_path);
+
+// Load kmers kept by clean_stream_prefilter() into colour 0 of db_graph
+void clean_stream_load(const CleanStream *cs, dBGraph *db_graph);
+
+void clean_stream_dealloc(CleanStream *cs);
+
+#endif /* CLEAN_STREAM_H_ */
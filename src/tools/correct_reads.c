@@ -13,6 +13,7 @@
 
 typedef struct
 {
+  size_t threadid; // passed to SeqOutput
   const dBGraph *db_graph;
   MsgPool *pool;
   dBAlignment aln;
@@ -26,9 +27,10 @@ typedef struct
 } CorrectReadsWorker;
 
 static void correct_reads_worker_alloc(CorrectReadsWorker *wrkr,
-                                       MsgPool *pool,
+                                       size_t threadid, MsgPool *pool,
                                        const dBGraph *db_graph)
 {
+  wrkr->threadid = threadid;
   wrkr->db_graph = db_graph;
   wrkr->pool = pool;
   db_alignment_alloc(&wrkr->aln);
@@ -114,7 +116,7 @@ static void handle_read(CorrectReadsWorker *wrkr,
     }
 
     graph_walker_finish(wlk);
-    rpt_walker_fast_clear(rptwlk, tmpnbuf->data, tmpnbuf->len);
+    rpt_walker_clear(rptwlk);
 
     // Add Ns for bases we couldn't resolve
     for(i = tmpnbuf->len; i < left_gap; i++) strbuf_append_char(buf, 'N');
@@ -172,7 +174,7 @@ static void handle_read(CorrectReadsWorker *wrkr,
     }
 
     graph_walker_finish(wlk);
-    rpt_walker_fast_clear(rptwlk, nbuf->data+init_len, nbuf->len-init_len);
+    rpt_walker_clear(rptwlk);
 
     // Copy added bases into buffer
     for(i = init_len; i < nbuf->len; i++) {
@@ -213,9 +215,7 @@ static void correct_read(CorrectReadsWorker *wrkr, AsyncIOData *data)
   {
     // Single ended read
     handle_read(wrkr, input, r1, buf1, fq_cutoff1, hp_cutoff);
-    pthread_mutex_lock(&output->lock_se);
-    gzputs(output->gzout_se, buf1->buff);
-    pthread_mutex_unlock(&output->lock_se);
+    seq_output_write_se(output, wrkr->threadid, data->readid, buf1);
 
     // Update stats
     wrkr->stats.num_se_reads++;
@@ -225,10 +225,7 @@ static void correct_read(CorrectReadsWorker *wrkr, AsyncIOData *data)
     // Paired-end reads
     handle_read(wrkr, input, r1, buf1, fq_cutoff1, hp_cutoff);
     handle_read(wrkr, input, r2, buf2, fq_cutoff2, hp_cutoff);
-    pthread_mutex_lock(&output->lock_pe);
-    gzputs(output->gzout_pe[0], buf1->buff);
-    gzputs(output->gzout_pe[1], buf2->buff);
-    pthread_mutex_unlock(&output->lock_pe);
+    seq_output_write_pe(output, wrkr->threadid, data->readid, buf1, buf2);
 
     // Update stats
     wrkr->stats.num_pe_reads += 2;
@@ -270,7 +267,7 @@ void correct_reads(size_t num_threads, size_t max_io_threads,
   CorrectReadsWorker *wrkrs = ctx_calloc(num_threads, sizeof(CorrectReadsWorker));
 
   for(i = 0; i < num_threads; i++)
-    correct_reads_worker_alloc(&wrkrs[i], &pool, db_graph);
+    correct_reads_worker_alloc(&wrkrs[i], i, &pool, db_graph);
 
   AsyncIOReadInput *asyncio_tasks = ctx_calloc(num_inputs, sizeof(AsyncIOReadInput));
   correct_aln_input_to_asycio(asyncio_tasks, inputs, num_inputs);
@@ -24,6 +24,31 @@
 
 // #define CTXVERBOSE 1
 
+// A path from the current read that is already in the path store. If the
+// store fills up part way through a read, the read is redone after the store
+// has been written to disk. These paths must not be added (or counted) again.
+// Whilst the store holds the path we only keep its index; its sequence is
+// copied out if the store fills up, before it is flushed.
+typedef struct
+{
+  dBNode node;
+  PathLen plen;
+  bool added; // result of graph_paths_find_or_add_mt()
+  bool used; // matched in this attempt (a read may add the same path twice)
+  PathIndex pindex; // where the path is in the store
+  size_t seq; // offset of packed sequence in GenPathWorker.done_seqs
+} GenPathDone;
+
+#define GEN_PATH_NO_SEQ SIZE_MAX
+
+#include "objbuf_macro.h"
+create_objbuf(gpdone_buf, GenPathDoneBuffer, GenPathDone);
+
+#ifndef BYTE_BUFFER_DEFINED
+  create_objbuf(bytebuf, ByteBuffer, uint8_t);
+  #define BYTE_BUFFER_DEFINED
+#endif
+
 struct GenPathWorker
 {
   pthread_t thread;
@@ -37,6 +62,7 @@ struct GenPathWorker
   AsyncIOData *data; // current data
   CorrectAlnInput task; // current task
   LoadingStats stats;
+  PathStoreCounts counts; // paths added, not yet added to the PathStore
 
   dBAlignment aln;
   CorrectAlnWorker corrector;
@@ -47,11 +73,21 @@ struct GenPathWorker
   size_t *pos_fw, *pos_rv;
   size_t num_fw, num_rv, junc_arrsize;
 
-  FILE *tmp_fh;
+  // Write paths to disk when the store is full
+  PathSpill *spill;
+  size_t spill_thread; // id from path_spill_add_thread()
+  bool store_full; // set if a path was rejected because the store was full
+  bool redoing; // read is being redone, skip paths in `done`
+  GenPathDoneBuffer done; // paths stored from current read, if spilling
+  ByteBuffer done_seqs;
 };
 
 #define INIT_BUFLEN 1024
 
+// Number of times to try adding paths from a read before giving up, when the
+// path store keeps filling up (see path_spill.h)
+#define GEN_PATHS_MAX_TRIES 10
+
 // Printing variables defined in correct_aln_input.h
 // Used for printint output
 volatile size_t print_contig_id = 0, print_path_id = 0;
@@ -71,14 +107,16 @@ size_t gen_paths_worker_est_mem(const dBGraph *db_graph)
 #define binary_seq_mem(n) ((((n)+3)/4 + sizeof(PathLen))*4)
 
 static void _gen_paths_worker_alloc(GenPathWorker *wrkr, dBGraph *db_graph,
-                                    FILE *tmp_fh)
+                                    PathSpill *spill)
 {
   GenPathWorker tmp = {.db_graph = db_graph, .pool = NULL,
-                       .tmp_fh = tmp_fh};
+                       .spill = spill, .spill_thread = 0,
+                       .store_full = false, .redoing = false};
 
   db_alignment_alloc(&tmp.aln);
   correct_aln_worker_alloc(&tmp.corrector, db_graph);
   loading_stats_init(&tmp.stats);
+  memset(&tmp.counts, 0, sizeof(tmp.counts));
 
   // Junction data
   // only fw arrays are malloc'd, rv point to fw
@@ -90,6 +128,9 @@ static void _gen_paths_worker_alloc(GenPathWorker *wrkr, dBGraph *db_graph,
   tmp.pos_rv = tmp.pos_fw + tmp.junc_arrsize;
   tmp.num_fw = tmp.num_rv = 0;
 
+  gpdone_buf_alloc(&tmp.done, 64);
+  bytebuf_alloc(&tmp.done_seqs, 1024);
+
   memcpy(wrkr, &tmp, sizeof(GenPathWorker));
 }
 
@@ -99,14 +140,21 @@ static void _gen_paths_worker_dealloc(GenPathWorker *wrkr)
   correct_aln_worker_dealloc(&wrkr->corrector);
   ctx_free(wrkr->pck_fw);
   ctx_free(wrkr->pos_fw);
+  gpdone_buf_dealloc(&wrkr->done);
+  bytebuf_dealloc(&wrkr->done_seqs);
 }
 
 
-GenPathWorker* gen_paths_workers_alloc(size_t n, dBGraph *graph, FILE *fout)
+GenPathWorker* gen_paths_workers_alloc(size_t n, dBGraph *graph,
+                                       PathSpill *spill)
 {
   size_t i;
   GenPathWorker *workers = ctx_malloc(n * sizeof(GenPathWorker));
-  for(i = 0; i < n; i++) _gen_paths_worker_alloc(&workers[i], graph, fout);
+  for(i = 0; i < n; i++) {
+    _gen_paths_worker_alloc(&workers[i], graph, spill);
+    if(spill != NULL)
+      workers[i].spill_thread = path_spill_add_thread(spill, &workers[i].counts);
+  }
   return workers;
 }
 
@@ -161,6 +209,61 @@ LoadingStats gen_paths_get_stats(const GenPathWorker *wrkr)
   return wrkr->stats;
 }
 
+// Was this path stored by an earlier attempt at the current read?
+// If so, sets `added` to the result we got then. Only called when redoing a
+// read, when all paths from earlier attempts have their sequence copied.
+static inline bool _path_already_done(GenPathWorker *wrkr, dBNode node,
+                                      const uint8_t *packed, PathLen plen,
+                                      bool *added)
+{
+  size_t i, nbytes = (plen+3)/4;
+  GenPathDone *done;
+
+  for(i = 0; i < wrkr->done.len; i++) {
+    done = &wrkr->done.data[i];
+    if(!done->used && db_nodes_are_equal(done->node, node) &&
+       done->plen == plen &&
+       memcmp(wrkr->done_seqs.data + done->seq, packed, nbytes) == 0)
+    {
+      done->used = true;
+      *added = done->added;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static inline void _path_set_done(GenPathWorker *wrkr, dBNode node,
+                                  PathLen plen, bool added, PathIndex pindex)
+{
+  GenPathDone done = {.node = node, .plen = plen, .added = added,
+                      .used = true, .pindex = pindex, .seq = GEN_PATH_NO_SEQ};
+  gpdone_buf_add(&wrkr->done, done);
+}
+
+// Store is full and about to be flushed: copy out the sequences of paths
+// this read has stored, so they can be skipped when the read is redone
+static void _paths_done_copy_seqs(GenPathWorker *wrkr)
+{
+  const PathStore *pstore = &wrkr->db_graph->pstore;
+  const uint8_t *path;
+  GenPathDone *done;
+  size_t i, nbytes;
+
+  for(i = 0; i < wrkr->done.len; i++) {
+    done = &wrkr->done.data[i];
+    if(done->seq != GEN_PATH_NO_SEQ) continue;
+    path = pstore->store + done->pindex;
+    nbytes = (done->plen+3)/4;
+    bytebuf_ensure_capacity(&wrkr->done_seqs, wrkr->done_seqs.len + nbytes);
+    memcpy(wrkr->done_seqs.data + wrkr->done_seqs.len,
+           packedpath_seq(path, pstore->colset_bytes), nbytes);
+    done->seq = wrkr->done_seqs.len;
+    wrkr->done_seqs.len += nbytes;
+  }
+}
+
 // Returns number of paths added
 // `pos_pl` is an array of positions in the nodes array of nodes to add paths to
 // `packed_ptr` is <plen><seq> and is the nucleotides denoting this path
@@ -184,7 +287,7 @@ static inline size_t _juncs_to_paths(const size_t *restrict pos_pl,
   dBNode node;
   size_t start_mn, start_pl, pos;
   PathLen plen, plen_orient;
-  bool added;
+  bool added, redone;
   PathIndex pindex = 0; // address of path once added
   bool printed = false;
 
@@ -267,8 +370,19 @@ static inline size_t _juncs_to_paths(const size_t *restrict pos_pl,
     uint8_t top_byte = packed_ptr[top_idx];
     packed_ptr[top_idx] &= 0xff >> (8 - bits_in_top_byte(plen));
 
-    added = graph_paths_find_or_add_mt(node, ctpcol, packed_ptr, plen,
-                                       &db_graph->pstore, &pindex);
+    // Paths stored before the store filled up are already on disk
+    redone = (wrkr->redoing &&
+              _path_already_done(wrkr, node, packed_ptr+sizeof(PathLen),
+                                 plen, &added));
+
+    if(!redone) {
+      added = graph_paths_find_or_add_mt(node, ctpcol, packed_ptr, plen,
+                                         &db_graph->pstore, &wrkr->counts,
+                                         &pindex);
+
+      if(wrkr->spill != NULL && pindex != PATH_NULL)
+        _path_set_done(wrkr, node, plen, added, pindex);
+    }
 
     packed_ptr[top_idx] = top_byte; // restore top byte
 
@@ -276,6 +390,9 @@ static inline size_t _juncs_to_paths(const size_t *restrict pos_pl,
       printf("We %s\n", added ? "added" : "abandoned");
     #endif
 
+    // Path store is full, this read will be redone once it has been flushed
+    if(!redone && pindex == PATH_NULL) { wrkr->store_full = true; break; }
+
     // If the path already exists, all of its subpaths also already exist
     if(!added && plen < MAX_PATHLEN) break;
     num_added++;
@@ -309,8 +426,8 @@ static inline size_t _juncs_to_paths(const size_t *restrict pos_pl,
                                          plen, db_graph),
                  "read: %s %s", wrkr->data->r1.name.b, wrkr->data->r1.seq.b);
 
-      // Check path after we wrote it
-      ctx_check2(graph_paths_check_path(node.key, pindex, &gp, db_graph),
+      // Check path after we wrote it (unless it was written before a flush)
+      ctx_check2(redone || graph_paths_check_path(node.key, pindex, &gp, db_graph),
                  "read: %s %s", wrkr->data->r1.name.b, wrkr->data->r1.seq.b);
     #endif
 
@@ -384,9 +501,15 @@ static void worker_contig_to_junctions(GenPathWorker *wrkr,
 
   for(i = 0; i < contig_len; i++)
   {
-    edges = db_node_get_edges(db_graph, nodes[i].key, ctxcol);
-    outdegree = edges_get_outdegree(edges, nodes[i].orient);
-    indegree = edges_get_indegree(edges, nodes[i].orient);
+    if(db_graph->num_of_cols == 1) {
+      edges = db_node_get_edges(db_graph, nodes[i].key, 0);
+      outdegree = edges_get_outdegree(edges, nodes[i].orient);
+      indegree = edges_get_indegree(edges, nodes[i].orient);
+    } else {
+      // Edges may be shared between colours
+      outdegree = db_node_outdegree_in_col(nodes[i], ctxcol, db_graph);
+      indegree = db_node_indegree_in_col(nodes[i], ctxcol, db_graph);
+    }
 
     if(indegree > 1 && i > 0)
     {
@@ -449,27 +572,53 @@ static void reads_to_paths(GenPathWorker *wrkr)
     wrkr->stats.total_bases_read += r2->seq.end;
   }
 
-  db_alignment_from_reads(&wrkr->aln, r1, r2,
-                          fq_cutoff1, fq_cutoff2, hp_cutoff,
-                          wrkr->db_graph, wrkr->task.crt_params.ctxcol);
+  // If the path store fills up whilst we are adding paths, we redo the read
+  // once the store has been written to disk
+  const LoadingStats stats = wrkr->stats;
+  size_t i, ntries = 0;
 
-  ctx_check2(db_alignment_check_edges(&wrkr->aln, wrkr->db_graph),
-             "Edges missing: was read %s%s%s used to build the graph?",
-             r1->name.b, r2 ? ", " : "", r2 ? r2->name.b : "");
+  gpdone_buf_reset(&wrkr->done);
+  bytebuf_reset(&wrkr->done_seqs);
 
-  // For debugging
-  // db_alignment_print(&wrkr->aln, wrkr->db_graph);
-
-  // Correct sequence errors in the alignment
-  correct_alignment_init(&wrkr->corrector, &wrkr->aln, wrkr->task.crt_params);
+  do
+  {
+    if(ntries++ == GEN_PATHS_MAX_TRIES)
+      die("Out of path memory! Cannot fit paths from read: %s", r1->name.b);
+
+    wrkr->stats = stats;
+    wrkr->store_full = false;
+    wrkr->redoing = (ntries > 1);
+    for(i = 0; i < wrkr->done.len; i++) wrkr->done.data[i].used = false;
+    if(wrkr->spill != NULL)
+      path_spill_read_start(wrkr->spill, wrkr->spill_thread);
+
+    db_alignment_from_reads(&wrkr->aln, r1, r2,
+                            fq_cutoff1, fq_cutoff2, hp_cutoff,
+                            wrkr->db_graph, wrkr->task.crt_params.ctxcol);
+
+    ctx_check2(db_alignment_check_edges(&wrkr->aln, wrkr->db_graph),
+               "Edges missing: was read %s%s%s used to build the graph?",
+               r1->name.b, r2 ? ", " : "", r2 ? r2->name.b : "");
+
+    // For debugging
+    // db_alignment_print(&wrkr->aln, wrkr->db_graph);
+
+    // Correct sequence errors in the alignment
+    correct_alignment_init(&wrkr->corrector, &wrkr->aln, wrkr->task.crt_params);
+
+    dBNodeBuffer *nbuf;
+    while((nbuf = correct_alignment_nxt(&wrkr->corrector)) != NULL) {
+      worker_contig_to_junctions(wrkr, nbuf);
+      wrkr->stats.contigs_loaded++;
+      wrkr->stats.num_kmers_loaded += nbuf->len;
+      wrkr->stats.total_bases_loaded += nbuf->len + wrkr->db_graph->kmer_size - 1;
+    }
 
-  dBNodeBuffer *nbuf;
-  while((nbuf = correct_alignment_nxt(&wrkr->corrector)) != NULL) {
-    worker_contig_to_junctions(wrkr, nbuf);
-    wrkr->stats.contigs_loaded++;
-    wrkr->stats.num_kmers_loaded += nbuf->len;
-    wrkr->stats.total_bases_loaded += nbuf->len + wrkr->db_graph->kmer_size - 1;
+    if(wrkr->store_full) _paths_done_copy_seqs(wrkr);
+    if(wrkr->spill != NULL)
+      path_spill_read_end(wrkr->spill, wrkr->spill_thread, wrkr->store_full);
   }
+  while(wrkr->store_full);
 }
 
 // Print progress every 5M reads
@@ -517,6 +666,7 @@ void gen_paths_worker_seq(GenPathWorker *wrkr, AsyncIOData *data,
   memcpy(&wrkr->task, task, sizeof(CorrectAlnInput));
 
   reads_to_paths(wrkr);
+  path_store_add_counts(&wrkr->db_graph->pstore, &wrkr->counts);
 }
 
 // Function used in tests
@@ -569,8 +719,11 @@ void generate_paths(CorrectAlnInput *tasks, size_t num_inputs,
   AsyncIOReadInput *asyncio_tasks = ctx_malloc(num_inputs * sizeof(AsyncIOReadInput));
   correct_aln_input_to_asycio(asyncio_tasks, tasks, num_inputs);
 
-  asyncio_run_threads(&pool, asyncio_tasks, num_inputs, generate_paths_worker,
-                      workers, num_workers, sizeof(GenPathWorker));
+  // Inputs are queued so readers move straight on to the next input, with
+  // at most one reader per worker. Each read carries its task (data->ptr).
+  asyncio_run_queued(&pool, asyncio_tasks, num_inputs, num_workers,
+                     generate_paths_worker, workers, num_workers,
+                     sizeof(GenPathWorker));
 
   ctx_free(asyncio_tasks);
   msgpool_dealloc(&pool);
@@ -580,4 +733,8 @@ void generate_paths(CorrectAlnInput *tasks, size_t num_inputs,
 
   // Merge gap counts into worker[0]
   generate_paths_merge_stats(workers, num_workers);
+
+  // Update PathStore counters with paths added by each worker
+  for(i = 0; i < num_workers; i++)
+    path_store_add_counts(&workers[0].db_graph->pstore, &workers[i].counts);
 }
@@ -7,15 +7,17 @@
 #include "db_graph.h"
 #include "loading_stats.h"
 #include "correct_aln_input.h"
+#include "path_spill.h"
 
 typedef struct GenPathWorker GenPathWorker;
 
 // Estimate memory required per worker thread
 size_t gen_paths_worker_est_mem(const dBGraph *db_graph);
 
-// fout can be NULL - it is used as a tmp file if available (for defragging)
-// if fout is passed, it must be opened with "r+" so we can fseek, write, read
-GenPathWorker* gen_paths_workers_alloc(size_t n, dBGraph *graph, FILE *fout);
+// spill can be NULL - if passed, paths are written to disk when the path store
+// is full (see path_spill.h), otherwise we die when out of path memory
+GenPathWorker* gen_paths_workers_alloc(size_t n, dBGraph *graph,
+                                       PathSpill *spill);
 
 void gen_paths_workers_dealloc(GenPathWorker *mem, size_t n);
 
@@ -27,7 +29,8 @@ void gen_paths_worker_seq(GenPathWorker *wrkr, AsyncIOData *data,
 void gen_paths_from_str_mt(GenPathWorker *gen_path_wrkr, char *seq,
                            CorrectAlnParam params);
 
-// workers array must be at least as long as tasks
+// Thread all tasks using `num_workers` workers. Tasks are read in order from
+// a single queue, with up to `num_workers` files open at once.
 void generate_paths(CorrectAlnInput *tasks, size_t num_tasks,
                     GenPathWorker *workers, size_t num_workers);
 